@@ -38,6 +38,7 @@ extern uint32_t CountMinSketchEstimateFrequency(CountMinSketch *cms, void *key,
 extern float8 CountMinSketchEstimateNormFrequency(CountMinSketch *cms, void *key, Size size);
 extern uint64_t CountMinSketchTotal(CountMinSketch *cms);
 extern CountMinSketch *CountMinSketchMerge(CountMinSketch *result, CountMinSketch* incoming);
+extern bool CountMinSketchStateChanged(CountMinSketch *prev, CountMinSketch *cms);
 extern Size CountMinSketchSize(CountMinSketch *cms);
 
 #endif
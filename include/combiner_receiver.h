@@ -13,6 +13,7 @@
 
 #include "tcop/dest.h"
 #include "executor.h"
+#include "microbatch.h"
 
 typedef struct CombinerReceiver
 {
@@ -24,7 +25,18 @@ typedef struct CombinerReceiver
 	FuncExpr *hashfn;
 
 	uint64 name_hash;
-	List **tups_per_combiner;
+
+	/* Microbatches being filled for each combiner, allocated per batch */
+	microbatch_t **mbs;
+
+	/*
+	 * Full microbatches and the combiners they're for. These aren't sent until the plan has completed
+	 * successfully, so that a failed plan never has any of its output combined.
+	 */
+	List *full_mbs;
+	List *full_ids;
+	int ntups;
+	Size nbytes;
 } CombinerReceiver;
 
 typedef bool (*CombinerReceiveFunc) (ContQuery *query, uint32 shard_hash, uint64 group_hash, HeapTuple tup);
@@ -32,7 +44,8 @@ extern CombinerReceiveFunc CombinerReceiveHook;
 typedef void (*CombinerFlushFunc) (void);
 extern CombinerFlushFunc CombinerFlushHook;
 
-extern BatchReceiver *CreateCombinerReceiver(ContExecutor *cont_exec, ContQuery *query, Tuplestorestate *buffer);
+extern BatchReceiver *CreateCombinerReceiver(ContExecutor *cont_exec, ContQuery *query);
+extern DestReceiver *GetCombinerDestReceiver(BatchReceiver *receiver);
 extern void SetCombinerDestReceiverHashFunc(BatchReceiver *self, FuncExpr *hash);
 
 #endif
@@ -9,6 +9,7 @@
  */
 #include "postgres.h"
 
+#include "access/heapam.h"
 #include "catalog/objectaddress.h"
 #include "executor/tuptable.h"
 #include "nodes/execnodes.h"
@@ -50,3 +51,4 @@ CompatBuildTupleHashTable(TupleDesc inputDesc,
 
 extern char *CompatGetAttName(Oid relid, AttrNumber att);
 extern void ComaptExecAssignResultTypeFromTL(PlanState *ps);
+extern HTSU_Result CompatHeapDelete(Relation rel, ItemPointer tid, CommandId cid, bool wait, HeapUpdateFailureData *hufd);
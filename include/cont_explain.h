@@ -0,0 +1,89 @@
+/*-------------------------------------------------------------------------
+ *
+ * cont_explain.h
+ *	  EXPLAIN (CONTINUOUS, ANALYZE) support
+ *
+ * Copyright (c) 2018, PipelineDB, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef CONT_EXPLAIN_H
+#define CONT_EXPLAIN_H
+
+#include "postgres.h"
+
+#include "executor/execdesc.h"
+#include "executor/instrument.h"
+#include "nodes/parsenodes.h"
+#include "nodes/plannodes.h"
+#include "stats.h"
+#include "tcop/dest.h"
+
+#define CONT_EXPLAIN_MAX_REQUESTS 4
+#define CONT_EXPLAIN_RESULT_SIZE 16384
+#define CONT_EXPLAIN_DEFAULT_DURATION 10.0
+
+/*
+ * A worker's or combiner's sample of a CV under EXPLAIN (CONTINUOUS, ANALYZE). Per-node instrumentation
+ * is summed across every sampled execution of the CV's plan, in plan tree pre-order.
+ */
+typedef struct ContExplainSample
+{
+	MemoryContext cxt;
+	int request;
+	uint64 generation;
+	bool sampling; /* whether new executions should still be sampled */
+	int instrument_options;
+	bool verbose;
+	bool costs;
+
+	PlannedStmt *plan;
+	int nnodes;
+	Instrumentation *nodes;
+	char *plan_text;
+	int64 executions;
+
+	/* Proc stats at the start of sampling */
+	ProcStatsEntry *stats;
+	uint64 input_rows;
+	uint64 input_bytes;
+	uint64 output_rows;
+	uint64 output_bytes;
+	uint64 updated_rows;
+	uint64 updated_bytes;
+
+	/* Combiner group lookups: batch tuples, tuples looked up in the matrel and groups found there */
+	int64 lookup_groups;
+	int64 lookup_matrel;
+	int64 lookup_found;
+} ContExplainSample;
+
+struct ContQueryState;
+
+#define ContExplainIsSampling(sample) ((sample) && (sample)->sampling)
+
+#define ContExplainCountGroupLookups(sample, groups, matrel, found) \
+	do { \
+		if ((sample)) \
+		{ \
+			(sample)->lookup_groups += (groups); \
+			(sample)->lookup_matrel += (matrel); \
+			(sample)->lookup_found += (found); \
+		} \
+	} \
+	while(0)
+
+extern void ContExplainRequestLWLocks(void);
+extern Size ContExplainShmemSize(void);
+extern void ContExplainShmemInit(void);
+extern void InstallContExplainHooks(void);
+
+extern bool IsContExplainStmt(ExplainStmt *stmt);
+extern void ExplainContQuery(ExplainStmt *stmt, DestReceiver *dest);
+
+extern ContExplainSample *ContExplainStartQuery(struct ContQueryState *state);
+extern void ContExplainSetActive(ContExplainSample *sample, PlannedStmt *plan);
+extern void ContExplainAccumulate(ContExplainSample *sample, QueryDesc *query_desc);
+extern void ContExplainPublish(ContExplainSample *sample);
+
+#endif
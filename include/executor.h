@@ -11,6 +11,7 @@
 
 #include "postgres.h"
 
+#include "cont_explain.h"
 #include "nodes/execnodes.h"
 #include "pipeline_query.h"
 #include "reader.h"
@@ -33,6 +34,9 @@ typedef struct ContQueryState
 	MemoryContext state_cxt;
 	MemoryContext tmp_cxt;
 	ProcStatsEntry *stats;
+	LatencyStatsEntry *latency;
+	uint64 catalog_generation;
+	ContExplainSample *explain;
 } ContQueryState;
 
 typedef struct BatchReceiver
@@ -55,6 +59,11 @@ struct ContExecutor
 	Bitmapset *all_queries;
 	Bitmapset *exec_queries;
 
+	/* If any query has a priority, the order in which this batch executes its queries */
+	int *exec_order;
+	int exec_norder;
+	int exec_next;
+
 	ipc_tuple_reader_batch *batch;
 
 	Oid curr_query_id;
@@ -74,6 +83,7 @@ extern Oid ContExecutorStartNextQuery(ContExecutor *exec, int timeout);
 extern void ContExecutorPurgeQuery(ContExecutor *exec);
 extern void *ContExecutorIterate(ContExecutor *exec, int *len);
 extern void ContExecutorEndQuery(ContExecutor *exec);
+extern void ContExecutorEnsureTransaction(ContExecutor *exec);
 extern void ContExecutorEndBatch(ContExecutor *exec, bool commit);
 extern void ContExecutorAbortQuery(ContExecutor *exec);
 
@@ -79,6 +79,7 @@ extern FSS *FSSCopy(FSS *fss);
 extern FSS *FSSIncrement(FSS *fss, Datum datum, bool isnull);
 extern FSS *FSSIncrementWeighted(FSS *fss, Datum datum, bool isnull, uint64_t weight);
 extern FSS *FSSMerge(FSS *fss, FSS *incoming);
+extern bool FSSStateChanged(FSS *prev, FSS *fss);
 extern int FSSMonitoredLength(FSS *fss);
 extern Datum *FSSTopK(FSS *fss, uint16_t k, bool **nulls, uint16_t *found);
 extern uint64_t *FSSTopKCounts(FSS *fss, uint16_t k, uint16_t *found);
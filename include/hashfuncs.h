@@ -15,6 +15,16 @@
 #define get_combiner_for_shard_hash(hash) ((hash) % num_combiners)
 #define is_group_hash_mine(hash) (get_combiner_for_shard_hash(hash) == MyContQueryProc->group_id)
 
+/*
+ * Groups of a CV with a sharded matrel always live in the same matrel shard, and each shard
+ * is owned by exactly one combiner regardless of how many combiners there are. Shards are
+ * taken from the full 64-bit hash, so with as many shards as combiners each group is owned
+ * by the same combiner it would be without shards.
+ */
+#define get_matrel_shard_for_hash(hash, nshards) ((int) ((uint64) (hash) % (uint64) (nshards)))
+#define get_combiner_for_matrel_shard(shard) ((shard) % num_combiners)
+#define is_matrel_shard_mine(shard) (get_combiner_for_matrel_shard(shard) == MyContQueryProc->group_id)
+
 extern Datum hash_group(PG_FUNCTION_ARGS);
 extern Datum ls_hash_group(PG_FUNCTION_ARGS);
 extern uint64 slot_hash_group_skip_attr(TupleTableSlot *slot, AttrNumber sw_attno, FuncExpr *hash, FunctionCallInfo fcinfo);
@@ -0,0 +1,68 @@
+/*-------------------------------------------------------------------------
+ *
+ * ingestlog.h
+ *	  Local write-ahead log for asynchronous stream inserts
+ *
+ * Copyright (c) 2018, PipelineDB, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef INGESTLOG_H
+#define INGESTLOG_H
+
+#include "postgres.h"
+
+#include "microbatch.h"
+#include "utils/timestamp.h"
+
+#define INGEST_LOG_DIR "pipeline/ingest"
+
+/*
+ * Positions are the segment number in the upper 32 bits and the offset within the segment in the
+ * lower 32 bits. A segment is switched once its offset exceeds INGEST_LOG_SEG_SIZE, so a single
+ * record may extend a segment past that size.
+ */
+#define INGEST_LOG_SEG_SIZE (64 * 1024 * 1024)
+#define IngestLogPosSegNo(pos) ((uint32) ((pos) >> 32))
+#define IngestLogPosOffset(pos) ((uint32) (pos))
+#define IngestLogMakePos(segno, offset) ((((uint64) (segno)) << 32) | (uint64) (offset))
+
+typedef enum IngestLogSlotState
+{
+	INGEST_SLOT_FREE = 0,
+	INGEST_SLOT_OPEN,   /* an insert is still appending to the log */
+	INGEST_SLOT_SEALED, /* all of the insert's batches have been logged and sent */
+	INGEST_SLOT_REPLAY  /* everything from start onwards must be replayed */
+} IngestLogSlotState;
+
+/*
+ * Tracks a single logged insert until combiners have committed all of its tuples. The ack
+ * embedded here is attached to every microbatch the insert sends, exactly like a synchronous ack.
+ */
+typedef struct IngestLogSlot
+{
+	microbatch_ack_t ack;
+	IngestLogSlotState state;
+	uint64 start;
+	uint64 epoch;
+	uint64 generation;
+	TimestampTz sealed_at;
+	int ntups;
+} IngestLogSlot;
+
+/* guc */
+extern bool ingest_log_enabled;
+extern int ingest_log_max_pending;
+
+extern void IngestLogRequestLWLocks(void);
+extern Size IngestLogShmemSize(void);
+extern void IngestLogShmemInit(void);
+
+extern IngestLogSlot *IngestLogBegin(void);
+extern void IngestLogInsert(IngestLogSlot *slot, Oid relid, char *buf, int len, int ntups);
+extern void IngestLogEnd(IngestLogSlot *slot);
+
+extern void IngestLogAdvance(void);
+extern void IngestLogReplay(void);
+
+#endif
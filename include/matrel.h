@@ -10,6 +10,7 @@
 #ifndef CQMATVIEW_H
 #define CQMATVIEW_H
 
+#include "datatype/timestamp.h"
 #include "nodes/execnodes.h"
 
 extern bool matrels_writable;
@@ -18,9 +19,32 @@ extern bool matrels_writable;
 #define CQ_MATREL_SUFFIX "_mrel"
 #define CQ_SEQREL_SUFFIX "_seq"
 #define CQ_DEFREL_SUFFIX "_def"
+#define CQ_SNAPSHOT_SUFFIX "_snap"
+#define CQ_SNAPSHOT_MARKER_SUFFIX "_snapmark"
+#define CQ_ARCHIVE_SUFFIX "_archive"
+#define CQ_ARCHIVE_BUCKET "$bucket"
+#define CQ_ARCHIVE_GROUPS "$groups"
+#define CQ_ARCHIVE_PKS "$pks"
+#define CQ_TOPN_SUFFIX "_topn"
+#define CQ_CACHE_SUFFIX "_cache"
 #define CQ_MATREL_PKEY "$pk"
+#define CQ_MATREL_MAX_SHARDS 1024
+#define CQ_MATREL_MAX_TTL_PARTITIONS 1024
+#define CQ_TOPN_MAX 1000
 #define MatRelWritable() (matrels_writable)
 
+/* Columns of a matrel's top-N relation */
+#define Natts_topn 4
+#define Anum_topn_combiner 1
+#define Anum_topn_pk 2
+#define Anum_topn_value 3
+#define Anum_topn_row 4
+
+/* Columns of a matrel's finalized cache relation */
+#define Natts_cache 2
+#define Anum_cache_pk 1
+#define Anum_cache_row 2
+
 extern ResultRelInfo *CQMatRelOpen(Relation matrel);
 extern void CQOSRelClose(ResultRelInfo *rinfo);
 extern ResultRelInfo *CQOSRelOpen(Relation osrel);
@@ -33,5 +57,23 @@ extern char *CVNameToOSRelName(char *cv_name);
 extern char *CVNameToMatRelName(char *cv_name);
 extern char *CVNameToDefRelName(char *cv_name);
 extern char *CVNameToSeqRelName(char *cv_name);
+extern char *CVNameToTopNName(char *cv_name);
+extern char *MatRelNameToShardName(char *matrel_name, int shard);
+extern Oid GetMatRelShardRelid(Oid matrelid, int shard);
+extern int64 TimestampGetTTLPartitionStart(Timestamp ts, int interval);
+extern Timestamp TTLPartitionStartGetTimestamp(int64 start);
+extern char *MatRelNameToTTLPartitionName(char *matrel_name, int64 start);
+extern bool TTLPartitionNameGetStart(char *matrel_name, char *relname, int64 *start);
+extern char *MatRelNameToSnapshotName(char *matrel_name);
+extern char *MatRelNameToSnapshotMarkerName(char *matrel_name);
+extern Oid GetMatRelSnapshotRelid(Oid matrelid);
+extern Oid GetMatRelSnapshotMarkerRelid(Oid matrelid);
+extern void RestoreMatRelSnapshot(Oid matrelid);
+extern char *MatRelNameToArchiveName(char *matrel_name);
+extern Oid GetMatRelArchiveRelid(Oid matrelid);
+extern char *MatRelNameToTopNName(char *matrel_name);
+extern Oid GetMatRelTopNRelid(Oid matrelid);
+extern char *MatRelNameToCacheName(char *matrel_name);
+extern Oid GetMatRelCacheRelid(Oid matrelid);
 
 #endif
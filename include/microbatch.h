@@ -19,6 +19,7 @@
 #include "nodes/pg_list.h"
 #include "port/atomics.h"
 #include "scheduler.h"
+#include "utils/timestamp.h"
 
 #define MAX_MICROBATCH_SIZE (continuous_query_batch_mem * 1024)
 
@@ -56,6 +57,7 @@ typedef enum
 } StreamInsertLevel;
 
 extern microbatch_ack_t *microbatch_ack_new(StreamInsertLevel level);
+extern void microbatch_ack_init(microbatch_ack_t *ack, StreamInsertLevel level);
 extern void microbatch_ack_free(microbatch_ack_t *ack);
 
 #define microbatch_ack_ref_is_valid(ref) ((ref)->tag == pg_atomic_read_u64(&((microbatch_ack_t *) ref->ptr)->id))
@@ -98,6 +100,8 @@ typedef enum microbatch_type_t
 	FlushTuple
 } microbatch_type_t;
 
+struct IngestLogSlot;
+
 typedef struct microbatch_t
 {
 	microbatch_type_t type;
@@ -113,6 +117,14 @@ typedef struct microbatch_t
 	tagged_ref_t *tups;
 	int ntups;
 	StringInfo buf;
+
+	/* When the batch was packed for sending, and when it was unpacked by its reader */
+	TimestampTz sent_at;
+	TimestampTz recv_at;
+
+	/* If set, the packed batch is appended to the ingest log before it's sent */
+	struct IngestLogSlot *log_slot;
+	Oid log_relid;
 } microbatch_t;
 
 extern microbatch_t *microbatch_new(microbatch_type_t type, Bitmapset *queries, TupleDesc desc);
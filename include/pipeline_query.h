@@ -77,6 +77,21 @@ typedef FormData_pipeline_query *Form_pipeline_query;
 #define OPTION_TTL "ttl"
 #define OPTION_TTL_COLUMN "ttl_column"
 #define OPTION_TTL_ATTNO "ttl_attno"
+#define OPTION_TTL_PARTITION "ttl_partition"
+#define OPTION_SHARDS "shards"
+#define OPTION_UNLOGGED "unlogged"
+#define OPTION_ROLLUPS "rollups"
+#define OPTION_FREEZE_AFTER "freeze_after"
+#define OPTION_FREEZE_ATTNO "freeze_attno"
+#define OPTION_TOPN "topn"
+#define OPTION_TOPN_COLUMN "topn_column"
+#define OPTION_TOPN_ATTNO "topn_attno"
+#define OPTION_CACHE "cache"
+#define OPTION_COMMIT_INTERVAL "commit_interval"
+#define OPTION_FRESHNESS "freshness"
+#define OPTION_PRIORITY "priority"
+
+#define CQ_PRIORITY_MAX 100
 
 #define OPTION_CV "cv"
 #define OPTION_TRANSFORM "transform"
@@ -156,6 +171,17 @@ typedef struct ContQuery
 	AttrNumber ttl_attno;
 	AttrNumber sw_attno;
 	int ttl;
+	int ttl_partition; /* seconds, 0 if the matrel isn't partitioned by its TTL column */
+	int matrel_shards;
+	bool unlogged;
+	int freeze_after;
+	AttrNumber freeze_attno;
+	int topn;
+	AttrNumber topn_attno;
+	bool cached;
+	int commit_interval; /* ms, 0 to use the combiner's interval */
+	int freshness; /* ms, 0 for no target */
+	int priority;
 
 	/* for transform */
 	Oid tgfn;
@@ -174,6 +200,7 @@ typedef enum ContQueryAction
 extern Oid PipelineQueryRelationOid;
 
 extern int continuous_view_fillfactor;
+extern int sketch_storage;
 
 extern PipelineDDLLock AcquirePipelineDDLLock(void);
 extern void ReleasePipelineDDLLock(PipelineDDLLock lock);
@@ -196,6 +223,8 @@ extern void ExecCreateContTransformStmt(RangeVar *transform, Node *stmt, List *o
 extern void StorePipelineQueryReloptions(Oid relid, List *options);
 
 extern Query *GetContQueryDef(Oid defrelid);
+extern Query *GetContViewMatRelQuery(Relation overlayrel);
+extern int CreateMatRelTTLPartitions(ContQuery *cq);
 
 extern HeapTuple GetPipelineQueryTuple(RangeVar *name);
 extern bool RangeVarIsContView(RangeVar *name);
@@ -232,6 +261,7 @@ extern Bitmapset *GetContTransformIds(void);
 extern bool ContQuerySetActive(Oid id, bool active);
 
 extern ContQuery *GetContQueryForId(Oid id);
+extern int GetContQueryPriority(Oid id);
 extern ContQuery *RangeVarGetContView(RangeVar *cv_name);
 extern ContQuery *RangeVarGetContQuery(RangeVar *cq_name);
 extern ContQuery *GetContViewForId(Oid id);
@@ -0,0 +1,52 @@
+/*-------------------------------------------------------------------------
+ *
+ * pipeline_trace.h
+ *	  Static tracepoints, see src/probes.d
+ *
+ * With `make USE_DTRACE=1` these are USDT probes generated from src/probes.d, which perf, bpftrace,
+ * SystemTap and DTrace can attach to by name. Otherwise every probe compiles to nothing, and so does
+ * anything guarded by its _ENABLED() test.
+ *
+ * Copyright (c) 2018, PipelineDB, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef PIPELINE_TRACE_H
+#define PIPELINE_TRACE_H
+
+#ifdef USE_PIPELINEDB_PROBES
+
+#include "pipeline_probes.h"
+
+#else
+
+#define TRACE_PIPELINEDB_MICROBATCH_SEND(INT1, INT2, INT3, INT4) do {} while (0)
+#define TRACE_PIPELINEDB_MICROBATCH_SEND_ENABLED() (0)
+#define TRACE_PIPELINEDB_MICROBATCH_SEND_QUEUE(INT1, INT2, INT3) do {} while (0)
+#define TRACE_PIPELINEDB_MICROBATCH_SEND_QUEUE_ENABLED() (0)
+#define TRACE_PIPELINEDB_MICROBATCH_RECV(INT1, INT2, INT3, INT4) do {} while (0)
+#define TRACE_PIPELINEDB_MICROBATCH_RECV_ENABLED() (0)
+#define TRACE_PIPELINEDB_ACK_CREATE(INT1, INT2) do {} while (0)
+#define TRACE_PIPELINEDB_ACK_CREATE_ENABLED() (0)
+#define TRACE_PIPELINEDB_ACK_DONE(INT1, INT2, INT3, INT4) do {} while (0)
+#define TRACE_PIPELINEDB_ACK_DONE_ENABLED() (0)
+#define TRACE_PIPELINEDB_WORKER_BATCH_START(INT1, INT2, INT3) do {} while (0)
+#define TRACE_PIPELINEDB_WORKER_BATCH_START_ENABLED() (0)
+#define TRACE_PIPELINEDB_WORKER_BATCH_DONE(INT1, INT2, INT3, INT4) do {} while (0)
+#define TRACE_PIPELINEDB_WORKER_BATCH_DONE_ENABLED() (0)
+#define TRACE_PIPELINEDB_COMBINER_LOOKUP(INT1, INT2, INT3, INT4, INT5) do {} while (0)
+#define TRACE_PIPELINEDB_COMBINER_LOOKUP_ENABLED() (0)
+#define TRACE_PIPELINEDB_COMBINER_COMBINE(INT1, INT2, INT3) do {} while (0)
+#define TRACE_PIPELINEDB_COMBINER_COMBINE_ENABLED() (0)
+#define TRACE_PIPELINEDB_COMBINER_SYNC(INT1, INT2, INT3, INT4) do {} while (0)
+#define TRACE_PIPELINEDB_COMBINER_SYNC_ENABLED() (0)
+#define TRACE_PIPELINEDB_QUEUE_SPILL(INT1, INT2, INT3) do {} while (0)
+#define TRACE_PIPELINEDB_QUEUE_SPILL_ENABLED() (0)
+#define TRACE_PIPELINEDB_QUEUE_RETRY(INT1, INT2, INT3) do {} while (0)
+#define TRACE_PIPELINEDB_QUEUE_RETRY_ENABLED() (0)
+#define TRACE_PIPELINEDB_REAPER_DELETE(INT1, INT2, INT3) do {} while (0)
+#define TRACE_PIPELINEDB_REAPER_DELETE_ENABLED() (0)
+
+#endif
+
+#endif
@@ -42,6 +42,7 @@ extern void ipc_tuple_reader_destroy(void);
 extern ipc_tuple_reader_batch *ipc_tuple_reader_pull(void);
 extern void ipc_tuple_reader_reset(void);
 extern void ipc_tuple_reader_ack(void);
+extern void ipc_tuple_reader_ack_committed(Bitmapset *pending);
 
 extern ipc_tuple *ipc_tuple_reader_next(Oid query_id);
 extern void ipc_tuple_reader_rewind(void);
@@ -11,6 +11,7 @@
 
 extern int ttl_expiration_batch_size;
 extern int ttl_expiration_threshold;
+extern int matrel_snapshot_interval;
 
 int DeleteTTLExpiredRows(RangeVar *cvname, RangeVar *matrel);
 
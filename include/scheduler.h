@@ -42,6 +42,9 @@ typedef struct ContQueryProc
 	volatile int pzmq_id;
 	volatile int group_id; /* unqiue [0, n) for each db_oid, type pair */
 
+	/* set by combiners from the moment they decide to sync until their commit is flushed */
+	volatile bool committing;
+
 	BackgroundWorkerHandle *bgw_handle;
 	ContQueryDatabaseMetadata *db_meta;
 } ContQueryProc;
@@ -91,6 +94,10 @@ extern int  continuous_query_combiner_work_mem;
 extern int  continuous_query_combiner_synchronous_commit;
 
 extern int continuous_query_commit_interval;
+extern bool continuous_query_combiner_group_commit;
+extern bool continuous_query_adaptive_commit_interval;
+extern int continuous_query_min_commit_interval;
+extern int continuous_query_max_commit_interval;
 extern double continuous_query_proc_priority;
 
 #define MyDSMCQueue (MyContQueryProc->cq_handle->cqueue)
@@ -34,8 +34,48 @@ typedef struct ProcStatsEntry
 	pg_atomic_uint64 executions;
 	pg_atomic_uint64 errors;
 	pg_atomic_uint64 exec_ms;
+	pg_atomic_uint64 deleted_rows;
+	pg_atomic_uint64 toast_bytes;
+	pg_atomic_uint64 commit_interval; /* combiners only, the current sync interval in ms */
 } ProcStatsEntry;
 
+/*
+ * Stages of an event's path through continuous queries that latency is tracked for
+ */
+typedef enum LatencyStage
+{
+	LATENCY_WORKER_QUEUE = 0, /* from the inserting backend's send until a worker reads it */
+	LATENCY_WORKER_EXEC,      /* worker plan execution, per batch */
+	LATENCY_COMBINER_QUEUE,   /* from the worker's send until a combiner reads it */
+	LATENCY_COMBINE,          /* in-memory combine, per batch */
+	LATENCY_SYNC,             /* matrel sync, per sync */
+	LATENCY_COMMIT,           /* combiner commit, including any WAL flush, per sync */
+	NUM_LATENCY_STAGES
+} LatencyStage;
+
+/*
+ * Latencies are recorded in microseconds into HDR-style log-linear histograms. Values below
+ * LATENCY_SUB_BUCKETS are exact, and every power of two above that is split into LATENCY_SUB_BUCKETS
+ * linear buckets, so that percentiles are accurate to within 1/LATENCY_SUB_BUCKETS. Values at or
+ * above 2^(LATENCY_MAX_BITS) us (about 9.5 hours) all land in the last bucket.
+ */
+#define LATENCY_SUB_BUCKET_BITS 4
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_MAX_BITS 35
+#define LATENCY_BUCKETS ((LATENCY_MAX_BITS - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+typedef struct LatencyStatsKey
+{
+	Oid dbid;
+	Oid cqid;
+} LatencyStatsKey;
+
+typedef struct LatencyStatsEntry
+{
+	LatencyStatsKey key;
+	pg_atomic_uint64 counts[NUM_LATENCY_STAGES][LATENCY_BUCKETS];
+} LatencyStatsEntry;
+
 typedef struct StreamStatsKey
 {
 	Oid dbid;
@@ -54,12 +94,17 @@ typedef struct StreamStatsEntry
  * If we're a CQ process, this tracks our various runtime stats
  */
 extern ProcStatsEntry *MyProcStatCQEntry;
+extern LatencyStatsEntry *MyLatencyStatCQEntry;
+
+/* guc */
+extern int latency_stats_max_queries;
 
 extern Size StatsShmemSize(void);
 extern void StatsRequestLWLocks(void);
 extern void StatsShmemInit(void);
 extern void PurgeDeadProcStats(Oid cqid);
 extern void PurgeDeadStreamStats(Oid relid);
+extern void PurgeDeadLatencyStats(Oid cqid);
 extern void GetInstallationStats(uint64 *events_inp, uint64 *batches_inp, uint64 *bytes_inp, uint64 *errorsp, int *cqcountp, int *ccountp, int *wcountp);
 extern StreamStatsEntry *GetStreamStatsEntry(Oid relid);
 
@@ -123,7 +168,37 @@ extern StreamStatsEntry *GetStreamStatsEntry(Oid relid);
 	} \
 	while(0)
 
+#define StatsIncrementCQDelete(nrows) \
+	do { \
+		if (MyProcStatCQEntry) \
+			pg_atomic_fetch_add_u64(&MyProcStatCQEntry->deleted_rows, (nrows)); \
+	} \
+	while(0)
+
+#define StatsIncrementCQToast(nbytes) \
+	do { \
+		if (MyProcStatCQEntry) \
+			pg_atomic_fetch_add_u64(&MyProcStatCQEntry->toast_bytes, (nbytes)); \
+	} \
+	while(0)
+
+#define StatsSetCQCommitInterval(entry, ms) \
+	do { \
+		if ((entry)) \
+			pg_atomic_write_u64(&(entry)->commit_interval, (ms)); \
+	} \
+	while(0)
+
+#define StatsRecordCQLatency(entry, stage, start, end, n) \
+	do { \
+		if ((entry)) \
+			RecordLatency((entry), (stage), (end) - (start), (n)); \
+	} \
+	while(0)
+
 extern ProcStatsEntry *ProcStatsInit(Oid cqid, pid_t pid);
 extern StreamStatsEntry *StreamStatsInit(Oid relid);
+extern LatencyStatsEntry *LatencyStatsInit(Oid cqid);
+extern void RecordLatency(LatencyStatsEntry *entry, LatencyStage stage, int64 us, uint64 n);
 
 #endif
@@ -13,6 +13,7 @@
 #include "executor.h"
 #include "executor/tuptable.h"
 #include "foreign/foreign.h"
+#include "ingestlog.h"
 #include "lib/stringinfo.h"
 #include "nodes/bitmapset.h"
 #include "nodes/execnodes.h"
@@ -48,6 +49,8 @@ typedef struct StreamInsertState
 	microbatch_ack_t *ack;
 	uint64 start_generation;
 
+	IngestLogSlot *log_slot;
+
 	ContQueryDatabaseMetadata *db_meta;
 } StreamInsertState;
 
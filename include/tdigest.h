@@ -43,6 +43,7 @@ extern TDigest *TDigestCopy(TDigest *t);
 extern TDigest *TDigestAdd(TDigest *t, float8 x, int64 w);
 extern TDigest *TDigestCompress(TDigest *t);
 extern TDigest *TDigestMerge(TDigest *t1, TDigest *t2);
+extern bool TDigestStateChanged(TDigest *prev, TDigest *t);
 
 extern float8 TDigestCDF(TDigest *t, float8 x);
 extern float8 TDigestQuantile(TDigest *t, float8 q);
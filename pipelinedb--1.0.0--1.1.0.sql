@@ -1,3 +1,188 @@
 
 -- OIDs are finicky and PG is moving away from them
 ALTER TABLE pipelinedb.cont_query SET WITHOUT OIDS;
+
+-- Stats now include rows deleted by the reaper, bytes written out of line to matrel TOAST tables
+-- and the commit interval that combiners currently use
+DROP VIEW pipelinedb.db_stats;
+DROP VIEW pipelinedb.query_stats;
+DROP VIEW pipelinedb.proc_stats;
+DROP VIEW pipelinedb.proc_query_stats;
+DROP FUNCTION pipelinedb.get_proc_query_stats();
+
+CREATE FUNCTION pipelinedb.get_proc_query_stats()
+RETURNS table (
+  type text,
+  pid int4,
+  start_time timestamptz,
+  query_id int4,
+  input_rows int8,
+  output_rows int8,
+  updated_rows int8,
+  input_bytes int8,
+  output_bytes int8,
+  updated_bytes int8,
+  executions int8,
+  errors int8,
+  exec_ms int8,
+  deleted_rows int8,
+  toast_bytes int8,
+  commit_interval int8
+)
+AS 'MODULE_PATHNAME', 'pipeline_get_proc_query_stats'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+-- Raw stats, most granular form
+CREATE VIEW pipelinedb.proc_query_stats AS
+ SELECT
+   type,
+   pid,
+   start_time,
+   query_id,
+   input_rows,
+   output_rows,
+   updated_rows,
+   output_bytes,
+   updated_bytes,
+   input_bytes,
+   executions,
+   errors,
+   exec_ms,
+   deleted_rows,
+   toast_bytes,
+   commit_interval
+ FROM pipelinedb.get_proc_query_stats();
+
+-- Stats by process type, pid
+CREATE VIEW pipelinedb.proc_stats AS
+ SELECT
+   type,
+   pid,
+   min(start_time) AS start_time,
+   sum(input_rows) AS input_rows,
+   sum(output_rows) AS output_rows,
+   sum(updated_rows) AS updated_rows,
+   sum(output_bytes) AS output_bytes,
+   sum(updated_bytes) AS updated_bytes,
+   sum(input_bytes) AS input_bytes,
+   sum(executions) AS executions,
+   sum(errors) AS errors,
+   sum(exec_ms) AS exec_ms,
+   sum(deleted_rows) AS deleted_rows,
+   sum(toast_bytes) AS toast_bytes,
+   max(commit_interval) AS commit_interval
+ FROM pipelinedb.proc_query_stats
+GROUP BY type, pid
+ORDER BY type, pid;
+
+-- Stats by process type, query
+CREATE VIEW pipelinedb.query_stats AS
+ SELECT
+   s.type,
+   n.nspname AS namespace,
+   c.relname AS continuous_query,
+   sum(input_rows) AS input_rows,
+   sum(output_rows) AS output_rows,
+   sum(updated_rows) AS updated_rows,
+   sum(output_bytes) AS output_bytes,
+   sum(updated_bytes) AS updated_bytes,
+   sum(input_bytes) AS input_bytes,
+   sum(executions) AS executions,
+   sum(errors) AS errors,
+   sum(exec_ms) AS exec_ms,
+   sum(deleted_rows) AS deleted_rows,
+   sum(toast_bytes) AS toast_bytes,
+   max(commit_interval) AS commit_interval
+ FROM pipelinedb.proc_query_stats s
+ JOIN pipelinedb.cont_query pq ON pq.id = s.query_id
+ JOIN pg_class c ON pq.relid = c.oid
+ JOIN pg_namespace n ON c.relnamespace = n.oid
+GROUP BY s.type, namespace, continuous_query
+ORDER BY s.type, namespace, continuous_query;
+
+-- Stats by process type
+CREATE VIEW pipelinedb.db_stats AS
+ SELECT
+   type,
+   sum(input_rows) AS input_rows,
+   sum(output_rows) AS output_rows,
+   sum(updated_rows) AS updated_rows,
+   sum(output_bytes) AS output_bytes,
+   sum(updated_bytes) AS updated_bytes,
+   sum(input_bytes) AS input_bytes,
+   sum(executions) AS executions,
+   sum(errors) AS errors,
+   sum(exec_ms) AS exec_ms,
+   sum(deleted_rows) AS deleted_rows,
+   sum(toast_bytes) AS toast_bytes,
+   max(commit_interval) AS commit_interval
+ FROM pipelinedb.proc_query_stats
+GROUP BY type
+ORDER BY type;
+
+CREATE FUNCTION pipelinedb.get_latency_stats(percentiles float8[] DEFAULT '{0.5,0.9,0.99,0.999}')
+RETURNS table (
+  query_id int4,
+  stage text,
+  count int8,
+  percentiles float8[],
+  max float8
+)
+AS 'MODULE_PATHNAME', 'pipeline_get_latency_stats'
+LANGUAGE C VOLATILE PARALLEL SAFE;
+
+CREATE FUNCTION pipelinedb.reset_latency_stats()
+RETURNS void
+AS 'MODULE_PATHNAME', 'pipeline_reset_latency_stats'
+LANGUAGE C VOLATILE;
+
+-- Per-stage latency percentiles by continuous query, in microseconds
+CREATE VIEW pipelinedb.latency_stats AS
+ SELECT
+  n.nspname AS namespace,
+  c.relname AS query,
+  s.stage,
+  s.count,
+  s.percentiles[1] AS p50,
+  s.percentiles[2] AS p90,
+  s.percentiles[3] AS p99,
+  s.percentiles[4] AS p999,
+  s.max
+ FROM pipelinedb.get_latency_stats() s
+ JOIN pipelinedb.cont_query q ON s.query_id = q.id
+ JOIN pg_class c ON q.relid = c.oid
+ JOIN pg_namespace n ON c.relnamespace = n.oid;
+
+-- Microbenchmarks for the sketch data structures, see src/test/bench/sketch_bench.py
+CREATE FUNCTION pipelinedb.sketch_benchmark(
+  sketch text,
+  n int8,
+  cardinality int8 DEFAULT 0,
+  size int4 DEFAULT NULL,
+  reps int4 DEFAULT 10)
+RETURNS table (
+  op text,
+  ops int8,
+  total_ms float8,
+  ns_per_op float8,
+  ops_per_sec float8,
+  bytes int8
+)
+AS 'MODULE_PATHNAME', 'pipeline_sketch_benchmark'
+LANGUAGE C VOLATILE;
+
+/*
+ * All combine aggregates are already parallel safe and have serialize/deserialize
+ * functions, but a few functions that may appear in plans over continuous views and
+ * their matrels were never marked, which forces any such plan to run serially.
+ *
+ * Functions that modify state (activate, truncate_continuous_view, etc.) stay unsafe.
+ */
+ALTER FUNCTION combine_trans_dummy(anyelement, anyelement) PARALLEL SAFE;
+ALTER FUNCTION pipelinedb.get_streams() PARALLEL SAFE;
+ALTER FUNCTION pipelinedb.get_views() PARALLEL SAFE;
+ALTER FUNCTION pipelinedb.get_transforms() PARALLEL SAFE;
+ALTER FUNCTION pipelinedb.get_worker_querydef(text) PARALLEL SAFE;
+ALTER FUNCTION pipelinedb.get_combiner_querydef(text) PARALLEL SAFE;
+ALTER FUNCTION pipelinedb.get_stream_readers() PARALLEL SAFE;
+ALTER FUNCTION pipelinedb.get_stream_stats() PARALLEL SAFE;
@@ -4056,6 +4056,13 @@ add_unfinalized_var(Index varno, AttrNumber attr, Query *q,
 		Var *result;
 		Node *arg;
 
+		/* A frozen or cached CV's view reads finalized values, which have nothing left to combine */
+		if (rte->subquery->setOperations)
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("combine aggregates are not supported over set operations"),
+					 errdetail("Continuous views with frozen buckets or a cache read finalized values, which can't be combined.")));
+
 		if (list_length(args) != 1)
 			elog(ERROR, "combine argument must be a single aggregate column");
 
@@ -172,6 +172,18 @@ CountMinSketchMerge(CountMinSketch *result, CountMinSketch* incoming)
 	return result;
 }
 
+/*
+ * CountMinSketchStateChanged
+ *
+ * Merging only ever adds to the running count, so two states of the same sketch
+ * with equal counts and dimensions contain the same table
+ */
+bool
+CountMinSketchStateChanged(CountMinSketch *prev, CountMinSketch *cms)
+{
+	return prev->count != cms->count || prev->d != cms->d || prev->w != cms->w;
+}
+
 /*
  * CountMinSketchSize
  */
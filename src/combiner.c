@@ -9,20 +9,28 @@
 #include "postgres.h"
 
 #include "access/htup_details.h"
+#include "access/tuptoaster.h"
 #include "access/xact.h"
 #include "analyzer.h"
 #include "catalog.h"
+#include "catalog/dependency.h"
 #include "catalog/namespace.h"
 #include "catalog/pg_proc.h"
 #include "catalog/pg_type.h"
+#include "cmsketch.h"
 #include "combiner_receiver.h"
+#include "commands/extension.h"
 #include "commands/sequence.h"
 #include "commands/lockcmds.h"
 #include "compat.h"
+#include "config.h"
+#include "cont_explain.h"
 #include "executor/execdesc.h"
 #include "executor/executor.h"
 #include "executor/tstoreReceiver.h"
+#include "fss.h"
 #include "hashfuncs.h"
+#include "ingestlog.h"
 #include "matrel.h"
 #include "miscadmin.h"
 #include "miscutils.h"
@@ -38,6 +46,7 @@
 #include "pgstat.h"
 #include "physical_group_lookup.h"
 #include "pipeline_query.h"
+#include "pipeline_trace.h"
 #include "planner.h"
 #include "rewrite/rewriteHandler.h"
 #include "scheduler.h"
@@ -47,6 +56,7 @@
 #include "tcop/dest.h"
 #include "tcop/pquery.h"
 #include "tcop/tcopprot.h"
+#include "tdigest.h"
 #include "utils/builtins.h"
 #include "utils/datum.h"
 #include "utils/fmgroids.h"
@@ -71,10 +81,38 @@
  */
 #define EXISTING_ADDED 0x1
 
+/*
+ * Groups spilled to disk between syncs are partitioned by group hash, and each partition
+ * is merged back in separately at sync time
+ */
+#define NUM_SPILL_PARTITIONS 16
+#define SPILL_PARTITION_WORK_MEM 64
+
 #define OLD_TUPLE 		0
 #define NEW_TUPLE 		1
 #define DELTA_TUPLE		2
 
+/*
+ * Commit interval currently used by this combiner, along with what was observed since the last sync.
+ * Adaptive intervals are always min_commit_interval times a power of two, so that with group commit
+ * the sync boundaries of combiners using different intervals still line up.
+ */
+static int sync_interval;
+static int interval_batches;
+static int interval_full_batches;
+static int interval_idle_polls;
+
+/*
+ * Determines whether or not a combined aggregate state differs from the state it was combined with
+ */
+typedef bool (*StateChangedFunc) (struct varlena *prev, struct varlena *new);
+
+typedef struct StateChangeDetector
+{
+	StateChangedFunc changed;
+	int32 header_len; /* bytes of the state, including its varlena header, that changed reads */
+} StateChangeDetector;
+
 typedef struct
 {
 	AttrNumber arrival_ts_attr;
@@ -87,20 +125,92 @@ typedef struct
 	MemoryContext context;
 	TimestampTz last_tick;
 	TimestampTz last_matrel_sync;
+
+	/*
+	 * Cached step groups keyed by the overlay group they belong to. Only window groups
+	 * whose set of in-window step rows changed since the last tick are recomputed.
+	 */
+	TupleHashTable window_groups;
+	AttrNumber *window_keys;
+	AttrNumber *overlay_keys;
+	int nkeys;
+	TupleTableSlot *window_key_slot;
+	List *dirty_windows;
+
+	/*
+	 * A copy of the combine plan that we use to combine step tuples into window partials
+	 */
+	PlannedStmt *partial_plan;
+	Tuplestorestate *partial_input;
+	DestReceiver *partial_dest;
+	Tuplestorestate *partial_output;
 } SWOutputState;
 
+/*
+ * Which of its window's stacks a cached step tuple is on, see update_window_partials
+ */
+typedef enum SWStepStack
+{
+	SW_STEP_OPEN = 0,
+	SW_STEP_BACK,
+	SW_STEP_FRONT
+} SWStepStack;
+
 typedef struct
 {
 	PhysicalTupleData base;
 	TimestampTz last_touched;
+	struct WindowGroupEntry *window;
+
+	/* the following are only used by step tuples */
+	TimestampTz step;
+	SWStepStack stack;
+	HeapTuple suffix; /* front steps: this step combined with all newer front steps */
 } OverlayTupleEntry;
 
+typedef struct WindowGroupEntry
+{
+	HeapTuple key;
+	List *open;
+	List *back;
+	HeapTuple back_partial;
+	List *front;
+	OverlayTupleEntry *overlay;
+	bool dirty;
+	bool rebuild;
+} WindowGroupEntry;
+
+/*
+ * A matrel shard owned by this combiner. CVs without a sharded matrel have a single
+ * shard, which is the matrel itself. A TTL-partitioned matrel has the matrel itself as its
+ * first shard, followed by the partitions that the current batch's groups belong in.
+ */
+typedef struct MatRelShard
+{
+	int id;
+	Oid relid;
+	int64 start; /* TTL partitions only, InvalidOid relid if the partition doesn't exist */
+	MemoryContext plan_cache_cxt;
+	PlannedStmt *groups_plan;
+	TimestampTz last_groups_plan;
+} MatRelShard;
+
+/*
+ * One of the groups in a combiner's top-N heap, keyed by its matrel primary key
+ */
+typedef struct TopNEntry
+{
+	Datum pk;
+	Datum value;
+	Datum row;
+} TopNEntry;
+
 typedef struct
 {
 	ContQueryState base;
 	PlannedStmt *combine_plan;
-	PlannedStmt *groups_plan;
-	TimestampTz last_groups_plan;
+	MatRelShard *shards;
+	int nshards;
 	TupleDesc desc;
 	MemoryContext plan_cache_cxt;
 	MemoryContext combine_cxt;
@@ -124,6 +234,8 @@ typedef struct
 	TupleHashTable existing;
 	TupleHashTable deltas;
 	long pending_tuples;
+	TimestampTz first_seen; /* when the oldest pending tuple was read */
+	bool synced; /* synced in the transaction that is about to commit */
 
 	/* Stores the hashes of the current batch, in parallel to the order of the batch's tuplestore */
 	int64 *group_hashes;
@@ -132,6 +244,16 @@ typedef struct
 	bool seq_pk;
 	FunctionCallInfo hash_fcinfo;
 
+	/* Per-attribute change detectors for sketch columns, unset for columns without one */
+	StateChangeDetector *changed_funcs;
+
+	/* Partial results of cold groups spilled to disk since the last sync */
+	Tuplestorestate **spill;
+	long spilled_tuples;
+
+	/* Size of the in-memory combine result as of the last combine */
+	Size combined_bytes;
+
 	/* Projection to execute on output stream tuples */
 	ProjectionInfo *output_stream_proj;
 	TupleTableSlot *proj_input_slot;
@@ -143,6 +265,23 @@ typedef struct
 	Node *lookup_query;
 	RangeTblEntry *lookup_rte;
 
+	/* Min-heap of this combiner's current top-N groups, for CVs that maintain one */
+	TopNEntry *topn;
+	int ntopn;
+	bool topn_dirty;
+	Oid topn_relfilenode;
+	MemoryContext topn_cxt;
+	FmgrInfo *topn_cmp;
+	Oid topn_collation;
+	FmgrInfo *topn_pk_cmp;
+	Oid topn_pk_collation;
+	Oid topn_relid;
+
+	/* Finalized cache of the CV's overlay rows, if it has one */
+	Oid cache_relid;
+	TupleTableSlot *cache_slot;
+	RegProcedure cache_eqproc;
+
 	/* Sliding-window state */
 	SWOutputState *sw;
 
@@ -172,14 +311,196 @@ prepare_combine_plan(ContQueryCombinerState *state, PlannedStmt *plan)
 	heap_close(rel, AccessShareLock);
 }
 
+/*
+ * get_slot_ttl_partition
+ *
+ * Determines the start of the TTL partition range that the given group falls in
+ */
+static bool
+get_slot_ttl_partition(ContQueryCombinerState *state, TupleTableSlot *slot, int64 *start)
+{
+	bool isnull;
+	Datum d = slot_getattr(slot, state->base.query->ttl_attno, &isnull);
+
+	if (isnull)
+		return false;
+
+	*start = TimestampGetTTLPartitionStart(DatumGetTimestamp(d), state->base.query->ttl_partition);
+
+	return true;
+}
+
+/*
+ * in_shard
+ *
+ * Determines whether or not the group with the given hash may live in the given matrel shard.
+ * Any group of a TTL-partitioned matrel may live in the matrel itself, since that's where groups
+ * go if their partition didn't exist yet when they were first inserted.
+ */
+static bool
+in_shard(ContQueryCombinerState *state, MatRelShard *shard, TupleTableSlot *slot, uint64 hash)
+{
+	int64 start;
+
+	if (state->base.query->ttl_partition)
+	{
+		if (shard == &state->shards[0])
+			return true;
+		if (!OidIsValid(shard->relid))
+			return false;
+
+		return get_slot_ttl_partition(state, slot, &start) && start == shard->start;
+	}
+
+	if (!state->base.query->matrel_shards)
+		return true;
+
+	return get_matrel_shard_for_hash(hash, state->base.query->matrel_shards) == shard->id;
+}
+
+/*
+ * get_slot_shard
+ *
+ * Returns the index of the owned matrel shard that a new group should be inserted into
+ */
+static int
+get_slot_shard(ContQueryCombinerState *state, TupleTableSlot *slot)
+{
+	uint64 hash;
+	int i;
+
+	if (state->nshards == 1)
+		return 0;
+
+	if (state->base.query->ttl_partition)
+	{
+		for (i = 1; i < state->nshards; i++)
+		{
+			if (in_shard(state, &state->shards[i], slot, 0))
+				return i;
+		}
+
+		return 0;
+	}
+
+	hash = slot_hash_group(slot, state->hashfunc, state->hash_fcinfo);
+
+	for (i = 0; i < state->nshards; i++)
+	{
+		if (in_shard(state, &state->shards[i], slot, hash))
+			return i;
+	}
+
+	elog(ERROR, "group does not belong to any matrel shard owned by this process");
+
+	return -1;
+}
+
+/*
+ * get_tuple_shard
+ *
+ * Returns the index of the owned matrel shard that the given existing group was read from
+ */
+static int
+get_tuple_shard(ContQueryCombinerState *state, HeapTuple tup)
+{
+	int i;
+
+	for (i = 0; i < state->nshards; i++)
+	{
+		if (state->shards[i].relid == tup->t_tableOid)
+			return i;
+	}
+
+	elog(ERROR, "group does not belong to any matrel shard owned by this process");
+
+	return -1;
+}
+
+/*
+ * refresh_ttl_partitions
+ *
+ * Determines which TTL partitions of the matrel the groups in the incoming batch belong in. Partitions
+ * are created and dropped by the reaper, so they're looked up by name for each batch, and the cached
+ * lookup plans of the ones we already knew about are kept.
+ */
+static void
+refresh_ttl_partitions(ContQueryCombinerState *state)
+{
+	ContQuery *cq = state->base.query;
+	MatRelShard *shards = MemoryContextAllocZero(state->base.state_cxt,
+			sizeof(MatRelShard) * (tuplestore_tuple_count(state->batch) + 1));
+	char *matrel_name = get_rel_name(cq->matrelid);
+	Oid namespace = get_rel_namespace(cq->matrelid);
+	TupleTableSlot *slot = state->slot;
+	int nshards = 1;
+	int i;
+
+	shards[0] = state->shards[0];
+
+	tuplestore_rescan(state->batch);
+	foreach_tuple(slot, state->batch)
+	{
+		MatRelShard *shard;
+		int64 start;
+
+		if (!get_slot_ttl_partition(state, slot, &start))
+			continue;
+
+		for (i = 1; i < nshards; i++)
+		{
+			if (shards[i].start == start)
+				break;
+		}
+
+		if (i < nshards)
+			continue;
+
+		shard = &shards[nshards++];
+		shard->start = start;
+		if (matrel_name)
+			shard->relid = get_relname_relid(MatRelNameToTTLPartitionName(matrel_name, start), namespace);
+
+		if (!OidIsValid(shard->relid))
+			continue;
+
+		for (i = 1; i < state->nshards; i++)
+		{
+			if (state->shards[i].relid == shard->relid)
+			{
+				*shard = state->shards[i];
+				state->shards[i].plan_cache_cxt = NULL;
+				break;
+			}
+		}
+
+		if (!shard->plan_cache_cxt)
+			shard->plan_cache_cxt = AllocSetContextCreate(state->plan_cache_cxt, "CombinerTTLPartitionPlanCacheCxt",
+					ALLOCSET_DEFAULT_MINSIZE,
+					ALLOCSET_DEFAULT_INITSIZE,
+					ALLOCSET_DEFAULT_MAXSIZE);
+	}
+	tuplestore_rescan(state->batch);
+
+	for (i = 1; i < state->nshards; i++)
+	{
+		if (state->shards[i].plan_cache_cxt)
+			MemoryContextDelete(state->shards[i].plan_cache_cxt);
+	}
+
+	pfree(state->shards);
+	state->shards = shards;
+	state->nshards = nshards;
+}
+
 /*
  * get_values
  *
  * Given an incoming batch, returns a VALUES clause containing each tuple's
- * group columns that can be joined against with the matrel's existing groups.
+ * group columns that can be joined against with the given matrel shard's existing groups.
  */
 static List *
-get_values(ContQueryCombinerState *state)
+get_values(ContQueryCombinerState *state, MatRelShard *shard)
 {
 	TupleHashTable existing = state->existing;
 	TupleTableSlot *slot = state->slot;
@@ -196,7 +517,10 @@ get_values(ContQueryCombinerState *state)
 	 * the actual selectivity of the groups, which keeps the matrel index fast. The hash
 	 * was already generated by the worker when determining which combiner process to
 	 * send tuples to since we shard on groups.
+	 *
+	 * Each shard we own scans the batch separately, so start from its beginning.
 	 */
+	tuplestore_rescan(state->batch);
 	foreach_tuple(slot, state->batch)
 	{
 		Type typeinfo;
@@ -213,6 +537,13 @@ get_values(ContQueryCombinerState *state)
 			continue;
 		}
 
+		/* Groups that live in other shards are looked up separately */
+		if (!in_shard(state, shard, slot, state->group_hashes[pos]))
+		{
+			pos++;
+			continue;
+		}
+
 		typeinfo = typeidType(state->hashfunc->funcresulttype);
 		typ = (Form_pg_type) GETSTRUCT(typeinfo);
 
@@ -282,11 +613,11 @@ get_groups(ContQueryCombinerState *state, List *values, ParseState *ps)
 /*
  * get_cached_groups_plan
  *
- * Plans and caches the combiner's existing groups retrieval plan,
+ * Plans and caches the combiner's existing groups retrieval plan for the given matrel shard,
  * or simply returns the cached plan if it's still valid.
  */
 static PlannedStmt *
-get_cached_groups_plan(ContQueryCombinerState *state, List *values)
+get_cached_groups_plan(ContQueryCombinerState *state, MatRelShard *shard, List *values)
 {
 	MemoryContext old_cxt;
 	ParseState *ps;
@@ -297,21 +628,22 @@ get_cached_groups_plan(ContQueryCombinerState *state, List *values)
 	ResTarget *res;
 	A_Star *star;
 	ColumnRef *cref;
+	RangeVar *rv;
 	PlannedStmt *plan;
 
-	if (state->groups_plan != NULL &&
-			!TimestampDifferenceExceeds(state->last_groups_plan, GetCurrentTimestamp(), GROUPS_PLAN_LIFESPAN))
+	if (shard->groups_plan != NULL &&
+			!TimestampDifferenceExceeds(shard->last_groups_plan, GetCurrentTimestamp(), GROUPS_PLAN_LIFESPAN))
 	{
 		if (values)
-			set_values(state->groups_plan, values);
+			set_values(shard->groups_plan, values);
 
 		/* use a fresh copy of the plan, as it may be modified by the executor */
-		plan = copyObject(state->groups_plan);
+		plan = copyObject(shard->groups_plan);
 		return plan;
 	}
 
 	/* cache miss, plan the query */
-	MemoryContextReset(state->plan_cache_cxt);
+	MemoryContextReset(shard->plan_cache_cxt);
 
 	sel = makeNode(SelectStmt);
 	res = makeNode(ResTarget);
@@ -323,7 +655,11 @@ get_cached_groups_plan(ContQueryCombinerState *state, List *values)
 	sel->targetList = list_make1(res);
 
 	/* we can't use the matrel RangeVar here because the matre's schema may have changed */
-	sel->fromClause = list_make1(RelidGetRangeVar(state->base.query->matrelid));
+	rv = RelidGetRangeVar(shard->relid);
+
+	/* A TTL-partitioned matrel's partitions are looked up separately, so only read the matrel itself */
+	rv->inh = false;
+	sel->fromClause = list_make1(rv);
 
 	/* populate the ParseState's p_varnamespace member */
 	ps = make_parsestate(NULL);
@@ -346,9 +682,9 @@ get_cached_groups_plan(ContQueryCombinerState *state, List *values)
 
 	plan = GetGroupsLookupPlan(query);
 
-	old_cxt = MemoryContextSwitchTo(state->plan_cache_cxt);
-	state->groups_plan = copyObject(plan);
-	state->last_groups_plan = GetCurrentTimestamp();
+	old_cxt = MemoryContextSwitchTo(shard->plan_cache_cxt);
+	shard->groups_plan = copyObject(plan);
+	shard->last_groups_plan = GetCurrentTimestamp();
 	MemoryContextSwitchTo(old_cxt);
 
 	return plan;
@@ -391,59 +727,34 @@ hash_groups(ContQueryCombinerState *state)
 }
 
 /*
- * select_existing_groups
+ * lookup_existing_groups
  *
- * Adds all existing groups in the matrel to the combine input set
+ * Retrieves the given groups from a matrel shard into the existing groups hashtable
  */
 static void
-select_existing_groups(ContQueryCombinerState *state)
+lookup_existing_groups(ContQueryCombinerState *state, MatRelShard *shard, List *values)
 {
-	TupleHashTable existing = state->existing;
 	PlannedStmt *plan = NULL;
 	Portal portal = NULL;
 	DestReceiver *dest;
-	PhysicalTuple pt;
-	TupleTableSlot *slot = state->slot;
-	List *tups = NIL;
-	ListCell *lc;
-	List *values = NIL;
-	TupleHashTable batchgroups;
 	Relation matrel;
-	TupleHashIterator status;
-	TupleHashEntry entry;
 
-	if (state->isagg && state->ngroupatts > 0)
-	{
-		Assert(state->existing);
-
-		values = get_values(state);
-
-		/*
-		 * If we're grouping and there aren't any uncached values to look up,
-		 * there is no need to execute a query.
-		 */
-		if (!values)
-			goto finish;
-	}
-	else if (state->isagg && state->ngroupatts == 0)
+	/* The reaper may drop a TTL partition at any time, until we've locked it */
+	matrel = try_relation_open(shard->relid, RowShareLock);
+	if (!matrel)
 	{
-		/*
-		 * If we're not grouping on any columns, then there's only one row to look up
-		 * so we don't need to do a VALUES-matrel join. If it's already in existing, we're done
-		 */
-		if (state->existing->hashtab->members)
-			return;
+		Assert(state->base.query->ttl_partition);
+		shard->relid = InvalidOid;
+		return;
 	}
 
-	matrel = heap_open(state->base.query->matrelid, RowShareLock);
-
-	plan = get_cached_groups_plan(state, values);
+	plan = get_cached_groups_plan(state, shard, values);
 
 	/*
 	 * Group lookups should always be underneath a physical group lookup CustomScan
 	 */
 	Assert(IsA(plan->planTree, CustomScan));
-	SetPhysicalGroupLookupOutput(existing);
+	SetPhysicalGroupLookupOutput(state->existing);
 
 	/*
 	 * Now run the query that retrieves existing tuples to merge this merge request with.
@@ -479,8 +790,72 @@ select_existing_groups(ContQueryCombinerState *state)
 	PortalDrop(portal, false);
 
 	heap_close(matrel, NoLock);
+}
+
+/*
+ * select_existing_groups
+ *
+ * Adds all existing groups in the matrel to the combine input set
+ */
+static void
+select_existing_groups(ContQueryCombinerState *state)
+{
+	TupleHashTable existing = state->existing;
+	PhysicalTuple pt;
+	TupleTableSlot *slot = state->slot;
+	List *tups = NIL;
+	ListCell *lc;
+	TupleHashTable batchgroups;
+	TupleHashIterator status;
+	TupleHashEntry entry;
+	int i;
+
+	if (state->isagg && state->ngroupatts > 0)
+	{
+		uint32 nexisting;
+		int64 nlookups = 0;
+		TimestampTz start = 0;
+
+		Assert(state->existing);
+		nexisting = existing->hashtab->members;
+
+		if (TRACE_PIPELINEDB_COMBINER_LOOKUP_ENABLED())
+			start = GetCurrentTimestamp();
+
+		if (state->base.query->ttl_partition)
+			refresh_ttl_partitions(state);
+
+		/* Each shard we own is looked up separately, since it has its own lookup index */
+		for (i = 0; i < state->nshards; i++)
+		{
+			List *values = get_values(state, &state->shards[i]);
+
+			/*
+			 * If we're grouping and there aren't any uncached values to look up,
+			 * there is no need to execute a query.
+			 */
+			if (values)
+				lookup_existing_groups(state, &state->shards[i], values);
+			nlookups += list_length(values);
+		}
+
+		ContExplainCountGroupLookups(state->base.explain, tuplestore_tuple_count(state->batch), nlookups,
+				existing->hashtab->members - nexisting);
+		TRACE_PIPELINEDB_COMBINER_LOOKUP(state->base.query_id, tuplestore_tuple_count(state->batch), nlookups,
+				existing->hashtab->members - nexisting, start ? GetCurrentTimestamp() - start : -1);
+	}
+	else
+	{
+		/*
+		 * If we're not grouping on any columns, then there's only one row to look up
+		 * so we don't need to do a VALUES-matrel join. If it's already in existing, we're done
+		 */
+		if (state->isagg && state->existing->hashtab->members)
+			return;
+
+		lookup_existing_groups(state, &state->shards[0], NIL);
+	}
 
-finish:
 	batchgroups = hash_groups(state);
 	tuplestore_rescan(state->batch);
 	foreach_tuple(slot, state->batch)
@@ -610,49 +985,189 @@ project_overlay(ContQueryCombinerState *state, ExprContext *econtext, HeapTuple
 }
 
 /*
- * load_sw_matrel_groups
- *
- * Sync sliding-window matrel rows newer than the given timestamp
- * from disk into the local cache. If the cache already contains rows
- * covering the given timestamp, the matrel doesn't need to be scanned.
+ * mark_window_dirty
  */
 static void
-sync_sw_matrel_groups(ContQueryCombinerState *state, Relation matrel)
+mark_window_dirty(ContQueryCombinerState *state, WindowGroupEntry *wg)
 {
-	HeapTuple tup = NULL;
-	HeapScanDesc scan;
-	ScanKeyData skey[1];
-	TimestampTz oldest;
-	FunctionCallInfoData hashfcinfo;
-	FmgrInfo flinfo;
-	uint64 cv_name_hash = InvalidOid;
-	bool close_matrel = matrel == NULL;
-	Size size = 0;
-
-	/*
-	 * We only need to sync once, all other groups will be cached
-	 * from the combiner's output.
-	 */
-	if (state->sw->last_matrel_sync)
-		return;
+	MemoryContext old;
 
-	/* If a matrel didn't get passed to us, we need to lock one ourselves */
-	if (matrel == NULL)
-		matrel = try_relation_open(state->base.query->matrelid, AccessShareLock);
+	Assert(wg);
 
-	if (matrel == NULL)
+	if (wg->dirty)
 		return;
 
-	Assert(state->sw);
-	Assert(state->sw->arrival_ts_attr);
-	oldest = GetCurrentTimestamp() - (1000 * state->base.query->sw_interval_ms);
+	old = MemoryContextSwitchTo(state->sw->context);
+	state->sw->dirty_windows = lappend(state->sw->dirty_windows, wg);
+	MemoryContextSwitchTo(old);
 
-	/* We only need to scan for in-window rows */
-	ScanKeyInit(&skey[0],
-				state->sw->arrival_ts_attr,
-				BTGreaterEqualStrategyNumber, F_TIMESTAMP_GE, TimestampTzGetDatum(oldest));
+	wg->dirty = true;
+}
 
-	scan = heap_beginscan(matrel, GetTransactionSnapshot(), 1, skey);
+/*
+ * attach_step_tuple
+ *
+ * Adds a newly cached step tuple to the window group it belongs to
+ */
+static void
+attach_step_tuple(ContQueryCombinerState *state, OverlayTupleEntry *ot, TupleTableSlot *slot)
+{
+	TupleHashEntry entry;
+	WindowGroupEntry *wg;
+	MemoryContext old;
+	bool isnew;
+	bool isnull;
+
+	entry = LookupTupleHashEntry(state->sw->window_groups, slot, &isnew);
+	old = MemoryContextSwitchTo(state->sw->window_groups->tablecxt);
+
+	if (isnew)
+	{
+		wg = palloc0(sizeof(WindowGroupEntry));
+		wg->key = ExecCopySlotTuple(slot);
+		entry->additional = wg;
+	}
+
+	ot->step = DatumGetTimestampTz(slot_getattr(slot, state->sw->arrival_ts_attr, &isnull));
+	Assert(!isnull);
+	ot->stack = SW_STEP_OPEN;
+
+	wg = (WindowGroupEntry *) entry->additional;
+	wg->open = lappend(wg->open, ot);
+	ot->window = wg;
+
+	MemoryContextSwitchTo(old);
+
+	mark_window_dirty(state, wg);
+}
+
+/*
+ * step_tuple_changed
+ *
+ * Called when a cached step tuple has been combined into. If the step was already sealed, the window
+ * partials that include it are stale and must be rebuilt.
+ */
+static void
+step_tuple_changed(ContQueryCombinerState *state, OverlayTupleEntry *ot)
+{
+	Assert(ot->window);
+
+	if (ot->stack != SW_STEP_OPEN)
+		ot->window->rebuild = true;
+
+	mark_window_dirty(state, ot->window);
+}
+
+/*
+ * detach_step_tuple
+ *
+ * Removes an out-of-window step tuple from its window group. Since steps expire oldest first, this
+ * is usually the oldest front step, which we can just pop. Otherwise the window's partials must be rebuilt.
+ */
+static void
+detach_step_tuple(ContQueryCombinerState *state, OverlayTupleEntry *ot)
+{
+	WindowGroupEntry *wg = ot->window;
+	MemoryContext old;
+
+	Assert(wg && wg->dirty);
+	old = MemoryContextSwitchTo(state->sw->window_groups->tablecxt);
+
+	switch (ot->stack)
+	{
+		case SW_STEP_OPEN:
+			wg->open = list_delete_ptr(wg->open, ot);
+			break;
+		case SW_STEP_BACK:
+			wg->back = list_delete_ptr(wg->back, ot);
+			wg->rebuild = true;
+			break;
+		case SW_STEP_FRONT:
+			if (linitial(wg->front) == ot)
+				wg->front = list_delete_first(wg->front);
+			else
+			{
+				wg->front = list_delete_ptr(wg->front, ot);
+				wg->rebuild = true;
+			}
+			break;
+	}
+
+	MemoryContextSwitchTo(old);
+	ot->window = NULL;
+}
+
+/*
+ * get_overlay_window
+ *
+ * Get the window group that the overlay tuple in the given slot was computed from
+ */
+static WindowGroupEntry *
+get_overlay_window(ContQueryCombinerState *state, TupleTableSlot *slot)
+{
+	TupleTableSlot *key = state->sw->window_key_slot;
+	TupleHashEntry entry;
+	int i;
+
+	ExecClearTuple(key);
+	MemSet(key->tts_isnull, true, sizeof(bool) * key->tts_tupleDescriptor->natts);
+
+	for (i = 0; i < state->sw->nkeys; i++)
+	{
+		AttrNumber attno = state->sw->window_keys[i];
+		key->tts_values[attno - 1] = slot_getattr(slot, state->sw->overlay_keys[i], &key->tts_isnull[attno - 1]);
+	}
+
+	ExecStoreVirtualTuple(key);
+	entry = LookupTupleHashEntry(state->sw->window_groups, key, NULL);
+
+	return entry ? (WindowGroupEntry *) entry->additional : NULL;
+}
+
+/*
+ * load_sw_matrel_groups
+ *
+ * Sync sliding-window matrel rows newer than the given timestamp
+ * from disk into the local cache. If the cache already contains rows
+ * covering the given timestamp, the matrel doesn't need to be scanned.
+ */
+static void
+sync_sw_matrel_groups(ContQueryCombinerState *state, Relation matrel)
+{
+	HeapTuple tup = NULL;
+	HeapScanDesc scan;
+	ScanKeyData skey[1];
+	TimestampTz oldest;
+	FunctionCallInfoData hashfcinfo;
+	FmgrInfo flinfo;
+	uint64 cv_name_hash = InvalidOid;
+	bool close_matrel = matrel == NULL;
+	Size size = 0;
+
+	/*
+	 * We only need to sync once, all other groups will be cached
+	 * from the combiner's output.
+	 */
+	if (state->sw->last_matrel_sync)
+		return;
+
+	/* If a matrel didn't get passed to us, we need to lock one ourselves */
+	if (matrel == NULL)
+		matrel = try_relation_open(state->base.query->matrelid, AccessShareLock);
+
+	if (matrel == NULL)
+		return;
+
+	Assert(state->sw);
+	Assert(state->sw->arrival_ts_attr);
+	oldest = GetCurrentTimestamp() - (1000 * state->base.query->sw_interval_ms);
+
+	/* We only need to scan for in-window rows */
+	ScanKeyInit(&skey[0],
+				state->sw->arrival_ts_attr,
+				BTGreaterEqualStrategyNumber, F_TIMESTAMP_GE, TimestampTzGetDatum(oldest));
+
+	scan = heap_beginscan(matrel, GetTransactionSnapshot(), 1, skey);
 
 	if (state->hashfunc)
 	{
@@ -698,22 +1213,33 @@ sync_sw_matrel_groups(ContQueryCombinerState *state, Relation matrel)
 
 		entry = LookupTupleHashEntry(state->sw->step_groups, state->slot, &isnew);
 
-		if (!isnew)
-		{
-			Assert(entry->additional);
-			pfree(entry->additional);
-		}
-
 		size += state->sw->step_groups->entrysize + HEAPTUPLESIZE + tup->t_len;
 
 		if (size > continuous_query_combiner_work_mem)
 			elog(ERROR, "not enough continuous_query_combiner_work_mem to sync sliding-window groups");
 
-		old = MemoryContextSwitchTo(state->sw->step_groups->tablecxt);
-		ot = palloc0(sizeof(OverlayTupleEntry));
-		ot->base.tuple = heap_copytuple(tup);
-		entry->additional = ot;
-		MemoryContextSwitchTo(old);
+		if (isnew)
+		{
+			old = MemoryContextSwitchTo(state->sw->step_groups->tablecxt);
+			ot = palloc0(sizeof(OverlayTupleEntry));
+			ot->base.tuple = heap_copytuple(tup);
+			entry->additional = ot;
+			MemoryContextSwitchTo(old);
+
+			attach_step_tuple(state, ot, state->slot);
+		}
+		else
+		{
+			Assert(entry->additional);
+			ot = (OverlayTupleEntry *) entry->additional;
+
+			old = MemoryContextSwitchTo(state->sw->step_groups->tablecxt);
+			heap_freetuple(ot->base.tuple);
+			ot->base.tuple = heap_copytuple(tup);
+			MemoryContextSwitchTo(old);
+
+			step_tuple_changed(state, ot);
+		}
 
 		state->sw->last_matrel_sync = GetCurrentTimestamp();
 	}
@@ -724,12 +1250,129 @@ sync_sw_matrel_groups(ContQueryCombinerState *state, Relation matrel)
 		heap_close(matrel, AccessShareLock);
 }
 
+/*
+ * cmsketch_changed
+ */
+static bool
+cmsketch_changed(struct varlena *prev, struct varlena *new)
+{
+	return CountMinSketchStateChanged((CountMinSketch *) prev, (CountMinSketch *) new);
+}
+
+/*
+ * tdigest_changed
+ */
+static bool
+tdigest_changed(struct varlena *prev, struct varlena *new)
+{
+	return TDigestStateChanged((TDigest *) prev, (TDigest *) new);
+}
+
+/*
+ * fss_changed
+ */
+static bool
+fss_changed(struct varlena *prev, struct varlena *new)
+{
+	return FSSStateChanged((FSS *) prev, (FSS *) new);
+}
+
+/*
+ * get_changed_funcs
+ *
+ * The combine functions of some sketch types keep a running total in the state's header
+ * that only ever grows when something is merged in, which is much cheaper to compare than
+ * the entire state. We only use these for types that actually belong to this extension.
+ */
+static StateChangeDetector *
+get_changed_funcs(TupleDesc desc)
+{
+	StateChangeDetector *funcs = NULL;
+	Oid extoid = get_extension_oid(PIPELINEDB_EXTENSION_NAME, true);
+	int i;
+
+	if (!OidIsValid(extoid))
+		return NULL;
+
+	for (i = 0; i < desc->natts; i++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(desc, i);
+		StateChangedFunc func = NULL;
+		int32 header_len = 0;
+		HeapTuple tup;
+		char *typname;
+
+		if (attr->attisdropped || attr->attlen != -1)
+			continue;
+		if (getExtensionOfObject(TypeRelationId, attr->atttypid) != extoid)
+			continue;
+
+		tup = SearchSysCache1(TYPEOID, ObjectIdGetDatum(attr->atttypid));
+		if (!HeapTupleIsValid(tup))
+			elog(ERROR, "cache lookup failed for type %u", attr->atttypid);
+
+		typname = NameStr(((Form_pg_type) GETSTRUCT(tup))->typname);
+
+		if (!strcmp(typname, "cmsketch"))
+		{
+			func = cmsketch_changed;
+			header_len = offsetof(CountMinSketch, table);
+		}
+		else if (!strcmp(typname, "tdigest"))
+		{
+			func = tdigest_changed;
+			header_len = offsetof(TDigest, min);
+		}
+		else if (!strcmp(typname, "topk"))
+		{
+			func = fss_changed;
+			header_len = offsetof(FSS, typ);
+		}
+
+		ReleaseSysCache(tup);
+
+		if (!func)
+			continue;
+
+		if (!funcs)
+			funcs = palloc0(sizeof(StateChangeDetector) * desc->natts);
+		funcs[i].changed = func;
+		funcs[i].header_len = header_len;
+	}
+
+	return funcs;
+}
+
+/*
+ * get_state_header
+ *
+ * Returns a plain varlena holding at least the first header_len bytes of the given state. States read
+ * back from the matrel are usually toasted or have a short header, in which case only the slice that
+ * the change detector needs is detoasted.
+ */
+static struct varlena *
+get_state_header(Datum d, int32 header_len)
+{
+	struct varlena *v = (struct varlena *) DatumGetPointer(d);
+
+	if (!VARATT_IS_EXTENDED(v))
+		return v;
+
+	v = heap_tuple_untoast_attr_slice(v, 0, header_len - VARHDRSZ);
+
+	/* A truncated state can't be compared by its header */
+	if (VARSIZE(v) < header_len)
+		return NULL;
+
+	return v;
+}
+
 /*
  * compare_slots
  */
 static int
 compare_slots(TupleTableSlot *lslot, TupleTableSlot *rslot,
-		AttrNumber pk, bool *equal)
+		AttrNumber pk, bool *equal, StateChangeDetector *changed_funcs)
 {
 	AttrNumber att;
 	TupleDesc desc;
@@ -759,6 +1402,31 @@ compare_slots(TupleTableSlot *lslot, TupleTableSlot *rslot,
 		prev = slot_getattr(lslot, att, &prev_null);
 		new = slot_getattr(rslot, att, &new_null);
 
+		/*
+		 * Sketch states with a change detector don't need to be compared byte-by-byte. The detector
+		 * only reads the state's header, so that's all we detoast of toasted or compressed states.
+		 */
+		if (changed_funcs && changed_funcs[att - 1].changed && !prev_null && !new_null)
+		{
+			StateChangeDetector *detector = &changed_funcs[att - 1];
+			struct varlena *prev_header = get_state_header(prev, detector->header_len);
+			struct varlena *new_header = get_state_header(new, detector->header_len);
+
+			if (prev_header && new_header)
+			{
+				if (detector->changed(prev_header, new_header))
+					num_changed++;
+				else
+					equal[att - 1] = false;
+
+				if (prev_header != (struct varlena *) DatumGetPointer(prev))
+					pfree(prev_header);
+				if (new_header != (struct varlena *) DatumGetPointer(new))
+					pfree(new_header);
+				continue;
+			}
+		}
+
 		/*
 		 * Note that this equality check only does a byte-by-byte comparison, which may yield false
 		 * negatives. This is fine, because a false negative will just cause an extraneous write, which
@@ -774,46 +1442,494 @@ compare_slots(TupleTableSlot *lslot, TupleTableSlot *rslot,
 }
 
 /*
- * add_matrel_tuples_to_overlay_input
+ * sw_step_expired
+ */
+static inline bool
+sw_step_expired(ContQueryCombinerState *state, OverlayTupleEntry *ot, TimestampTz now)
+{
+	return (now - ot->step) / 1000 > state->base.query->sw_interval_ms;
+}
+
+/*
+ * expire_sw_step_tuples
  *
- * Add all existing cached matrel groups to the input of the overlay plan
- * we're about to execute. Note that we still add matrel rows that may
- * not have been modified by the most recent combine call, because their
- * corresponding values in the overlay output are dependent on the current
- * time.
+ * Find all cached step tuples that have fallen out of the window, and mark their window groups dirty.
+ * Front and back steps are ordered oldest first, so we only need to look at the oldest steps of each window.
  */
 static List *
-add_cached_sw_tuples_to_overlay_input(ContQueryCombinerState *state)
+expire_sw_step_tuples(ContQueryCombinerState *state)
 {
-	TupleHashEntry matrel_entry;
+	TupleHashEntry entry;
 	List *to_delete = NIL;
 	TupleHashIterator seq;
+	TimestampTz now = GetCurrentTimestamp();
 
-	InitTupleHashIterator(state->sw->step_groups, &seq);
-	while ((matrel_entry = ScanTupleHashTable(state->sw->step_groups, &seq)) != NULL)
+	InitTupleHashIterator(state->sw->window_groups, &seq);
+	while ((entry = ScanTupleHashTable(state->sw->window_groups, &seq)) != NULL)
+	{
+		WindowGroupEntry *wg = (WindowGroupEntry *) entry->additional;
+		List *expired = NIL;
+		ListCell *lc;
+		bool front_expired = true;
+
+		foreach(lc, wg->front)
+		{
+			OverlayTupleEntry *ot = (OverlayTupleEntry *) lfirst(lc);
+
+			if (!sw_step_expired(state, ot, now))
+			{
+				front_expired = false;
+				break;
+			}
+			expired = lappend(expired, ot);
+		}
+
+		if (front_expired)
+		{
+			foreach(lc, wg->back)
+			{
+				OverlayTupleEntry *ot = (OverlayTupleEntry *) lfirst(lc);
+
+				if (!sw_step_expired(state, ot, now))
+					break;
+				expired = lappend(expired, ot);
+			}
+		}
+
+		foreach(lc, wg->open)
+		{
+			OverlayTupleEntry *ot = (OverlayTupleEntry *) lfirst(lc);
+
+			if (sw_step_expired(state, ot, now))
+				expired = lappend(expired, ot);
+		}
+
+		if (expired)
+		{
+			mark_window_dirty(state, wg);
+			to_delete = list_concat(to_delete, expired);
+		}
+	}
+
+	return to_delete;
+}
+
+/*
+ * step_cmp
+ */
+static int
+step_cmp(const void *a, const void *b)
+{
+	OverlayTupleEntry *l = *(OverlayTupleEntry **) a;
+	OverlayTupleEntry *r = *(OverlayTupleEntry **) b;
+
+	if (l->step < r->step)
+		return -1;
+	if (l->step > r->step)
+		return 1;
+
+	return 0;
+}
+
+/*
+ * sort_steps
+ *
+ * Sort the given list of step tuples oldest first, freeing the input list
+ */
+static List *
+sort_steps(List *steps)
+{
+	OverlayTupleEntry **sorted;
+	List *result = NIL;
+	ListCell *lc;
+	int n = list_length(steps);
+	int i = 0;
+
+	if (n < 2)
+		return steps;
+
+	sorted = palloc(sizeof(OverlayTupleEntry *) * n);
+	foreach(lc, steps)
+		sorted[i++] = (OverlayTupleEntry *) lfirst(lc);
+
+	qsort(sorted, n, sizeof(OverlayTupleEntry *), step_cmp);
+
+	for (i = 0; i < n; i++)
+		result = lappend(result, sorted[i]);
+
+	list_free(steps);
+	pfree(sorted);
+
+	return result;
+}
+
+/*
+ * step_partial
+ *
+ * Front steps cover all newer front steps, other steps only cover themselves
+ */
+static inline HeapTuple
+step_partial(OverlayTupleEntry *ot)
+{
+	return ot->suffix ? ot->suffix : ot->base.tuple;
+}
+
+/*
+ * execute_sw_plan
+ *
+ * Execute one of the plans used to compute sliding-window values
+ */
+static void
+execute_sw_plan(PlannedStmt *pstmt, DestReceiver *dest, Tuplestorestate *output)
+{
+	QueryDesc *query_desc;
+
+	tuplestore_clear(output);
+	query_desc = CreateQueryDesc(pstmt,
+			NULL, InvalidSnapshot, InvalidSnapshot, dest, NULL, NULL, 0);
+	query_desc->estate = CreateEState(query_desc);
+
+	query_desc->planstate = ExecInitNode(pstmt->planTree, query_desc->estate, 0);
+	ExecuteContPlan(query_desc->estate, query_desc->planstate, false,
+			query_desc->operation,
+			true, 0, ForwardScanDirection, dest, true);
+	ExecEndNode(query_desc->planstate);
+
+	query_desc->planstate = NULL;
+	query_desc->estate = NULL;
+	tuplestore_rescan(output);
+}
+
+/*
+ * combine_sw_partials
+ *
+ * Combine each of the given lists of step tuples into a single tuple, all with one execution
+ * of the combine plan. Each list's tuples are tagged with the list's position in place of their
+ * step so that the plan groups them separately from every other list, and each result is then
+ * tagged with the newest step it covers so that it's considered in-window by the overlay plan.
+ */
+static HeapTuple *
+combine_sw_partials(ContQueryCombinerState *state, List *groups)
+{
+	int ngroups = list_length(groups);
+	int natts = state->desc->natts;
+	AttrNumber step_attr = state->sw->arrival_ts_attr;
+	HeapTuple *result = palloc0(sizeof(HeapTuple) * ngroups);
+	TimestampTz *newest = palloc0(sizeof(TimestampTz) * ngroups);
+	Datum *values = palloc0(sizeof(Datum) * natts);
+	bool *nulls = palloc0(sizeof(bool) * natts);
+	bool *replaces = palloc0(sizeof(bool) * natts);
+	MemoryContext old;
+	ListCell *lc;
+	int i = 0;
+
+	replaces[step_attr - 1] = true;
+
+	foreach(lc, groups)
+	{
+		List *group = (List *) lfirst(lc);
+		ListCell *tlc;
+
+		Assert(group);
+		foreach(tlc, group)
+		{
+			HeapTuple tup = (HeapTuple) lfirst(tlc);
+			HeapTuple tagged;
+			TimestampTz step;
+			bool isnull;
+
+			step = DatumGetTimestampTz(heap_getattr(tup, step_attr, state->desc, &isnull));
+			Assert(!isnull);
+			if (tlc == list_head(group) || step > newest[i])
+				newest[i] = step;
+
+			values[step_attr - 1] = TimestampTzGetDatum((TimestampTz) i);
+			tagged = heap_modify_tuple(tup, state->desc, values, nulls, replaces);
+			tuplestore_puttuple(state->sw->partial_input, tagged);
+			heap_freetuple(tagged);
+		}
+		i++;
+	}
+
+	execute_sw_plan(state->sw->partial_plan, state->sw->partial_dest, state->sw->partial_output);
+	tuplestore_clear(state->sw->partial_input);
+
+	old = MemoryContextSwitchTo(state->sw->step_groups->tablecxt);
+	foreach_tuple(state->slot, state->sw->partial_output)
 	{
-		Datum d;
 		bool isnull;
-		TimestampTz ts;
-		OverlayTupleEntry *ot = (OverlayTupleEntry *) matrel_entry->additional;
-		PhysicalTuple matrel_tup = &ot->base;
+		TimestampTz tag = DatumGetTimestampTz(slot_getattr(state->slot, step_attr, &isnull));
 
-		ExecStoreTuple(matrel_tup->tuple, state->slot, InvalidBuffer, false);
-		d = slot_getattr(state->slot, state->sw->arrival_ts_attr, &isnull);
-		ts = DatumGetTimestampTz(d);
 		Assert(!isnull);
+		Assert(tag >= 0 && tag < ngroups);
+
+		values[step_attr - 1] = TimestampTzGetDatum(newest[tag]);
+		result[tag] = heap_modify_tuple(ExecMaterializeSlot(state->slot), state->desc, values, nulls, replaces);
+	}
+	MemoryContextSwitchTo(old);
+	tuplestore_clear(state->sw->partial_output);
+
+	for (i = 0; i < ngroups; i++)
+	{
+		if (result[i] == NULL)
+			elog(ERROR, "failed to combine sliding-window partial %d of %d", i, ngroups);
+	}
+
+	pfree(newest);
+	pfree(values);
+	pfree(nulls);
+	pfree(replaces);
+
+	return result;
+}
+
+/*
+ * build_front_partials
+ *
+ * Compute each front step's suffix, which is the step combined with all newer front steps. Suffixes are
+ * computed as a parallel scan: after the round with offset d, each step covers the 2d steps starting at
+ * itself. Every round is a single execution of the combine plan over all of the given windows, so
+ * building k front steps takes log(k) executions.
+ */
+static void
+build_front_partials(ContQueryCombinerState *state, List *windows)
+{
+	int nwindows = list_length(windows);
+	OverlayTupleEntry ***fronts = palloc(sizeof(OverlayTupleEntry **) * nwindows);
+	int *lens = palloc(sizeof(int) * nwindows);
+	int maxlen = 0;
+	ListCell *lc;
+	int i = 0;
+	int d;
+
+	foreach(lc, windows)
+	{
+		WindowGroupEntry *wg = (WindowGroupEntry *) lfirst(lc);
+		ListCell *slc;
+		int j = 0;
+
+		lens[i] = list_length(wg->front);
+		fronts[i] = palloc(sizeof(OverlayTupleEntry *) * lens[i]);
+		foreach(slc, wg->front)
+			fronts[i][j++] = (OverlayTupleEntry *) lfirst(slc);
+
+		maxlen = Max(maxlen, lens[i]);
+		i++;
+	}
+
+	for (d = 1; d < maxlen; d *= 2)
+	{
+		List *groups = NIL;
+		HeapTuple *partials;
+		int n = 0;
+		int j;
 
-		if ((GetCurrentTimestamp() - ts) / 1000 > state->base.query->sw_interval_ms)
+		for (i = 0; i < nwindows; i++)
 		{
-			to_delete = lappend(to_delete, ot);
-			continue;
+			for (j = 0; j + d < lens[i]; j++)
+				groups = lappend(groups, list_make2(step_partial(fronts[i][j]), step_partial(fronts[i][j + d])));
+		}
+
+		partials = combine_sw_partials(state, groups);
+
+		for (i = 0; i < nwindows; i++)
+		{
+			for (j = 0; j + d < lens[i]; j++)
+			{
+				OverlayTupleEntry *ot = fronts[i][j];
+
+				if (ot->suffix)
+					heap_freetuple(ot->suffix);
+				ot->suffix = partials[n++];
+			}
 		}
 
-		tuplestore_puttuple(state->sw->overlay_input, matrel_tup->tuple);
+		foreach(lc, groups)
+			list_free((List *) lfirst(lc));
+		list_free(groups);
+		pfree(partials);
 	}
-	tuplestore_rescan(state->sw->overlay_input);
 
-	return to_delete;
+	for (i = 0; i < nwindows; i++)
+		pfree(fronts[i]);
+	pfree(fronts);
+	pfree(lens);
+}
+
+/*
+ * update_window_partials
+ *
+ * Each window group's step tuples are kept on two stacks so that its value can be computed from a
+ * constant number of tuples rather than from all of the steps in the window:
+ *
+ * - open steps may still be combined into, and are used as they are
+ * - back steps were sealed since the front was last built, and back_partial is their combination
+ * - front steps are the oldest steps, and the oldest one's suffix is the combination of all of them
+ *
+ * A step is sealed once the step after it has also ended. Expiring the oldest step just pops it off
+ * of the front. Once the front is empty and a back step expires, or a sealed step is combined into
+ * again, the front is rebuilt from all sealed steps. Each step is usually pushed onto the back once
+ * and moved to the front once before it expires, so a tick's cost is proportional to the number of
+ * dirty windows rather than the number of steps in them.
+ */
+static void
+update_window_partials(ContQueryCombinerState *state)
+{
+	TimestampTz now = GetCurrentTimestamp();
+	int64 seal_us = 2 * (int64) state->base.query->sw_step_ms * 1000;
+	MemoryContext cxt = state->sw->window_groups->tablecxt;
+	List *pushed = NIL;
+	List *groups = NIL;
+	List *rebuilt = NIL;
+	ListCell *lc;
+
+	foreach(lc, state->sw->dirty_windows)
+	{
+		WindowGroupEntry *wg = (WindowGroupEntry *) lfirst(lc);
+		List *open = NIL;
+		List *sealed = NIL;
+		ListCell *slc;
+		MemoryContext old;
+
+		old = MemoryContextSwitchTo(cxt);
+
+		foreach(slc, wg->open)
+		{
+			OverlayTupleEntry *ot = (OverlayTupleEntry *) lfirst(slc);
+
+			if (now - ot->step >= seal_us)
+				sealed = lappend(sealed, ot);
+			else
+				open = lappend(open, ot);
+		}
+
+		list_free(wg->open);
+		wg->open = open;
+		sealed = sort_steps(sealed);
+
+		/* Sealed steps can only be pushed onto the back if they're newer than every step already on it */
+		if (sealed && !wg->rebuild)
+		{
+			List *stack = wg->back ? wg->back : wg->front;
+
+			if (stack && ((OverlayTupleEntry *) linitial(sealed))->step <= ((OverlayTupleEntry *) llast(stack))->step)
+				wg->rebuild = true;
+		}
+
+		if (wg->rebuild)
+		{
+			wg->front = sort_steps(list_concat(list_concat(wg->front, wg->back), sealed));
+			wg->back = NIL;
+
+			if (wg->back_partial)
+				heap_freetuple(wg->back_partial);
+			wg->back_partial = NULL;
+
+			foreach(slc, wg->front)
+			{
+				OverlayTupleEntry *ot = (OverlayTupleEntry *) lfirst(slc);
+
+				ot->stack = SW_STEP_FRONT;
+				if (ot->suffix)
+					heap_freetuple(ot->suffix);
+				ot->suffix = NULL;
+			}
+
+			wg->rebuild = false;
+			MemoryContextSwitchTo(old);
+
+			if (list_length(wg->front) > 1)
+				rebuilt = lappend(rebuilt, wg);
+		}
+		else if (sealed)
+		{
+			List *group = NIL;
+
+			MemoryContextSwitchTo(old);
+
+			if (wg->back_partial)
+				group = lappend(group, wg->back_partial);
+			foreach(slc, sealed)
+			{
+				OverlayTupleEntry *ot = (OverlayTupleEntry *) lfirst(slc);
+
+				ot->stack = SW_STEP_BACK;
+				group = lappend(group, ot->base.tuple);
+			}
+
+			pushed = lappend(pushed, wg);
+			groups = lappend(groups, group);
+
+			MemoryContextSwitchTo(cxt);
+			wg->back = list_concat(wg->back, sealed);
+			MemoryContextSwitchTo(old);
+		}
+		else
+		{
+			MemoryContextSwitchTo(old);
+		}
+	}
+
+	if (pushed)
+	{
+		HeapTuple *partials = combine_sw_partials(state, groups);
+		int i = 0;
+
+		foreach(lc, pushed)
+		{
+			WindowGroupEntry *wg = (WindowGroupEntry *) lfirst(lc);
+
+			if (wg->back_partial)
+				heap_freetuple(wg->back_partial);
+			wg->back_partial = partials[i++];
+		}
+
+		foreach(lc, groups)
+			list_free((List *) lfirst(lc));
+		list_free(groups);
+		list_free(pushed);
+		pfree(partials);
+	}
+
+	if (rebuilt)
+	{
+		build_front_partials(state, rebuilt);
+		list_free(rebuilt);
+	}
+}
+
+/*
+ * add_dirty_sw_tuples_to_overlay_input
+ *
+ * Add the partials of all dirty window groups to the input of the overlay plan we're about to
+ * execute. Window groups that haven't changed since the last tick would produce the same overlay
+ * output as before, so we don't need to recompute them.
+ */
+static void
+add_dirty_sw_tuples_to_overlay_input(ContQueryCombinerState *state)
+{
+	ListCell *lc;
+
+	foreach(lc, state->sw->dirty_windows)
+	{
+		WindowGroupEntry *wg = (WindowGroupEntry *) lfirst(lc);
+		ListCell *slc;
+
+		Assert(!wg->rebuild);
+
+		if (wg->front)
+			tuplestore_puttuple(state->sw->overlay_input, step_partial((OverlayTupleEntry *) linitial(wg->front)));
+		if (wg->back_partial)
+			tuplestore_puttuple(state->sw->overlay_input, wg->back_partial);
+
+		foreach(slc, wg->open)
+		{
+			OverlayTupleEntry *ot = (OverlayTupleEntry *) lfirst(slc);
+			tuplestore_puttuple(state->sw->overlay_input, ot->base.tuple);
+		}
+	}
+
+	tuplestore_rescan(state->sw->overlay_input);
 }
 
 /*
@@ -849,6 +1965,8 @@ destroy_overlay_tuple_entry(OverlayTupleEntry *ot)
 {
 	Assert(ot);
 	pfree(ot->base.tuple);
+	if (ot->suffix)
+		heap_freetuple(ot->suffix);
 	pfree(ot);
 }
 
@@ -881,72 +1999,120 @@ gc_cached_matrel_tuples(ContQueryCombinerState *state, List *expired)
 #endif
 
 		Assert(removed);
+		detach_step_tuple(state, ot);
 		destroy_overlay_tuple_entry(ot);
 	}
 }
 
 /*
- * gc_cached_overlay_tuples
+ * expire_overlay_tuple
  *
- * GC any out-of-window tuples in the overlay cache. We indicate an
- * out-of-window tuple in the output stream by writing a null new tuple:
+ * Remove the given window group's cached overlay tuple. We indicate an out-of-window
+ * tuple in the output stream by writing a null new tuple:
  *
  * INSERT INTO osrel (old, new) VALUES (<old tuple>, <null>)
  */
 static void
-gc_cached_overlay_tuples(ContQueryCombinerState *state,
-		TimestampTz this_tick, ResultRelInfo *osri)
+expire_overlay_tuple(ContQueryCombinerState *state, WindowGroupEntry *wg, ResultRelInfo *osri)
 {
-	TupleHashEntry entry;
-	List *to_delete = NIL;
-	ListCell *lc;
-	TupleHashIterator seq;
+	OverlayTupleEntry *overlay_entry = wg->overlay;
+	Datum values[4];
+	bool nulls[4];
+	HeapTuple tup;
+	HeapTuple os_tup;
+#ifdef USE_ASSERT_CHECKING
+	bool removed;
+#endif
 
-	InitTupleHashIterator(state->sw->overlay_groups, &seq);
-	while ((entry = (TupleHashEntry) ScanTupleHashTable(state->sw->overlay_groups, &seq)) != NULL)
-	{
-		Datum values[4];
-		bool nulls[4];
-		HeapTuple tup;
-		HeapTuple os_tup;
-		OverlayTupleEntry *overlay_entry = (OverlayTupleEntry *) entry->additional;
+	Assert(overlay_entry);
+	tup = overlay_entry->base.tuple;
 
-		if (overlay_entry->last_touched == this_tick)
-			continue;
+	MemSet(nulls, false, sizeof(nulls));
 
-		tup = overlay_entry->base.tuple;
-		to_delete = lappend(to_delete, overlay_entry);
+	nulls[state->output_stream_arrival_ts - 1] = true;
+	nulls[NEW_TUPLE] = true;
+	values[NEW_TUPLE] = (Datum) 0;
+	values[OLD_TUPLE] = heap_copy_tuple_as_datum(tup, state->overlay_desc);
 
-		MemSet(nulls, false, sizeof(nulls));
+	os_tup = heap_form_tuple(state->os_slot->tts_tupleDescriptor, values, nulls);
+	ExecStoreTuple(os_tup, state->os_slot, InvalidBuffer, false);
+	ExecStreamInsert(NULL, osri, state->os_slot, NULL);
 
-		nulls[state->output_stream_arrival_ts - 1] = true;
-		nulls[NEW_TUPLE] = true;
-		values[NEW_TUPLE] = (Datum) 0;
-		values[OLD_TUPLE] = heap_copy_tuple_as_datum(tup, state->overlay_desc);
+	ExecStoreTuple(tup, state->overlay_slot, InvalidBuffer, false);
+#ifdef USE_ASSERT_CHECKING
+	removed = tuplehash_remove(state->sw->overlay_groups, state->overlay_slot);
+#else
+	tuplehash_remove(state->sw->overlay_groups, state->overlay_slot);
+#endif
 
-		os_tup = heap_form_tuple(state->os_slot->tts_tupleDescriptor, values, nulls);
-		ExecStoreTuple(os_tup, state->os_slot, InvalidBuffer, false);
-		ExecStreamInsert(NULL, osri, state->os_slot, NULL);
+	Assert(removed);
+	destroy_overlay_tuple_entry(overlay_entry);
+	wg->overlay = NULL;
+}
+
+/*
+ * gc_cached_overlay_tuples
+ *
+ * GC any cached overlay tuples of dirty window groups that weren't recomputed by this tick,
+ * which means that they no longer have any in-window step tuples (or are filtered out by HAVING).
+ */
+static void
+gc_cached_overlay_tuples(ContQueryCombinerState *state,
+		TimestampTz this_tick, ResultRelInfo *osri)
+{
+	ListCell *lc;
+
+	foreach(lc, state->sw->dirty_windows)
+	{
+		WindowGroupEntry *wg = (WindowGroupEntry *) lfirst(lc);
+
+		if (wg->overlay && wg->overlay->last_touched != this_tick)
+			expire_overlay_tuple(state, wg, osri);
 	}
+}
+
+/*
+ * clean_dirty_windows
+ *
+ * Reset the dirty window list after a tick, removing any window groups that no longer have in-window
+ * step tuples. A window group is never removed while it still has a cached overlay tuple, since nothing
+ * would ever GC that tuple afterwards.
+ */
+static void
+clean_dirty_windows(ContQueryCombinerState *state, ResultRelInfo *osri)
+{
+	ListCell *lc;
 
-	foreach(lc, to_delete)
+	foreach(lc, state->sw->dirty_windows)
 	{
-		OverlayTupleEntry *ot = (OverlayTupleEntry *) lfirst(lc);
-		HeapTuple tup = ot->base.tuple;
+		WindowGroupEntry *wg = (WindowGroupEntry *) lfirst(lc);
 #ifdef USE_ASSERT_CHECKING
 		bool removed;
 #endif
 
-		ExecStoreTuple(tup, state->overlay_slot, InvalidBuffer, false);
+		wg->dirty = false;
+
+		if (wg->open || wg->back || wg->front)
+			continue;
+
+		if (wg->overlay)
+			expire_overlay_tuple(state, wg, osri);
+
+		ExecStoreTuple(wg->key, state->slot, InvalidBuffer, false);
 #ifdef USE_ASSERT_CHECKING
-		removed = tuplehash_remove(state->sw->overlay_groups, state->overlay_slot);
+		removed = tuplehash_remove(state->sw->window_groups, state->slot);
 #else
-		tuplehash_remove(state->sw->overlay_groups, state->overlay_slot);
+		tuplehash_remove(state->sw->window_groups, state->slot);
 #endif
 
 		Assert(removed);
-		destroy_overlay_tuple_entry(ot);
+		Assert(!wg->back_partial);
+		heap_freetuple(wg->key);
+		pfree(wg);
 	}
+
+	list_free(state->sw->dirty_windows);
+	state->sw->dirty_windows = NIL;
 }
 
 /*
@@ -957,28 +2123,11 @@ gc_cached_overlay_tuples(ContQueryCombinerState *state,
 static void
 execute_sw_overlay_plan(ContQueryCombinerState *state)
 {
-	QueryDesc *query_desc;
-	struct Plan *plan;
-
 	Assert(state->sw);
 	Assert(state->sw->overlay_plan);
 	Assert(state->sw->overlay_dest);
 
-	tuplestore_clear(state->sw->overlay_output);
-	query_desc = CreateQueryDesc(state->sw->overlay_plan,
-			NULL, InvalidSnapshot, InvalidSnapshot, state->sw->overlay_dest, NULL, NULL, 0);
-	query_desc->estate = CreateEState(query_desc);
-
-	plan = state->sw->overlay_plan->planTree;
-	query_desc->planstate = ExecInitNode(plan, query_desc->estate, 0);
-	ExecuteContPlan(query_desc->estate, query_desc->planstate, false,
-			query_desc->operation,
-			true, 0, ForwardScanDirection, state->sw->overlay_dest, true);
-	ExecEndNode(query_desc->planstate);
-
-	query_desc->planstate = NULL;
-	query_desc->estate = NULL;
-	tuplestore_rescan(state->sw->overlay_output);
+	execute_sw_plan(state->sw->overlay_plan, state->sw->overlay_dest, state->sw->overlay_output);
 }
 
 /*
@@ -1034,10 +2183,28 @@ tick_sw_groups(ContQueryCombinerState *state, Relation matrel, bool force)
 	sync_sw_matrel_groups(state, matrel);
 
 	/*
-	 * Compute instantaneous sliding-window values
+	 * Expire out-of-window step tuples, which dirties the windows they belonged to
 	 */
-	to_delete = add_cached_sw_tuples_to_overlay_input(state);
+	to_delete = expire_sw_step_tuples(state);
 	gc_cached_matrel_tuples(state, to_delete);
+
+	/*
+	 * If no window has changed since the last tick, all cached overlay values are still current
+	 */
+	if (state->sw->dirty_windows == NIL)
+	{
+		EndStreamModify(NULL, osri);
+		CQOSRelClose(osri);
+		heap_close(osrel, RowExclusiveLock);
+		state->sw->last_tick = GetCurrentTimestamp();
+		return;
+	}
+
+	/*
+	 * Compute instantaneous sliding-window values for dirty windows only, from their partials
+	 */
+	update_window_partials(state);
+	add_dirty_sw_tuples_to_overlay_input(state);
 	execute_sw_overlay_plan(state);
 
 	/*
@@ -1056,6 +2223,7 @@ tick_sw_groups(ContQueryCombinerState *state, Relation matrel, bool force)
 		MemoryContext old;
 		TupleHashEntry entry;
 		OverlayTupleEntry *overlay_entry = NULL;
+		WindowGroupEntry *wg;
 
 		Assert(!TupIsNull(state->overlay_slot));
 		entry = (TupleHashEntry) LookupTupleHashEntry(state->sw->overlay_groups, state->overlay_slot, &isnew);
@@ -1075,6 +2243,14 @@ tick_sw_groups(ContQueryCombinerState *state, Relation matrel, bool force)
 		overlay_entry = (OverlayTupleEntry *) entry->additional;
 		overlay_entry->last_touched = this_tick;
 
+		/* Link the overlay tuple to its window so it can be expired along with it */
+		wg = get_overlay_window(state, state->overlay_slot);
+		if (wg == NULL)
+			elog(ERROR, "sliding-window overlay tuple has no window group");
+
+		wg->overlay = overlay_entry;
+		overlay_entry->window = wg;
+
 		if (!isnew)
 		{
 			MemSet(replaces, false, sizeof(replaces));
@@ -1084,7 +2260,7 @@ tick_sw_groups(ContQueryCombinerState *state, Relation matrel, bool force)
 			 * Similarly to how we don't sync unchanged tuples to disk when combining,
 			 * we don't write unchanged tuples to output streams.
 			 */
-			if (!compare_slots(state->overlay_slot, state->overlay_prev_slot, state->pk, replaces))
+			if (!compare_slots(state->overlay_slot, state->overlay_prev_slot, state->pk, replaces, NULL))
 				continue;
 
 			old_tup = overlay_entry->base.tuple;
@@ -1121,6 +2297,7 @@ tick_sw_groups(ContQueryCombinerState *state, Relation matrel, bool force)
 	 * Expire any out-of-window tuples in the overlay cache
 	 */
 	gc_cached_overlay_tuples(state, this_tick, osri);
+	clean_dirty_windows(state, osri);
 
 	/* Done, cleanup */
 	EndStreamModify(NULL, osri);
@@ -1238,6 +2415,21 @@ init_sw_state(ContQueryCombinerState *state, Relation matrel)
 	state->sw->overlay_dest = CreateDestReceiver(DestTuplestore);
 	SetTuplestoreDestReceiverParams(state->sw->overlay_dest, state->sw->overlay_output, state->sw->context, true);
 
+	/*
+	 * Window partials are computed by the combine plan, but it gets its own copy reading from
+	 * its own tuplestore so that computing them never touches the combiner's batch.
+	 */
+	old = MemoryContextSwitchTo(state->sw->context);
+	state->sw->partial_input = tuplestore_begin_heap(true, true, work_mem);
+	state->sw->partial_output = tuplestore_begin_heap(true, true, work_mem);
+	MemoryContextSwitchTo(old);
+
+	state->sw->partial_plan = copyObject(state->combine_plan);
+	SetCombinerPlanTuplestorestate(state->sw->partial_plan, state->sw->partial_input);
+
+	state->sw->partial_dest = CreateDestReceiver(DestTuplestore);
+	SetTuplestoreDestReceiverParams(state->sw->partial_dest, state->sw->partial_output, state->sw->context, true);
+
 	if (IsA(state->sw->overlay_plan->planTree, Agg))
 	{
 		Agg *agg = (Agg *) state->sw->overlay_plan->planTree;
@@ -1263,6 +2455,29 @@ init_sw_state(ContQueryCombinerState *state, Relation matrel)
 	CompatExecTuplesHashPrepare(n_group_attr, group_ops, &eq_funcs, &hash_funcs);
 	state->sw->overlay_groups = CompatBuildTupleHashTable(state->overlay_desc, n_group_attr,
 			group_idx, eq_funcs, hash_funcs, 1000, sizeof(OverlayTupleEntry), CurrentMemoryContext, tmp_cxt, false);
+
+	/*
+	 * Window groups are keyed by the overlay plan's grouping columns as they appear in the matrel,
+	 * so step tuples can be looked up directly and overlay tuples can be mapped back to them.
+	 */
+	state->sw->nkeys = n_group_attr;
+	state->sw->overlay_keys = group_idx;
+	if (n_group_attr)
+	{
+		Agg *agg = (Agg *) state->sw->overlay_plan->planTree;
+
+		state->sw->window_keys = palloc0(sizeof(AttrNumber) * n_group_attr);
+		memcpy(state->sw->window_keys, agg->grpColIdx, sizeof(AttrNumber) * n_group_attr);
+	}
+
+	tmp_cxt = AllocSetContextCreate(CurrentMemoryContext, "SWWindowGroupsTmpCxt",
+				ALLOCSET_DEFAULT_MINSIZE,
+				ALLOCSET_DEFAULT_INITSIZE,
+				ALLOCSET_DEFAULT_MAXSIZE);
+
+	state->sw->window_key_slot = MakeSingleTupleTableSlot(state->desc);
+	state->sw->window_groups = CompatBuildTupleHashTable(state->desc, n_group_attr,
+			state->sw->window_keys, eq_funcs, hash_funcs, 1000, sizeof(WindowGroupEntry), CurrentMemoryContext, tmp_cxt, false);
 }
 
 /*
@@ -1308,6 +2523,11 @@ project_sw_overlay_into_ostream(ContQueryCombinerState *state, Relation matrel)
 		old = MemoryContextSwitchTo(state->sw->step_groups->tablecxt);
 		ot->base.tuple = ExecCopySlotTuple(state->slot);
 		MemoryContextSwitchTo(old);
+
+		if (isnew)
+			attach_step_tuple(state, ot, state->slot);
+		else
+			step_tuple_changed(state, ot);
 	}
 
 	/* Force a tick */
@@ -1354,6 +2574,9 @@ combine(ContQueryCombinerState *state, bool lookup)
 	dest = CreateDestReceiver(DestTuplestore);
 	SetTuplestoreDestReceiverParams(dest, state->combined, state->combine_cxt, false);
 
+	/* instrument the combine plan if this CV is being sampled by EXPLAIN (CONTINUOUS, ANALYZE) */
+	ContExplainSetActive(state->base.explain, state->combine_plan);
+
 	PortalStart(portal, NULL, 0, NULL);
 
 	(void) PortalRun(portal,
@@ -1364,32 +2587,446 @@ combine(ContQueryCombinerState *state, bool lookup)
 					 dest,
 					 NULL);
 
-	PortalDrop(portal, false);
-	tuplestore_clear(state->batch);
+	PortalDrop(portal, false);
+	ContExplainSetActive(NULL, NULL);
+
+	tuplestore_clear(state->batch);
+}
+
+/*
+ * set_group_hash
+ *
+ * Set the group hash at the given index, increasing the size of the group hashes array if necessary
+ */
+static void
+set_group_hash(ContQueryCombinerState *state, int index, int64 hash)
+{
+	int start = state->group_hashes_len;
+
+	while (index >= state->group_hashes_len)
+		state->group_hashes_len *= 2;
+
+	if (start != state->group_hashes_len)
+	{
+		MemoryContext old = MemoryContextSwitchTo(state->base.state_cxt);
+		state->group_hashes = repalloc(state->group_hashes, state->group_hashes_len * sizeof(int64));
+		MemoryContextSwitchTo(old);
+	}
+
+	Assert(index < state->group_hashes_len);
+	state->group_hashes[index] = hash;
+}
+
+/*
+ * topn_compare
+ */
+static int
+topn_compare(ContQueryCombinerState *state, Datum a, Datum b)
+{
+	return DatumGetInt32(FunctionCall2Coll(state->topn_cmp, state->topn_collation, a, b));
+}
+
+/*
+ * topn_swap
+ */
+static void
+topn_swap(ContQueryCombinerState *state, int i, int j)
+{
+	TopNEntry tmp = state->topn[i];
+
+	state->topn[i] = state->topn[j];
+	state->topn[j] = tmp;
+}
+
+/*
+ * topn_sift_up
+ */
+static void
+topn_sift_up(ContQueryCombinerState *state, int i)
+{
+	while (i > 0)
+	{
+		int parent = (i - 1) / 2;
+
+		if (topn_compare(state, state->topn[i].value, state->topn[parent].value) >= 0)
+			break;
+
+		topn_swap(state, i, parent);
+		i = parent;
+	}
+}
+
+/*
+ * topn_sift_down
+ */
+static void
+topn_sift_down(ContQueryCombinerState *state, int i)
+{
+	for (;;)
+	{
+		int min = i;
+		int left = 2 * i + 1;
+		int right = left + 1;
+
+		if (left < state->ntopn && topn_compare(state, state->topn[left].value, state->topn[min].value) < 0)
+			min = left;
+		if (right < state->ntopn && topn_compare(state, state->topn[right].value, state->topn[min].value) < 0)
+			min = right;
+
+		if (min == i)
+			break;
+
+		topn_swap(state, i, min);
+		i = min;
+	}
+}
+
+/*
+ * topn_set_entry
+ *
+ * Copy a group into the top-N memory context, releasing whatever the entry held before
+ */
+static void
+topn_set_entry(ContQueryCombinerState *state, TopNEntry *entry, Datum pk, Datum value, Datum row)
+{
+	Form_pg_attribute pkattr = TupleDescAttr(state->desc, state->pk - 1);
+	Form_pg_attribute valattr = TupleDescAttr(state->overlay_desc, state->base.query->topn_attno - 1);
+	MemoryContext old = MemoryContextSwitchTo(state->topn_cxt);
+
+	if (!pkattr->attbyval && DatumGetPointer(entry->pk))
+		pfree(DatumGetPointer(entry->pk));
+	if (!valattr->attbyval && DatumGetPointer(entry->value))
+		pfree(DatumGetPointer(entry->value));
+	if (DatumGetPointer(entry->row))
+		pfree(DatumGetPointer(entry->row));
+
+	entry->pk = datumCopy(pk, pkattr->attbyval, pkattr->attlen);
+	entry->value = datumCopy(value, valattr->attbyval, valattr->attlen);
+	entry->row = datumCopy(row, false, -1);
+
+	MemoryContextSwitchTo(old);
+}
+
+/*
+ * topn_offer
+ *
+ * Offer a group's latest value to the top-N heap, returning whether the heap changed. The heap's
+ * root is always the smallest of the current top-N, so a group that isn't already in a full heap
+ * only gets in by evicting it.
+ */
+static bool
+topn_offer(ContQueryCombinerState *state, Datum pk, Datum value, Datum row)
+{
+	int i;
+
+	for (i = 0; i < state->ntopn; i++)
+	{
+		if (DatumGetInt32(FunctionCall2Coll(state->topn_pk_cmp, state->topn_pk_collation, pk, state->topn[i].pk)) == 0)
+			break;
+	}
+
+	if (i < state->ntopn)
+	{
+		bool grew = topn_compare(state, value, state->topn[i].value) > 0;
+
+		topn_set_entry(state, &state->topn[i], pk, value, row);
+		if (grew)
+			topn_sift_down(state, i);
+		else
+			topn_sift_up(state, i);
+	}
+	else if (state->ntopn < state->base.query->topn)
+	{
+		i = state->ntopn++;
+		topn_set_entry(state, &state->topn[i], pk, value, row);
+		topn_sift_up(state, i);
+	}
+	else if (topn_compare(state, value, state->topn[0].value) > 0)
+	{
+		topn_set_entry(state, &state->topn[0], pk, value, row);
+		topn_sift_down(state, 0);
+	}
+	else
+	{
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * update_topn
+ *
+ * Offer a group that was just written to the matrel to the top-N heap, given its overlay row
+ */
+static void
+update_topn(ContQueryCombinerState *state, HeapTuple tup, Datum row)
+{
+	Datum value;
+	Datum pk;
+	bool isnull;
+
+	/* Groups without a value to rank them by can't be in the top-N */
+	value = GetAttributeByNum(DatumGetHeapTupleHeader(row), state->base.query->topn_attno, &isnull);
+	if (isnull)
+		return;
+
+	pk = heap_getattr(tup, state->pk, state->desc, &isnull);
+	Assert(!isnull);
+
+	if (topn_offer(state, pk, value, row))
+		state->topn_dirty = true;
+}
+
+/*
+ * reset_topn
+ */
+static void
+reset_topn(ContQueryCombinerState *state)
+{
+	MemoryContextReset(state->topn_cxt);
+	state->topn = MemoryContextAllocZero(state->topn_cxt, sizeof(TopNEntry) * state->base.query->topn);
+	state->ntopn = 0;
+}
+
+/*
+ * open_topn
+ *
+ * Open the top-N relation for a sync. If it's been truncated since we last saw it, the groups
+ * we're holding were truncated along with it, so start over from an empty heap.
+ */
+static Relation
+open_topn(ContQueryCombinerState *state)
+{
+	Relation rel = try_relation_open(state->topn_relid, RowExclusiveLock);
+
+	if (rel == NULL)
+		return NULL;
+
+	if (rel->rd_node.relNode != state->topn_relfilenode)
+	{
+		reset_topn(state);
+		state->topn_relfilenode = rel->rd_node.relNode;
+	}
+
+	return rel;
+}
+
+/*
+ * sync_topn
+ *
+ * Replace the rows this combiner last wrote to the top-N relation with its current heap
+ */
+static void
+sync_topn(ContQueryCombinerState *state, Relation rel)
+{
+	TupleDesc desc = RelationGetDescr(rel);
+	ScanKeyData skey[1];
+	HeapScanDesc scan;
+	HeapTuple tup;
+	int i;
+
+	ScanKeyInit(&skey[0],
+				Anum_topn_combiner,
+				BTEqualStrategyNumber, F_INT4EQ, Int32GetDatum(MyContQueryProc->group_id));
+
+	scan = heap_beginscan(rel, GetTransactionSnapshot(), 1, skey);
+	while ((tup = heap_getnext(scan, ForwardScanDirection)) != NULL)
+		simple_heap_delete(rel, &tup->t_self);
+	heap_endscan(scan);
+
+	for (i = 0; i < state->ntopn; i++)
+	{
+		Datum values[Natts_topn];
+		bool nulls[Natts_topn];
+
+		MemSet(nulls, false, sizeof(nulls));
+		values[Anum_topn_combiner - 1] = Int32GetDatum(MyContQueryProc->group_id);
+		values[Anum_topn_pk - 1] = state->topn[i].pk;
+		values[Anum_topn_value - 1] = state->topn[i].value;
+		values[Anum_topn_row - 1] = state->topn[i].row;
+
+		simple_heap_insert(rel, heap_form_tuple(desc, values, nulls));
+	}
+
+	/* The next sync may happen in this same transaction, and it must see what we just wrote */
+	CommandCounterIncrement();
+	state->topn_dirty = false;
+}
+
+/*
+ * init_topn
+ *
+ * Load the top-N groups this combiner last wrote out, so that its heap survives restarts
+ */
+static void
+init_topn(ContQueryCombinerState *state)
+{
+	ContQuery *cq = state->base.query;
+	Form_pg_attribute attr;
+	TypeCacheEntry *typ;
+	Relation rel;
+	HeapScanDesc scan;
+	HeapTuple tup;
+
+	state->topn_cxt = AllocSetContextCreate(state->base.state_cxt, "CombinerTopNCxt",
+			ALLOCSET_DEFAULT_MINSIZE,
+			ALLOCSET_DEFAULT_INITSIZE,
+			ALLOCSET_DEFAULT_MAXSIZE);
+	reset_topn(state);
+
+	attr = TupleDescAttr(state->overlay_desc, cq->topn_attno - 1);
+	typ = lookup_type_cache(attr->atttypid, TYPECACHE_CMP_PROC_FINFO);
+	state->topn_cmp = &typ->cmp_proc_finfo;
+	state->topn_collation = attr->attcollation;
+
+	attr = TupleDescAttr(state->desc, state->pk - 1);
+	typ = lookup_type_cache(attr->atttypid, TYPECACHE_CMP_PROC_FINFO);
+	state->topn_pk_cmp = &typ->cmp_proc_finfo;
+	state->topn_pk_collation = attr->attcollation;
+
+	state->topn_relid = GetMatRelTopNRelid(cq->matrelid);
+	rel = heap_open(state->topn_relid, RowExclusiveLock);
+	state->topn_relfilenode = rel->rd_node.relNode;
+
+	scan = heap_beginscan(rel, GetTransactionSnapshot(), 0, NULL);
+	while ((tup = heap_getnext(scan, ForwardScanDirection)) != NULL)
+	{
+		Datum values[Natts_topn];
+		bool nulls[Natts_topn];
+		int combiner;
+
+		heap_deform_tuple(tup, RelationGetDescr(rel), values, nulls);
+		combiner = DatumGetInt32(values[Anum_topn_combiner - 1]);
+
+		/* Groups held by combiners that no longer exist have been resharded onto the remaining ones */
+		if (combiner >= num_combiners && MyContQueryProc->group_id == 0)
+		{
+			simple_heap_delete(rel, &tup->t_self);
+			continue;
+		}
+
+		if (combiner != MyContQueryProc->group_id || nulls[Anum_topn_value - 1] || nulls[Anum_topn_row - 1])
+			continue;
+
+		/* Our own rows get rewritten by every sync, so we can't hold on to references into them */
+		if (attr->attlen == -1)
+			values[Anum_topn_pk - 1] = PointerGetDatum(PG_DETOAST_DATUM(values[Anum_topn_pk - 1]));
+		if (TupleDescAttr(state->overlay_desc, cq->topn_attno - 1)->attlen == -1)
+			values[Anum_topn_value - 1] = PointerGetDatum(PG_DETOAST_DATUM(values[Anum_topn_value - 1]));
+		values[Anum_topn_row - 1] = PointerGetDatum(PG_DETOAST_DATUM(values[Anum_topn_row - 1]));
+
+		topn_offer(state, values[Anum_topn_pk - 1], values[Anum_topn_value - 1], values[Anum_topn_row - 1]);
+	}
+	heap_endscan(scan);
+
+	heap_close(rel, NoLock);
+}
+
+/*
+ * init_cache
+ */
+static void
+init_cache(ContQueryCombinerState *state)
+{
+	TypeCacheEntry *typ;
+	Relation rel;
+
+	state->cache_relid = GetMatRelCacheRelid(state->base.query->matrelid);
+
+	rel = heap_open(state->cache_relid, AccessShareLock);
+	state->cache_slot = MakeSingleTupleTableSlot(CreateTupleDescCopy(RelationGetDescr(rel)));
+	heap_close(rel, AccessShareLock);
+
+	typ = lookup_type_cache(TupleDescAttr(state->desc, state->pk - 1)->atttypid, TYPECACHE_EQ_OPR);
+	state->cache_eqproc = get_opcode(typ->eq_opr);
 }
 
 /*
- * set_group_hash
+ * update_cache
  *
- * Set the group hash at the given index, increasing the size of the group hashes array if necessary
+ * Write a group's latest overlay row to the finalized cache, replacing whatever was cached for it before
  */
 static void
-set_group_hash(ContQueryCombinerState *state, int index, int64 hash)
+update_cache(ContQueryCombinerState *state, ResultRelInfo *ri, EState *estate, HeapTuple tup, Datum row)
 {
-	int start = state->group_hashes_len;
+	Relation rel = ri->ri_RelationDesc;
+	Relation index = ri->ri_IndexRelationDescs[0];
+	Datum values[Natts_cache];
+	bool nulls[Natts_cache];
+	ItemPointerData tid;
+	ScanKeyData skey;
+	IndexScanDesc scan;
+	HeapTuple cached;
+	bool found = false;
+	bool isnull;
+
+	Assert(ri->ri_NumIndices == 1);
+
+	MemSet(nulls, false, sizeof(nulls));
+	values[Anum_cache_pk - 1] = heap_getattr(tup, state->pk, state->desc, &isnull);
+	values[Anum_cache_row - 1] = row;
+
+	ScanKeyEntryInitialize(&skey, 0, 1, BTEqualStrategyNumber, InvalidOid,
+			index->rd_indcollation[0], state->cache_eqproc, values[Anum_cache_pk - 1]);
+
+	scan = index_beginscan(rel, index, GetActiveSnapshot(), 1, 0);
+	index_rescan(scan, &skey, 1, NULL, 0);
+	if ((cached = index_getnext(scan, ForwardScanDirection)) != NULL)
+	{
+		tid = cached->t_self;
+		found = true;
+	}
+	index_endscan(scan);
 
-	while (index >= state->group_hashes_len)
-		state->group_hashes_len *= 2;
+	tup = heap_form_tuple(RelationGetDescr(rel), values, nulls);
+	ExecStoreTuple(tup, state->cache_slot, InvalidBuffer, false);
 
-	if (start != state->group_hashes_len)
+	if (found)
 	{
-		MemoryContext old = MemoryContextSwitchTo(state->base.state_cxt);
-		state->group_hashes = repalloc(state->group_hashes, state->group_hashes_len * sizeof(int64));
-		MemoryContextSwitchTo(old);
+		tup->t_self = tid;
+		ExecCQMatRelUpdate(ri, state->cache_slot, estate);
+	}
+	else
+	{
+		ExecCQMatRelInsert(ri, state->cache_slot, estate);
 	}
+}
 
-	Assert(index < state->group_hashes_len);
-	state->group_hashes[index] = hash;
+/*
+ * get_freeze_watermark
+ *
+ * The reaper freezes groups whose time bucket is older than the CV's freeze watermark into its archive,
+ * as of when it does so. Groups are looked up before the watermark is taken, so any group the reaper froze
+ * before we looked for it is older than the watermark.
+ */
+static Datum
+get_freeze_watermark(ContQueryCombinerState *state)
+{
+	ContQuery *cq = state->base.query;
+	TimestampTz watermark = GetCurrentTimestamp() - cq->freeze_after * USECS_PER_SEC;
+
+	if (TupleDescAttr(state->desc, cq->freeze_attno - 1)->atttypid == TIMESTAMPOID)
+		return DirectFunctionCall1(timestamptz_timestamp, TimestampTzGetDatum(watermark));
+
+	return TimestampTzGetDatum(watermark);
+}
+
+/*
+ * is_frozen
+ *
+ * Is the given group's time bucket older than the CV's freeze watermark?
+ */
+static bool
+is_frozen(ContQueryCombinerState *state, TupleTableSlot *slot, Datum watermark)
+{
+	AttrNumber attno = state->base.query->freeze_attno;
+
+	if (!state->base.query->freeze_after || slot->tts_isnull[attno - 1])
+		return false;
+
+	/* Timestamps and timestamptzs are both int64 microseconds */
+	return DatumGetTimestamp(slot->tts_values[attno - 1]) < DatumGetTimestamp(watermark);
 }
 
 /*
@@ -1408,7 +3045,9 @@ sync_combine(ContQueryCombinerState *state)
 	int i;
 	Relation matrel;
 	Relation osrel;
-	ResultRelInfo *ri;
+	Relation topnrel = NULL;
+	ResultRelInfo *cache_ri = NULL;
+	ResultRelInfo **ris;
 	ResultRelInfo *osri;
 	Size nbytes_inserted = 0;
 	Size nbytes_updated = 0;
@@ -1418,6 +3057,8 @@ sync_combine(ContQueryCombinerState *state)
 	Bitmapset *os_targets = NULL;
 	Bitmapset *orig_targets = NULL;
 	int pending = 0;
+	int ndropped = 0;
+	Datum watermark = (Datum) 0;
 
 	estate->es_range_table = state->combine_plan->rtable;
 
@@ -1432,6 +3073,17 @@ sync_combine(ContQueryCombinerState *state)
 		return;
 	}
 
+	if (state->topn)
+		topnrel = open_topn(state);
+
+	if (OidIsValid(state->cache_relid))
+	{
+		Relation cache = try_relation_open(state->cache_relid, RowExclusiveLock);
+
+		if (cache)
+			cache_ri = CQMatRelOpen(cache);
+	}
+
 	/*
 	 * We haven't combined anything with on-disk groups yet, so what's
 	 * in the combined store is the deltas that are about to be applied
@@ -1464,6 +3116,9 @@ sync_combine(ContQueryCombinerState *state)
 	/* Do a final combine with existing on-disk groups */
 	combine(state, true);
 
+	if (state->base.query->freeze_after)
+		watermark = get_freeze_watermark(state);
+
 	osri = CQOSRelOpen(osrel);
 
 	BeginStreamModify(NULL, osri, list_make1(state->acks), 0, REENTRANT_STREAM_INSERT);
@@ -1487,7 +3142,28 @@ sync_combine(ContQueryCombinerState *state)
 		os_targets = NULL;
 	}
 
-	ri = CQMatRelOpen(matrel);
+	/* Open each matrel shard we own, which for an unsharded matrel is just the matrel */
+	ris = palloc0(sizeof(ResultRelInfo *) * state->nshards);
+	for (i = 0; i < state->nshards; i++)
+	{
+		Relation rel;
+
+		if (state->shards[i].relid == RelationGetRelid(matrel))
+		{
+			ris[i] = CQMatRelOpen(matrel);
+			continue;
+		}
+
+		if (!OidIsValid(state->shards[i].relid))
+			continue;
+
+		/* A TTL partition that none of our existing groups were read from may have been dropped since */
+		rel = try_relation_open(state->shards[i].relid, RowExclusiveLock);
+		if (rel)
+			ris[i] = CQMatRelOpen(rel);
+		else
+			state->shards[i].relid = InvalidOid;
+	}
 
 	estate->es_per_tuple_exprcontext = CreateStandaloneExprContext();
 
@@ -1500,6 +3176,7 @@ sync_combine(ContQueryCombinerState *state)
 		PhysicalTuple update = NULL;
 		HeapTuple tup = NULL;
 		HeapTuple os_tup;
+		ResultRelInfo *ri;
 		Datum os_values[4];
 		bool os_nulls[4];
 		int replaces = 0;
@@ -1527,123 +3204,402 @@ sync_combine(ContQueryCombinerState *state)
 			}
 		}
 
+		/* Existing groups of a TTL-partitioned matrel may live in the matrel itself rather than their partition */
+		if (update && state->base.query->ttl_partition)
+			ri = ris[get_tuple_shard(state, update->tuple)];
+		else
+			ri = ris[get_slot_shard(state, slot)];
+
 		if (update && SHOULD_UPDATE(state))
 		{
 			ExecStoreTuple(update->tuple, state->prev_slot, InvalidBuffer, false);
 			replaces = compare_slots(state->prev_slot, state->slot,
-					state->pk, replace_all);
+					state->pk, replace_all, state->changed_funcs);
 
 			if (replaces == 0)
 				continue;
 
-			if (os_targets)
-				os_values[OLD_TUPLE] = project_overlay(state, econtext, update->tuple, &os_nulls[OLD_TUPLE]);
+			if (os_targets)
+				os_values[OLD_TUPLE] = project_overlay(state, econtext, update->tuple, &os_nulls[OLD_TUPLE]);
+
+			/*
+			 * The slot has the updated values, so store them in the updatable physical tuple
+			 */
+			tup = heap_modify_tuple(update->tuple, slot->tts_tupleDescriptor,
+					slot->tts_values, slot->tts_isnull, replace_all);
+			ExecStoreTuple(tup, slot, InvalidBuffer, false);
+			ExecCQMatRelUpdate(ri, slot, estate);
+
+			if (os_targets)
+				os_values[NEW_TUPLE] = project_overlay(state, econtext, tup, &os_nulls[NEW_TUPLE]);
+
+			ntups_updated++;
+			nbytes_updated += HEAPTUPLESIZE + slot->tts_tuple->t_len;
+		}
+		else if (is_frozen(state, slot, watermark))
+		{
+			/*
+			 * The group's bucket has been frozen into the archive with its finalized values, or is about
+			 * to be, so there's nothing left to combine this late event with
+			 */
+			ndropped++;
+			continue;
+		}
+		else
+		{
+			/* No existing tuple found, so it's an INSERT. Also generate a primary key for it if necessary. */
+			if (state->seq_pk)
+				slot->tts_values[state->pk - 1] = nextval_internal(state->base.query->seqrelid, true);
+			slot->tts_isnull[state->pk - 1] = false;
+			tup = heap_form_tuple(slot->tts_tupleDescriptor, slot->tts_values, slot->tts_isnull);
+			ExecStoreTuple(tup, slot, InvalidBuffer, false);
+			ExecCQMatRelInsert(ri, slot, estate);
+
+			if (os_targets)
+			{
+				os_nulls[OLD_TUPLE] = true;
+				os_nulls[NEW_TUPLE] = false;
+				os_values[OLD_TUPLE] = (Datum) NULL;
+				os_values[NEW_TUPLE] = project_overlay(state, econtext, tup, &os_nulls[NEW_TUPLE]);
+			}
+
+			ntups_inserted++;
+			nbytes_inserted += HEAPTUPLESIZE + slot->tts_tuple->t_len;
+		}
+
+		/*
+		 * The top-N heap and finalized cache both work with the group's overlay row,
+		 * which the output stream may have already projected
+		 */
+		if (topnrel || cache_ri)
+		{
+			if (!os_targets)
+				os_values[NEW_TUPLE] = project_overlay(state, econtext, tup, &os_nulls[NEW_TUPLE]);
+
+			if (topnrel && !os_nulls[NEW_TUPLE])
+				update_topn(state, tup, os_values[NEW_TUPLE]);
+			if (cache_ri && !os_nulls[NEW_TUPLE])
+				update_cache(state, cache_ri, estate, tup, os_values[NEW_TUPLE]);
+		}
+
+		/*
+		 * If anything is reading this CV's output stream, write out the
+		 * old and new rows to it
+		 */
+		if (os_targets &&
+				(os_nulls[OLD_TUPLE] == false || os_nulls[NEW_TUPLE] == false))
+		{
+			TupleHashEntry e = LookupTupleHashEntry(state->deltas, slot, NULL);
+
+			if (e != NULL)
+			{
+				PhysicalTuple pt = (PhysicalTuple) e->additional;
+				os_values[DELTA_TUPLE] = heap_copy_tuple_as_datum(pt->tuple, state->desc);
+				os_nulls[DELTA_TUPLE] = false;
+				os_nulls[state->output_stream_arrival_ts - 1] = true;
+				os_tup = heap_form_tuple(state->os_slot->tts_tupleDescriptor, os_values, os_nulls);
+				ExecStoreTuple(os_tup, state->os_slot, InvalidBuffer, false);
+				ExecStreamInsert(NULL, osri, state->os_slot, NULL);
+			}
+			else
+			{
+				elog(WARNING, "tuple not found in delta store");
+			}
+		}
+
+		ResetPerTupleExprContext(estate);
+	}
+
+	if (sis)
+	{
+		EndStreamModify(NULL, osri);
+		CQOSRelClose(osri);
+		heap_close(osrel, RowExclusiveLock);
+	}
+
+	/*
+	 * We handle SW output stream writes here so we can execute the
+	 * overlay plan on the whole batch all at once in order to to
+	 * compute output stream tuples.
+	 *
+	 * Note that this only happens if the output stream currently
+	 * has any readers.
+	 */
+	if (orig_targets && state->sw)
+		project_sw_overlay_into_ostream(state, matrel);
+
+	tuplestore_clear(state->combined);
+
+	StatsIncrementCQUpdate(ntups_updated, nbytes_updated);
+	StatsIncrementCQWrite(ntups_inserted, nbytes_inserted);
+
+	if (ndropped)
+		elog(DEBUG1, "dropped %d late groups of \"%s\" whose buckets are frozen",
+				ndropped, state->base.query->name->relname);
+
+	for (i = 0; i < state->nshards; i++)
+	{
+		Relation rel;
+
+		if (!ris[i])
+			continue;
+
+		rel = ris[i]->ri_RelationDesc;
+		CQMatRelClose(ris[i]);
+		if (rel != matrel)
+			heap_close(rel, RowExclusiveLock);
+	}
+
+	if (topnrel)
+	{
+		if (state->topn_dirty)
+			sync_topn(state, topnrel);
+		heap_close(topnrel, RowExclusiveLock);
+	}
+
+	if (cache_ri)
+	{
+		Relation cache = cache_ri->ri_RelationDesc;
+
+		CQMatRelClose(cache_ri);
+		heap_close(cache, RowExclusiveLock);
+	}
+
+	heap_close(matrel, RowExclusiveLock);
+
+	FreeExecutorState(estate);
+}
+
+/*
+ * cmp_group_hash
+ */
+static int
+cmp_group_hash(const void *a, const void *b)
+{
+	int64 l = *(const int64 *) a;
+	int64 r = *(const int64 *) b;
+
+	if (l < r)
+		return -1;
+	if (l > r)
+		return 1;
+	return 0;
+}
+
+/*
+ * spill_tuple
+ */
+static void
+spill_tuple(ContQueryCombinerState *state, TupleTableSlot *slot, uint64 hash)
+{
+	int part = hash % NUM_SPILL_PARTITIONS;
+
+	if (!state->spill)
+		state->spill = MemoryContextAllocZero(state->base.state_cxt,
+				sizeof(Tuplestorestate *) * NUM_SPILL_PARTITIONS);
+
+	/*
+	 * These must outlive the transaction because we don't necessarily commit between
+	 * batches, so they're released explicitly by release_spilled_groups
+	 */
+	if (!state->spill[part])
+	{
+		MemoryContext old = MemoryContextSwitchTo(state->base.state_cxt);
+		state->spill[part] = tuplestore_begin_heap(false, true, SPILL_PARTITION_WORK_MEM);
+		MemoryContextSwitchTo(old);
+	}
+
+	tuplestore_puttupleslot(state->spill[part], slot);
+	state->spilled_tuples++;
+}
+
+/*
+ * spill_cold_groups
+ *
+ * If the ongoing combine result has outgrown continuous_query_combiner_work_mem, move the partial
+ * results of all groups that the last batch didn't touch to disk. Hot groups stay in memory so that
+ * they keep being combined in place, and everything is merged back together at sync time.
+ */
+static void
+spill_cold_groups(ContQueryCombinerState *state, int ntups)
+{
+	TupleTableSlot *slot = state->slot;
+	Size nbytes = 0;
+	int64 *hot;
+
+	tuplestore_rescan(state->combined);
+	foreach_tuple(slot, state->combined)
+		nbytes += HEAPTUPLESIZE + slot->tts_tuple->t_len;
+	tuplestore_rescan(state->combined);
+
+	state->combined_bytes = nbytes;
+
+	/*
+	 * Sliding-window queries cache their groups across syncs for the overlay plan, so they
+	 * must keep everything in memory. Without grouping columns there is only one group.
+	 */
+	if (!state->isagg || !state->hashfunc || state->sw)
+		return;
+
+	if (nbytes <= continuous_query_combiner_work_mem * 1024L)
+		return;
+
+	hot = palloc(sizeof(int64) * ntups);
+	memcpy(hot, state->group_hashes, sizeof(int64) * ntups);
+	qsort(hot, ntups, sizeof(int64), cmp_group_hash);
+
+	/*
+	 * The batch store is empty between combines, so we can use it to hold the hot groups
+	 * while the combined store is rebuilt
+	 */
+	Assert(tuplestore_tuple_count(state->batch) == 0);
+
+	tuplestore_rescan(state->combined);
+	foreach_tuple(slot, state->combined)
+	{
+		int64 hash = (int64) slot_hash_group(slot, state->hashfunc, state->hash_fcinfo);
+
+		if (bsearch(&hash, hot, ntups, sizeof(int64), cmp_group_hash))
+			tuplestore_puttupleslot(state->batch, slot);
+		else
+			spill_tuple(state, slot, (uint64) hash);
+	}
+	tuplestore_clear(state->combined);
+
+	foreach_tuple(slot, state->batch)
+		tuplestore_puttupleslot(state->combined, slot);
+	tuplestore_clear(state->batch);
+
+	pfree(hot);
+}
+
+/*
+ * release_spilled_groups
+ */
+static void
+release_spilled_groups(ContQueryCombinerState *state)
+{
+	int i;
+
+	if (!state->spill)
+		return;
+
+	for (i = 0; i < NUM_SPILL_PARTITIONS; i++)
+	{
+		if (state->spill[i])
+			tuplestore_end(state->spill[i]);
+		state->spill[i] = NULL;
+	}
+
+	state->spilled_tuples = 0;
+}
+
+/*
+ * sync_spilled_groups
+ *
+ * Merges spilled groups back in and syncs them one partition at a time, so that only a single
+ * partition's groups are ever combined in memory at once
+ */
+static void
+sync_spilled_groups(ContQueryCombinerState *state)
+{
+	TupleTableSlot *slot = state->slot;
+	int i;
+
+	/* Partition whatever is still in memory too, so that each group lives in exactly one partition */
+	tuplestore_rescan(state->combined);
+	foreach_tuple(slot, state->combined)
+		spill_tuple(state, slot, slot_hash_group(slot, state->hashfunc, state->hash_fcinfo));
+	tuplestore_clear(state->combined);
 
-			/*
-			 * The slot has the updated values, so store them in the updatable physical tuple
-			 */
-			tup = heap_modify_tuple(update->tuple, slot->tts_tupleDescriptor,
-					slot->tts_values, slot->tts_isnull, replace_all);
-			ExecStoreTuple(tup, slot, InvalidBuffer, false);
-			ExecCQMatRelUpdate(ri, slot, estate);
+	for (i = 0; i < NUM_SPILL_PARTITIONS; i++)
+	{
+		if (!state->spill[i])
+			continue;
 
-			if (os_targets)
-				os_values[NEW_TUPLE] = project_overlay(state, econtext, tup, &os_nulls[NEW_TUPLE]);
+		foreach_tuple(slot, state->spill[i])
+			tuplestore_puttupleslot(state->batch, slot);
 
-			ntups_updated++;
-			nbytes_updated += HEAPTUPLESIZE + slot->tts_tuple->t_len;
-		}
-		else
-		{
-			/* No existing tuple found, so it's an INSERT. Also generate a primary key for it if necessary. */
-			if (state->seq_pk)
-				slot->tts_values[state->pk - 1] = nextval_internal(state->base.query->seqrelid, true);
-			slot->tts_isnull[state->pk - 1] = false;
-			tup = heap_form_tuple(slot->tts_tupleDescriptor, slot->tts_values, slot->tts_isnull);
-			ExecStoreTuple(tup, slot, InvalidBuffer, false);
-			ExecCQMatRelInsert(ri, slot, estate);
+		tuplestore_end(state->spill[i]);
+		state->spill[i] = NULL;
 
-			if (os_targets)
-			{
-				os_nulls[OLD_TUPLE] = true;
-				os_nulls[NEW_TUPLE] = false;
-				os_values[OLD_TUPLE] = (Datum) NULL;
-				os_values[NEW_TUPLE] = project_overlay(state, econtext, tup, &os_nulls[NEW_TUPLE]);
-			}
+		/* A group may have been spilled more than once, so combine its partial results first */
+		combine(state, false);
+		sync_combine(state);
 
-			ntups_inserted++;
-			nbytes_inserted += HEAPTUPLESIZE + slot->tts_tuple->t_len;
-		}
+		state->existing = NULL;
+		MemoryContextResetAndDeleteChildren(state->combine_cxt);
+	}
 
-		/*
-		 * If anything is reading this CV's output stream, write out the
-		 * old and new rows to it
-		 */
-		if (os_targets &&
-				(os_nulls[OLD_TUPLE] == false || os_nulls[NEW_TUPLE] == false))
-		{
-			TupleHashEntry e = LookupTupleHashEntry(state->deltas, slot, NULL);
+	state->spilled_tuples = 0;
+}
 
-			if (e != NULL)
-			{
-				PhysicalTuple pt = (PhysicalTuple) e->additional;
-				os_values[DELTA_TUPLE] = heap_copy_tuple_as_datum(pt->tuple, state->desc);
-				os_nulls[DELTA_TUPLE] = false;
-				os_nulls[state->output_stream_arrival_ts - 1] = true;
-				os_tup = heap_form_tuple(state->os_slot->tts_tupleDescriptor, os_values, os_nulls);
-				ExecStoreTuple(os_tup, state->os_slot, InvalidBuffer, false);
-				ExecStreamInsert(NULL, osri, state->os_slot, NULL);
-			}
-			else
-			{
-				elog(WARNING, "tuple not found in delta store");
-			}
-		}
+/*
+ * get_sync_interval
+ *
+ * A CV's own commit interval overrides the combiner's, and its freshness target caps either one
+ */
+static int
+get_sync_interval(ContQueryCombinerState *state)
+{
+	ContQuery *query = state->base.query;
+	int interval = query->commit_interval ? query->commit_interval : sync_interval;
 
-		ResetPerTupleExprContext(estate);
-	}
+	if (query->freshness)
+		interval = Min(interval, query->freshness);
 
-	if (sis)
-	{
-		EndStreamModify(NULL, osri);
-		CQOSRelClose(osri);
-		heap_close(osrel, RowExclusiveLock);
-	}
+	return interval;
+}
 
-	/*
-	 * We handle SW output stream writes here so we can execute the
-	 * overlay plan on the whole batch all at once in order to to
-	 * compute output stream tuples.
-	 *
-	 * Note that this only happens if the output stream currently
-	 * has any readers.
-	 */
-	if (orig_targets && state->sw)
-		project_sw_overlay_into_ostream(state, matrel);
+/*
+ * is_sync_due
+ *
+ * With group commit, CVs are synced whenever the clock crosses a commit interval boundary, so that
+ * all combiners commit at about the same time and can share WAL flushes
+ */
+static bool
+is_sync_due(ContQueryCombinerState *state, TimestampTz now)
+{
+	TimestampTz interval = (TimestampTz) get_sync_interval(state) * 1000;
 
-	tuplestore_clear(state->combined);
+	if (!state->first_seen || !interval)
+		return true;
 
-	StatsIncrementCQUpdate(ntups_updated, nbytes_updated);
-	StatsIncrementCQWrite(ntups_inserted, nbytes_inserted);
+	if (continuous_query_combiner_group_commit)
+		return now / interval != state->first_seen / interval;
 
-	CQMatRelClose(ri);
-	heap_close(matrel, RowExclusiveLock);
+	return TimestampDifferenceExceeds(state->first_seen, now, get_sync_interval(state));
+}
 
-	FreeExecutorState(estate);
+/*
+ * must_sync
+ *
+ * Partial results that spilled to temporary files can't outlive the transaction they were written in,
+ * so their CVs must be synced whenever we commit
+ */
+static bool
+must_sync(ContQueryCombinerState *state)
+{
+	return state->spilled_tuples > 0 || !tuplestore_in_memory(state->combined);
 }
 
 /*
  * sync_all
+ *
+ * Syncs every CV that has pending results and whose sync is due, or every CV at all if force is set.
+ * Returns the number of pending tuples left in memory.
  */
-static void
-sync_all(ContExecutor *cont_exec)
+static long
+sync_all(ContExecutor *cont_exec, bool force)
 {
 	Bitmapset *tmp = bms_copy(cont_exec->all_queries);
 	ContQueryCombinerState **states = (ContQueryCombinerState **) cont_exec->states;
 	int id;
+	TimestampTz now = GetCurrentTimestamp();
 	TimestampTz start_time;
 	long secs;
 	int usecs;
+	long remaining = 0;
 
 	PushActiveSnapshot(GetTransactionSnapshot());
 
@@ -1651,17 +3607,31 @@ sync_all(ContExecutor *cont_exec)
 	{
 		volatile bool error = false;
 		ContQueryCombinerState *state = states[id];
+		bool spilled;
 
 		if (!state)
 			continue;
 
+		/* CVs with a longer commit interval may keep combining in memory across our commits */
+		if (!force && state->pending_tuples > 0 && !must_sync(state) && !is_sync_due(state, now))
+		{
+			remaining += state->pending_tuples;
+			continue;
+		}
+
 		start_time = GetCurrentTimestamp();
 		debug_query_string = state->base.query->name->relname;
 		MyProcStatCQEntry = state->base.stats;
 
+		if (state->spilled_tuples > 0 || state->pending_tuples > 0)
+			state->synced = true;
+		spilled = state->spilled_tuples > 0;
+
 		PG_TRY();
 		{
-			if (state->pending_tuples > 0)
+			if (state->spilled_tuples > 0)
+				sync_spilled_groups(state);
+			else if (state->pending_tuples > 0)
 				sync_combine(state);
 		}
 		PG_CATCH();
@@ -1674,12 +3644,28 @@ sync_all(ContExecutor *cont_exec)
 		PG_END_TRY();
 
 		if (error)
+		{
+			ContExplainSetActive(NULL, NULL);
+			release_spilled_groups(state);
 			ContExecutorAbortQuery(cont_exec);
+		}
 
-		TimestampDifference(start_time, GetCurrentTimestamp(), &secs, &usecs);
+		now = GetCurrentTimestamp();
+		TimestampDifference(start_time, now, &secs, &usecs);
 		StatsIncrementCQExecMs(secs * 1000 + (usecs / 1000));
+		if (error)
+			state->synced = false;
+		else if (state->synced)
+		{
+			StatsRecordCQLatency(state->base.latency, LATENCY_SYNC, start_time, now, 1);
+			TRACE_PIPELINEDB_COMBINER_SYNC(state->base.query_id, state->pending_tuples, spilled,
+					now - start_time);
+			ContExplainPublish(state->base.explain);
+		}
 
 		state->pending_tuples = 0;
+		state->combined_bytes = 0;
+		state->first_seen = 0;
 		state->existing = NULL;
 		debug_query_string = NULL;
 		MyProcStatCQEntry = NULL;
@@ -1697,6 +3683,31 @@ sync_all(ContExecutor *cont_exec)
 
 	if (ActiveSnapshotSet())
 		PopActiveSnapshot();
+
+	return remaining;
+}
+
+/*
+ * record_commit_latency
+ *
+ * Charges the time spent committing a transaction to every CV that synced within it
+ */
+static void
+record_commit_latency(ContExecutor *cont_exec, TimestampTz start, TimestampTz end)
+{
+	ContQueryCombinerState **states = (ContQueryCombinerState **) cont_exec->states;
+	int id = -1;
+
+	while ((id = bms_next_member(cont_exec->all_queries, id)) >= 0)
+	{
+		ContQueryCombinerState *state = states[id];
+
+		if (!state || !state->synced)
+			continue;
+
+		StatsRecordCQLatency(state->base.latency, LATENCY_COMMIT, start, end, 1);
+		state->synced = false;
+	}
 }
 
 /*
@@ -1731,7 +3742,7 @@ assign_output_stream_projection(ContQueryCombinerState *state)
 	estate = CreateExecutorState();
 	context = CreateStandaloneExprContext();
 	overlayrel = heap_openrv(state->base.query->name, NoLock);
-	overlay = get_view_query(overlayrel);
+	overlay = GetContViewMatRelQuery(overlayrel);
 	heap_close(overlayrel, NoLock);
 
 	state->output_stream_proj = build_projection(overlay->targetList, estate, context, NULL);
@@ -1813,6 +3824,58 @@ init_lookup_query(ContQueryCombinerState *state)
 	state->lookup_query = (Node *) sub;
 }
 
+/*
+ * init_matrel_shards
+ *
+ * Determines which matrel shards we write to. An unsharded matrel is its own single shard, and
+ * backends combining into a sharded matrel directly (e.g. via combine_table) own all of its shards.
+ */
+static void
+init_matrel_shards(ContQueryCombinerState *state)
+{
+	ContQuery *cq = state->base.query;
+	MemoryContext old = MemoryContextSwitchTo(state->base.state_cxt);
+	int i;
+
+	if (!cq->matrel_shards)
+	{
+		state->shards = palloc0(sizeof(MatRelShard));
+		state->shards[0].relid = cq->matrelid;
+		state->shards[0].plan_cache_cxt = state->plan_cache_cxt;
+		state->nshards = 1;
+
+		/* TTL partitions come and go with each batch, so they can't share the matrel's plan cache */
+		if (cq->ttl_partition)
+			state->shards[0].plan_cache_cxt = AllocSetContextCreate(state->plan_cache_cxt, "CombinerShardPlanCacheCxt",
+					ALLOCSET_DEFAULT_MINSIZE,
+					ALLOCSET_DEFAULT_INITSIZE,
+					ALLOCSET_DEFAULT_MAXSIZE);
+
+		MemoryContextSwitchTo(old);
+		return;
+	}
+
+	state->shards = palloc0(sizeof(MatRelShard) * cq->matrel_shards);
+
+	for (i = 0; i < cq->matrel_shards; i++)
+	{
+		MatRelShard *shard;
+
+		if (IsContQueryCombinerProcess() && !is_matrel_shard_mine(i))
+			continue;
+
+		shard = &state->shards[state->nshards++];
+		shard->id = i;
+		shard->relid = GetMatRelShardRelid(cq->matrelid, i);
+		shard->plan_cache_cxt = AllocSetContextCreate(state->plan_cache_cxt, "CombinerShardPlanCacheCxt",
+				ALLOCSET_DEFAULT_MINSIZE,
+				ALLOCSET_DEFAULT_INITSIZE,
+				ALLOCSET_DEFAULT_MAXSIZE);
+	}
+
+	MemoryContextSwitchTo(old);
+}
+
 /*
  * init_query_state
  */
@@ -1859,7 +3922,7 @@ init_query_state(ContExecutor *cont_exec, ContQueryState *base)
 	state->slot = MakeSingleTupleTableSlot(state->desc);
 	state->delta_slot = MakeSingleTupleTableSlot(state->desc);
 	state->prev_slot = MakeSingleTupleTableSlot(state->desc);
-	state->groups_plan = NULL;
+	state->changed_funcs = get_changed_funcs(state->desc);
 
 	/* this will grow dynamically when needed, but this is a good starting size */
 	state->group_hashes_len = continuous_query_batch_size;
@@ -1867,6 +3930,8 @@ init_query_state(ContExecutor *cont_exec, ContQueryState *base)
 
 	/* process/query level statistics */
 	state->base.stats = ProcStatsInit(state->base.query->id, MyProcPid);
+	state->base.latency = LatencyStatsInit(state->base.query->id);
+	StatsSetCQCommitInterval(state->base.stats, get_sync_interval(state));
 
 	if (matrel == NULL)
 	{
@@ -1874,6 +3939,12 @@ init_query_state(ContExecutor *cont_exec, ContQueryState *base)
 		return base;
 	}
 
+	init_matrel_shards(state);
+
+	/* An unlogged matrel may have been emptied by crash recovery, so make sure it's been restored before we write to it */
+	if (base->query->unlogged)
+		RestoreMatRelSnapshot(base->query->matrelid);
+
 	osrel = try_relation_open(base->query->osrelid, AccessShareLock);
 	state->os_slot = MakeSingleTupleTableSlot(CreateTupleDescCopy(RelationGetDescr(osrel)));
 	heap_close(osrel, AccessShareLock);
@@ -1947,6 +4018,13 @@ init_query_state(ContExecutor *cont_exec, ContQueryState *base)
 	Assert(AttributeNumberIsValid(state->pk));
 	state->seq_pk = OidIsValid(base->query->seqrelid);
 
+	if (base->query->cached)
+		init_cache(state);
+
+	/* Only combiner processes own groups, so backends combining directly into the matrel don't maintain a top-N */
+	if (base->query->topn && IsContQueryCombinerProcess())
+		init_topn(state);
+
 	return base;
 }
 
@@ -1991,12 +4069,153 @@ read_batch(ContExecutor *exec, ContQueryCombinerState *state, Oid query_id)
  * need_sync
  */
 static bool
-need_sync(ContExecutor *exec, TimestampTz last_sync)
+need_sync(ContExecutor *exec)
 {
-	if ((exec->batch && exec->batch->has_acks) || !continuous_query_commit_interval)
+	ContQueryCombinerState **states = (ContQueryCombinerState **) exec->states;
+	TimestampTz now = GetCurrentTimestamp();
+	int id = -1;
+
+	if (exec->batch && exec->batch->has_acks)
 		return true;
 
-	return TimestampDifferenceExceeds(last_sync, GetCurrentTimestamp(), continuous_query_commit_interval);
+	while ((id = bms_next_member(exec->all_queries, id)) >= 0)
+	{
+		ContQueryCombinerState *state = states[id];
+
+		if (state && state->pending_tuples > 0 && is_sync_due(state, now))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * get_dirty_groups
+ *
+ * Returns the number of groups waiting to be synced, whether any of them had to be spilled to disk,
+ * and how much memory their combine results are holding across all CVs
+ */
+static long
+get_dirty_groups(ContExecutor *exec, bool *spilled, Size *nbytes)
+{
+	ContQueryCombinerState **states = (ContQueryCombinerState **) exec->states;
+	Bitmapset *tmp = bms_copy(exec->all_queries);
+	long ngroups = 0;
+	int id;
+
+	*spilled = false;
+	*nbytes = 0;
+
+	while ((id = bms_first_member(tmp)) >= 0)
+	{
+		ContQueryCombinerState *state = states[id];
+
+		if (!state)
+			continue;
+
+		ngroups += tuplestore_tuple_count(state->combined) + state->spilled_tuples;
+		*nbytes += state->combined_bytes;
+		if (state->spilled_tuples > 0 || !tuplestore_in_memory(state->combined))
+			*spilled = true;
+	}
+
+	bms_free(tmp);
+
+	return ngroups;
+}
+
+/*
+ * get_pending_queries
+ *
+ * Returns the CVs that have combined tuples waiting for a later commit
+ */
+static Bitmapset *
+get_pending_queries(ContExecutor *exec)
+{
+	ContQueryCombinerState **states = (ContQueryCombinerState **) exec->states;
+	Bitmapset *result = NULL;
+	int id = -1;
+
+	while ((id = bms_next_member(exec->all_queries, id)) >= 0)
+	{
+		if (states[id] && states[id]->pending_tuples > 0)
+			result = bms_add_member(result, id);
+	}
+
+	return result;
+}
+
+/*
+ * get_max_sync_interval
+ *
+ * The longest adaptive interval, which is the largest power-of-two multiple of min_commit_interval
+ * that doesn't exceed max_commit_interval
+ */
+static int
+get_max_sync_interval(void)
+{
+	int interval = continuous_query_min_commit_interval;
+
+	while (interval <= continuous_query_max_commit_interval / 2)
+		interval *= 2;
+
+	return interval;
+}
+
+/*
+ * adjust_sync_interval
+ *
+ * Picks the commit interval to use until the next sync, based on what was observed since the last one:
+ *
+ * - Groups spilled to disk, more dirty groups than fit in a batch, or combine results that together
+ *   hold more than combiner_work_mem halve the interval. Each CV only spills once its own results
+ *   outgrow combiner_work_mem, so with many CVs the combiner's memory is mostly bounded by this. Every
+ *   dirty group also costs an update at sync time, so letting them pile up only grows sync latency.
+ * - If most batches were full, input is backing up, so the interval is doubled to amortize syncs
+ *   over more input, up to max_commit_interval.
+ * - If the combiner went idle, syncing more often costs little, so the interval is halved to keep
+ *   views fresh, down to min_commit_interval.
+ */
+static void
+adjust_sync_interval(ContExecutor *exec)
+{
+	ContQueryCombinerState **states = (ContQueryCombinerState **) exec->states;
+	Bitmapset *tmp;
+	long ngroups;
+	bool spilled;
+	Size nbytes;
+	int prev = sync_interval;
+	int interval = sync_interval;
+	int id;
+
+	if (!continuous_query_adaptive_commit_interval)
+		return;
+
+	ngroups = get_dirty_groups(exec, &spilled, &nbytes);
+
+	if (spilled || ngroups > continuous_query_batch_size || nbytes > continuous_query_combiner_work_mem * 1024L)
+		interval /= 2;
+	else if (interval_batches && interval_full_batches * 2 >= interval_batches)
+		interval *= 2;
+	else if (interval_idle_polls)
+		interval /= 2;
+
+	sync_interval = Max(continuous_query_min_commit_interval, Min(interval, get_max_sync_interval()));
+
+	interval_batches = 0;
+	interval_full_batches = 0;
+	interval_idle_polls = 0;
+
+	if (sync_interval == prev)
+		return;
+
+	tmp = bms_copy(exec->all_queries);
+	while ((id = bms_first_member(tmp)) >= 0)
+	{
+		if (states[id])
+			StatsSetCQCommitInterval(states[id]->base.stats, get_sync_interval(states[id]));
+	}
+	bms_free(tmp);
 }
 
 /*
@@ -2044,15 +4263,26 @@ ContinuousQueryCombinerMain(void)
 {
 	ContExecutor *cont_exec = ContExecutorNew(&init_query_state);
 	Oid query_id;
-	TimestampTz first_seen = 0;
 	bool do_commit = false;
+	TimestampTz commit_start;
 	long total_pending = 0;
 	uint64 min_tick_ms;
 
 	min_tick_ms = get_min_tick_ms();
 
-	/* Set the commit level */
-	synchronous_commit = continuous_query_combiner_synchronous_commit;
+	/* Set the commit level, group commits are committed asynchronously and flushed afterwards */
+	if (continuous_query_combiner_group_commit)
+		synchronous_commit = SYNCHRONOUS_COMMIT_OFF;
+	else
+		synchronous_commit = continuous_query_combiner_synchronous_commit;
+
+	MyContQueryProc->committing = false;
+
+	/* Adaptive intervals start out short and only grow once there's enough input to justify it */
+	if (continuous_query_adaptive_commit_interval)
+		sync_interval = continuous_query_min_commit_interval;
+	else
+		sync_interval = continuous_query_commit_interval;
 
 	for (;;)
 	{
@@ -2063,6 +4293,15 @@ ContinuousQueryCombinerMain(void)
 
 		ContExecutorStartBatch(cont_exec, min_tick_ms);
 
+		if (!cont_exec->batch)
+			interval_idle_polls++;
+		else
+		{
+			interval_batches++;
+			if (cont_exec->batch->ntups >= continuous_query_batch_size)
+				interval_full_batches++;
+		}
+
 		while ((query_id = ContExecutorStartNextQuery(cont_exec, min_tick_ms)) != InvalidOid)
 		{
 			int count = 0;
@@ -2072,6 +4311,7 @@ ContinuousQueryCombinerMain(void)
 			PG_TRY();
 			{
 				TimestampTz start_time;
+				TimestampTz end_time;
 				long secs;
 				int usecs;
 
@@ -2081,6 +4321,8 @@ ContinuousQueryCombinerMain(void)
 				start_time = GetCurrentTimestamp();
 				MemoryContextSwitchTo(state->base.tmp_cxt);
 
+				ContExplainStartQuery(&state->base);
+
 				count = read_batch(cont_exec, state, query_id);
 				if (count)
 				{
@@ -2088,9 +4330,10 @@ ContinuousQueryCombinerMain(void)
 					total_pending += count;
 
 					combine(state, false);
+					spill_cold_groups(state, count);
 
-					if (!first_seen)
-						first_seen = GetCurrentTimestamp();
+					if (!state->first_seen)
+						state->first_seen = GetCurrentTimestamp();
 				}
 
 				if (state->sw)
@@ -2102,8 +4345,16 @@ ContinuousQueryCombinerMain(void)
 
 				MemoryContextResetAndDeleteChildren(state->base.tmp_cxt);
 
-				TimestampDifference(start_time, GetCurrentTimestamp(), &secs, &usecs);
+				end_time = GetCurrentTimestamp();
+				TimestampDifference(start_time, end_time, &secs, &usecs);
 				StatsIncrementCQExecMs(secs * 1000 + (usecs / 1000));
+				if (count)
+				{
+					StatsRecordCQLatency(state->base.latency, LATENCY_COMBINE, start_time, end_time, 1);
+					TRACE_PIPELINEDB_COMBINER_COMBINE(query_id, count, end_time - start_time);
+					if (ContExplainIsSampling(state->base.explain))
+						ContExplainPublish(state->base.explain);
+				}
 			}
 			PG_CATCH();
 			{
@@ -2137,22 +4388,51 @@ next:
 			 * free the stats object
 			 */
 			if (error)
+			{
+				ContExplainSetActive(NULL, NULL);
+				if (state)
+					release_spilled_groups(state);
 				ContExecutorPurgeQuery(cont_exec);
+			}
 		}
 
 		if (total_pending == 0)
+		{
+			/* Tighten the interval while idle so that the next input shows up in views quickly */
+			if (interval_idle_polls)
+				adjust_sync_interval(cont_exec);
 			do_commit = true;
-		else if (need_sync(cont_exec, first_seen))
+		}
+		else if (need_sync(cont_exec))
 		{
-			sync_all(cont_exec);
+			MyContQueryProc->committing = true;
+			adjust_sync_interval(cont_exec);
+			ContExecutorEnsureTransaction(cont_exec);
+			total_pending = sync_all(cont_exec, cont_exec->batch && cont_exec->batch->has_acks);
 			do_commit = true;
-			first_seen = 0;
-			total_pending = 0;
 		}
 		else
 			do_commit = false;
 
+		commit_start = do_commit ? GetCurrentTimestamp() : 0;
 		ContExecutorEndBatch(cont_exec, do_commit);
+		if (do_commit)
+			record_commit_latency(cont_exec, commit_start, GetCurrentTimestamp());
+
+		/*
+		 * Acks for logged inserts are only counted once combiners have committed their tuples. CVs
+		 * with a longer commit interval may still be holding some of them back.
+		 */
+		if (do_commit)
+		{
+			Bitmapset *pending = get_pending_queries(cont_exec);
+
+			ipc_tuple_reader_ack_committed(pending);
+			bms_free(pending);
+		}
+
+		if (do_commit)
+			IngestLogAdvance();
 	}
 
 	for (query_id = 0; query_id < MAX_CQS; query_id++)
@@ -2232,11 +4512,11 @@ GetCombinerLookupPlan(ContQuery *view)
 		}
 
 		state->existing = existing;
-		values = get_values(state);
+		values = get_values(state, &state->shards[0]);
 	}
 
 	am_cont_combiner = true;
-	plan = get_cached_groups_plan(state, values);
+	plan = get_cached_groups_plan(state, &state->shards[0], values);
 	am_cont_combiner = save;
 
 	tuplestore_end(state->batch);
@@ -2329,7 +4609,7 @@ combine_table(PG_FUNCTION_ARGS)
 			continue;
 
 		combine(state, false);
-		sync_all(&exec);
+		sync_all(&exec, true);
 
 		MemoryContextResetAndDeleteChildren(base->tmp_cxt);
 
@@ -2339,7 +4619,7 @@ combine_table(PG_FUNCTION_ARGS)
 	if (state->pending_tuples)
 	{
 		combine(state, true);
-		sync_all(&exec);
+		sync_all(&exec, true);
 	}
 
 	heap_endscan(scan);
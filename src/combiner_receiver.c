@@ -31,11 +31,40 @@
 CombinerReceiveFunc CombinerReceiveHook = NULL;
 CombinerFlushFunc CombinerFlushHook = NULL;
 
-static void
-combiner_receive(CombinerReceiver *c, TupleTableSlot *slot)
+#define DEST_TO_COMBINER_RECEIVER(self) \
+	((CombinerReceiver *) ((char *) (self) - offsetof(CombinerReceiver, pub)))
+
+/*
+ * get_combiner_microbatch
+ */
+static microbatch_t *
+get_combiner_microbatch(CombinerReceiver *c, int combiner_id)
 {
+	if (!c->mbs)
+		c->mbs = palloc0(sizeof(microbatch_t *) * num_combiners);
+
+	if (!c->mbs[combiner_id])
+	{
+		c->mbs[combiner_id] = microbatch_new(CombinerTuple, bms_make_singleton(c->cont_query->id), NULL);
+		microbatch_add_acks(c->mbs[combiner_id], c->cont_exec->batch->sync_acks);
+	}
+
+	return c->mbs[combiner_id];
+}
+
+/*
+ * combiner_receive_slot
+ *
+ * Serializes each partial result straight into the microbatch of the combiner that owns its group,
+ * so the worker doesn't need to buffer its plan output before sending it anywhere
+ */
+static bool
+combiner_receive_slot(TupleTableSlot *slot, DestReceiver *self)
+{
+	CombinerReceiver *c = DEST_TO_COMBINER_RECEIVER(self);
 	MemoryContext old = MemoryContextSwitchTo(ContQueryBatchContext);
-	tagged_ref_t *ref;
+	HeapTuple tup;
+	uint64 group_hash;
 	uint32 shard_hash;
 	bool received = false;
 
@@ -44,101 +73,164 @@ combiner_receive(CombinerReceiver *c, TupleTableSlot *slot)
 
 	Assert(c->cont_query->type == CONT_VIEW);
 
-	ref = palloc(sizeof(tagged_ref_t));
-	ref->ptr = ExecCopySlotTuple(slot);
-
 	/* Shard by groups or name if no grouping. */
 	if (c->hash_fcinfo)
 	{
-		ref->tag = slot_hash_group(slot, c->hashfn, c->hash_fcinfo);
-		shard_hash = slot_hash_group_skip_attr(slot, c->cont_query->sw_attno, c->hashfn, c->hash_fcinfo);
+		group_hash = slot_hash_group(slot, c->hashfn, c->hash_fcinfo);
+
+		/*
+		 * Sliding-window groups are sharded without their time bucket so that all of a group's
+		 * buckets are combined by the same process. Otherwise the group hash is the shard hash.
+		 */
+		if (AttributeNumberIsValid(c->cont_query->sw_attno))
+			shard_hash = slot_hash_group_skip_attr(slot, c->cont_query->sw_attno, c->hashfn, c->hash_fcinfo);
+		else
+			shard_hash = group_hash;
 	}
 	else
 	{
-		ref->tag = c->name_hash;
+		group_hash = c->name_hash;
 		shard_hash = c->name_hash;
 	}
 
+	tup = ExecCopySlotTuple(slot);
+
 	if (CombinerReceiveHook)
-		received = CombinerReceiveHook(c->cont_query, shard_hash, ref->tag, ref->ptr);
+		received = CombinerReceiveHook(c->cont_query, shard_hash, group_hash, tup);
 
 	if (!received)
 	{
-		int i = get_combiner_for_shard_hash(shard_hash);
-		c->tups_per_combiner[i] = lappend(c->tups_per_combiner[i], ref);
+		int i;
+		microbatch_t *mb;
+
+		if (c->cont_query->matrel_shards)
+			i = get_combiner_for_matrel_shard(get_matrel_shard_for_hash(shard_hash, c->cont_query->matrel_shards));
+		else
+			i = get_combiner_for_shard_hash(shard_hash);
+
+		mb = get_combiner_microbatch(c, i);
+
+		if (!microbatch_add_tuple(mb, tup, group_hash))
+		{
+			c->full_mbs = lappend(c->full_mbs, mb);
+			c->full_ids = lappend_int(c->full_ids, i);
+			c->mbs[i] = NULL;
+
+			mb = get_combiner_microbatch(c, i);
+			microbatch_add_tuple(mb, tup, group_hash);
+		}
+
+		c->ntups++;
+		c->nbytes += HEAPTUPLESIZE + tup->t_len;
+
+		heap_freetuple(tup);
 	}
 
 	MemoryContextSwitchTo(old);
+
+	return true;
+}
+
+/*
+ * combiner_startup
+ */
+static void
+combiner_startup(DestReceiver *self, int operation, TupleDesc typeinfo)
+{
+}
+
+/*
+ * combiner_shutdown
+ */
+static void
+combiner_shutdown(DestReceiver *self)
+{
 }
 
+/*
+ * combiner_destroy
+ */
+static void
+combiner_destroy(DestReceiver *self)
+{
+}
+
+/*
+ * flush_to_combiner
+ *
+ * Sends all of the plan's microbatches to their combiners once it has completed
+ */
 static void
 flush_to_combiner(BatchReceiver *receiver, TupleTableSlot *slot)
 {
 	int i;
-	int ntups = 0;
-	Size size = 0;
-	microbatch_t *mb;
+	List *acks = NIL;
 	CombinerReceiver *c = (CombinerReceiver *) receiver;
-
-	foreach_tuple(slot, c->base.buffer)
-	{
-		combiner_receive(c, slot);
-	}
+	ListCell *lc;
+	ListCell *id;
 
 	if (CombinerFlushHook)
 		CombinerFlushHook();
 
-	mb = microbatch_new(CombinerTuple, bms_make_singleton(c->cont_query->id), NULL);
-	microbatch_add_acks(mb, c->cont_exec->batch->sync_acks);
-
-	for (i = 0; i < num_combiners; i++)
+	forboth(lc, c->full_mbs, id, c->full_ids)
 	{
-		List *tups = c->tups_per_combiner[i];
-		ListCell *lc;
+		microbatch_t *mb = (microbatch_t *) lfirst(lc);
 
-		if (tups == NIL)
-			continue;
+		microbatch_send_to_combiner(mb, lfirst_int(id));
+		microbatch_destroy(mb);
+	}
 
-		ntups += list_length(tups);
+	list_free(c->full_mbs);
+	list_free(c->full_ids);
+	c->full_mbs = NIL;
+	c->full_ids = NIL;
 
-		foreach(lc, tups)
+	if (c->mbs)
+	{
+		for (i = 0; i < num_combiners; i++)
 		{
-			tagged_ref_t *ref = lfirst(lc);
-			HeapTuple tup = (HeapTuple) ref->ptr;
-			uint64 hash = ref->tag;
+			microbatch_t *mb = c->mbs[i];
 
-			if (!microbatch_add_tuple(mb, tup, hash))
-			{
+			if (!mb)
+				continue;
+
+			if (!microbatch_is_empty(mb))
 				microbatch_send_to_combiner(mb, i);
-				microbatch_add_tuple(mb, tup, hash);
-			}
 
-			size += HEAPTUPLESIZE + tup->t_len;
-		}
+			/* All microbatches carry the same acks, so we only need to increment them once */
+			if (!acks)
+			{
+				acks = mb->acks;
+				mb->acks = NIL;
+			}
 
-		if (!microbatch_is_empty(mb))
-		{
-			microbatch_send_to_combiner(mb, i);
-			microbatch_reset(mb);
+			microbatch_destroy(mb);
 		}
 
-		list_free_deep(tups);
-		c->tups_per_combiner[i] = NIL;
+		pfree(c->mbs);
+		c->mbs = NULL;
 	}
 
-	microbatch_acks_check_and_exec(mb->acks, microbatch_ack_increment_ctups, ntups);
-	microbatch_destroy(mb);
+	microbatch_acks_check_and_exec(acks, microbatch_ack_increment_ctups, c->ntups);
+	list_free_deep(acks);
+
+	StatsIncrementCQWrite(c->ntups, c->nbytes);
 
-	StatsIncrementCQWrite(ntups, size);
+	c->ntups = 0;
+	c->nbytes = 0;
 }
 
 BatchReceiver *
-CreateCombinerReceiver(ContExecutor *cont_exec, ContQuery *query, Tuplestorestate *buffer)
+CreateCombinerReceiver(ContExecutor *cont_exec, ContQuery *query)
 {
 	CombinerReceiver *self = (CombinerReceiver *) palloc0(sizeof(CombinerReceiver));
 	char *relname = get_rel_name(query->relid);
 
-	self->tups_per_combiner = palloc0(sizeof(List *) * num_combiners);
+	self->pub.receiveSlot = combiner_receive_slot;
+	self->pub.rStartup = combiner_startup;
+	self->pub.rShutdown = combiner_shutdown;
+	self->pub.rDestroy = combiner_destroy;
+	self->pub.mydest = DestNone;
 	self->cont_exec = cont_exec;
 	self->cont_query = query;
 	self->name_hash = MurmurHash3_64(relname, strlen(relname), MURMUR_SEED);
@@ -146,11 +238,22 @@ CreateCombinerReceiver(ContExecutor *cont_exec, ContQuery *query, Tuplestorestat
 	pfree(relname);
 
 	self->base.flush = &flush_to_combiner;
-	self->base.buffer = buffer;
+	self->base.buffer = NULL;
 
 	return (BatchReceiver *) self;
 }
 
+/*
+ * GetCombinerDestReceiver
+ *
+ * Returns the DestReceiver that worker plans should write their output to
+ */
+DestReceiver *
+GetCombinerDestReceiver(BatchReceiver *receiver)
+{
+	return &((CombinerReceiver *) receiver)->pub;
+}
+
 /*
  * SetCombinerDestReceiverHashFunc
  *
@@ -20,6 +20,7 @@
 #include "commands/dbcommands.h"
 #include "compat.h"
 #include "config.h"
+#include "cont_explain.h"
 #include "copy.h"
 #include "executor.h"
 #include "miscadmin.h"
@@ -216,6 +217,11 @@ PipelineProcessUtility(PlannedStmt *pstmt, const char *sql, ProcessUtilityContex
 				goto epilogue;
 			}
 		}
+		else if (IsA(parsetree, ExplainStmt) && IsContExplainStmt((ExplainStmt *) parsetree))
+		{
+			ExplainContQuery((ExplainStmt *) parsetree, dest);
+			goto epilogue;
+		}
 		else if (IsA(parsetree, ViewStmt) && IsA(((ViewStmt *) parsetree)->query, SelectStmt))
 		{
 			ViewStmt *stmt = (ViewStmt *) parsetree;
@@ -10,6 +10,7 @@
  */
 #include "postgres.h"
 
+#include "access/heapam.h"
 #include "access/htup.h"
 #include "access/htup_details.h"
 #include "catalog/pg_proc.h"
@@ -175,3 +176,16 @@ ComaptExecAssignResultTypeFromTL(PlanState *ps)
 	ExecInitResultTupleSlotTL(ps->state, ps);
 #endif
 }
+
+/*
+ * CompatHeapDelete
+ */
+HTSU_Result
+CompatHeapDelete(Relation rel, ItemPointer tid, CommandId cid, bool wait, HeapUpdateFailureData *hufd)
+{
+#if (PG_VERSION_NUM < 110000)
+	return heap_delete(rel, tid, cid, InvalidSnapshot, wait, hufd);
+#else
+	return heap_delete(rel, tid, cid, InvalidSnapshot, wait, hufd, false);
+#endif
+}
@@ -19,7 +19,9 @@
 #include "commands.h"
 #include "commands/extension.h"
 #include "config.h"
+#include "cont_explain.h"
 #include "fmgr.h"
+#include "ingestlog.h"
 #include "pzmq.h"
 #include "matrel.h"
 #include "miscadmin.h"
@@ -42,6 +44,14 @@ PG_MODULE_MAGIC;
 
 static shmem_startup_hook_type save_shmem_startup_hook;
 
+/* Local and remote levels are the only ones that combiners can tell apart */
+static const struct config_enum_entry combiner_synchronous_commit_options[] = {
+	{"off", SYNCHRONOUS_COMMIT_OFF, false},
+	{"local", SYNCHRONOUS_COMMIT_LOCAL_FLUSH, false},
+	{"on", SYNCHRONOUS_COMMIT_ON, false},
+	{NULL, 0, false}
+};
+
 static const struct config_enum_entry stream_insert_options[] = {
 	{"async", STREAM_INSERT_ASYNCHRONOUS, false},
 	{"sync_receive", STREAM_INSERT_SYNCHRONOUS_RECEIVE, false},
@@ -49,6 +59,15 @@ static const struct config_enum_entry stream_insert_options[] = {
 	{NULL, 0, false}
 };
 
+/* Values are the attstorage codes that sketch columns are created with */
+static const struct config_enum_entry sketch_storage_options[] = {
+	{"plain", 'p', false},
+	{"main", 'm', false},
+	{"external", 'e', false},
+	{"extended", 'x', false},
+	{NULL, 0, false}
+};
+
 char *pipeline_version_str = "unknown";
 char *pipeline_revision_str = "unknown";
 
@@ -64,10 +83,14 @@ pipeline_shmem_startup(void)
 	RequestAddinShmemSpace(ContQuerySchedulerShmemSize());
 	RequestAddinShmemSpace(MicrobatchAckShmemSize());
 	RequestAddinShmemSpace(StatsShmemSize());
+	RequestAddinShmemSpace(IngestLogShmemSize());
+	RequestAddinShmemSpace(ContExplainShmemSize());
 
 	ContQuerySchedulerShmemInit();
 	MicrobatchAckShmemInit();
 	StatsShmemInit();
+	IngestLogShmemInit();
+	ContExplainShmemInit();
 }
 
 /*
@@ -378,6 +401,47 @@ _PG_init(void)
 			PGC_POSTMASTER, GUC_UNIT_MS,
 			NULL, NULL, NULL);
 
+	DefineCustomBoolVariable("pipelinedb.adaptive_commit_interval",
+			gettext_noop("Lets each combiner vary its commit interval between min_commit_interval and max_commit_interval."),
+			gettext_noop("Combiners commit less often while they are saturated and more often while they are idle or short on memory."),
+			&continuous_query_adaptive_commit_interval,
+			false,
+			PGC_POSTMASTER, 0,
+			NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pipelinedb.min_commit_interval",
+			gettext_noop("Sets the shortest commit interval that combiners will use when adaptive_commit_interval is enabled."),
+			NULL,
+			&continuous_query_min_commit_interval,
+			10, 1, 60000,
+			PGC_POSTMASTER, GUC_UNIT_MS,
+			NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pipelinedb.max_commit_interval",
+			gettext_noop("Sets the longest commit interval that combiners will use when adaptive_commit_interval is enabled."),
+			gettext_noop("This bounds how stale continuous views may become while combiners are saturated."),
+			&continuous_query_max_commit_interval,
+			1000, 1, 60000,
+			PGC_POSTMASTER, GUC_UNIT_MS,
+			NULL, NULL, NULL);
+
+	DefineCustomEnumVariable("pipelinedb.combiner_synchronous_commit",
+			gettext_noop("Sets the synchronization level of combiner commits."),
+			gettext_noop("Synchronous commits make combined results durable before synchronous stream inserts are acknowledged."),
+			&continuous_query_combiner_synchronous_commit,
+			SYNCHRONOUS_COMMIT_OFF,
+			combiner_synchronous_commit_options,
+			PGC_POSTMASTER, 0,
+			NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("pipelinedb.combiner_group_commit",
+			gettext_noop("Aligns combiner commits to a common clock and lets concurrent commits share a single WAL flush."),
+			NULL,
+			&continuous_query_combiner_group_commit,
+			true,
+			PGC_POSTMASTER, 0,
+			NULL, NULL, NULL);
+
 	DefineCustomIntVariable("pipelinedb.ipc_hwm",
 			gettext_noop("Sets the high watermark for IPC between worker and combiner processes."),
 			gettext_noop("A value will queue more IPC messages in memory."),
@@ -410,6 +474,14 @@ _PG_init(void)
 			PGC_POSTMASTER, 0,
 			NULL, NULL, NULL);
 
+	DefineCustomIntVariable("pipelinedb.matrel_snapshot_interval",
+			gettext_noop("Sets the time between snapshots of unlogged continuous view materialization tables."),
+			gettext_noop("After a crash, an unlogged materialization table loses all changes made since its last snapshot."),
+			&matrel_snapshot_interval,
+			60, 1, INT_MAX / 1000,
+			PGC_POSTMASTER, GUC_UNIT_S,
+			NULL, NULL, NULL);
+
 	DefineCustomIntVariable("pipelinedb.queue_mem",
 			gettext_noop("Sets the maximum amount of memory each queue process will use."),
 			NULL,
@@ -426,6 +498,15 @@ _PG_init(void)
 			PGC_POSTMASTER, 0,
 			NULL, NULL, NULL);
 
+	DefineCustomEnumVariable("pipelinedb.sketch_storage",
+			gettext_noop("Sets the storage strategy for sketch columns of new continuous views."),
+			gettext_noop("Sketch states are rewritten in full on every update, so by default they are stored uncompressed."),
+			&sketch_storage,
+			'e',
+			sketch_storage_options,
+			PGC_USERSET, 0,
+			NULL, NULL, NULL);
+
 	DefineCustomIntVariable("pipelinedb.combiner_work_mem",
 			gettext_noop("Sets the maximum memory to be used for combining partial results for continuous queries."),
 			NULL,
@@ -434,6 +515,30 @@ _PG_init(void)
 			PGC_POSTMASTER, GUC_UNIT_KB,
 			NULL, NULL, NULL);
 
+	DefineCustomBoolVariable("pipelinedb.ingest_log",
+			gettext_noop("Logs asynchronous stream inserts locally so that they can be replayed after a crash."),
+			gettext_noop("Tuples that were logged but not yet committed by combiners may be combined more than once after a crash."),
+			&ingest_log_enabled,
+			false,
+			PGC_USERSET, 0,
+			NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pipelinedb.ingest_log_max_pending",
+			gettext_noop("Sets the maximum number of logged inserts per database that may be awaiting combiner commits."),
+			NULL,
+			&ingest_log_max_pending,
+			1024, 16, 65536,
+			PGC_POSTMASTER, 0,
+			NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pipelinedb.latency_stats_max_queries",
+			gettext_noop("Sets the maximum number of continuous queries for which per-stage latency histograms are kept."),
+			gettext_noop("Each query's histograms take about 24kB of shared memory. Setting this to 0 disables latency tracking."),
+			&latency_stats_max_queries,
+			64, 0, MAX_CQS,
+			PGC_POSTMASTER, 0,
+			NULL, NULL, NULL);
+
 	DefineCustomBoolVariable("pipelinedb.anonymous_update_checks",
 			gettext_noop("Anonymously check for available updates."),
 			NULL,
@@ -455,6 +560,8 @@ _PG_init(void)
 	create_ipc_directory();
 
 	StatsRequestLWLocks();
+	IngestLogRequestLWLocks();
+	ContExplainRequestLWLocks();
 
 	save_shmem_startup_hook = shmem_startup_hook;
 	shmem_startup_hook = pipeline_shmem_startup;
@@ -462,6 +569,7 @@ _PG_init(void)
 	InstallCommandHooks();
 	InstallAnalyzerHooks();
 	InstallPlannerHooks();
+	InstallContExplainHooks();
 
 	MemSet(&worker, 0, sizeof(BackgroundWorker));
 
@@ -0,0 +1,793 @@
+/*-------------------------------------------------------------------------
+ *
+ * cont_explain.c
+ *	  EXPLAIN (CONTINUOUS, ANALYZE) support
+ *
+ * A continuous query's plans are never executed by the backend that wants to explain them, so
+ * EXPLAIN (CONTINUOUS, ANALYZE) registers a request in shared memory and waits. For the duration of
+ * the request, each worker and combiner that executes the requested CV turns on instrumentation for its
+ * plan, sums per-node counters across every batch it executes, and publishes a rendered plan along with
+ * its stage counters into a result buffer of its own. The backend then collects whatever was published.
+ *
+ * Plan state is rebuilt by workers and combiners for every batch, so the plan text is rendered by the
+ * process that executed it rather than shipped back in pieces.
+ *
+ * Copyright (c) 2018, PipelineDB, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "commands/defrem.h"
+#include "commands/explain.h"
+#include "cont_explain.h"
+#include "executor.h"
+#include "executor/executor.h"
+#include "miscadmin.h"
+#include "nodes/nodeFuncs.h"
+#include "pgstat.h"
+#include "pipeline_query.h"
+#include "scheduler.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+
+/* How often the explaining backend checks for interrupts while it waits */
+#define CONT_EXPLAIN_POLL_MS 100
+
+/* How long to wait past the sampling window for combiners to sync what they sampled */
+#define CONT_EXPLAIN_GRACE_MS 500
+
+#define CONT_EXPLAIN_MAX_DURATION 3600.0
+
+typedef struct ContExplainRequest
+{
+	bool in_use;
+	Oid dbid;
+	Oid cqid;
+	uint64 generation;
+	TimestampTz end_at;
+	int instrument_options;
+	bool verbose;
+	bool costs;
+} ContExplainRequest;
+
+typedef struct ContExplainResult
+{
+	bool valid;
+	char data[CONT_EXPLAIN_RESULT_SIZE];
+} ContExplainResult;
+
+typedef struct ContExplainShmemStruct
+{
+	/* number of requests in use, read without the lock so that processes can skip all of this cheaply */
+	pg_atomic_uint32 nactive;
+
+	/* protected by the lock */
+	uint64 generation;
+	ContExplainRequest requests[CONT_EXPLAIN_MAX_REQUESTS];
+
+	/* one result per worker and combiner for each request */
+	ContExplainResult results[FLEXIBLE_ARRAY_MEMBER];
+} ContExplainShmemStruct;
+
+#define NUM_EXPLAIN_PROCS (num_workers + num_combiners)
+
+static ContExplainShmemStruct *ContExplainShmem = NULL;
+static LWLockPadded *cont_explain_lock = NULL;
+
+static ExecutorStart_hook_type save_executor_start_hook = NULL;
+static ExecutorEnd_hook_type save_executor_end_hook = NULL;
+
+/* Sample to instrument the plan currently being executed by a combiner with */
+static ContExplainSample *active_sample = NULL;
+
+/*
+ * ContExplainRequestLWLocks
+ */
+void
+ContExplainRequestLWLocks(void)
+{
+	RequestNamedLWLockTranche("pipelinedb_cont_explain", 1);
+}
+
+/*
+ * ContExplainShmemSize
+ */
+Size
+ContExplainShmemSize(void)
+{
+	return add_size(offsetof(ContExplainShmemStruct, results),
+			mul_size(sizeof(ContExplainResult), mul_size(CONT_EXPLAIN_MAX_REQUESTS, NUM_EXPLAIN_PROCS)));
+}
+
+/*
+ * ContExplainShmemInit
+ */
+void
+ContExplainShmemInit(void)
+{
+	bool found;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	ContExplainShmem = ShmemInitStruct("ContExplainShmem", ContExplainShmemSize(), &found);
+
+	if (!found)
+	{
+		MemSet(ContExplainShmem, 0, ContExplainShmemSize());
+		pg_atomic_init_u32(&ContExplainShmem->nactive, 0);
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * get_lock
+ */
+static LWLock *
+get_lock(void)
+{
+	if (!cont_explain_lock)
+		cont_explain_lock = GetNamedLWLockTranche("pipelinedb_cont_explain");
+
+	return &cont_explain_lock[0].lock;
+}
+
+/*
+ * get_result
+ */
+static ContExplainResult *
+get_result(int request, int proc)
+{
+	return &ContExplainShmem->results[request * NUM_EXPLAIN_PROCS + proc];
+}
+
+/*
+ * cont_explain_executor_start
+ *
+ * Turns on instrumentation for a combiner's combine plan while it's being sampled
+ */
+static void
+cont_explain_executor_start(QueryDesc *query_desc, int eflags)
+{
+	if (active_sample && query_desc->plannedstmt == active_sample->plan)
+		query_desc->instrument_options |= active_sample->instrument_options;
+
+	if (save_executor_start_hook)
+		save_executor_start_hook(query_desc, eflags);
+	else
+		standard_ExecutorStart(query_desc, eflags);
+}
+
+/*
+ * cont_explain_executor_end
+ *
+ * Accumulates a sampled combine plan's instrumentation before its plan state goes away
+ */
+static void
+cont_explain_executor_end(QueryDesc *query_desc)
+{
+	if (active_sample && query_desc->plannedstmt == active_sample->plan)
+		ContExplainAccumulate(active_sample, query_desc);
+
+	if (save_executor_end_hook)
+		save_executor_end_hook(query_desc);
+	else
+		standard_ExecutorEnd(query_desc);
+}
+
+/*
+ * InstallContExplainHooks
+ */
+void
+InstallContExplainHooks(void)
+{
+	save_executor_start_hook = ExecutorStart_hook;
+	ExecutorStart_hook = cont_explain_executor_start;
+
+	save_executor_end_hook = ExecutorEnd_hook;
+	ExecutorEnd_hook = cont_explain_executor_end;
+}
+
+/*
+ * IsContExplainStmt
+ */
+bool
+IsContExplainStmt(ExplainStmt *stmt)
+{
+	ListCell *lc;
+
+	foreach(lc, stmt->options)
+	{
+		DefElem *opt = (DefElem *) lfirst(lc);
+
+		if (strcmp(opt->defname, "continuous") == 0)
+			return defGetBoolean(opt);
+	}
+
+	return false;
+}
+
+/*
+ * get_explained_query
+ *
+ * Returns the continuous query that the given EXPLAIN target reads from
+ */
+static ContQuery *
+get_explained_query(ExplainStmt *stmt)
+{
+	Query *query = (Query *) stmt->query;
+	ContQuery *cq = NULL;
+	ListCell *lc;
+
+	if (!IsA(query, Query) || query->commandType != CMD_SELECT)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				errmsg("EXPLAIN (CONTINUOUS) only supports SELECT statements")));
+
+	foreach(lc, query->rtable)
+	{
+		RangeTblEntry *rte = (RangeTblEntry *) lfirst(lc);
+
+		if (rte->rtekind != RTE_RELATION || !RelidIsContQuery(rte->relid))
+			continue;
+
+		if (cq)
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					errmsg("EXPLAIN (CONTINUOUS) only supports queries that read from a single continuous view or transform")));
+
+		cq = RelidGetContQuery(rte->relid);
+	}
+
+	if (!cq)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				errmsg("EXPLAIN (CONTINUOUS) requires a query that reads from a continuous view or transform"),
+				errhint("For example: EXPLAIN (CONTINUOUS, ANALYZE) SELECT * FROM cv;")));
+
+	return cq;
+}
+
+/*
+ * start_request
+ *
+ * Claims a request slot for the given continuous query, returning its index
+ */
+static int
+start_request(ContQuery *cq, double duration, int instrument_options, bool verbose, bool costs)
+{
+	ContExplainRequest *req = NULL;
+	int i;
+
+	LWLockAcquire(get_lock(), LW_EXCLUSIVE);
+
+	for (i = 0; i < CONT_EXPLAIN_MAX_REQUESTS; i++)
+	{
+		if (!ContExplainShmem->requests[i].in_use)
+		{
+			req = &ContExplainShmem->requests[i];
+			break;
+		}
+	}
+
+	if (!req)
+	{
+		LWLockRelease(get_lock());
+		ereport(ERROR,
+				(errcode(ERRCODE_TOO_MANY_CONNECTIONS),
+				errmsg("too many concurrent EXPLAIN (CONTINUOUS) requests"),
+				errdetail("At most %d continuous queries can be explained at once.", CONT_EXPLAIN_MAX_REQUESTS)));
+	}
+
+	req->in_use = true;
+	req->dbid = MyDatabaseId;
+	req->cqid = cq->id;
+	req->generation = ++ContExplainShmem->generation;
+	req->end_at = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), (int64) (duration * 1000));
+	req->instrument_options = instrument_options;
+	req->verbose = verbose;
+	req->costs = costs;
+
+	MemSet(get_result(i, 0), 0, sizeof(ContExplainResult) * NUM_EXPLAIN_PROCS);
+
+	pg_atomic_fetch_add_u32(&ContExplainShmem->nactive, 1);
+
+	LWLockRelease(get_lock());
+
+	return i;
+}
+
+/*
+ * end_request
+ *
+ * Releases the given request slot, appending anything that was published for it to buf if given
+ */
+static int
+end_request(int request, StringInfo buf)
+{
+	int nresults = 0;
+	int i;
+
+	LWLockAcquire(get_lock(), LW_EXCLUSIVE);
+
+	for (i = 0; buf && i < NUM_EXPLAIN_PROCS; i++)
+	{
+		ContExplainResult *result = get_result(request, i);
+
+		if (!result->valid)
+			continue;
+
+		appendStringInfo(buf, "\n%s", result->data);
+		nresults++;
+	}
+
+	ContExplainShmem->requests[request].in_use = false;
+	pg_atomic_fetch_sub_u32(&ContExplainShmem->nactive, 1);
+
+	LWLockRelease(get_lock());
+
+	return nresults;
+}
+
+/*
+ * ExplainContQuery
+ *
+ * EXPLAIN (CONTINUOUS, ANALYZE) samples the given continuous query's executions by workers and combiners
+ * for a while, and reports their plans with accumulated per-node counters
+ */
+void
+ExplainContQuery(ExplainStmt *stmt, DestReceiver *dest)
+{
+	ContQuery *cq;
+	ListCell *lc;
+	bool analyze = false;
+	bool verbose = false;
+	bool costs = true;
+	bool timing = true;
+	double duration = CONT_EXPLAIN_DEFAULT_DURATION;
+	int instrument_options;
+	int commit_interval;
+	int request;
+	int nresults;
+	TimestampTz until;
+	TupOutputState *tstate;
+	StringInfoData buf;
+
+	foreach(lc, stmt->options)
+	{
+		DefElem *opt = (DefElem *) lfirst(lc);
+
+		if (strcmp(opt->defname, "continuous") == 0)
+			continue;
+		else if (strcmp(opt->defname, "analyze") == 0)
+			analyze = defGetBoolean(opt);
+		else if (strcmp(opt->defname, "verbose") == 0)
+			verbose = defGetBoolean(opt);
+		else if (strcmp(opt->defname, "costs") == 0)
+			costs = defGetBoolean(opt);
+		else if (strcmp(opt->defname, "timing") == 0)
+			timing = defGetBoolean(opt);
+		else if (strcmp(opt->defname, "duration") == 0)
+			duration = defGetNumeric(opt);
+		else if (strcmp(opt->defname, "format") == 0)
+		{
+			char *format = defGetString(opt);
+
+			if (pg_strcasecmp(format, "text") != 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("EXPLAIN (CONTINUOUS) only supports FORMAT TEXT")));
+		}
+		else
+			ereport(ERROR,
+					(errcode(ERRCODE_SYNTAX_ERROR),
+					errmsg("unrecognized EXPLAIN option \"%s\"", opt->defname)));
+	}
+
+	if (!analyze)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				errmsg("EXPLAIN (CONTINUOUS) requires ANALYZE"),
+				errhint("Continuous query plans are only available by sampling their executions with EXPLAIN (CONTINUOUS, ANALYZE).")));
+
+	if (duration <= 0 || duration > CONT_EXPLAIN_MAX_DURATION)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("EXPLAIN (CONTINUOUS) duration must be greater than 0 and at most %.0f seconds",
+						CONT_EXPLAIN_MAX_DURATION)));
+
+	cq = get_explained_query(stmt);
+
+	if (!cq->active)
+		ereport(NOTICE,
+				(errmsg("continuous %s \"%s\" is not active", cq->type == CONT_VIEW ? "view" : "transform",
+						cq->name->relname)));
+
+	instrument_options = INSTRUMENT_ROWS;
+	if (timing)
+		instrument_options |= INSTRUMENT_TIMER;
+
+	/* Combiners sync what they've sampled on their commit interval, so give them a chance to do so */
+	commit_interval = cq->commit_interval > 0 ? cq->commit_interval : continuous_query_commit_interval;
+	if (continuous_query_adaptive_commit_interval)
+		commit_interval = Max(commit_interval, continuous_query_max_commit_interval);
+
+	request = start_request(cq, duration, instrument_options, verbose, costs);
+
+	PG_TRY();
+	{
+		until = TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+				(int64) (duration * 1000) + commit_interval + CONT_EXPLAIN_GRACE_MS);
+
+		while (GetCurrentTimestamp() < until)
+		{
+			int rc = WaitLatch(MyLatch, WL_LATCH_SET | WL_POSTMASTER_DEATH | WL_TIMEOUT,
+					CONT_EXPLAIN_POLL_MS, WAIT_EVENT_PG_SLEEP);
+
+			ResetLatch(MyLatch);
+
+			if (rc & WL_POSTMASTER_DEATH)
+				proc_exit(1);
+
+			CHECK_FOR_INTERRUPTS();
+		}
+	}
+	PG_CATCH();
+	{
+		end_request(request, NULL);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	initStringInfo(&buf);
+	appendStringInfo(&buf, "Continuous %s: %s.%s\n", cq->type == CONT_VIEW ? "View" : "Transform",
+			cq->name->schemaname, cq->name->relname);
+	appendStringInfo(&buf, "Sampled: %.3f s\n", duration);
+
+	nresults = end_request(request, &buf);
+
+	if (!nresults)
+		appendStringInfoString(&buf, "\nNo executions were sampled\n");
+
+	/* Trim the trailing newline, since each line is its own output row */
+	if (buf.len > 0 && buf.data[buf.len - 1] == '\n')
+		buf.data[--buf.len] = '\0';
+
+	tstate = begin_tup_output_tupdesc(dest, ExplainResultDesc(stmt));
+	do_text_output_multiline(tstate, buf.data);
+	end_tup_output(tstate);
+
+	pfree(buf.data);
+}
+
+/*
+ * ContExplainStartQuery
+ *
+ * Called by workers and combiners before they execute a continuous query. Returns the query's sample
+ * if it's being explained, and NULL otherwise.
+ */
+ContExplainSample *
+ContExplainStartQuery(ContQueryState *state)
+{
+	ContExplainSample *sample = state->explain;
+	ContExplainRequest req;
+	MemoryContext old;
+	TimestampTz now;
+	bool found = false;
+	int i;
+
+	active_sample = NULL;
+
+	if (!ContExplainShmem || !state->query || pg_atomic_read_u32(&ContExplainShmem->nactive) == 0)
+		goto none;
+
+	LWLockAcquire(get_lock(), LW_SHARED);
+
+	for (i = 0; i < CONT_EXPLAIN_MAX_REQUESTS; i++)
+	{
+		ContExplainRequest *r = &ContExplainShmem->requests[i];
+
+		if (r->in_use && r->dbid == MyDatabaseId && r->cqid == state->query->id)
+		{
+			req = *r;
+			found = true;
+			break;
+		}
+	}
+
+	LWLockRelease(get_lock());
+
+	if (!found)
+		goto none;
+
+	if (sample && sample->generation != req.generation)
+	{
+		MemoryContextDelete(sample->cxt);
+		sample = state->explain = NULL;
+	}
+
+	now = GetCurrentTimestamp();
+
+	if (!sample)
+	{
+		MemoryContext cxt;
+
+		if (now >= req.end_at)
+			goto none;
+
+		cxt = AllocSetContextCreate(state->state_cxt, "ContExplainCxt", ALLOCSET_DEFAULT_SIZES);
+		old = MemoryContextSwitchTo(cxt);
+
+		sample = palloc0(sizeof(ContExplainSample));
+		sample->cxt = cxt;
+		sample->request = i;
+		sample->generation = req.generation;
+		sample->instrument_options = req.instrument_options;
+		sample->verbose = req.verbose;
+		sample->costs = req.costs;
+		sample->stats = state->stats;
+
+		if (sample->stats)
+		{
+			sample->input_rows = pg_atomic_read_u64(&sample->stats->input_rows);
+			sample->input_bytes = pg_atomic_read_u64(&sample->stats->input_bytes);
+			sample->output_rows = pg_atomic_read_u64(&sample->stats->output_rows);
+			sample->output_bytes = pg_atomic_read_u64(&sample->stats->output_bytes);
+			sample->updated_rows = pg_atomic_read_u64(&sample->stats->updated_rows);
+			sample->updated_bytes = pg_atomic_read_u64(&sample->stats->updated_bytes);
+		}
+
+		MemoryContextSwitchTo(old);
+		state->explain = sample;
+	}
+
+	/*
+	 * Once the window has passed we stop sampling new executions, but keep the sample around
+	 * while the request is still in use so that combiners can publish what they sync afterwards
+	 */
+	sample->sampling = now < req.end_at;
+
+	return sample;
+
+none:
+	if (sample)
+		MemoryContextDelete(sample->cxt);
+	state->explain = NULL;
+
+	return NULL;
+}
+
+/*
+ * ContExplainSetActive
+ *
+ * Sets the plan whose executions should be instrumented by the executor hooks
+ */
+void
+ContExplainSetActive(ContExplainSample *sample, PlannedStmt *plan)
+{
+	if (ContExplainIsSampling(sample))
+	{
+		sample->plan = plan;
+		active_sample = sample;
+	}
+	else
+	{
+		active_sample = NULL;
+	}
+}
+
+/*
+ * collect_planstates
+ */
+static bool
+collect_planstates(PlanState *planstate, List **nodes)
+{
+	*nodes = lappend(*nodes, planstate);
+	return planstate_tree_walker(planstate, collect_planstates, nodes);
+}
+
+/*
+ * ContExplainAccumulate
+ *
+ * Adds an execution's per-node instrumentation to the given sample and renders the accumulated plan.
+ * Must be called before the execution's plan state is freed.
+ */
+void
+ContExplainAccumulate(ContExplainSample *sample, QueryDesc *query_desc)
+{
+	List *nodes = NIL;
+	ListCell *lc;
+	ExplainState *es;
+	MemoryContext old;
+	int i = 0;
+
+	if (!ContExplainIsSampling(sample) || !query_desc->planstate)
+		return;
+
+	collect_planstates(query_desc->planstate, &nodes);
+
+	/* Our plans don't change shape between executions unless the query was redefined */
+	if (sample->nnodes != list_length(nodes))
+	{
+		if (sample->nodes)
+			pfree(sample->nodes);
+
+		sample->nnodes = list_length(nodes);
+		sample->nodes = MemoryContextAllocZero(sample->cxt, sizeof(Instrumentation) * sample->nnodes);
+		sample->executions = 0;
+	}
+
+	foreach(lc, nodes)
+	{
+		PlanState *ps = (PlanState *) lfirst(lc);
+
+		if (ps->instrument)
+		{
+			InstrEndLoop(ps->instrument);
+			InstrAggNode(&sample->nodes[i], ps->instrument);
+
+			/* The plan is rendered from its own nodes, so give them the totals so far */
+			*ps->instrument = sample->nodes[i];
+		}
+		i++;
+	}
+
+	sample->executions++;
+
+	es = NewExplainState();
+	es->analyze = true;
+	es->verbose = sample->verbose;
+	es->costs = sample->costs;
+	es->timing = (sample->instrument_options & INSTRUMENT_TIMER) != 0;
+	es->format = EXPLAIN_FORMAT_TEXT;
+
+	ExplainBeginOutput(es);
+	ExplainPrintPlan(es, query_desc);
+	ExplainEndOutput(es);
+
+	old = MemoryContextSwitchTo(sample->cxt);
+
+	if (sample->plan_text)
+		pfree(sample->plan_text);
+	sample->plan_text = pstrdup(es->str->data);
+
+	MemoryContextSwitchTo(old);
+
+	pfree(es->str->data);
+	list_free(nodes);
+}
+
+/*
+ * stat_delta
+ */
+static uint64
+stat_delta(pg_atomic_uint64 *counter, uint64 start)
+{
+	uint64 value = pg_atomic_read_u64(counter);
+
+	return value > start ? value - start : 0;
+}
+
+/*
+ * percent
+ */
+static double
+percent(int64 n, int64 total)
+{
+	return total > 0 ? 100.0 * n / total : 0.0;
+}
+
+/*
+ * ContExplainPublish
+ *
+ * Writes this process's view of the given sample into its result buffer for the explaining backend
+ */
+void
+ContExplainPublish(ContExplainSample *sample)
+{
+	ContExplainRequest *req;
+	StringInfoData buf;
+	bool is_worker;
+	int proc;
+	char *line;
+	char *next;
+
+	if (!sample || !MyContQueryProc || !ContExplainShmem)
+		return;
+
+	is_worker = MyContQueryProc->type == Worker;
+	proc = is_worker ? MyContQueryProc->group_id : num_workers + MyContQueryProc->group_id;
+
+	if (proc < 0 || proc >= NUM_EXPLAIN_PROCS)
+		return;
+
+	initStringInfo(&buf);
+
+	appendStringInfo(&buf, "%s %d (pid %d)\n", is_worker ? "Worker" : "Combiner",
+			MyContQueryProc->group_id, MyProcPid);
+	appendStringInfo(&buf, "  Executions: " INT64_FORMAT "\n", sample->executions);
+
+	if (sample->stats)
+	{
+		ProcStatsEntry *stats = sample->stats;
+
+		if (is_worker)
+		{
+			appendStringInfo(&buf, "  Stream Input: " UINT64_FORMAT " rows, " UINT64_FORMAT " bytes\n",
+					stat_delta(&stats->input_rows, sample->input_rows),
+					stat_delta(&stats->input_bytes, sample->input_bytes));
+			appendStringInfo(&buf, "  Sent to Combiners: " UINT64_FORMAT " rows, " UINT64_FORMAT " bytes\n",
+					stat_delta(&stats->output_rows, sample->output_rows),
+					stat_delta(&stats->output_bytes, sample->output_bytes));
+		}
+		else
+		{
+			appendStringInfo(&buf, "  Received from Workers: " UINT64_FORMAT " rows, " UINT64_FORMAT " bytes\n",
+					stat_delta(&stats->input_rows, sample->input_rows),
+					stat_delta(&stats->input_bytes, sample->input_bytes));
+		}
+	}
+
+	if (!is_worker && sample->lookup_groups > 0)
+	{
+		int64 cached = Max(sample->lookup_groups - sample->lookup_matrel, 0);
+
+		appendStringInfo(&buf, "  Group Lookups: " INT64_FORMAT " rows, " INT64_FORMAT " cached (%.1f%%), "
+				INT64_FORMAT " looked up in matrel, " INT64_FORMAT " groups found (%.1f%%)\n",
+				sample->lookup_groups, cached, percent(cached, sample->lookup_groups),
+				sample->lookup_matrel, sample->lookup_found, percent(sample->lookup_found, sample->lookup_matrel));
+	}
+
+	if (!is_worker && sample->stats)
+	{
+		ProcStatsEntry *stats = sample->stats;
+
+		appendStringInfo(&buf, "  Sync Writes: " UINT64_FORMAT " inserted (" UINT64_FORMAT " bytes), "
+				UINT64_FORMAT " updated (" UINT64_FORMAT " bytes)\n",
+				stat_delta(&stats->output_rows, sample->output_rows),
+				stat_delta(&stats->output_bytes, sample->output_bytes),
+				stat_delta(&stats->updated_rows, sample->updated_rows),
+				stat_delta(&stats->updated_bytes, sample->updated_bytes));
+	}
+
+	if (sample->plan_text)
+	{
+		appendStringInfoString(&buf, "  Plan:\n");
+
+		for (line = sample->plan_text; line && *line; line = next)
+		{
+			next = strchr(line, '\n');
+			if (next)
+				next++;
+
+			appendStringInfoString(&buf, "    ");
+			appendBinaryStringInfo(&buf, line, next ? next - line : strlen(line));
+		}
+
+		if (buf.data[buf.len - 1] != '\n')
+			appendStringInfoChar(&buf, '\n');
+	}
+
+	LWLockAcquire(get_lock(), LW_EXCLUSIVE);
+
+	req = &ContExplainShmem->requests[sample->request];
+
+	if (req->in_use && req->generation == sample->generation)
+	{
+		ContExplainResult *result = get_result(sample->request, proc);
+		int len = Min(buf.len, CONT_EXPLAIN_RESULT_SIZE - 1);
+
+		memcpy(result->data, buf.data, len);
+		result->data[len] = '\0';
+		result->valid = true;
+	}
+
+	LWLockRelease(get_lock());
+
+	pfree(buf.data);
+}
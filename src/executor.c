@@ -10,6 +10,7 @@
 
 #include "access/heapam.h"
 #include "access/xact.h"
+#include "access/xlog.h"
 #include "catalog.h"
 #include "catalog/namespace.h"
 #include "catalog/pg_namespace.h"
@@ -18,7 +19,9 @@
 #include "microbatch.h"
 #include "miscutils.h"
 #include "pgstat.h"
+#include "replication/syncrep.h"
 #include "tcop/tcopprot.h"
+#include "utils/inval.h"
 #include "utils/lsyscache.h"
 #include "utils/snapmgr.h"
 #include "utils/memutils.h"
@@ -27,11 +30,42 @@
 #define MAX_IN_XACT_TIMEOUT 5 /* 5ms */
 #define MAX_NOT_IN_XACT_TIMEOUT 3000 /* 3s */
 
+#define GROUP_COMMIT_MAX_WAIT 2 /* 2ms */
+#define GROUP_COMMIT_SLEEP_US 100
+
+typedef struct QueryPriority
+{
+	int id;
+	int priority;
+} QueryPriority;
+
 Oid PipelineExecLockRelationOid;
 
 MemoryContext ContQueryTransactionContext = NULL;
 MemoryContext ContQueryBatchContext = NULL;
 
+/*
+ * Bumped whenever pipelinedb.cont_query is invalidated. Each query state remembers the
+ * generation it was validated at, so we only need to go back to the catalog after
+ * something has actually changed.
+ */
+static uint64 ContQueryCatalogGeneration = 1;
+static bool ContQueryCatalogCallbackRegistered = false;
+
+/*
+ * invalidate_query_states
+ */
+static void
+invalidate_query_states(Datum arg, Oid relid)
+{
+	/*
+	 * NB: this may be called outside of a transaction, so we can't do any catalog access here.
+	 * InvalidOid means that all relcache entries are being reset, e.g. after a sinval queue overflow.
+	 */
+	if (relid == InvalidOid || relid == PipelineQueryRelationOid)
+		ContQueryCatalogGeneration++;
+}
+
 /*
  * AcquireContExecutionLock
  */
@@ -62,6 +96,60 @@ exec_begin(ContExecutor *exec)
 	exec->lock = AcquireContExecutionLock(AccessShareLock);
 }
 
+/*
+ * other_combiners_committing
+ */
+static bool
+other_combiners_committing(void)
+{
+	ContQueryDatabaseMetadata *db_meta = MyContQueryProc->db_meta;
+	int i;
+
+	for (i = 0; i < num_combiners; i++)
+	{
+		ContQueryProc *proc = &db_meta->db_procs[num_workers + i];
+
+		if (proc != MyContQueryProc && proc->committing)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * group_commit_flush
+ *
+ * With group commit, combiners commit asynchronously and then flush WAL themselves. Since combiners
+ * commit at the same clock boundaries, waiting briefly for the others that are still committing lets
+ * whichever flushes first cover all of their commit records, and the rest find nothing left to flush.
+ */
+static void
+group_commit_flush(XLogRecPtr lsn)
+{
+	TimestampTz start;
+
+	MyContQueryProc->committing = false;
+
+	if (!continuous_query_combiner_group_commit ||
+			continuous_query_combiner_synchronous_commit == SYNCHRONOUS_COMMIT_OFF)
+		return;
+
+	start = GetCurrentTimestamp();
+	while (GetFlushRecPtr() < lsn && other_combiners_committing() &&
+			!TimestampDifferenceExceeds(start, GetCurrentTimestamp(), GROUP_COMMIT_MAX_WAIT))
+		pg_usleep(GROUP_COMMIT_SLEEP_US);
+
+	XLogFlush(lsn);
+
+	if (continuous_query_combiner_synchronous_commit > SYNCHRONOUS_COMMIT_LOCAL_FLUSH)
+	{
+		/* SyncRepWaitForLSN decides whether to wait based on synchronous_commit */
+		synchronous_commit = continuous_query_combiner_synchronous_commit;
+		SyncRepWaitForLSN(lsn, true);
+		synchronous_commit = SYNCHRONOUS_COMMIT_OFF;
+	}
+}
+
 /*
  * exec_commit
  */
@@ -76,6 +164,9 @@ exec_commit(ContExecutor *exec)
 		ReleaseContExecutionLock(exec->lock);
 
 	CommitTransactionCommand();
+
+	if (exec->ptype == Combiner)
+		group_commit_flush(XactLastCommitEnd);
 }
 
 /*
@@ -118,8 +209,15 @@ ContExecutorNew(ContQueryStateInit initfn)
 	ipc_tuple_reader_init();
 	pgstat_report_activity(STATE_RUNNING, exec->pname);
 
+	if (!ContQueryCatalogCallbackRegistered)
+	{
+		CacheRegisterRelcacheCallback(invalidate_query_states, (Datum) 0);
+		ContQueryCatalogCallbackRegistered = true;
+	}
+
 	debug_query_string = NULL;
 	MyProcStatCQEntry = NULL;
+	MyLatencyStatCQEntry = NULL;
 
 	return exec;
 }
@@ -141,6 +239,7 @@ void
 ContExecutorStartBatch(ContExecutor *exec, int timeout)
 {
 	bool success;
+	bool force = timeout != 0;
 
 	exec->batch = NULL;
 
@@ -160,9 +259,19 @@ ContExecutorStartBatch(ContExecutor *exec, int timeout)
 	/* TODO(usmanm): report activity */
 	success = ipc_tuple_reader_poll(timeout);
 
-	if (!IsTransactionState())
+	/*
+	 * Idle polls don't need a transaction. We only need one if we actually have data to process,
+	 * or if we've been asked to run each query regardless of whether or not it has data (SW ticks).
+	 */
+	if (!IsTransactionState() && (success || force))
 		exec_begin(exec);
 
+	/*
+	 * Process any pending invalidations once per batch, rather than once per query
+	 */
+	if (IsTransactionState())
+		AcceptInvalidationMessages();
+
 	if (success)
 	{
 		exec->batch = ipc_tuple_reader_pull();
@@ -200,6 +309,95 @@ ContExecutorStartBatch(ContExecutor *exec, int timeout)
 	MemoryContextSwitchTo(ContQueryBatchContext);
 
 	exec->exec_queries = bms_copy(exec->all_queries);
+	order_queries(exec);
+}
+
+/*
+ * cmp_query_priority
+ */
+static int
+cmp_query_priority(const void *a, const void *b)
+{
+	const QueryPriority *qa = (const QueryPriority *) a;
+	const QueryPriority *qb = (const QueryPriority *) b;
+
+	if (qa->priority != qb->priority)
+		return qb->priority - qa->priority;
+
+	return qa->id - qb->id;
+}
+
+/*
+ * order_queries
+ *
+ * If any of this batch's queries has a priority, execute them by descending priority rather than
+ * in id order, so that higher priority queries see their input first
+ */
+static void
+order_queries(ContExecutor *exec)
+{
+	QueryPriority *queries;
+	bool prioritized = false;
+	int n = 0;
+	int id = -1;
+	int i;
+
+	exec->exec_order = NULL;
+	exec->exec_norder = 0;
+	exec->exec_next = 0;
+
+	queries = palloc(sizeof(QueryPriority) * bms_num_members(exec->exec_queries));
+
+	while ((id = bms_next_member(exec->exec_queries, id)) >= 0)
+	{
+		ContQueryState *state = exec->states[id];
+
+		queries[n].id = id;
+		queries[n].priority = 0;
+
+		/* A query's state is only initialized once it's executed, but it must already be ordered by its priority */
+		if (state && state->query)
+			queries[n].priority = state->query->priority;
+		else if (IsTransactionState())
+		{
+			PushActiveSnapshot(GetTransactionSnapshot());
+			queries[n].priority = GetContQueryPriority(id);
+			PopActiveSnapshot();
+		}
+
+		prioritized |= queries[n].priority > 0;
+		n++;
+	}
+
+	if (!prioritized)
+	{
+		pfree(queries);
+		return;
+	}
+
+	qsort(queries, n, sizeof(QueryPriority), cmp_query_priority);
+
+	exec->exec_order = palloc(sizeof(int) * n);
+	for (i = 0; i < n; i++)
+		exec->exec_order[i] = queries[i].id;
+	exec->exec_norder = n;
+
+	pfree(queries);
+}
+
+/*
+ * next_query_id
+ */
+static int
+next_query_id(ContExecutor *exec)
+{
+	if (!exec->exec_order)
+		return bms_first_member(exec->exec_queries);
+
+	if (exec->exec_next >= exec->exec_norder)
+		return -1;
+
+	return exec->exec_order[exec->exec_next++];
 }
 
 /*
@@ -245,10 +443,19 @@ get_query_state(ContExecutor *exec)
 	ContQueryState *state;
 	HeapTuple tup;
 	bool commit = false;
+	uint64 generation;
 
 	MyProcStatCQEntry = NULL;
+	MyLatencyStatCQEntry = NULL;
 	state = exec->states[exec->curr_query_id];
 
+	/*
+	 * If nothing in pipelinedb.cont_query has been invalidated since we last validated this
+	 * query's state, it can't have been dropped or modified, so we don't need a catalog lookup.
+	 */
+	if (state != NULL && state->catalog_generation == ContQueryCatalogGeneration)
+		return state;
+
 	/* Entry missing? Start a new transaction so we read the latest pipeline_query catalog. */
 	if (state == NULL)
 	{
@@ -259,6 +466,11 @@ get_query_state(ContExecutor *exec)
 
 	PushActiveSnapshot(GetTransactionSnapshot());
 
+	/*
+	 * Remember the generation we're validating against before doing the lookup, so that any
+	 * invalidation that arrives while we're loading this query's state will force another lookup.
+	 */
+	generation = ContQueryCatalogGeneration;
 	tup = PipelineCatalogLookup(PIPELINEQUERYID, 1, Int32GetDatum(exec->curr_query_id));
 
 	/* Was the continuous view removed? */
@@ -320,6 +532,8 @@ get_query_state(ContExecutor *exec)
 	Assert(exec->states[exec->curr_query_id] == state);
 	Assert(state->query);
 
+	state->catalog_generation = generation;
+
 	return state;
 }
 
@@ -333,7 +547,7 @@ ContExecutorStartNextQuery(ContExecutor *exec, int timeout)
 
 	for (;;)
 	{
-		int id = bms_first_member(exec->exec_queries);
+		int id = next_query_id(exec);
 
 		if (id == -1)
 		{
@@ -371,6 +585,7 @@ ContExecutorStartNextQuery(ContExecutor *exec, int timeout)
 			exec->curr_query = state;
 			debug_query_string = state->query->name->relname;
 			MyProcStatCQEntry = exec->curr_query->stats;
+			MyLatencyStatCQEntry = exec->curr_query->latency;
 		}
 		else
 			exec->curr_query = NULL;
@@ -424,6 +639,7 @@ ContExecutorEndQuery(ContExecutor *exec)
 	ipc_tuple_reader_rewind();
 	debug_query_string = NULL;
 	MyProcStatCQEntry = NULL;
+	MyLatencyStatCQEntry = NULL;
 }
 
 /*
@@ -439,15 +655,27 @@ ContExecutorAbortQuery(ContExecutor *exec)
 	exec->lock = AcquireContExecutionLock(AccessShareLock);
 }
 
+/*
+ * ContExecutorEnsureTransaction
+ *
+ * Idle polls don't start a transaction, so anything that must run within one regardless of
+ * whether this batch had data needs to start it first
+ */
+void
+ContExecutorEnsureTransaction(ContExecutor *exec)
+{
+	if (!IsTransactionState())
+		exec_begin(exec);
+}
+
 /*
  * ContExecutorEndBatch
  */
 void
 ContExecutorEndBatch(ContExecutor *exec, bool commit)
 {
-	Assert(IsTransactionState());
-
-	if (commit)
+	/* We won't be in a transaction if this batch was an idle poll */
+	if (commit && IsTransactionState())
 	{
 		exec_commit(exec);
 		MemoryContextReset(ContQueryTransactionContext);
@@ -489,9 +717,11 @@ ContExecutorEndBatch(ContExecutor *exec, bool commit)
 	MemoryContextResetAndDeleteChildren(ContQueryBatchContext);
 	MemoryContextResetAndDeleteChildren(ErrorContext);
 	exec->exec_queries = NULL;
+	exec->exec_order = NULL;
 	exec->batch = NULL;
 	debug_query_string = NULL;
 	MyProcStatCQEntry = NULL;
+	MyLatencyStatCQEntry = NULL;
 }
 
 /*
@@ -590,6 +590,19 @@ FSSMerge(FSS *fss, FSS *incoming)
 	return fss;
 }
 
+/*
+ * FSSStateChanged
+ *
+ * Merging always adds the incoming count to the running count, so if the count
+ * hasn't moved then nothing was merged into the state. This only reads the fixed
+ * header and thus works on unpacked bytes as well.
+ */
+bool
+FSSStateChanged(FSS *prev, FSS *fss)
+{
+	return prev->count != fss->count || prev->m != fss->m || prev->h != fss->h || prev->k != fss->k;
+}
+
 /*
  * FSSTopK
  */
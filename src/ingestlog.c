@@ -0,0 +1,1157 @@
+/*-------------------------------------------------------------------------
+ *
+ * ingestlog.c
+ *	  Local write-ahead log for asynchronous stream inserts
+ *
+ * Asynchronous inserts return as soon as their microbatches have been handed to ZeroMQ, so anything
+ * still sitting in a socket, a queue process or a worker's memory is lost on a crash. When the ingest
+ * log is enabled, each microbatch a backend sends is first appended to a per-database log, and the
+ * insert doesn't return until its records have been fsync'd. Concurrent inserts share fsyncs, so the
+ * cost is roughly one fsync per group of inserts rather than one per insert.
+ *
+ * Every logged insert holds a slot whose embedded ack travels with its microbatches, exactly like the
+ * ack of a synchronous insert. Once combiners have committed all of an insert's tuples its slot is
+ * released, and combiners periodically persist the lowest log position that is still unacknowledged.
+ * Everything from that position onwards is replayed by the reaper after a restart, as is the range
+ * covered by any slot whose batches were lost to a crashed worker or combiner. Replay can deliver
+ * tuples that were already committed, so the guarantee is at-least-once.
+ *
+ * Copyright (c) 2018, PipelineDB, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "postgres.h"
+
+#include "access/xact.h"
+#include "access/xlog.h"
+#include "ingestlog.h"
+#include "miscadmin.h"
+#include "miscutils.h"
+#include "pipeline_stream.h"
+#include "port/pg_crc32c.h"
+#include "scheduler.h"
+#include "storage/fd.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+
+bool ingest_log_enabled;
+int ingest_log_max_pending;
+
+/*
+ * How long a slot must remain unacked after a continuous query process has restarted before
+ * we assume its batches were lost and replay them
+ */
+#define INGEST_LOG_LOST_MS 5000
+
+#define INGEST_LOG_INSERT_LOCK 0 /* serializes appends */
+#define INGEST_LOG_FLUSH_LOCK 1 /* serializes fsyncs */
+#define INGEST_LOG_SLOT_LOCK 2 /* protects slot states */
+#define INGEST_LOG_ACK_LOCK 3 /* protects the persisted ack position */
+#define INGEST_LOG_NUM_LOCKS 4
+
+typedef struct IngestLogRecord
+{
+	uint32 len; /* length of the packed microbatch that follows */
+	Oid relid; /* stream the microbatch was inserted into */
+	pg_crc32c crc; /* covers relid and the microbatch */
+} IngestLogRecord;
+
+typedef struct IngestLogAckData
+{
+	uint64 pos;
+	pg_crc32c crc;
+} IngestLogAckData;
+
+typedef struct IngestLog
+{
+	Oid db_id;
+
+	/* protects insert_pos and flush_pos */
+	slock_t mutex;
+	uint64 insert_pos;
+	uint64 flush_pos;
+
+	/* protected by the slot lock */
+	uint64 epoch;
+	uint64 pending_epoch;
+	int next_slot;
+
+	/* protected by the ack lock */
+	uint64 ack_pos;
+	uint64 pending_ack_pos;
+	XLogRecPtr pending_ack_lsn;
+	uint32 oldest_segno;
+
+	IngestLogSlot slots[FLEXIBLE_ARRAY_MEMBER];
+} IngestLog;
+
+typedef struct IngestLogReader
+{
+	uint64 pos;
+	uint32 last_segno;
+	int fd;
+	StringInfoData buf;
+} IngestLogReader;
+
+#define IngestLogSize() \
+	add_size(offsetof(IngestLog, slots), mul_size(sizeof(IngestLogSlot), ingest_log_max_pending))
+
+static HTAB *ingest_logs = NULL;
+static IngestLog *MyIngestLog = NULL;
+static LWLockPadded *ingest_log_locks = NULL;
+
+/* The segment this process last appended to or flushed, kept open across inserts */
+static int my_seg_fd = -1;
+static uint32 my_segno = 0;
+
+/* End of the last record this process appended */
+static uint64 my_insert_end = 0;
+
+/* Slots of inserts that haven't finished yet, sealed on abort */
+static List *my_open_slots = NIL;
+static bool xact_callback_registered = false;
+
+/*
+ * IngestLogRequestLWLocks
+ */
+void
+IngestLogRequestLWLocks(void)
+{
+	RequestNamedLWLockTranche("pipelinedb_ingest_log", INGEST_LOG_NUM_LOCKS);
+}
+
+/*
+ * IngestLogShmemSize
+ */
+Size
+IngestLogShmemSize(void)
+{
+	return hash_estimate_size(16, IngestLogSize());
+}
+
+/*
+ * IngestLogShmemInit
+ */
+void
+IngestLogShmemInit(void)
+{
+	HASHCTL ctl;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	MemSet(&ctl, 0, sizeof(HASHCTL));
+
+	ctl.keysize = sizeof(Oid);
+	ctl.entrysize = IngestLogSize();
+
+	ingest_logs = ShmemInitHash("IngestLogShmem", 4, 16, &ctl, HASH_ELEM | HASH_BLOBS);
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * get_lock
+ */
+static LWLock *
+get_lock(int i)
+{
+	if (!ingest_log_locks)
+		ingest_log_locks = GetNamedLWLockTranche("pipelinedb_ingest_log");
+
+	return &ingest_log_locks[i].lock;
+}
+
+/*
+ * log_dir
+ */
+static void
+log_dir(char *path)
+{
+	snprintf(path, MAXPGPATH, "%s/%s/%u", DataDir, INGEST_LOG_DIR, MyDatabaseId);
+}
+
+/*
+ * seg_path
+ */
+static void
+seg_path(char *path, uint32 segno)
+{
+	snprintf(path, MAXPGPATH, "%s/%s/%u/%08X", DataDir, INGEST_LOG_DIR, MyDatabaseId, segno);
+}
+
+/*
+ * ack_path
+ */
+static void
+ack_path(char *path)
+{
+	snprintf(path, MAXPGPATH, "%s/%s/%u/ack", DataDir, INGEST_LOG_DIR, MyDatabaseId);
+}
+
+/*
+ * open_segment
+ *
+ * Point this process's cached segment descriptor at the given segment
+ */
+static void
+open_segment(uint32 segno)
+{
+	char path[MAXPGPATH];
+
+	if (my_seg_fd >= 0 && my_segno == segno)
+		return;
+
+	if (my_seg_fd >= 0)
+		close(my_seg_fd);
+
+	seg_path(path, segno);
+	my_seg_fd = open(path, O_RDWR | O_CREAT | PG_BINARY, S_IRUSR | S_IWUSR);
+
+	if (my_seg_fd < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open ingest log segment \"%s\": %m", path)));
+
+	my_segno = segno;
+}
+
+/*
+ * write_segment
+ */
+static void
+write_segment(char *buf, int len)
+{
+	errno = 0;
+	if (write(my_seg_fd, buf, len) != len)
+	{
+		/* If write didn't set errno, assume the problem is no disk space */
+		if (errno == 0)
+			errno = ENOSPC;
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write to ingest log segment %08X: %m", my_segno)));
+	}
+}
+
+/*
+ * fsync_segment
+ */
+static void
+fsync_segment(uint32 segno)
+{
+	open_segment(segno);
+
+	if (pg_fsync(my_seg_fd) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not fsync ingest log segment %08X: %m", segno)));
+}
+
+/*
+ * read_ack_pos
+ *
+ * Returns 0 if the ack file is missing or corrupt, in which case everything still on disk is replayed
+ */
+static uint64
+read_ack_pos(void)
+{
+	IngestLogAckData data;
+	char path[MAXPGPATH];
+	pg_crc32c crc;
+	bool ok;
+	int fd;
+
+	ack_path(path);
+	fd = open(path, O_RDONLY | PG_BINARY, 0);
+	if (fd < 0)
+		return 0;
+
+	ok = read(fd, &data, sizeof(IngestLogAckData)) == sizeof(IngestLogAckData);
+	close(fd);
+
+	if (!ok)
+		return 0;
+
+	INIT_CRC32C(crc);
+	COMP_CRC32C(crc, &data.pos, sizeof(uint64));
+	FIN_CRC32C(crc);
+
+	return EQ_CRC32C(crc, data.crc) ? data.pos : 0;
+}
+
+/*
+ * persist_ack_pos
+ *
+ * The ack file isn't fsync'd, since losing an update only means replaying more than necessary
+ * after a crash. Must be called with the ack lock held.
+ */
+static void
+persist_ack_pos(IngestLog *log, uint64 pos)
+{
+	IngestLogAckData data;
+	char path[MAXPGPATH];
+	int fd;
+
+	data.pos = pos;
+	INIT_CRC32C(data.crc);
+	COMP_CRC32C(data.crc, &data.pos, sizeof(uint64));
+	FIN_CRC32C(data.crc);
+
+	ack_path(path);
+	fd = open(path, O_WRONLY | O_CREAT | PG_BINARY, S_IRUSR | S_IWUSR);
+	if (fd < 0)
+	{
+		ereport(WARNING,
+				(errcode_for_file_access(),
+				 errmsg("could not open ingest log ack file \"%s\": %m", path)));
+		return;
+	}
+
+	if (write(fd, &data, sizeof(IngestLogAckData)) != sizeof(IngestLogAckData))
+	{
+		ereport(WARNING,
+				(errcode_for_file_access(),
+				 errmsg("could not write ingest log ack file \"%s\": %m", path)));
+		close(fd);
+		return;
+	}
+
+	close(fd);
+	log->ack_pos = pos;
+
+	/* Segments entirely before the acknowledged position will never be read again */
+	while (log->oldest_segno < IngestLogPosSegNo(pos))
+	{
+		seg_path(path, log->oldest_segno);
+		if (unlink(path) < 0 && errno != ENOENT)
+		{
+			ereport(WARNING,
+					(errcode_for_file_access(),
+					 errmsg("could not remove ingest log segment \"%s\": %m", path)));
+			break;
+		}
+		log->oldest_segno++;
+	}
+}
+
+/*
+ * reader_init
+ */
+static void
+reader_init(IngestLogReader *reader, uint64 start, uint32 last_segno)
+{
+	reader->pos = start;
+	reader->last_segno = last_segno;
+	reader->fd = -1;
+	initStringInfo(&reader->buf);
+}
+
+/*
+ * reader_close
+ */
+static void
+reader_close(IngestLogReader *reader)
+{
+	if (reader->fd >= 0)
+		close(reader->fd);
+	reader->fd = -1;
+	pfree(reader->buf.data);
+}
+
+/*
+ * reader_next
+ *
+ * Reads the next valid record starting before end into the reader's buffer. A short or corrupt
+ * record ends its segment, because after a crash appends always continue in a new segment.
+ */
+static bool
+reader_next(IngestLogReader *reader, uint64 end, Oid *relid)
+{
+	for (;;)
+	{
+		IngestLogRecord rec;
+		uint32 segno = IngestLogPosSegNo(reader->pos);
+
+		if (reader->pos >= end || segno > reader->last_segno)
+			return false;
+
+		if (reader->fd < 0)
+		{
+			char path[MAXPGPATH];
+
+			seg_path(path, segno);
+			reader->fd = open(path, O_RDONLY | PG_BINARY, 0);
+
+			if (reader->fd < 0)
+			{
+				if (errno != ENOENT)
+					ereport(ERROR,
+							(errcode_for_file_access(),
+							 errmsg("could not open ingest log segment \"%s\": %m", path)));
+
+				reader->pos = IngestLogMakePos(segno + 1, 0);
+				continue;
+			}
+
+			if (lseek(reader->fd, IngestLogPosOffset(reader->pos), SEEK_SET) < 0)
+				ereport(ERROR,
+						(errcode_for_file_access(),
+						 errmsg("could not seek in ingest log segment \"%s\": %m", path)));
+		}
+
+		if (read(reader->fd, &rec, sizeof(IngestLogRecord)) == sizeof(IngestLogRecord) &&
+				rec.len > 0 && AllocSizeIsValid(rec.len))
+		{
+			resetStringInfo(&reader->buf);
+			enlargeStringInfo(&reader->buf, rec.len);
+
+			if (read(reader->fd, reader->buf.data, rec.len) == (ssize_t) rec.len)
+			{
+				pg_crc32c crc;
+
+				INIT_CRC32C(crc);
+				COMP_CRC32C(crc, &rec.relid, sizeof(Oid));
+				COMP_CRC32C(crc, reader->buf.data, rec.len);
+				FIN_CRC32C(crc);
+
+				if (EQ_CRC32C(crc, rec.crc))
+				{
+					reader->buf.len = rec.len;
+					reader->pos += sizeof(IngestLogRecord) + rec.len;
+					*relid = rec.relid;
+					return true;
+				}
+			}
+		}
+
+		close(reader->fd);
+		reader->fd = -1;
+		reader->pos = IngestLogMakePos(segno + 1, 0);
+	}
+}
+
+/*
+ * init_log
+ *
+ * Recovers the log's state from disk. Appends always start in a fresh segment, and if anything
+ * past the persisted ack position survived, a replay slot is created for it.
+ */
+static void
+init_log(IngestLog *log)
+{
+	IngestLogReader reader;
+	char dir[MAXPGPATH];
+	DIR *d;
+	struct dirent *de;
+	uint32 min_segno = PG_UINT32_MAX;
+	uint32 max_segno = 0;
+	uint64 ack_pos = read_ack_pos();
+	uint64 end;
+	Oid relid;
+	int i;
+
+	log_dir(dir);
+	d = AllocateDir(dir);
+	while ((de = ReadDir(d, dir)) != NULL)
+	{
+		uint32 segno;
+
+		if (strlen(de->d_name) != 8 || strspn(de->d_name, "0123456789ABCDEF") != 8)
+			continue;
+
+		segno = (uint32) strtoul(de->d_name, NULL, 16);
+		min_segno = Min(min_segno, segno);
+		max_segno = Max(max_segno, segno);
+	}
+	FreeDir(d);
+
+	if (min_segno == PG_UINT32_MAX)
+		min_segno = max_segno = IngestLogPosSegNo(ack_pos);
+	else if (IngestLogPosSegNo(ack_pos) < min_segno)
+		ack_pos = IngestLogMakePos(min_segno, 0);
+
+	/* Find the end of the valid records past the ack position */
+	end = ack_pos;
+	reader_init(&reader, ack_pos, max_segno);
+	while (reader_next(&reader, PG_UINT64_MAX, &relid))
+		end = reader.pos;
+	reader_close(&reader);
+
+	SpinLockInit(&log->mutex);
+	log->insert_pos = IngestLogMakePos(Max(max_segno, IngestLogPosSegNo(ack_pos)) + 1, 0);
+	log->flush_pos = log->insert_pos;
+
+	log->epoch = 1;
+	log->pending_epoch = 0;
+	log->next_slot = 0;
+
+	log->ack_pos = ack_pos;
+	log->pending_ack_pos = ack_pos;
+	log->pending_ack_lsn = InvalidXLogRecPtr;
+	log->oldest_segno = min_segno;
+
+	for (i = 0; i < ingest_log_max_pending; i++)
+	{
+		IngestLogSlot *slot = &log->slots[i];
+
+		MemSet(slot, 0, sizeof(IngestLogSlot));
+		pg_atomic_init_u64(&slot->ack.id, 0);
+		pg_atomic_init_u32(&slot->ack.num_wacks, 0);
+		pg_atomic_init_u32(&slot->ack.num_cacks, 0);
+		pg_atomic_init_u32(&slot->ack.num_wrecv, 0);
+		pg_atomic_init_u32(&slot->ack.num_wtups, 0);
+		pg_atomic_init_u32(&slot->ack.num_ctups, 0);
+		slot->state = INGEST_SLOT_FREE;
+	}
+
+	if (end > ack_pos)
+	{
+		log->slots[0].state = INGEST_SLOT_REPLAY;
+		log->slots[0].start = ack_pos;
+		log->slots[0].epoch = log->epoch;
+
+		elog(LOG, "ingest log for database %u has unacknowledged records from %X/%X to %X/%X",
+				MyDatabaseId, IngestLogPosSegNo(ack_pos), IngestLogPosOffset(ack_pos),
+				IngestLogPosSegNo(end), IngestLogPosOffset(end));
+	}
+}
+
+/*
+ * attach
+ *
+ * Returns this database's ingest log, initializing it from disk if we're the first process to use
+ * it since startup. If create is false or nothing has ever been logged for this database, NULL may
+ * be returned.
+ */
+static IngestLog *
+attach(bool create)
+{
+	IngestLog *log;
+	char dir[MAXPGPATH];
+	struct stat st;
+	bool found;
+
+	if (MyIngestLog)
+		return MyIngestLog;
+
+	LWLockAcquire(get_lock(INGEST_LOG_INSERT_LOCK), LW_SHARED);
+	log = (IngestLog *) hash_search(ingest_logs, &MyDatabaseId, HASH_FIND, &found);
+	LWLockRelease(get_lock(INGEST_LOG_INSERT_LOCK));
+
+	if (found)
+	{
+		MyIngestLog = log;
+		return log;
+	}
+
+	if (!create)
+		return NULL;
+
+	log_dir(dir);
+
+	/* If nothing was ever logged for this database there is nothing to recover either */
+	if (!ingest_log_enabled && stat(dir, &st) != 0)
+		return NULL;
+
+	if (pg_mkdir_p(dir, S_IRWXU) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not create ingest log directory \"%s\": %m", dir)));
+
+	LWLockAcquire(get_lock(INGEST_LOG_INSERT_LOCK), LW_EXCLUSIVE);
+
+	log = (IngestLog *) hash_search(ingest_logs, &MyDatabaseId, HASH_ENTER_NULL, &found);
+	if (!log)
+		ereport(ERROR,
+				(errcode(ERRCODE_OUT_OF_MEMORY),
+				 errmsg("out of shared memory"),
+				 errhint("Too many databases are using the ingest log.")));
+
+	if (!found)
+	{
+		PG_TRY();
+		{
+			init_log(log);
+		}
+		PG_CATCH();
+		{
+			hash_search(ingest_logs, &MyDatabaseId, HASH_REMOVE, NULL);
+			PG_RE_THROW();
+		}
+		PG_END_TRY();
+	}
+
+	LWLockRelease(get_lock(INGEST_LOG_INSERT_LOCK));
+
+	MyIngestLog = log;
+
+	return log;
+}
+
+/*
+ * release_slots
+ *
+ * Frees the slots of inserts whose tuples have all been committed and returns the lowest position
+ * that may still need to be replayed. Must be called with the slot lock held.
+ */
+static uint64
+release_slots(IngestLog *log)
+{
+	uint64 bound;
+	int i;
+
+	SpinLockAcquire(&log->mutex);
+	bound = log->insert_pos;
+	SpinLockRelease(&log->mutex);
+
+	for (i = 0; i < ingest_log_max_pending; i++)
+	{
+		IngestLogSlot *slot = &log->slots[i];
+
+		if (slot->state == INGEST_SLOT_FREE)
+			continue;
+
+		if (slot->state == INGEST_SLOT_SEALED && microbatch_ack_is_acked(&slot->ack))
+		{
+			microbatch_ack_free(&slot->ack);
+			slot->state = INGEST_SLOT_FREE;
+			continue;
+		}
+
+		bound = Min(bound, slot->start);
+	}
+
+	return bound;
+}
+
+/*
+ * find_free_slot
+ *
+ * Must be called with the slot lock held
+ */
+static IngestLogSlot *
+find_free_slot(IngestLog *log)
+{
+	int i;
+
+	for (i = 0; i < ingest_log_max_pending; i++)
+	{
+		int idx = (log->next_slot + i) % ingest_log_max_pending;
+
+		if (log->slots[idx].state == INGEST_SLOT_FREE)
+		{
+			log->next_slot = (idx + 1) % ingest_log_max_pending;
+			return &log->slots[idx];
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * seal_slot
+ */
+static void
+seal_slot(IngestLogSlot *slot)
+{
+	TimestampTz now = GetCurrentTimestamp();
+
+	LWLockAcquire(get_lock(INGEST_LOG_SLOT_LOCK), LW_EXCLUSIVE);
+	slot->sealed_at = now;
+	slot->state = INGEST_SLOT_SEALED;
+	LWLockRelease(get_lock(INGEST_LOG_SLOT_LOCK));
+}
+
+/*
+ * flush_log
+ *
+ * Makes everything up to the given position durable. Whoever gets the flush lock fsyncs everything
+ * appended so far, so inserts waiting behind it usually find their records already flushed.
+ */
+static void
+flush_log(IngestLog *log, uint64 upto)
+{
+	for (;;)
+	{
+		uint64 flushed;
+		uint64 target;
+
+		SpinLockAcquire(&log->mutex);
+		flushed = log->flush_pos;
+		SpinLockRelease(&log->mutex);
+
+		if (flushed >= upto)
+			return;
+
+		/* If someone else is flushing, wait for them and then check whether they covered us */
+		if (!LWLockAcquireOrWait(get_lock(INGEST_LOG_FLUSH_LOCK), LW_EXCLUSIVE))
+			continue;
+
+		SpinLockAcquire(&log->mutex);
+		flushed = log->flush_pos;
+		target = log->insert_pos;
+		SpinLockRelease(&log->mutex);
+
+		/*
+		 * Earlier segments are fsync'd when appends switch away from them, so only the segment
+		 * containing the insert position can have unflushed records.
+		 */
+		if (flushed < upto && IngestLogPosOffset(target) > 0)
+			fsync_segment(IngestLogPosSegNo(target));
+
+		SpinLockAcquire(&log->mutex);
+		log->flush_pos = Max(log->flush_pos, target);
+		SpinLockRelease(&log->mutex);
+
+		LWLockRelease(get_lock(INGEST_LOG_FLUSH_LOCK));
+		return;
+	}
+}
+
+/*
+ * ingest_log_xact_callback
+ *
+ * If an insert fails partway through, only the tuples it actually sent will ever be acked,
+ * so its slot is sealed with that many tuples.
+ */
+static void
+ingest_log_xact_callback(XactEvent event, void *arg)
+{
+	ListCell *lc;
+
+	if (event != XACT_EVENT_ABORT || my_open_slots == NIL)
+		return;
+
+	foreach(lc, my_open_slots)
+	{
+		IngestLogSlot *slot = (IngestLogSlot *) lfirst(lc);
+
+		microbatch_ack_increment_wtups(&slot->ack, slot->ntups);
+		seal_slot(slot);
+	}
+
+	list_free(my_open_slots);
+	my_open_slots = NIL;
+}
+
+/*
+ * IngestLogBegin
+ *
+ * Reserves a slot for a new logged insert. If all slots are waiting on combiners, we wait for some
+ * to be released so that the log can't grow without bound behind a stalled pipeline.
+ */
+IngestLogSlot *
+IngestLogBegin(void)
+{
+	IngestLog *log = attach(true);
+	ContQueryDatabaseMetadata *db_meta = GetMyContQueryDatabaseMetadata();
+	IngestLogSlot *slot;
+	MemoryContext old;
+
+	Assert(log);
+
+	if (!xact_callback_registered)
+	{
+		RegisterXactCallback(ingest_log_xact_callback, NULL);
+		xact_callback_registered = true;
+	}
+
+	for (;;)
+	{
+		LWLockAcquire(get_lock(INGEST_LOG_SLOT_LOCK), LW_EXCLUSIVE);
+
+		slot = find_free_slot(log);
+		if (!slot)
+		{
+			release_slots(log);
+			slot = find_free_slot(log);
+		}
+
+		if (slot)
+		{
+			SpinLockAcquire(&log->mutex);
+			slot->start = log->insert_pos;
+			SpinLockRelease(&log->mutex);
+
+			/*
+			 * A worker or combiner that restarts from here on may have lost some of this insert's tuples,
+			 * even if it restarts before the insert is done sending them
+			 */
+			slot->generation = pg_atomic_read_u64(&db_meta->generation);
+			slot->state = INGEST_SLOT_OPEN;
+			slot->epoch = log->epoch;
+			slot->ntups = 0;
+		}
+
+		LWLockRelease(get_lock(INGEST_LOG_SLOT_LOCK));
+
+		if (slot)
+			break;
+
+		pg_usleep(1000);
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	microbatch_ack_init(&slot->ack, STREAM_INSERT_ASYNCHRONOUS);
+
+	old = MemoryContextSwitchTo(TopMemoryContext);
+	my_open_slots = lappend(my_open_slots, slot);
+	MemoryContextSwitchTo(old);
+
+	return slot;
+}
+
+/*
+ * IngestLogInsert
+ *
+ * Appends a packed microbatch to the log. Records aren't durable until IngestLogEnd.
+ */
+void
+IngestLogInsert(IngestLogSlot *slot, Oid relid, char *buf, int len, int ntups)
+{
+	IngestLog *log = MyIngestLog;
+	IngestLogRecord rec;
+	uint64 pos;
+
+	Assert(log);
+
+	rec.len = len;
+	rec.relid = relid;
+	INIT_CRC32C(rec.crc);
+	COMP_CRC32C(rec.crc, &rec.relid, sizeof(Oid));
+	COMP_CRC32C(rec.crc, buf, len);
+	FIN_CRC32C(rec.crc);
+
+	LWLockAcquire(get_lock(INGEST_LOG_INSERT_LOCK), LW_EXCLUSIVE);
+
+	SpinLockAcquire(&log->mutex);
+	pos = log->insert_pos;
+	SpinLockRelease(&log->mutex);
+
+	if (IngestLogPosOffset(pos) >= INGEST_LOG_SEG_SIZE)
+	{
+		uint64 next = IngestLogMakePos(IngestLogPosSegNo(pos) + 1, 0);
+
+		/* Everything in the old segment must be durable before flush_pos can move past it */
+		fsync_segment(IngestLogPosSegNo(pos));
+
+		SpinLockAcquire(&log->mutex);
+		log->insert_pos = next;
+		log->flush_pos = Max(log->flush_pos, next);
+		SpinLockRelease(&log->mutex);
+
+		pos = next;
+	}
+
+	open_segment(IngestLogPosSegNo(pos));
+
+	if (lseek(my_seg_fd, IngestLogPosOffset(pos), SEEK_SET) < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not seek in ingest log segment %08X: %m", my_segno)));
+
+	write_segment((char *) &rec, sizeof(IngestLogRecord));
+	write_segment(buf, len);
+
+	/* This append created the segment, so make sure its directory entry is durable too */
+	if (IngestLogPosOffset(pos) == 0)
+	{
+		char dir[MAXPGPATH];
+
+		log_dir(dir);
+		fsync_fname(dir, true);
+	}
+
+	pos += sizeof(IngestLogRecord) + len;
+
+	SpinLockAcquire(&log->mutex);
+	log->insert_pos = pos;
+	SpinLockRelease(&log->mutex);
+
+	LWLockRelease(get_lock(INGEST_LOG_INSERT_LOCK));
+
+	slot->ntups += ntups;
+	my_insert_end = pos;
+}
+
+/*
+ * IngestLogEnd
+ *
+ * Called once all of an insert's batches have been sent and its ack's tuple count is final
+ */
+void
+IngestLogEnd(IngestLogSlot *slot)
+{
+	IngestLog *log = MyIngestLog;
+
+	seal_slot(slot);
+	my_open_slots = list_delete_ptr(my_open_slots, slot);
+
+	flush_log(log, my_insert_end);
+}
+
+/*
+ * IngestLogAdvance
+ *
+ * Called by combiners after they commit. Releases the slots of fully committed inserts and
+ * persists the resulting ack position.
+ */
+void
+IngestLogAdvance(void)
+{
+	IngestLog *log = attach(false);
+	uint64 bound;
+
+	if (!log)
+		return;
+
+	LWLockAcquire(get_lock(INGEST_LOG_SLOT_LOCK), LW_EXCLUSIVE);
+	bound = release_slots(log);
+	LWLockRelease(get_lock(INGEST_LOG_SLOT_LOCK));
+
+	/* Another combiner is already taking care of it */
+	if (!LWLockConditionalAcquire(get_lock(INGEST_LOG_ACK_LOCK), LW_EXCLUSIVE))
+		return;
+
+	/*
+	 * With synchronous_commit off, the commits that acked these slots may not be durable yet. So a
+	 * new position is only persisted once WAL has been flushed past everything inserted at the time
+	 * it was computed, which includes all of those commits.
+	 */
+	if (log->pending_ack_pos > log->ack_pos && GetFlushRecPtr() >= log->pending_ack_lsn)
+		persist_ack_pos(log, log->pending_ack_pos);
+
+	if (bound > log->pending_ack_pos)
+	{
+		log->pending_ack_pos = bound;
+		log->pending_ack_lsn = GetXLogInsertRecPtr();
+	}
+
+	LWLockRelease(get_lock(INGEST_LOG_ACK_LOCK));
+}
+
+/*
+ * replay_range
+ *
+ * Resends every record in [start, end) to workers under the given slot's ack. Only queries that still
+ * read from each record's stream are targeted.
+ */
+static bool
+replay_range(IngestLogSlot *slot, uint64 start, uint64 end)
+{
+	IngestLogReader reader;
+	MemoryContext cxt;
+	MemoryContext old;
+	Oid relid;
+	int nrecords = 0;
+	bool done = true;
+
+	cxt = AllocSetContextCreate(CurrentMemoryContext, "IngestLogReplayContext",
+			ALLOCSET_DEFAULT_MINSIZE,
+			ALLOCSET_DEFAULT_INITSIZE,
+			ALLOCSET_DEFAULT_MAXSIZE);
+
+	reader_init(&reader, start, IngestLogPosSegNo(end));
+
+	StartTransactionCommand();
+
+	while (reader_next(&reader, end, &relid))
+	{
+		microbatch_t *mb;
+		microbatch_t *replay;
+		Bitmapset *queries;
+		int i;
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (get_sigterm_flag())
+		{
+			done = false;
+			break;
+		}
+
+		old = MemoryContextSwitchTo(cxt);
+
+		mb = microbatch_unpack(reader.buf.data, reader.buf.len);
+		queries = bms_intersect(mb->queries, GetAllStreamReaders(relid));
+
+		if (mb->type == WorkerTuple && !bms_is_empty(queries))
+		{
+			replay = microbatch_new(WorkerTuple, queries, mb->desc);
+			microbatch_add_ack(replay, &slot->ack);
+
+			for (i = 0; i < mb->ntups; i++)
+			{
+				HeapTuple tup = (HeapTuple) mb->tups[i].ptr;
+
+				if (!microbatch_add_tuple(replay, tup, 0))
+				{
+					microbatch_send_to_worker(replay, -1);
+					microbatch_add_tuple(replay, tup, 0);
+				}
+			}
+
+			if (!microbatch_is_empty(replay))
+				microbatch_send_to_worker(replay, -1);
+
+			slot->ntups += mb->ntups;
+			nrecords++;
+		}
+
+		MemoryContextSwitchTo(old);
+		MemoryContextReset(cxt);
+	}
+
+	CommitTransactionCommand();
+
+	reader_close(&reader);
+	MemoryContextDelete(cxt);
+
+	if (nrecords)
+		elog(LOG, "replayed %d ingest log records containing %d tuples", nrecords, slot->ntups);
+
+	return done;
+}
+
+/*
+ * IngestLogReplay
+ *
+ * Called periodically by the reaper. Replays the unacknowledged tail found at startup, as well as
+ * anything covered by slots that went unacked across a continuous query process restart.
+ *
+ * All slots reserved before the replay decision (the current epoch) are folded into a single replay
+ * slot covering everything from their lowest start position up to the current insert position.
+ */
+void
+IngestLogReplay(void)
+{
+	IngestLog *log = attach(true);
+	ContQueryDatabaseMetadata *db_meta;
+	IngestLogSlot *replay = NULL;
+	TimestampTz now = GetCurrentTimestamp();
+	uint64 generation;
+	uint64 epoch;
+	uint64 start = PG_UINT64_MAX;
+	uint64 end;
+	bool done = false;
+	int i;
+
+	if (!log)
+		return;
+
+	db_meta = GetMyContQueryDatabaseMetadata();
+	generation = pg_atomic_read_u64(&db_meta->generation);
+
+	LWLockAcquire(get_lock(INGEST_LOG_SLOT_LOCK), LW_EXCLUSIVE);
+
+	if (!log->pending_epoch)
+	{
+		bool lost = false;
+
+		for (i = 0; i < ingest_log_max_pending && !lost; i++)
+		{
+			IngestLogSlot *slot = &log->slots[i];
+
+			if (slot->state == INGEST_SLOT_REPLAY)
+				lost = true;
+			else if (slot->state == INGEST_SLOT_SEALED && slot->generation != generation &&
+					!microbatch_ack_is_acked(&slot->ack) &&
+					TimestampDifferenceExceeds(slot->sealed_at, now, INGEST_LOG_LOST_MS))
+				lost = true;
+		}
+
+		if (!lost)
+		{
+			LWLockRelease(get_lock(INGEST_LOG_SLOT_LOCK));
+			return;
+		}
+
+		log->pending_epoch = log->epoch++;
+	}
+
+	epoch = log->pending_epoch;
+
+	/* Inserts that were already in progress must finish logging first, we'll try again next time */
+	for (i = 0; i < ingest_log_max_pending; i++)
+	{
+		IngestLogSlot *slot = &log->slots[i];
+
+		if (slot->state == INGEST_SLOT_OPEN && slot->epoch <= epoch)
+		{
+			LWLockRelease(get_lock(INGEST_LOG_SLOT_LOCK));
+			return;
+		}
+	}
+
+	for (i = 0; i < ingest_log_max_pending; i++)
+	{
+		IngestLogSlot *slot = &log->slots[i];
+
+		if (slot->state == INGEST_SLOT_FREE || slot->epoch > epoch)
+			continue;
+
+		start = Min(start, slot->start);
+		microbatch_ack_free(&slot->ack);
+		slot->state = INGEST_SLOT_FREE;
+	}
+
+	log->pending_epoch = 0;
+
+	/* Everything we were going to replay has been acked in the meantime */
+	if (start == PG_UINT64_MAX)
+	{
+		LWLockRelease(get_lock(INGEST_LOG_SLOT_LOCK));
+		return;
+	}
+
+	SpinLockAcquire(&log->mutex);
+	end = log->insert_pos;
+	SpinLockRelease(&log->mutex);
+
+	replay = find_free_slot(log);
+	Assert(replay);
+
+	replay->state = INGEST_SLOT_OPEN;
+	replay->start = start;
+	replay->epoch = log->epoch;
+	replay->ntups = 0;
+
+	LWLockRelease(get_lock(INGEST_LOG_SLOT_LOCK));
+
+	microbatch_ack_init(&replay->ack, STREAM_INSERT_ASYNCHRONOUS);
+
+	PG_TRY();
+	{
+		done = replay_range(replay, start, end);
+	}
+	PG_CATCH();
+	{
+		/* Leave the range marked for replay so that the next attempt picks it up */
+		LWLockAcquire(get_lock(INGEST_LOG_SLOT_LOCK), LW_EXCLUSIVE);
+		microbatch_ack_free(&replay->ack);
+		replay->state = INGEST_SLOT_REPLAY;
+		LWLockRelease(get_lock(INGEST_LOG_SLOT_LOCK));
+
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	if (!done)
+	{
+		LWLockAcquire(get_lock(INGEST_LOG_SLOT_LOCK), LW_EXCLUSIVE);
+		microbatch_ack_free(&replay->ack);
+		replay->state = INGEST_SLOT_REPLAY;
+		LWLockRelease(get_lock(INGEST_LOG_SLOT_LOCK));
+		return;
+	}
+
+	microbatch_ack_increment_wtups(&replay->ack, replay->ntups);
+	seal_slot(replay);
+}
@@ -9,17 +9,29 @@
  */
 #include "postgres.h"
 
+#include "access/heapam.h"
 #include "access/htup_details.h"
+#include "access/tuptoaster.h"
 #include "access/xact.h"
 #include "catalog/index.h"
+#if (PG_VERSION_NUM < 110000)
+#include "catalog/pg_inherits_fn.h"
+#else
+#include "catalog/pg_inherits.h"
+#endif
 #include "executor/executor.h"
 #include "matrel.h"
+#include "miscadmin.h"
 #include "miscutils.h"
 #include "nodes/execnodes.h"
+#include "stats.h"
+#include "storage/bufmgr.h"
+#include "utils/int8.h"
 #include "utils/rel.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/palloc.h"
+#include "utils/snapmgr.h"
 #include "utils/syscache.h"
 
 bool matrels_writable;
@@ -141,6 +153,83 @@ ExecInsertCQMatRelIndexTuples(ResultRelInfo *indstate, TupleTableSlot *slot, ESt
 	}
 }
 
+/*
+ * count_toast_bytes
+ *
+ * The heap stores its own toasted copy of a tuple rather than modifying ours, so to find out how many
+ * bytes a write sent to the TOAST table we look at the stored tuple's external pointers, skipping any
+ * that were passed in unchanged. An update reuses those as they are, while an insert writes its own copy
+ * of every external value it is given.
+ *
+ * The toaster only writes anything out of line for tuples over TOAST_TUPLE_THRESHOLD, or for inserts of
+ * external values, so other writes never look at the stored tuple. The ones that do read back the page
+ * the write just dirtied, which is still in shared buffers.
+ */
+static void
+count_toast_bytes(Relation rel, HeapTuple tup, bool update)
+{
+	TupleDesc desc = RelationGetDescr(rel);
+	HeapTupleData stored;
+	Buffer buf;
+	Page page;
+	ItemId lp;
+	int64 nbytes = 0;
+	int i;
+
+	if (!MyProcStatCQEntry || !OidIsValid(rel->rd_rel->reltoastrelid))
+		return;
+
+	if (tup->t_len <= TOAST_TUPLE_THRESHOLD && (update || !HeapTupleHasExternal(tup)))
+		return;
+
+	buf = ReadBuffer(rel, ItemPointerGetBlockNumber(&tup->t_self));
+	LockBuffer(buf, BUFFER_LOCK_SHARE);
+
+	page = BufferGetPage(buf);
+	lp = PageGetItemId(page, ItemPointerGetOffsetNumber(&tup->t_self));
+
+	stored.t_data = (HeapTupleHeader) PageGetItem(page, lp);
+	stored.t_len = ItemIdGetLength(lp);
+	stored.t_tableOid = RelationGetRelid(rel);
+	stored.t_self = tup->t_self;
+
+	if (HeapTupleHasExternal(&stored))
+	{
+		for (i = 0; i < desc->natts; i++)
+		{
+			Form_pg_attribute attr = TupleDescAttr(desc, i);
+			struct varatt_external toast_pointer;
+			Datum value;
+			Datum given;
+			bool isnull;
+
+			if (attr->attisdropped || attr->attlen != -1)
+				continue;
+
+			value = heap_getattr(&stored, i + 1, desc, &isnull);
+			if (isnull || !VARATT_IS_EXTERNAL_ONDISK(DatumGetPointer(value)))
+				continue;
+
+			/* An update keeps the same TOAST pointer for values it didn't change */
+			if (update)
+			{
+				given = heap_getattr(tup, i + 1, desc, &isnull);
+				if (!isnull && VARATT_IS_EXTERNAL_ONDISK(DatumGetPointer(given)) &&
+						memcmp(DatumGetPointer(given), DatumGetPointer(value),
+							VARSIZE_EXTERNAL(DatumGetPointer(value))) == 0)
+					continue;
+			}
+
+			VARATT_EXTERNAL_GET_POINTER(toast_pointer, DatumGetPointer(value));
+			nbytes += toast_pointer.va_extsize;
+		}
+	}
+
+	UnlockReleaseBuffer(buf);
+
+	StatsIncrementCQToast(nbytes);
+}
+
 /*
  * ExecCQMatViewUpdate
  *
@@ -176,6 +265,7 @@ ExecCQMatRelUpdate(ResultRelInfo *ri, TupleTableSlot *slot, EState *estate)
 
 	tup = ExecMaterializeSlot(slot);
 	simple_heap_update(ri->ri_RelationDesc, &tup->t_self, tup);
+	count_toast_bytes(ri->ri_RelationDesc, tup, true);
 
 	if (!HeapTupleIsHeapOnly(tup))
 		ExecInsertCQMatRelIndexTuples(ri, slot, estate);
@@ -217,6 +307,7 @@ ExecCQMatRelInsert(ResultRelInfo *ri, TupleTableSlot *slot, EState *estate)
 	tup = ExecMaterializeSlot(slot);
 
 	heap_insert(ri->ri_RelationDesc, tup, GetCurrentCommandId(true), 0, NULL);
+	count_toast_bytes(ri->ri_RelationDesc, tup, false);
 	ExecInsertCQMatRelIndexTuples(ri, slot, estate);
 }
 
@@ -275,3 +366,370 @@ CVNameToSeqRelName(char *cv_name)
 
 	return relname;
 }
+
+/*
+ * CVNameToTopNName
+ */
+char *
+CVNameToTopNName(char *cv_name)
+{
+	char *relname = palloc0(NAMEDATALEN);
+
+	strcpy(relname, cv_name);
+	append_suffix(relname, CQ_TOPN_SUFFIX, NAMEDATALEN);
+
+	return relname;
+}
+
+/*
+ * MatRelNameToShardName
+ */
+char *
+MatRelNameToShardName(char *matrel_name, int shard)
+{
+	char *relname = palloc0(NAMEDATALEN);
+	char suffix[NAMEDATALEN];
+
+	snprintf(suffix, NAMEDATALEN, "_%d", shard);
+	strcpy(relname, matrel_name);
+	append_suffix(relname, suffix, NAMEDATALEN);
+
+	return relname;
+}
+
+/*
+ * GetMatRelShardRelid
+ *
+ * Shards are inheritance children of the matrel, identified by their name so that they
+ * can be found no matter what schema the CV has been moved to
+ */
+Oid
+GetMatRelShardRelid(Oid matrelid, int shard)
+{
+	char *matrel_name = get_rel_name(matrelid);
+	char *shard_name;
+	List *children;
+	ListCell *lc;
+	Oid result = InvalidOid;
+
+	if (!matrel_name)
+		elog(ERROR, "cache lookup failed for relation %u", matrelid);
+
+	shard_name = MatRelNameToShardName(matrel_name, shard);
+	children = find_inheritance_children(matrelid, NoLock);
+
+	foreach(lc, children)
+	{
+		Oid relid = lfirst_oid(lc);
+		char *relname = get_rel_name(relid);
+
+		if (relname && !strcmp(relname, shard_name))
+		{
+			result = relid;
+			break;
+		}
+	}
+
+	list_free(children);
+
+	if (!OidIsValid(result))
+		elog(ERROR, "shard %d of materialization table \"%s\" not found", shard, matrel_name);
+
+	return result;
+}
+
+/*
+ * TimestampGetTTLPartitionStart
+ *
+ * Returns the start of the TTL partition range that the given TTL column value falls in, as Unix time.
+ * Ranges are aligned to multiples of their width, so every combiner and the reaper agree on them.
+ */
+int64
+TimestampGetTTLPartitionStart(Timestamp ts, int interval)
+{
+	int64 width = (int64) interval * USECS_PER_SEC;
+	int64 bucket = ts / width;
+
+	/* Round down for timestamps before the Postgres epoch too */
+	if (ts % width < 0)
+		bucket--;
+
+	return bucket * interval + (int64) (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY;
+}
+
+/*
+ * TTLPartitionStartGetTimestamp
+ */
+Timestamp
+TTLPartitionStartGetTimestamp(int64 start)
+{
+	return (start - (int64) (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY) * USECS_PER_SEC;
+}
+
+/*
+ * MatRelNameToTTLPartitionName
+ *
+ * TTL partitions are named after the Unix time their range starts at
+ */
+char *
+MatRelNameToTTLPartitionName(char *matrel_name, int64 start)
+{
+	char *relname = palloc0(NAMEDATALEN);
+	char suffix[NAMEDATALEN];
+
+	snprintf(suffix, NAMEDATALEN, "_" INT64_FORMAT, start);
+	strcpy(relname, matrel_name);
+	append_suffix(relname, suffix, NAMEDATALEN);
+
+	return relname;
+}
+
+/*
+ * TTLPartitionNameGetStart
+ *
+ * Determines whether the given relation is one of a matrel's TTL partitions, and if so, when its range starts
+ */
+bool
+TTLPartitionNameGetStart(char *matrel_name, char *relname, int64 *start)
+{
+	char *suffix = strrchr(relname, '_');
+	int64 value;
+
+	if (!suffix || !scanint8(suffix + 1, true, &value))
+		return false;
+
+	/* The matrel's name may have been truncated to make room for the suffix */
+	if (strcmp(MatRelNameToTTLPartitionName(matrel_name, value), relname))
+		return false;
+
+	*start = value;
+
+	return true;
+}
+
+/*
+ * MatRelNameToSnapshotName
+ */
+char *
+MatRelNameToSnapshotName(char *matrel_name)
+{
+	char *relname = palloc0(NAMEDATALEN);
+
+	strcpy(relname, matrel_name);
+	append_suffix(relname, CQ_SNAPSHOT_SUFFIX, NAMEDATALEN);
+
+	return relname;
+}
+
+/*
+ * MatRelNameToSnapshotMarkerName
+ */
+char *
+MatRelNameToSnapshotMarkerName(char *matrel_name)
+{
+	char *relname = palloc0(NAMEDATALEN);
+
+	strcpy(relname, matrel_name);
+	append_suffix(relname, CQ_SNAPSHOT_MARKER_SUFFIX, NAMEDATALEN);
+
+	return relname;
+}
+
+/*
+ * MatRelNameToArchiveName
+ */
+char *
+MatRelNameToArchiveName(char *matrel_name)
+{
+	char *relname = palloc0(NAMEDATALEN);
+
+	strcpy(relname, matrel_name);
+	append_suffix(relname, CQ_ARCHIVE_SUFFIX, NAMEDATALEN);
+
+	return relname;
+}
+
+/*
+ * MatRelNameToTopNName
+ */
+char *
+MatRelNameToTopNName(char *matrel_name)
+{
+	char *relname = palloc0(NAMEDATALEN);
+
+	strcpy(relname, matrel_name);
+	append_suffix(relname, CQ_TOPN_SUFFIX, NAMEDATALEN);
+
+	return relname;
+}
+
+/*
+ * MatRelNameToCacheName
+ */
+char *
+MatRelNameToCacheName(char *matrel_name)
+{
+	char *relname = palloc0(NAMEDATALEN);
+
+	strcpy(relname, matrel_name);
+	append_suffix(relname, CQ_CACHE_SUFFIX, NAMEDATALEN);
+
+	return relname;
+}
+
+/*
+ * get_matrel_sibling_relid
+ *
+ * Snapshot, archive, top-N and cache relations always live in the same schema as their matrel
+ */
+static Oid
+get_matrel_sibling_relid(Oid matrelid, char *relname)
+{
+	Oid result = get_relname_relid(relname, get_rel_namespace(matrelid));
+
+	if (!OidIsValid(result))
+		elog(ERROR, "relation \"%s\" not found", relname);
+
+	return result;
+}
+
+/*
+ * GetMatRelSnapshotRelid
+ */
+Oid
+GetMatRelSnapshotRelid(Oid matrelid)
+{
+	char *matrel_name = get_rel_name(matrelid);
+
+	if (!matrel_name)
+		elog(ERROR, "cache lookup failed for relation %u", matrelid);
+
+	return get_matrel_sibling_relid(matrelid, MatRelNameToSnapshotName(matrel_name));
+}
+
+/*
+ * GetMatRelSnapshotMarkerRelid
+ */
+Oid
+GetMatRelSnapshotMarkerRelid(Oid matrelid)
+{
+	char *matrel_name = get_rel_name(matrelid);
+
+	if (!matrel_name)
+		elog(ERROR, "cache lookup failed for relation %u", matrelid);
+
+	return get_matrel_sibling_relid(matrelid, MatRelNameToSnapshotMarkerName(matrel_name));
+}
+
+/*
+ * GetMatRelArchiveRelid
+ */
+Oid
+GetMatRelArchiveRelid(Oid matrelid)
+{
+	char *matrel_name = get_rel_name(matrelid);
+
+	if (!matrel_name)
+		elog(ERROR, "cache lookup failed for relation %u", matrelid);
+
+	return get_matrel_sibling_relid(matrelid, MatRelNameToArchiveName(matrel_name));
+}
+
+/*
+ * GetMatRelTopNRelid
+ */
+Oid
+GetMatRelTopNRelid(Oid matrelid)
+{
+	char *matrel_name = get_rel_name(matrelid);
+
+	if (!matrel_name)
+		elog(ERROR, "cache lookup failed for relation %u", matrelid);
+
+	return get_matrel_sibling_relid(matrelid, MatRelNameToTopNName(matrel_name));
+}
+
+/*
+ * GetMatRelCacheRelid
+ */
+Oid
+GetMatRelCacheRelid(Oid matrelid)
+{
+	char *matrel_name = get_rel_name(matrelid);
+
+	if (!matrel_name)
+		elog(ERROR, "cache lookup failed for relation %u", matrelid);
+
+	return get_matrel_sibling_relid(matrelid, MatRelNameToCacheName(matrel_name));
+}
+
+/*
+ * RestoreMatRelSnapshot
+ *
+ * Crash recovery resets an unlogged matrel to empty, and with it the unlogged marker relation that
+ * always holds a single row otherwise. If the marker is empty, reload the matrel from its last logged
+ * snapshot and put the marker back. The marker is locked until the end of the transaction, so the
+ * first process to get here does the restore and everyone else sees the restored matrel.
+ */
+void
+RestoreMatRelSnapshot(Oid matrelid)
+{
+	Relation marker = heap_open(GetMatRelSnapshotMarkerRelid(matrelid), ExclusiveLock);
+	Relation snapshot;
+	Relation matrel;
+	ResultRelInfo *ri;
+	EState *estate;
+	TupleTableSlot *slot;
+	HeapScanDesc scan;
+	HeapTuple tup;
+	bool reset;
+	int64 nrows = 0;
+
+	scan = heap_beginscan(marker, GetLatestSnapshot(), 0, NULL);
+	reset = heap_getnext(scan, ForwardScanDirection) == NULL;
+	heap_endscan(scan);
+
+	if (!reset)
+	{
+		heap_close(marker, NoLock);
+		return;
+	}
+
+	matrel = heap_open(matrelid, RowExclusiveLock);
+	snapshot = heap_open(GetMatRelSnapshotRelid(matrelid), AccessShareLock);
+
+	estate = CreateExecutorState();
+	ri = CQMatRelOpen(matrel);
+	estate->es_result_relations = ri;
+	estate->es_num_result_relations = 1;
+	estate->es_result_relation_info = ri;
+
+	slot = MakeSingleTupleTableSlot(RelationGetDescr(matrel));
+
+	/* The snapshot relation has exactly the same columns as the matrel */
+	scan = heap_beginscan(snapshot, GetLatestSnapshot(), 0, NULL);
+	while ((tup = heap_getnext(scan, ForwardScanDirection)) != NULL)
+	{
+		CHECK_FOR_INTERRUPTS();
+
+		ExecStoreTuple(heap_copytuple(tup), slot, InvalidBuffer, true);
+		ExecCQMatRelInsert(ri, slot, estate);
+		ExecClearTuple(slot);
+		ResetPerTupleExprContext(estate);
+		nrows++;
+	}
+	heap_endscan(scan);
+
+	ExecDropSingleTupleTableSlot(slot);
+	CQMatRelClose(ri);
+	FreeExecutorState(estate);
+
+	simple_heap_insert(marker, heap_form_tuple(RelationGetDescr(marker), NULL, NULL));
+	CommandCounterIncrement();
+
+	elog(LOG, "restored " INT64_FORMAT " rows of \"%s\" from its last snapshot", nrows, RelationGetRelationName(matrel));
+
+	heap_close(snapshot, AccessShareLock);
+	heap_close(matrel, NoLock);
+	heap_close(marker, NoLock);
+}
@@ -10,9 +10,11 @@
 
 #include "catalog/pg_type.h"
 #include "executor.h"
+#include "ingestlog.h"
 #include "miscadmin.h"
 #include "nodes/value.h"
 #include "microbatch.h"
+#include "pipeline_trace.h"
 #include "pzmq.h"
 #include "miscutils.h"
 #include "storage/shmem.h"
@@ -94,17 +96,28 @@ microbatch_ipc_init(void)
 }
 
 /*
- * microbatch_ack_new
+ * make_ack_id
  */
-microbatch_ack_t *
-microbatch_ack_new(StreamInsertLevel level)
+static uint64
+make_ack_id(StreamInsertLevel level)
 {
-	microbatch_ack_t *ack;
 	uint64 id;
 	id = level;
 	id <<= 62L;
 	id |= (rand() ^ (int) MyProcPid) & 0x3fffffffffffffff;
 
+	return id;
+}
+
+/*
+ * microbatch_ack_new
+ */
+microbatch_ack_t *
+microbatch_ack_new(StreamInsertLevel level)
+{
+	microbatch_ack_t *ack;
+	uint64 id = make_ack_id(level);
+
 	for (;;)
 	{
 		int i = pg_atomic_fetch_add_u64(&MicrobatchAckShmem->counter, 1) % MAX_MICROBATCHES;
@@ -129,9 +142,29 @@ microbatch_ack_new(StreamInsertLevel level)
 		break;
 	}
 
+	TRACE_PIPELINEDB_ACK_CREATE(id, level);
+
 	return ack;
 }
 
+/*
+ * microbatch_ack_init
+ *
+ * Initializes an ack that lives outside of the shared ack pool
+ */
+void
+microbatch_ack_init(microbatch_ack_t *ack, StreamInsertLevel level)
+{
+	pg_atomic_write_u32(&ack->num_cacks, 0);
+	pg_atomic_write_u32(&ack->num_ctups, 0);
+	pg_atomic_write_u32(&ack->num_wacks, 0);
+	pg_atomic_write_u32(&ack->num_wrecv, 0);
+	pg_atomic_write_u32(&ack->num_wtups, 0);
+	pg_atomic_write_u64(&ack->id, make_ack_id(level));
+
+	TRACE_PIPELINEDB_ACK_CREATE(pg_atomic_read_u64(&ack->id), level);
+}
+
 /*
  * microbatch_ack_free
  */
@@ -150,10 +183,14 @@ microbatch_ack_wait(microbatch_ack_t *ack, ContQueryDatabaseMetadata *db_meta, u
 	bool success = false;
 	uint64 generation;
 	StreamInsertLevel level = microbatch_ack_get_level(ack);
+	TimestampTz start = 0;
 
 	if (level == STREAM_INSERT_ASYNCHRONOUS)
 		return true;
 
+	if (TRACE_PIPELINEDB_ACK_DONE_ENABLED())
+		start = GetCurrentTimestamp();
+
 	for (;;)
 	{
 		if (level == STREAM_INSERT_SYNCHRONOUS_RECEIVE && microbatch_ack_is_received(ack))
@@ -183,6 +220,9 @@ microbatch_ack_wait(microbatch_ack_t *ack, ContQueryDatabaseMetadata *db_meta, u
 		CHECK_FOR_INTERRUPTS();
 	}
 
+	TRACE_PIPELINEDB_ACK_DONE(pg_atomic_read_u64(&ack->id), level, success,
+			start ? GetCurrentTimestamp() - start : -1);
+
 	return success;
 }
 
@@ -200,6 +240,7 @@ microbatch_new(microbatch_type_t type, Bitmapset *queries, TupleDesc desc)
 	mb->buf = makeStringInfo();
 
 	mb->packed_size = sizeof(microbatch_type_t);
+	mb->packed_size += sizeof(TimestampTz); /* send time */
 	mb->packed_size += sizeof(int); /* number of tuples */
 	mb->packed_size += sizeof(int); /* number of acks */
 
@@ -456,6 +497,10 @@ microbatch_pack(microbatch_t *mb, int *len)
 	memcpy(pos, &mb->type, sizeof(microbatch_type_t));
 	pos += sizeof(microbatch_type_t);
 
+	mb->sent_at = GetCurrentTimestamp();
+	memcpy(pos, &mb->sent_at, sizeof(TimestampTz));
+	pos += sizeof(TimestampTz);
+
 	/* Pack acks */
 	memcpy(pos, &nacks, sizeof(int));
 	pos += sizeof(int);
@@ -533,6 +578,9 @@ microbatch_unpack(char *buf, int len)
 	memcpy(&mb->type, pos, sizeof(microbatch_type_t));
 	pos += sizeof(microbatch_type_t);
 
+	memcpy(&mb->sent_at, pos, sizeof(TimestampTz));
+	pos += sizeof(TimestampTz);
+
 	/* Unpack acks */
 	memcpy(&nacks, pos, sizeof(int));
 	pos += sizeof(int);
@@ -620,6 +668,11 @@ microbatch_send(microbatch_t *mb, uint64 recv_id, bool async, ContQueryDatabaseM
 	int len;
 	char *buf = microbatch_pack(mb, &len);
 
+	if (mb->log_slot)
+		IngestLogInsert(mb->log_slot, mb->log_relid, buf, len, mb->ntups);
+
+	TRACE_PIPELINEDB_MICROBATCH_SEND(mb->type, mb->ntups, len, async);
+
 	pzmq_connect(recv_id);
 
 	if (!async)
@@ -648,6 +701,8 @@ microbatch_send(microbatch_t *mb, uint64 recv_id, bool async, ContQueryDatabaseM
 		int queue_id = rand() % num_queues;
 		int offset = num_workers + num_combiners;
 
+		TRACE_PIPELINEDB_MICROBATCH_SEND_QUEUE(mb->type, mb->ntups, len);
+
 		/* TODO(derekjn) encapsulate this offset arithmetic in a function */
 		queue_id = db_meta->db_procs[offset + queue_id].pzmq_id;
 		buf = microbatch_pack_for_queue(recv_id, buf, &len);
@@ -24,6 +24,7 @@
 #include "funcapi.h"
 #include "executor/spi.h"
 #include "libpq/pqformat.h"
+#include "matrel.h"
 #include "microbatch.h"
 #include "miscutils.h"
 #include "nodes/execnodes.h"
@@ -36,6 +37,7 @@
 #include "utils/builtins.h"
 #include "utils/datum.h"
 #include "utils/fmgrprotos.h"
+#include "utils/lsyscache.h"
 #include "utils/numeric.h"
 #include "utils/rel.h"
 #include "utils/syscache.h"
@@ -631,6 +633,10 @@ pipeline_truncate_continuous_view(PG_FUNCTION_ARGS)
 	Relation pipeline_query = OpenPipelineQuery(RowExclusiveLock);
 
 	RangeVar *matrel;
+	Oid matrelid;
+	Oid topnrelid;
+	Oid cacherelid;
+	ContQuery *cv;
 	HeapTuple tuple = GetPipelineQueryTuple(rv);
 
 	if (!HeapTupleIsValid(tuple))
@@ -641,6 +647,25 @@ pipeline_truncate_continuous_view(PG_FUNCTION_ARGS)
 	matrel = RangeVarGetMatRelName(rv);
 	trunc->relations = lappend(trunc->relations, matrel);
 
+	/* Otherwise an unlogged matrel's last snapshot would bring the truncated rows back after a crash */
+	matrelid = RangeVarGetRelid(matrel, NoLock, false);
+	if (get_rel_persistence(matrelid) == RELPERSISTENCE_UNLOGGED)
+		trunc->relations = lappend(trunc->relations, RelidGetRangeVar(GetMatRelSnapshotRelid(matrelid)));
+
+	/* Frozen groups live on in the archive, which the overlay view reads alongside the matrel */
+	cv = RangeVarGetContQuery(rv);
+	if (cv && cv->freeze_after)
+		trunc->relations = lappend(trunc->relations, RelidGetRangeVar(GetMatRelArchiveRelid(matrelid)));
+
+	/* Combiners notice the top-N relation's new relfilenode and start over from an empty top-N */
+	topnrelid = get_relname_relid(MatRelNameToTopNName(matrel->relname), get_rel_namespace(matrelid));
+	if (OidIsValid(topnrelid))
+		trunc->relations = lappend(trunc->relations, RelidGetRangeVar(topnrelid));
+
+	cacherelid = get_relname_relid(MatRelNameToCacheName(matrel->relname), get_rel_namespace(matrelid));
+	if (OidIsValid(cacherelid))
+		trunc->relations = lappend(trunc->relations, RelidGetRangeVar(cacherelid));
+
 	ClosePipelineQuery(pipeline_query, NoLock);
 
 	/* Call TRUNCATE on the backing view table(s). */
@@ -735,8 +760,17 @@ pipeline_set_ttl(PG_FUNCTION_ARGS)
 
 		if (!AttributeNumberIsValid(ttl_attno))
 			elog(ERROR, "column \"%s\" does not exist", ttl_colname);
+
+		/* Archived groups can only be expired a whole row group at a time, by their bucket */
+		if (cv->freeze_after && ttl_attno != cv->freeze_attno)
+			elog(ERROR, "the TTL column of a continuous view with \"%s\" must be its time bucket column", OPTION_FREEZE_AFTER);
 	}
 
+	/* Partitions are bounded by the TTL column, and combiners and the reaper both depend on it */
+	if (cv->ttl_partition && (!ttli || ttl_attno != cv->ttl_attno))
+		elog(ERROR, "the TTL of a continuous view with \"%s\" can't be removed or moved to another column",
+				OPTION_TTL_PARTITION);
+
 	ttl = ttli ? IntervalToEpoch(ttli) : -1;
 
 	initStringInfo(&buf);
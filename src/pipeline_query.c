@@ -8,6 +8,7 @@
  */
 #include "postgres.h"
 
+#include "access/genam.h"
 #include "access/heapam.h"
 #include "access/htup.h"
 #include "access/htup_details.h"
@@ -16,8 +17,14 @@
 #include "access/xact.h"
 #include "analyzer.h"
 #include "catalog.h"
+#include "catalog/dependency.h"
 #include "catalog/indexing.h"
 #include "catalog/namespace.h"
+#if (PG_VERSION_NUM < 110000)
+#include "catalog/pg_inherits_fn.h"
+#else
+#include "catalog/pg_inherits.h"
+#endif
 #include "catalog/pg_namespace.h"
 #include "catalog/pg_proc.h"
 #include "catalog/pg_rewrite.h"
@@ -25,25 +32,32 @@
 #include "catalog/toasting.h"
 #include "commands/alter.h"
 #include "commands/defrem.h"
+#include "commands/extension.h"
 #include "commands/sequence.h"
 #include "commands/tablecmds.h"
+#include "commands/tablespace.h"
 #include "commands/view.h"
 #include "compat.h"
+#include "config.h"
 #include "executor/spi.h"
 #include "matrel.h"
 #include "miscadmin.h"
 #include "miscutils.h"
 #include "nodes/makefuncs.h"
 #include "nodes/nodeFuncs.h"
+#include "optimizer/clauses.h"
+#include "optimizer/tlist.h"
 #include "parser/analyze.h"
 #include "parser/parse_coerce.h"
 #include "parser/parse_func.h"
 #include "parser/parse_target.h"
 #include "parser/parse_type.h"
+#include "parser/parsetree.h"
 #include "pipeline_query.h"
 #include "pipeline_stream.h"
 #include "planner.h"
 #include "rewrite/rewriteHandler.h"
+#include "rewrite/rewriteManip.h"
 #include "ruleutils.h"
 #include "stats.h"
 #include "tcop/tcopprot.h"
@@ -55,14 +69,18 @@
 #include "utils/rel.h"
 #include "utils/snapmgr.h"
 #include "utils/syscache.h"
+#include "utils/timestamp.h"
+#include "utils/typcache.h"
 #include "utils/varlena.h"
 
 #define CQ_MATREL_INDEX_TYPE "btree"
 #define is_sw(row) ((row)->step_factor > 0)
+#define TTL_PARTITION_LOOKAHEAD 10 /* seconds */
 
 Oid PipelineQueryRelationOid;
 
 int continuous_view_fillfactor;
+int sketch_storage;
 
 /*
  * compare_oid
@@ -353,6 +371,29 @@ GetContQueryDef(Oid defrelid)
 	return result;
 }
 
+/*
+ * GetContViewMatRelQuery
+ *
+ * Get the part of a CV's view that reads from its matrel. That's the whole view unless the CV freezes its
+ * closed buckets or caches its finalized rows, in which case the view is a union of it and a scan of the
+ * CV's archive or cache.
+ */
+Query *
+GetContViewMatRelQuery(Relation overlayrel)
+{
+	Query *result = get_view_query(overlayrel);
+
+	if (result->setOperations)
+	{
+		SetOperationStmt *setop = (SetOperationStmt *) result->setOperations;
+
+		Assert(IsA(setop->larg, RangeTblRef));
+		result = rt_fetch(((RangeTblRef *) setop->larg)->rtindex, result->rtable)->subquery;
+	}
+
+	return result;
+}
+
 /*
  * AcquirePipelineDDLLock
  */
@@ -896,6 +937,41 @@ create_lookup_index(RangeVar *cv, Oid matrelid, RangeVar *matrel, SelectStmt *se
 	return index_oid;
 }
 
+/*
+ * create_ttl_index
+ *
+ * Create an index on a TTL matrel's TTL column, which allows expired rows to be found without
+ * scanning the entire matrel. Sliding windows without any grouping already have one.
+ */
+static Oid
+create_ttl_index(Oid matrelid, RangeVar *matrel, SelectStmt *select, bool is_sw, AttrNumber ttl_attno)
+{
+	IndexStmt *index;
+	IndexElem *indexcol;
+	ObjectAddress address;
+
+	if (select->groupClause == NIL && is_sw)
+		return InvalidOid;
+
+	indexcol = makeNode(IndexElem);
+	indexcol->name = CompatGetAttName(matrelid, ttl_attno);
+	indexcol->ordering = SORTBY_DEFAULT;
+	indexcol->nulls_ordering = SORTBY_NULLS_DEFAULT;
+
+	index = makeNode(IndexStmt);
+	index->relation = matrel;
+	index->accessMethod = CQ_MATREL_INDEX_TYPE;
+	index->indexParams = list_make1(indexcol);
+
+#if (PG_VERSION_NUM < 110000)
+	address = DefineIndex(matrelid, index, InvalidOid, false, false, false, false, false);
+#else
+	address = DefineIndex(matrelid, index, InvalidOid, InvalidOid, InvalidOid, false, false, false, false, false);
+#endif
+
+	return address.objectId;
+}
+
 /*
  * create_pkey_index
  */
@@ -932,187 +1008,989 @@ create_pkey_index(RangeVar *cv, Oid matrelid, RangeVar *matrel, char *colname)
 }
 
 /*
- * DefineContView
+ * create_matrel_shards
  *
- * Adds a CV to the `pipeline_query` catalog table.
+ * Create the given number of shards for a matrel. Shards are inheritance children of the matrel
+ * that each have their own copy of the matrel's indexes, and each combiner only ever writes to the
+ * shards it owns. Reads of the matrel itself see the rows of all of its shards.
+ *
+ * This only relies on plain table inheritance. Combiners and workers route each group to its shard
+ * themselves, so we don't need declarative partitioning. PG11 does have hash partitioning and
+ * partitioned indexes, but PG10 has neither, and PG11 requires unique indexes on a partitioned table
+ * to include the partition key, which the matrel's "$pk" index does not.
  */
-Oid
-DefineContView(Relation pipeline_query, Oid relid, Oid streamrelid, Oid matrelid, Oid seqrelid, int ttl,
-		AttrNumber ttl_attno, double step_factor, Oid *pq_id)
+static void
+create_matrel_shards(RangeVar *cv, Oid matrelid, RangeVar *matrel, CreateStmt *matrel_stmt,
+		SelectStmt *select, bool is_sw, AttrNumber ttl_attno, char *pkname, int nshards)
 {
-	HeapTuple tup;
-	bool nulls[Natts_pipeline_query];
-	Datum values[Natts_pipeline_query];
-	Oid id;
-	Oid result;
+	static char *validnsps[] = HEAP_RELOPT_NAMESPACES;
+	ObjectAddress referenced;
+	int i;
 
-	id = get_next_id(pipeline_query);
+	referenced.classId = RelationRelationId;
+	referenced.objectId = matrelid;
+	referenced.objectSubId = 0;
 
-	Assert(OidIsValid(id));
+	for (i = 0; i < nshards; i++)
+	{
+		CreateStmt *create_stmt = makeNode(CreateStmt);
+		RangeVar *shard = makeRangeVar(matrel->schemaname, MatRelNameToShardName(matrel->relname, i), -1);
+		ObjectAddress address;
+		Datum toast_options;
 
-	MemSet(values, 0, sizeof(values));
-	MemSet(nulls, 0, sizeof(nulls));
+		create_stmt->relation = shard;
+		create_stmt->inhRelations = list_make1(matrel);
+		create_stmt->options = matrel_stmt->options;
+		create_stmt->tablespacename = matrel_stmt->tablespacename;
 
-	values[Anum_pipeline_query_type - 1] = CharGetDatum(PIPELINE_QUERY_VIEW);
+		address = DefineRelation(create_stmt, RELKIND_RELATION, InvalidOid, NULL, NULL);
+		CommandCounterIncrement();
 
-	values[Anum_pipeline_query_id - 1] = Int32GetDatum(id);
-	values[Anum_pipeline_query_relid - 1] = ObjectIdGetDatum(relid);
-	values[Anum_pipeline_query_active - 1] = BoolGetDatum(continuous_queries_enabled);
-	values[Anum_pipeline_query_streamrelid - 1] = ObjectIdGetDatum(streamrelid);
-	values[Anum_pipeline_query_matrelid - 1] = ObjectIdGetDatum(matrelid);
-	values[Anum_pipeline_query_seqrelid - 1] = ObjectIdGetDatum(seqrelid);
-	values[Anum_pipeline_query_ttl - 1] = Int32GetDatum(ttl);
-	values[Anum_pipeline_query_ttl_attno - 1] = Int16GetDatum(ttl_attno);
-	values[Anum_pipeline_query_step_factor - 1] = Int16GetDatum((int16) step_factor);
+		toast_options = transformRelOptions((Datum) 0, create_stmt->options, "toast",
+				validnsps, true, false);
 
-	/* unused */
-	values[Anum_pipeline_query_tgnargs - 1] = Int16GetDatum(0);
-	values[Anum_pipeline_query_tgargs - 1] = DirectFunctionCall1(byteain, CStringGetDatum(""));
+		(void) heap_reloptions(RELKIND_TOASTVALUE, toast_options, true);
+		AlterTableCreateToastTable(address.objectId, toast_options, AccessExclusiveLock);
 
-	tup = heap_form_tuple(pipeline_query->rd_att, values, nulls);
-	result = PipelineCatalogTupleInsert(pipeline_query, tup);
+		create_lookup_index(cv, address.objectId, shard, select, is_sw);
+		CommandCounterIncrement();
 
-	*pq_id = id;
+		if (AttributeNumberIsValid(ttl_attno))
+		{
+			create_ttl_index(address.objectId, shard, select, is_sw, ttl_attno);
+			CommandCounterIncrement();
+		}
 
-	return result;
+		create_pkey_index(cv, address.objectId, shard, pkname);
+		CommandCounterIncrement();
+
+		/* Shards can't be dropped on their own, but they go away with the matrel */
+		recordDependencyOn(&address, &referenced, DEPENDENCY_INTERNAL);
+	}
 }
 
 /*
- * DefineContTransform
+ * clone_matrel_indexes
+ *
+ * Give a new child of a matrel a copy of each of the matrel's indexes. Children have the same
+ * attribute numbers as the matrel, so index expressions and predicates can be used as they are.
  */
-Oid
-DefineContTransform(Oid relid, Oid defrelid, Oid streamrelid, Oid typoid, Oid osrelid, List **optionsp, Oid *ptgfnid)
+static void
+clone_matrel_indexes(Relation matrel, Oid childid, RangeVar *child)
 {
-	Relation pipeline_query;
-	HeapTuple tup;
-	bool nulls[Natts_pipeline_query];
-	Datum values[Natts_pipeline_query];
-	Oid id;
-	Oid result;
-	char *tgs;
-	int nargs;
-	char *funcname;
-	char *relname;
-	List *options = *optionsp;
-
-	pipeline_query = heap_open(PipelineQueryRelationOid, RowExclusiveLock);
+	List *indexes = RelationGetIndexList(matrel);
+	ListCell *lc;
 
-	id = get_next_id(pipeline_query);
+	foreach(lc, indexes)
+	{
+		Relation index = index_open(lfirst_oid(lc), AccessShareLock);
+		Form_pg_index form = index->rd_index;
+		IndexStmt *stmt = makeNode(IndexStmt);
+		List *pred = RelationGetIndexPredicate(index);
+		ListCell *expr = list_head(RelationGetIndexExpressions(index));
+		int i;
 
-	Assert(OidIsValid(id));
+		stmt->relation = child;
+		stmt->accessMethod = get_am_name(index->rd_rel->relam);
+		stmt->primary = form->indisprimary;
+		stmt->unique = form->indisunique;
+		stmt->isconstraint = form->indisprimary;
+		if (pred)
+			stmt->whereClause = (Node *) make_ands_explicit(pred);
 
-	MemSet(values, 0, sizeof(values));
-	MemSet(nulls, 0, sizeof(nulls));
+		for (i = 0; i < form->indnatts; i++)
+		{
+			IndexElem *indexcol = makeNode(IndexElem);
+			AttrNumber attno = form->indkey.values[i];
 
-	values[Anum_pipeline_query_type - 1] = Int8GetDatum(PIPELINE_QUERY_TRANSFORM);
+			if (AttributeNumberIsValid(attno))
+				indexcol->name = CompatGetAttName(RelationGetRelid(matrel), attno);
+			else
+			{
+				indexcol->expr = (Node *) lfirst(expr);
+				expr = lnext(expr);
+			}
 
-	values[Anum_pipeline_query_id - 1] = Int32GetDatum(id);
-	values[Anum_pipeline_query_relid - 1] = ObjectIdGetDatum(relid);
-	values[Anum_pipeline_query_defrelid - 1] = ObjectIdGetDatum(defrelid);
-	values[Anum_pipeline_query_active - 1] = BoolGetDatum(continuous_queries_enabled);
-	values[Anum_pipeline_query_streamrelid - 1] = ObjectIdGetDatum(streamrelid);
-	values[Anum_pipeline_query_matrelid - 1] = ObjectIdGetDatum(typoid); /* HACK(usmanm): So matrel index works */
-	values[Anum_pipeline_query_osrelid - 1] = ObjectIdGetDatum(osrelid);
-	values[Anum_pipeline_query_pkidxid - 1] = ObjectIdGetDatum(InvalidOid);
-	values[Anum_pipeline_query_lookupidxid - 1] = ObjectIdGetDatum(InvalidOid);
+			indexcol->ordering = SORTBY_DEFAULT;
+			indexcol->nulls_ordering = SORTBY_NULLS_DEFAULT;
+			stmt->indexParams = lappend(stmt->indexParams, indexcol);
+		}
 
-	options = lappend(options, makeDefElem(OPTION_ACTION, (Node *) makeString(ACTION_TRANSFORM), -1));
+		index_close(index, AccessShareLock);
 
-	relname = get_rel_name(osrelid);
-	Assert(relname);
-	options = lappend(options, makeDefElem(OPTION_OSREL, (Node *) makeString(pstrdup(relname)), -1));
+#if (PG_VERSION_NUM < 110000)
+		DefineIndex(childid, stmt, InvalidOid, false, false, false, false, false);
+#else
+		DefineIndex(childid, stmt, InvalidOid, InvalidOid, InvalidOid, false, false, false, false, false);
+#endif
+		CommandCounterIncrement();
+	}
 
-	relname = get_qualified_relname(streamrelid);
-	Assert(relname);
-	options = lappend(options, makeDefElem(OPTION_STREAM, (Node *) makeString(pstrdup(relname)), -1));
+	list_free(indexes);
+}
 
-	relname = get_rel_name(relid);
-	Assert(relname);
-	options = lappend(options, makeDefElem(OPTION_TRANSFORM, (Node *) makeString(pstrdup(relname)), -1));
+/*
+ * ttl_partition_bound
+ *
+ * Returns the given TTL partition boundary as a literal of the TTL column's type
+ */
+static char *
+ttl_partition_bound(Oid type, int64 start)
+{
+	Oid typoutput;
+	bool isvarlena;
 
-	if (ptgfnid)
-		*ptgfnid = InvalidOid;
+	getTypeOutputInfo(type, &typoutput, &isvarlena);
 
-	if (GetOptionAsString(options, OPTION_TGFN, &funcname))
-	{
-		Oid fargtypes[1];
-		Oid tgfnoid = InvalidOid;
+	return psprintf("%s::%s",
+			quote_literal_cstr(OidOutputFunctionCall(typoutput, TimestampGetDatum(TTLPartitionStartGetTimestamp(start)))),
+			format_type_be(type));
+}
 
-		tgfnoid = LookupFuncName(textToQualifiedNameList((text *) CStringGetTextDatum(funcname)), 0, fargtypes, false);
+/*
+ * create_ttl_partition
+ *
+ * Create the TTL partition of a matrel whose range starts at the given Unix time. Like shards, TTL partitions
+ * are inheritance children of the matrel with their own copy of its indexes. Each one has a CHECK constraint
+ * on its range, so that constraint exclusion can skip partitions that a query's TTL column predicates rule out.
+ */
+static void
+create_ttl_partition(Relation matrel, AttrNumber ttl_attno, int interval, int64 start)
+{
+	static char *validnsps[] = HEAP_RELOPT_NAMESPACES;
+	Form_pg_attribute attr = TupleDescAttr(RelationGetDescr(matrel), ttl_attno - 1);
+	char *column = (char *) quote_identifier(NameStr(attr->attname));
+	RangeVar *parent = makeRangeVar(get_namespace_name(RelationGetNamespace(matrel)),
+			pstrdup(RelationGetRelationName(matrel)), -1);
+	RangeVar *partition = makeRangeVar(parent->schemaname, MatRelNameToTTLPartitionName(parent->relname, start), -1);
+	CreateStmt *create_stmt = makeNode(CreateStmt);
+	Constraint *check = makeNode(Constraint);
+	ObjectAddress address;
+	ObjectAddress referenced;
+	Datum toast_options;
+	RawStmt *raw;
+	char *sql;
+
+	sql = psprintf("SELECT %s >= %s AND %s < %s",
+			column, ttl_partition_bound(attr->atttypid, start),
+			column, ttl_partition_bound(attr->atttypid, start + interval));
+	raw = (RawStmt *) linitial(pg_parse_query(sql));
+
+	check->contype = CONSTR_CHECK;
+	check->location = -1;
+	check->initially_valid = true;
+	check->raw_expr = ((ResTarget *) linitial(((SelectStmt *) raw->stmt)->targetList))->val;
+
+	create_stmt->relation = partition;
+	create_stmt->inhRelations = list_make1(parent);
+	create_stmt->constraints = list_make1(check);
+	create_stmt->options = list_make1(makeDefElem(OPTION_FILLFACTOR,
+			(Node *) makeInteger(RelationGetFillFactor(matrel, HEAP_DEFAULT_FILLFACTOR)), -1));
+	if (OidIsValid(matrel->rd_rel->reltablespace))
+		create_stmt->tablespacename = get_tablespace_name(matrel->rd_rel->reltablespace);
+
+	address = DefineRelation(create_stmt, RELKIND_RELATION, InvalidOid, NULL, NULL);
+	CommandCounterIncrement();
 
-		/*
-		 * We store the trigger function by qualified name for dump/restore support.
-		 * The OID will change across restores (even for binary upgrades) and there isn't a good place in which
-		 * to sync it with the new OID in these cases so we just retrieve the OID via function name when we need to use it.
-		 */
-		if (OidIsValid(tgfnoid))
-		{
-			Form_pg_proc form;
-			HeapTuple tup = SearchSysCache1(PROCOID, ObjectIdGetDatum(tgfnoid));
-			List *qualified = NIL;
-			DefElem *opt;
+	toast_options = transformRelOptions((Datum) 0, create_stmt->options, "toast",
+			validnsps, true, false);
 
-			form = (Form_pg_proc) GETSTRUCT(tup);
+	(void) heap_reloptions(RELKIND_TOASTVALUE, toast_options, true);
+	AlterTableCreateToastTable(address.objectId, toast_options, AccessExclusiveLock);
 
-			qualified = list_make2(makeString(get_namespace_name(form->pronamespace)), makeString(NameStr(form->proname)));
-			opt = GetContQueryOption(options, OPTION_TGFN);
-			Assert(opt);
+	clone_matrel_indexes(matrel, address.objectId, partition);
 
-			opt->arg = (Node *) makeString(NameListToQuotedString(qualified));
-			ReleaseSysCache(tup);
-		}
-		*ptgfnid = tgfnoid;
+	/* The reaper creates most partitions, but they belong to whoever owns the CV */
+	if (matrel->rd_rel->relowner != GetUserId())
+	{
+		ATExecChangeOwner(address.objectId, matrel->rd_rel->relowner, false, AccessExclusiveLock);
+		CommandCounterIncrement();
 	}
 
-	if (GetOptionAsString(options, OPTION_TGARGS, &tgs))
-		values[Anum_pipeline_query_tgargs - 1] = DirectFunctionCall1(byteain, CStringGetDatum(tgs));
-	else
-		values[Anum_pipeline_query_tgargs - 1] = DirectFunctionCall1(byteain, CStringGetDatum(""));
+	referenced.classId = RelationRelationId;
+	referenced.objectId = RelationGetRelid(matrel);
+	referenced.objectSubId = 0;
 
-	if (GetOptionAsInteger(options, OPTION_TGNARGS, &nargs))
-		values[Anum_pipeline_query_tgnargs - 1] = Int16GetDatum(nargs);
-	else
-		values[Anum_pipeline_query_tgnargs - 1] = Int16GetDatum(0);
+	/* Unlike shards, TTL partitions are dropped on their own by the reaper as they expire */
+	recordDependencyOn(&address, &referenced, DEPENDENCY_AUTO);
+	CommandCounterIncrement();
+}
 
-	/* unused */
-	values[Anum_pipeline_query_seqrelid - 1] = ObjectIdGetDatum(InvalidOid);
-	values[Anum_pipeline_query_ttl - 1] = Int32GetDatum(-1);
-	values[Anum_pipeline_query_ttl_attno - 1] = Int16GetDatum(InvalidAttrNumber);
-	values[Anum_pipeline_query_step_factor - 1] = Int16GetDatum(0);
+/*
+ * CreateMatRelTTLPartitions
+ *
+ * Make sure that a TTL-partitioned matrel has partitions from the current time through a little while
+ * ahead of it, so that combiners always have a partition to put new groups in. The reaper calls this
+ * periodically and drops partitions as they expire. Groups whose partition doesn't exist, e.g. because
+ * their TTL column is far in the past or future, go in the matrel itself.
+ *
+ * Returns the number of partitions created.
+ */
+int
+CreateMatRelTTLPartitions(ContQuery *cq)
+{
+	bool save_allow = allowSystemTableMods;
+	Relation matrel;
+	TimestampTz now = GetCurrentTimestamp();
+	int64 start;
+	int64 end;
+	int created = 0;
 
-	tup = heap_form_tuple(pipeline_query->rd_att, values, nulls);
+	Assert(cq->ttl_partition > 0);
 
-	result = PipelineCatalogTupleInsert(pipeline_query, tup);
-	CommandCounterIncrement();
+	matrel = heap_open(cq->matrelid, AccessShareLock);
 
-	heap_freetuple(tup);
+	/* timestamp TTL columns hold local times */
+	if (TupleDescAttr(RelationGetDescr(matrel), cq->ttl_attno - 1)->atttypid == TIMESTAMPOID)
+		now = DatumGetTimestamp(DirectFunctionCall1(timestamptz_timestamp, TimestampTzGetDatum(now)));
 
-	SyncPipelineStreamReaders();
+	start = TimestampGetTTLPartitionStart(now, cq->ttl_partition);
+	end = TimestampGetTTLPartitionStart(now + (int64) Max(cq->ttl_partition, TTL_PARTITION_LOOKAHEAD) * USECS_PER_SEC,
+			cq->ttl_partition);
 
-	heap_close(pipeline_query, NoLock);
+	/* Partitions inherit the matrel's hidden state columns, which may have pseudo-types */
+	allowSystemTableMods = true;
 
-	CommandCounterIncrement();
+	PG_TRY();
+	{
+		for (; start <= end; start += cq->ttl_partition)
+		{
+			char *relname = MatRelNameToTTLPartitionName(RelationGetRelationName(matrel), start);
 
-	*optionsp = options;
+			if (OidIsValid(get_relname_relid(relname, RelationGetNamespace(matrel))))
+				continue;
 
-	return result;
+			create_ttl_partition(matrel, cq->ttl_attno, cq->ttl_partition, start);
+			created++;
+		}
+	}
+	PG_CATCH();
+	{
+		allowSystemTableMods = save_allow;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	allowSystemTableMods = save_allow;
+	heap_close(matrel, NoLock);
+
+	return created;
 }
 
 /*
- * UpdateContViewRelIds
+ * set_sketch_storage
+ *
+ * Sketch states are large and every combine rewrites them in full, so compressing them with pglz on each
+ * update mostly burns CPU and WAL. Give the sketch columns of a new matrel the configured storage strategy
+ * instead of their types' default. All of this extension's varlena types are sketches.
  */
-void
-UpdateContViewRelIds(Relation pipeline_query, Oid cvid, Oid cvrelid, Oid defrelid, Oid osrelid, List *options)
+static void
+set_sketch_storage(Oid matrelid)
 {
-	bool replace[Natts_pipeline_query];
-	bool nulls[Natts_pipeline_query];
-	Datum values[Natts_pipeline_query];
-	HeapTuple tup;
-	HeapTuple new;
+	Oid extoid = get_extension_oid(PIPELINEDB_EXTENSION_NAME, true);
+	Relation rel;
+	TupleDesc desc;
+	List *cmds = NIL;
+	char *storage;
+	int i;
 
-	MemSet(replace, 0 , sizeof(replace));
-	MemSet(nulls, 0 , sizeof(nulls));
-	replace[Anum_pipeline_query_relid - 1] = true;
+	if (!OidIsValid(extoid))
+		return;
+
+	switch (sketch_storage)
+	{
+		case 'p':
+			storage = "plain";
+			break;
+		case 'm':
+			storage = "main";
+			break;
+		case 'e':
+			storage = "external";
+			break;
+		default:
+			return;
+	}
+
+	rel = heap_open(matrelid, NoLock);
+	desc = RelationGetDescr(rel);
+
+	for (i = 0; i < desc->natts; i++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(desc, i);
+		AlterTableCmd *cmd;
+
+		if (attr->attisdropped || attr->attlen != -1 || attr->attstorage == sketch_storage)
+			continue;
+		if (getExtensionOfObject(TypeRelationId, attr->atttypid) != extoid)
+			continue;
+
+		cmd = makeNode(AlterTableCmd);
+		cmd->subtype = AT_SetStorage;
+		cmd->name = pstrdup(NameStr(attr->attname));
+		cmd->def = (Node *) makeString(storage);
+		cmds = lappend(cmds, cmd);
+	}
+
+	heap_close(rel, NoLock);
+
+	if (cmds)
+	{
+		AlterTableInternal(matrelid, cmds, false);
+		CommandCounterIncrement();
+	}
+}
+
+/*
+ * create_matrel_archive
+ *
+ * Create the relation that closed time buckets of a matrel are frozen into, and union it into the CV's
+ * view. Frozen groups never change again, so they are archived with their finalized values, in row groups
+ * that hold each output column as an array. Every column of a row group is compressed and stored on its
+ * own, and reading the CV unnests them back into rows. Row groups also record their latest bucket, for
+ * TTL expiration, and the primary keys their groups had in the matrel.
+ */
+static void
+create_matrel_archive(RangeVar *view, Oid matrelid, RangeVar *matrel, CreateStmt *matrel_stmt, Oid overlayid,
+		SelectStmt *overlay, AttrNumber pk, AttrNumber bucket)
+{
+	CreateStmt *create_stmt = makeNode(CreateStmt);
+	ObjectAddress address;
+	ObjectAddress referenced;
+	Relation rel;
+	TupleDesc desc;
+	Form_pg_attribute attr;
+	StringInfoData args;
+	StringInfoData names;
+	StringInfoData targets;
+	StringInfoData sql;
+	SelectStmt *archive;
+	SelectStmt *setop;
+	ViewStmt *stmt;
+	Oid arraytype;
+	int i;
+
+	referenced.classId = RelationRelationId;
+	referenced.objectId = matrelid;
+	referenced.objectSubId = 0;
+
+	create_stmt->relation = makeRangeVar(matrel->schemaname, MatRelNameToArchiveName(matrel->relname), -1);
+	create_stmt->options = list_make1(makeDefElem(OPTION_FILLFACTOR, (Node *) makeInteger(100), -1));
+	create_stmt->tablespacename = matrel_stmt->tablespacename;
+
+	rel = heap_open(matrelid, NoLock);
+	desc = RelationGetDescr(rel);
+
+	attr = TupleDescAttr(desc, bucket - 1);
+	create_stmt->tableElts = list_make1(make_coldef(CQ_ARCHIVE_BUCKET, attr->atttypid, attr->atttypmod));
+	create_stmt->tableElts = lappend(create_stmt->tableElts, make_coldef(CQ_ARCHIVE_GROUPS, INT4OID, -1));
+
+	attr = TupleDescAttr(desc, pk - 1);
+	arraytype = get_array_type(attr->atttypid);
+	if (!OidIsValid(arraytype))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("\"%s\" cannot be specified for continuous views with a primary key of type %s",
+					 OPTION_FREEZE_AFTER, format_type_be(attr->atttypid))));
+	create_stmt->tableElts = lappend(create_stmt->tableElts, make_coldef(CQ_ARCHIVE_PKS, arraytype, attr->atttypmod));
+
+	heap_close(rel, NoLock);
+
+	initStringInfo(&args);
+	initStringInfo(&names);
+	initStringInfo(&targets);
+
+	rel = heap_open(overlayid, NoLock);
+	desc = RelationGetDescr(rel);
+
+	for (i = 0; i < desc->natts; i++)
+	{
+		const char *name;
+
+		attr = TupleDescAttr(desc, i);
+		arraytype = get_array_type(attr->atttypid);
+
+		/* unnest would flatten an array column's values */
+		if (!OidIsValid(arraytype) || type_is_array(attr->atttypid))
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("\"%s\" cannot be specified for continuous views with a column of type %s",
+						 OPTION_FREEZE_AFTER, format_type_be(attr->atttypid)),
+					 errdetail("Column \"%s\" can't be archived.", NameStr(attr->attname))));
+
+		create_stmt->tableElts = lappend(create_stmt->tableElts,
+				make_coldef(pstrdup(NameStr(attr->attname)), arraytype, attr->atttypmod));
+
+		/* Keep each column's type modifier, which unnest loses, so that the union keeps the view's types */
+		name = quote_identifier(NameStr(attr->attname));
+		appendStringInfo(&args, "%sa.%s", i ? ", " : "", name);
+		appendStringInfo(&names, "%s%s", i ? ", " : "", name);
+		appendStringInfo(&targets, "%sCAST(u.%s AS %s)", i ? ", " : "", name,
+				format_type_with_typemod(attr->atttypid, attr->atttypmod));
+	}
+
+	heap_close(rel, NoLock);
+
+	address = DefineRelation(create_stmt, RELKIND_RELATION, InvalidOid, NULL, NULL);
+	CommandCounterIncrement();
+
+	AlterTableCreateToastTable(address.objectId, (Datum) 0, AccessExclusiveLock);
+
+	/* The archive can't be dropped on its own, but it goes away with the matrel */
+	recordDependencyOn(&address, &referenced, DEPENDENCY_INTERNAL);
+
+	initStringInfo(&sql);
+	appendStringInfo(&sql, "SELECT %s FROM %s a, unnest(%s) AS u(%s)", targets.data,
+			quote_qualified_identifier(matrel->schemaname, create_stmt->relation->relname), args.data, names.data);
+
+	archive = (SelectStmt *) ((RawStmt *) linitial(pg_parse_query(sql.data)))->stmt;
+	Assert(IsA(archive, SelectStmt));
+
+	setop = makeNode(SelectStmt);
+	setop->op = SETOP_UNION;
+	setop->all = true;
+	setop->larg = overlay;
+	setop->rarg = archive;
+
+	stmt = makeNode(ViewStmt);
+	stmt->view = view;
+	stmt->query = (Node *) setop;
+	stmt->replace = true;
+
+	DefineView(stmt, sql.data, -1, 0);
+	CommandCounterIncrement();
+}
+
+/*
+ * is_nonnegative_const
+ */
+static bool
+is_nonnegative_const(Node *node)
+{
+	Const *c;
+	Oid out;
+	bool isvarlena;
+	char *value;
+
+	node = strip_implicit_coercions(node);
+	if (!IsA(node, Const))
+		return false;
+
+	c = (Const *) node;
+	if (c->constisnull || TypeCategory(c->consttype) != TYPCATEGORY_NUMERIC)
+		return false;
+
+	getTypeOutputInfo(c->consttype, &out, &isvarlena);
+	value = OidOutputFunctionCall(out, c->constvalue);
+
+	return value[0] != '-' && pg_strcasecmp(value, "NaN");
+}
+
+/*
+ * is_nonnegative_input
+ *
+ * Is the given aggregate input guaranteed to be non-negative, either because it's a non-negative
+ * constant or because one of the given implicitly ANDed quals bounds it below by one?
+ */
+static bool
+is_nonnegative_input(Node *expr, List *quals)
+{
+	ListCell *lc;
+
+	if (is_nonnegative_const(expr))
+		return true;
+
+	expr = strip_implicit_coercions(expr);
+
+	foreach(lc, quals)
+	{
+		OpExpr *op = (OpExpr *) lfirst(lc);
+		char *name;
+
+		if (!IsA(op, OpExpr) || list_length(op->args) != 2)
+			continue;
+
+		name = get_opname(op->opno);
+		if (!name || (strcmp(name, ">=") && strcmp(name, ">")))
+			continue;
+
+		if (equal(strip_implicit_coercions(linitial(op->args)), expr) && is_nonnegative_const(lsecond(op->args)))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * get_topn_column
+ *
+ * Find the aggregate column of a CV's query that its top-N groups are ranked by.
+ *
+ * Each combiner only keeps its current top-N groups, so a member whose value drops can't be replaced
+ * by a group it never kept. The column must therefore be an aggregate whose values never decrease:
+ * count, max, or sum over input that the query guarantees is non-negative.
+ */
+static TargetEntry *
+get_topn_column(Query *query, char *colname)
+{
+	TargetEntry *result = NULL;
+	TypeCacheEntry *typ;
+	Aggref *agg;
+	bool monotonic = false;
+	ListCell *lc;
+
+	if (!query->hasAggs || query->groupClause == NIL)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("\"%s\" can only be specified for continuous views with aggregates and a GROUP BY clause", OPTION_TOPN)));
+
+	foreach(lc, query->targetList)
+	{
+		TargetEntry *te = (TargetEntry *) lfirst(lc);
+
+		if (!te->resjunk && te->resname && !strcmp(te->resname, colname))
+		{
+			result = te;
+			break;
+		}
+	}
+
+	if (!result)
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_COLUMN),
+				 errmsg("\"%s\" column \"%s\" does not exist", OPTION_TOPN_COLUMN, colname)));
+
+	if (!contain_aggs_of_level((Node *) result->expr, 0))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("\"%s\" must refer to an aggregate column", OPTION_TOPN_COLUMN),
+				 errdetail("Column \"%s\" is a grouping column.", colname)));
+
+	agg = (Aggref *) strip_implicit_coercions((Node *) result->expr);
+	if (IsA(agg, Aggref) && get_func_namespace(agg->aggfnoid) == PG_CATALOG_NAMESPACE)
+	{
+		char *name = get_func_name(agg->aggfnoid);
+
+		if (!strcmp(name, "count") || !strcmp(name, "max"))
+			monotonic = true;
+		else if (!strcmp(name, "sum") && list_length(agg->args) == 1)
+		{
+			Node *arg = (Node *) ((TargetEntry *) linitial(agg->args))->expr;
+			List *quals = list_concat(make_ands_implicit((Expr *) copyObject(query->jointree->quals)),
+					make_ands_implicit((Expr *) copyObject(agg->aggfilter)));
+
+			monotonic = is_nonnegative_input(arg, quals);
+		}
+	}
+
+	if (!monotonic)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("\"%s\" must refer to a count, max or sum of non-negative values", OPTION_TOPN_COLUMN),
+				 errdetail("Top-N groups can only be maintained for aggregates whose values never decrease."),
+				 errhint("Bound a sum's input with a WHERE or FILTER clause such as \"x >= 0\".")));
+
+	typ = lookup_type_cache(exprType((Node *) result->expr), TYPECACHE_CMP_PROC);
+	if (!OidIsValid(typ->cmp_proc))
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_FUNCTION),
+				 errmsg("could not identify an ordering for type %s", format_type_be(typ->type_id)),
+				 errdetail("Top-N groups can only be ranked by columns whose type has a default btree operator class.")));
+
+	return result;
+}
+
+/*
+ * create_topn
+ *
+ * Create the relation that each combiner keeps its current top-N groups of a CV in, and the view
+ * that merges them into the CV's overall top-N. A group's full overlay row is stored alongside the
+ * value it's ranked by, so reading the view never touches the matrel.
+ */
+static void
+create_topn(RangeVar *view, Oid matrelid, RangeVar *matrel, CreateStmt *matrel_stmt, Oid overlayid,
+		AttrNumber pk, AttrNumber attno, int n)
+{
+	CreateStmt *create_stmt = makeNode(CreateStmt);
+	ObjectAddress address;
+	ObjectAddress referenced;
+	Relation rel;
+	Form_pg_attribute attr;
+	StringInfoData sql;
+	ViewStmt *stmt;
+
+	referenced.classId = RelationRelationId;
+	referenced.objectId = matrelid;
+	referenced.objectSubId = 0;
+
+	create_stmt->relation = makeRangeVar(matrel->schemaname, MatRelNameToTopNName(matrel->relname), -1);
+	create_stmt->tablespacename = matrel_stmt->tablespacename;
+	create_stmt->tableElts = list_make1(make_coldef("combiner_id", INT4OID, -1));
+
+	rel = heap_open(matrelid, NoLock);
+	attr = TupleDescAttr(RelationGetDescr(rel), pk - 1);
+	create_stmt->tableElts = lappend(create_stmt->tableElts, make_coldef("group_pk", attr->atttypid, attr->atttypmod));
+	heap_close(rel, NoLock);
+
+	rel = heap_open(overlayid, NoLock);
+	attr = TupleDescAttr(RelationGetDescr(rel), attno - 1);
+	create_stmt->tableElts = lappend(create_stmt->tableElts, make_coldef("group_value", attr->atttypid, attr->atttypmod));
+	create_stmt->tableElts = lappend(create_stmt->tableElts, make_coldef("group_row", rel->rd_rel->reltype, -1));
+	heap_close(rel, NoLock);
+
+	address = DefineRelation(create_stmt, RELKIND_RELATION, InvalidOid, NULL, NULL);
+	CommandCounterIncrement();
+
+	AlterTableCreateToastTable(address.objectId, (Datum) 0, AccessExclusiveLock);
+	recordDependencyOn(&address, &referenced, DEPENDENCY_INTERNAL);
+
+	/*
+	 * A group may briefly be held by two combiners after num_combiners changes, in which case
+	 * the one with the highest value is the most recent
+	 */
+	initStringInfo(&sql);
+	appendStringInfo(&sql, "CREATE VIEW %s AS SELECT (t.group_row).* FROM "
+			"(SELECT DISTINCT ON (group_pk) group_row, group_value FROM %s ORDER BY group_pk, group_value DESC) t "
+			"ORDER BY t.group_value DESC LIMIT %d",
+			quote_qualified_identifier(view->schemaname, CVNameToTopNName(view->relname)),
+			quote_qualified_identifier(matrel->schemaname, create_stmt->relation->relname), n);
+
+	stmt = (ViewStmt *) ((RawStmt *) linitial(pg_parse_query(sql.data)))->stmt;
+	Assert(IsA(stmt, ViewStmt));
+
+	address = DefineView(stmt, sql.data, -1, 0);
+	CommandCounterIncrement();
+
+	recordDependencyOn(&address, &referenced, DEPENDENCY_INTERNAL);
+}
+
+/*
+ * create_cache
+ *
+ * Create the relation that combiners keep each group's finalized overlay row in, and redefine the CV's view
+ * to read from it, so that reading the CV is a plain scan that never evaluates a finalize function. Combiners
+ * and the reaper still finalize groups with the view's matrel side, so it's kept as the first branch of a
+ * union that never returns anything.
+ */
+static void
+create_cache(RangeVar *view, Oid matrelid, RangeVar *matrel, CreateStmt *matrel_stmt, Oid overlayid,
+		SelectStmt *overlay, AttrNumber pk)
+{
+	CreateStmt *create_stmt = makeNode(CreateStmt);
+	ObjectAddress address;
+	ObjectAddress referenced;
+	Relation rel;
+	Form_pg_attribute attr;
+	StringInfoData sql;
+	SelectStmt *cached;
+	SelectStmt *setop;
+	ViewStmt *stmt;
+	A_Const *none;
+
+	referenced.classId = RelationRelationId;
+	referenced.objectId = matrelid;
+	referenced.objectSubId = 0;
+
+	create_stmt->relation = makeRangeVar(matrel->schemaname, MatRelNameToCacheName(matrel->relname), -1);
+	create_stmt->tablespacename = matrel_stmt->tablespacename;
+
+	rel = heap_open(matrelid, NoLock);
+	attr = TupleDescAttr(RelationGetDescr(rel), pk - 1);
+	create_stmt->tableElts = list_make1(make_coldef("group_pk", attr->atttypid, attr->atttypmod));
+	heap_close(rel, NoLock);
+
+	create_stmt->tableElts = lappend(create_stmt->tableElts, make_coldef("group_row", get_rel_type_id(overlayid), -1));
+
+	address = DefineRelation(create_stmt, RELKIND_RELATION, InvalidOid, NULL, NULL);
+	CommandCounterIncrement();
+
+	AlterTableCreateToastTable(address.objectId, (Datum) 0, AccessExclusiveLock);
+	recordDependencyOn(&address, &referenced, DEPENDENCY_INTERNAL);
+
+	/* Combiners find a group's cached row by its matrel primary key */
+	create_pkey_index(view, address.objectId, create_stmt->relation, "group_pk");
+	CommandCounterIncrement();
+
+	/*
+	 * The cache has a row for every group, frozen ones included, so a frozen CV's view doesn't need to
+	 * read its archive anymore. Expanding the cached rows keeps each column's type modifier.
+	 */
+	initStringInfo(&sql);
+	appendStringInfo(&sql, "SELECT (c.group_row).* FROM %s c",
+			quote_qualified_identifier(matrel->schemaname, create_stmt->relation->relname));
+
+	cached = (SelectStmt *) ((RawStmt *) linitial(pg_parse_query(sql.data)))->stmt;
+	Assert(IsA(cached, SelectStmt));
+
+	none = makeNode(A_Const);
+	none->val.type = T_Integer;
+	none->val.val.ival = 0;
+	none->location = -1;
+
+	/* The executor never reads the matrel below a LIMIT 0 */
+	overlay = copyObject(overlay);
+	overlay->limitCount = (Node *) none;
+
+	setop = makeNode(SelectStmt);
+	setop->op = SETOP_UNION;
+	setop->all = true;
+	setop->larg = overlay;
+	setop->rarg = cached;
+
+	stmt = makeNode(ViewStmt);
+	stmt->view = view;
+	stmt->query = (Node *) setop;
+	stmt->replace = true;
+
+	DefineView(stmt, sql.data, -1, 0);
+	CommandCounterIncrement();
+}
+
+/*
+ * create_matrel_snapshot
+ *
+ * Create the relations used to snapshot an unlogged matrel: a logged relation with the matrel's columns
+ * that the reaper periodically copies the matrel into, and an unlogged marker relation holding a single
+ * row. Crash recovery empties the marker along with the matrel, which is how we know to restore the
+ * matrel from its snapshot.
+ */
+static void
+create_matrel_snapshot(Oid matrelid, RangeVar *matrel, CreateStmt *matrel_stmt)
+{
+	CreateStmt *create_stmt;
+	ObjectAddress address;
+	ObjectAddress referenced;
+	Relation rel;
+	TupleDesc desc;
+	int i;
+
+	referenced.classId = RelationRelationId;
+	referenced.objectId = matrelid;
+	referenced.objectSubId = 0;
+
+	create_stmt = makeNode(CreateStmt);
+	create_stmt->relation = makeRangeVar(matrel->schemaname, MatRelNameToSnapshotName(matrel->relname), -1);
+	create_stmt->tablespacename = matrel_stmt->tablespacename;
+
+	rel = heap_open(matrelid, NoLock);
+	desc = RelationGetDescr(rel);
+
+	for (i = 0; i < desc->natts; i++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(desc, i);
+
+		create_stmt->tableElts = lappend(create_stmt->tableElts,
+				make_coldef(pstrdup(NameStr(attr->attname)), attr->atttypid, attr->atttypmod));
+	}
+
+	heap_close(rel, NoLock);
+
+	address = DefineRelation(create_stmt, RELKIND_RELATION, InvalidOid, NULL, NULL);
+	CommandCounterIncrement();
+
+	AlterTableCreateToastTable(address.objectId, (Datum) 0, AccessExclusiveLock);
+	recordDependencyOn(&address, &referenced, DEPENDENCY_INTERNAL);
+
+	create_stmt = makeNode(CreateStmt);
+	create_stmt->relation = makeRangeVar(matrel->schemaname, MatRelNameToSnapshotMarkerName(matrel->relname), -1);
+	create_stmt->relation->relpersistence = RELPERSISTENCE_UNLOGGED;
+	create_stmt->tablespacename = matrel_stmt->tablespacename;
+
+	address = DefineRelation(create_stmt, RELKIND_RELATION, InvalidOid, NULL, NULL);
+	CommandCounterIncrement();
+
+	recordDependencyOn(&address, &referenced, DEPENDENCY_INTERNAL);
+
+	/* The matrel starts out empty, so there's nothing to restore until the first crash */
+	rel = heap_open(address.objectId, RowExclusiveLock);
+	simple_heap_insert(rel, heap_form_tuple(RelationGetDescr(rel), NULL, NULL));
+	heap_close(rel, NoLock);
+
+	CommandCounterIncrement();
+}
+
+/*
+ * DefineContView
+ *
+ * Adds a CV to the `pipeline_query` catalog table.
+ */
+Oid
+DefineContView(Relation pipeline_query, Oid relid, Oid streamrelid, Oid matrelid, Oid seqrelid, int ttl,
+		AttrNumber ttl_attno, double step_factor, Oid *pq_id)
+{
+	HeapTuple tup;
+	bool nulls[Natts_pipeline_query];
+	Datum values[Natts_pipeline_query];
+	Oid id;
+	Oid result;
+
+	id = get_next_id(pipeline_query);
+
+	Assert(OidIsValid(id));
+
+	MemSet(values, 0, sizeof(values));
+	MemSet(nulls, 0, sizeof(nulls));
+
+	values[Anum_pipeline_query_type - 1] = CharGetDatum(PIPELINE_QUERY_VIEW);
+
+	values[Anum_pipeline_query_id - 1] = Int32GetDatum(id);
+	values[Anum_pipeline_query_relid - 1] = ObjectIdGetDatum(relid);
+	values[Anum_pipeline_query_active - 1] = BoolGetDatum(continuous_queries_enabled);
+	values[Anum_pipeline_query_streamrelid - 1] = ObjectIdGetDatum(streamrelid);
+	values[Anum_pipeline_query_matrelid - 1] = ObjectIdGetDatum(matrelid);
+	values[Anum_pipeline_query_seqrelid - 1] = ObjectIdGetDatum(seqrelid);
+	values[Anum_pipeline_query_ttl - 1] = Int32GetDatum(ttl);
+	values[Anum_pipeline_query_ttl_attno - 1] = Int16GetDatum(ttl_attno);
+	values[Anum_pipeline_query_step_factor - 1] = Int16GetDatum((int16) step_factor);
+
+	/* unused */
+	values[Anum_pipeline_query_tgnargs - 1] = Int16GetDatum(0);
+	values[Anum_pipeline_query_tgargs - 1] = DirectFunctionCall1(byteain, CStringGetDatum(""));
+
+	tup = heap_form_tuple(pipeline_query->rd_att, values, nulls);
+	result = PipelineCatalogTupleInsert(pipeline_query, tup);
+
+	*pq_id = id;
+
+	return result;
+}
+
+/*
+ * DefineContTransform
+ */
+Oid
+DefineContTransform(Oid relid, Oid defrelid, Oid streamrelid, Oid typoid, Oid osrelid, List **optionsp, Oid *ptgfnid)
+{
+	Relation pipeline_query;
+	HeapTuple tup;
+	bool nulls[Natts_pipeline_query];
+	Datum values[Natts_pipeline_query];
+	Oid id;
+	Oid result;
+	char *tgs;
+	int nargs;
+	char *funcname;
+	char *relname;
+	List *options = *optionsp;
+
+	pipeline_query = heap_open(PipelineQueryRelationOid, RowExclusiveLock);
+
+	id = get_next_id(pipeline_query);
+
+	Assert(OidIsValid(id));
+
+	MemSet(values, 0, sizeof(values));
+	MemSet(nulls, 0, sizeof(nulls));
+
+	values[Anum_pipeline_query_type - 1] = Int8GetDatum(PIPELINE_QUERY_TRANSFORM);
+
+	values[Anum_pipeline_query_id - 1] = Int32GetDatum(id);
+	values[Anum_pipeline_query_relid - 1] = ObjectIdGetDatum(relid);
+	values[Anum_pipeline_query_defrelid - 1] = ObjectIdGetDatum(defrelid);
+	values[Anum_pipeline_query_active - 1] = BoolGetDatum(continuous_queries_enabled);
+	values[Anum_pipeline_query_streamrelid - 1] = ObjectIdGetDatum(streamrelid);
+	values[Anum_pipeline_query_matrelid - 1] = ObjectIdGetDatum(typoid); /* HACK(usmanm): So matrel index works */
+	values[Anum_pipeline_query_osrelid - 1] = ObjectIdGetDatum(osrelid);
+	values[Anum_pipeline_query_pkidxid - 1] = ObjectIdGetDatum(InvalidOid);
+	values[Anum_pipeline_query_lookupidxid - 1] = ObjectIdGetDatum(InvalidOid);
+
+	options = lappend(options, makeDefElem(OPTION_ACTION, (Node *) makeString(ACTION_TRANSFORM), -1));
+
+	relname = get_rel_name(osrelid);
+	Assert(relname);
+	options = lappend(options, makeDefElem(OPTION_OSREL, (Node *) makeString(pstrdup(relname)), -1));
+
+	relname = get_qualified_relname(streamrelid);
+	Assert(relname);
+	options = lappend(options, makeDefElem(OPTION_STREAM, (Node *) makeString(pstrdup(relname)), -1));
+
+	relname = get_rel_name(relid);
+	Assert(relname);
+	options = lappend(options, makeDefElem(OPTION_TRANSFORM, (Node *) makeString(pstrdup(relname)), -1));
+
+	if (ptgfnid)
+		*ptgfnid = InvalidOid;
+
+	if (GetOptionAsString(options, OPTION_TGFN, &funcname))
+	{
+		Oid fargtypes[1];
+		Oid tgfnoid = InvalidOid;
+
+		tgfnoid = LookupFuncName(textToQualifiedNameList((text *) CStringGetTextDatum(funcname)), 0, fargtypes, false);
+
+		/*
+		 * We store the trigger function by qualified name for dump/restore support.
+		 * The OID will change across restores (even for binary upgrades) and there isn't a good place in which
+		 * to sync it with the new OID in these cases so we just retrieve the OID via function name when we need to use it.
+		 */
+		if (OidIsValid(tgfnoid))
+		{
+			Form_pg_proc form;
+			HeapTuple tup = SearchSysCache1(PROCOID, ObjectIdGetDatum(tgfnoid));
+			List *qualified = NIL;
+			DefElem *opt;
+
+			form = (Form_pg_proc) GETSTRUCT(tup);
+
+			qualified = list_make2(makeString(get_namespace_name(form->pronamespace)), makeString(NameStr(form->proname)));
+			opt = GetContQueryOption(options, OPTION_TGFN);
+			Assert(opt);
+
+			opt->arg = (Node *) makeString(NameListToQuotedString(qualified));
+			ReleaseSysCache(tup);
+		}
+		*ptgfnid = tgfnoid;
+	}
+
+	if (GetOptionAsString(options, OPTION_TGARGS, &tgs))
+		values[Anum_pipeline_query_tgargs - 1] = DirectFunctionCall1(byteain, CStringGetDatum(tgs));
+	else
+		values[Anum_pipeline_query_tgargs - 1] = DirectFunctionCall1(byteain, CStringGetDatum(""));
+
+	if (GetOptionAsInteger(options, OPTION_TGNARGS, &nargs))
+		values[Anum_pipeline_query_tgnargs - 1] = Int16GetDatum(nargs);
+	else
+		values[Anum_pipeline_query_tgnargs - 1] = Int16GetDatum(0);
+
+	/* unused */
+	values[Anum_pipeline_query_seqrelid - 1] = ObjectIdGetDatum(InvalidOid);
+	values[Anum_pipeline_query_ttl - 1] = Int32GetDatum(-1);
+	values[Anum_pipeline_query_ttl_attno - 1] = Int16GetDatum(InvalidAttrNumber);
+	values[Anum_pipeline_query_step_factor - 1] = Int16GetDatum(0);
+
+	tup = heap_form_tuple(pipeline_query->rd_att, values, nulls);
+
+	result = PipelineCatalogTupleInsert(pipeline_query, tup);
+	CommandCounterIncrement();
+
+	heap_freetuple(tup);
+
+	SyncPipelineStreamReaders();
+
+	heap_close(pipeline_query, NoLock);
+
+	CommandCounterIncrement();
+
+	*optionsp = options;
+
+	return result;
+}
+
+/*
+ * UpdateContViewRelIds
+ */
+void
+UpdateContViewRelIds(Relation pipeline_query, Oid cvid, Oid cvrelid, Oid defrelid, Oid osrelid, List *options)
+{
+	bool replace[Natts_pipeline_query];
+	bool nulls[Natts_pipeline_query];
+	Datum values[Natts_pipeline_query];
+	HeapTuple tup;
+	HeapTuple new;
+
+	MemSet(replace, 0 , sizeof(replace));
+	MemSet(nulls, 0 , sizeof(nulls));
+	replace[Anum_pipeline_query_relid - 1] = true;
 	replace[Anum_pipeline_query_defrelid - 1] = true;
 	replace[Anum_pipeline_query_osrelid - 1] = true;
 	replace[Anum_pipeline_query_pkidxid - 1] = true;
@@ -1534,63 +2412,314 @@ SyncContView(RangeVar *name)
 
 	d = SysCacheGetAttr(RELOID, tup, Anum_pg_class_reloptions, &isnull);
 
-	if (isnull)
-	{
-		ReleaseSysCache(tup);
-		elog(ERROR, "no reloptions found for OID %u", defrelid);
-	}
+	if (isnull)
+	{
+		ReleaseSysCache(tup);
+		elog(ERROR, "no reloptions found for OID %u", defrelid);
+	}
+
+	options = DatumGetArrayTypeP(d);
+	deconstruct_array(options, TEXTOID, -1, false, 'i', &values, &nulls, &noptions);
+
+	for (i = 0; i < noptions; i++)
+	{
+		char *raw = TextDatumGetCString(values[i]);
+		char *key;
+		char *value;
+		List *split = NIL;
+		RangeVar *rv;
+
+		if (!SplitIdentifierString(raw, '=', &split))
+			elog(ERROR, "failed to parse option \"%s\"", raw);
+
+		if (list_length(split) != 2)
+			elog(ERROR, "failed to parse option \"%s\"", raw);
+
+		key = (char *) linitial(split);
+		value = (char *) lsecond(split);
+		rv = makeRangeVar(name->schemaname, value, -1);
+
+		if (!pg_strcasecmp(key, OPTION_LOOKUPINDEX))
+			lookupindexid = RangeVarGetRelid(rv, NoLock, false);
+		else if (!pg_strcasecmp(key, OPTION_PKINDEX))
+			pkindexid = RangeVarGetRelid(rv, NoLock, false);
+		else if (!pg_strcasecmp(key, OPTION_SEQREL))
+			seqrelid = RangeVarGetRelid(rv, NoLock, false);
+		else if (!pg_strcasecmp(key, OPTION_MATREL))
+			matrelid = RangeVarGetRelid(rv, NoLock, false);
+		else if (!pg_strcasecmp(key, OPTION_OSREL))
+			osrelid = RangeVarGetRelid(rv, NoLock, false);
+		else if (!pg_strcasecmp(key, OPTION_OVERLAY))
+			overlayid = RangeVarGetRelid(rv, NoLock, false);
+	}
+
+	pq = OpenPipelineQuery(NoLock);
+	ReleaseSysCache(tup);
+	UpdateContViewIndexIds(pq, cq->id, pkindexid, lookupindexid, seqrelid);
+
+	raw = (RawStmt *) linitial(pg_parse_query(cq->sql));
+	Assert(IsA(raw->stmt, SelectStmt));
+
+	record_cv_dependencies(matrelid, osrelid, overlayid,
+			lookupindexid, pkindexid, defrelid, seqrelid, (SelectStmt *) raw->stmt, cq->cvdef);
+
+	ClosePipelineQuery(pq, NoLock);
+
+	/*
+	 * This CV is ready to start reading events now
+	 */
+	SyncPipelineStreamReaders();
+}
+
+/* Time bucket granularities that rollups can be built at, from finest to coarsest */
+static const char *rollup_grains[] = {"second", "minute", "hour", "day", "month", "year"};
+
+/*
+ * get_rollup_grain
+ *
+ * If the given expression buckets timestamps by one of our rollup granularities, either with one of
+ * our own bucketing functions or with date_trunc, return that granularity's index into rollup_grains
+ */
+static int
+get_rollup_grain(Expr *expr)
+{
+	FuncExpr *func;
+	char *name;
+	int i;
+
+	if (!IsA(expr, FuncExpr))
+		return -1;
+
+	func = (FuncExpr *) expr;
+	name = get_func_name(func->funcid);
+
+	if (!name)
+		return -1;
+
+	if (!strcmp(name, "date_trunc"))
+	{
+		Const *unit;
+
+		if (list_length(func->args) != 2)
+			return -1;
+
+		unit = (Const *) linitial(func->args);
+		if (!IsA(unit, Const) || unit->constisnull || unit->consttype != TEXTOID)
+			return -1;
+
+		name = TextDatumGetCString(unit->constvalue);
+	}
+	else if (get_func_namespace(func->funcid) != get_namespace_oid(PIPELINEDB_EXTENSION_NAME, true))
+	{
+		return -1;
+	}
+
+	for (i = 0; i < lengthof(rollup_grains); i++)
+	{
+		if (!pg_strcasecmp(name, rollup_grains[i]))
+			return i;
+	}
+
+	return -1;
+}
+
+/*
+ * get_time_bucket
+ *
+ * Find the single grouping column of a CV's query that buckets timestamps, for options that need one
+ */
+static TargetEntry *
+get_time_bucket(Query *query, char *option, int *grainp)
+{
+	TargetEntry *bucket = NULL;
+	ListCell *lc;
+
+	if (!query->hasAggs || query->groupClause == NIL)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("\"%s\" can only be specified for continuous views with aggregates and a GROUP BY clause", option)));
+
+	foreach(lc, query->targetList)
+	{
+		TargetEntry *te = (TargetEntry *) lfirst(lc);
+		int grain;
+
+		if (te->resjunk)
+			continue;
+
+		grain = get_rollup_grain(te->expr);
+		if (grain < 0 || !get_sortgroupref_clause_noerr(te->ressortgroupref, query->groupClause))
+			continue;
+
+		if (bucket)
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("\"%s\" requires exactly one time bucket grouping column", option),
+					 errdetail("Both \"%s\" and \"%s\" are time buckets.", bucket->resname, te->resname)));
+
+		bucket = te;
+
+		if (grainp)
+			*grainp = grain;
+	}
+
+	if (!bucket)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("\"%s\" requires a time bucket grouping column", option),
+				 errhint("Group by an expression such as minute(arrival_timestamp) or date_trunc('minute', arrival_timestamp).")));
+
+	return bucket;
+}
+
+/*
+ * create_rollups
+ *
+ * Create a cascade of coarser-grained CVs on top of a time-bucketed CV. Each rollup reads the output stream
+ * of the next finer level and combines its delta rows, so its cost scales with the number of finer-grained
+ * groups that changed rather than with the number of raw events. Rollups are named <cv>_<granularity> and
+ * have the same columns as the CV they are built from.
+ */
+static void
+create_rollups(RangeVar *view, Query *query, char *rollups)
+{
+	List *grains;
+	ListCell *lc;
+	TargetEntry *bucket;
+	char *prev_name = view->relname;
+	int prev_grain = -1;
+
+	if (!SplitIdentifierString(pstrdup(rollups), ',', &grains) || grains == NIL)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("\"%s\" must be a comma-separated list of granularities", OPTION_ROLLUPS),
+				 errhint("For example, ... WITH (rollups = 'hour, day') ...")));
+
+	bucket = get_time_bucket(query, OPTION_ROLLUPS, &prev_grain);
+
+	foreach(lc, query->targetList)
+	{
+		TargetEntry *te = (TargetEntry *) lfirst(lc);
+
+		if (te->resjunk || IsA(te->expr, Aggref))
+			continue;
+
+		if (contain_aggs_of_level((Node *) te->expr, 0))
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("rollups can only combine plain aggregate columns"),
+					 errdetail("Column \"%s\" is an expression over aggregates.", te->resname)));
+	}
+
+	foreach(lc, grains)
+	{
+		char *grain_name = (char *) lfirst(lc);
+		StringInfoData sql;
+		StringInfoData groups;
+		ListCell *tlc;
+		char *name;
+		ViewStmt *stmt;
+		bool first = true;
+		int grain = -1;
+		int i;
+
+		for (i = 0; i < lengthof(rollup_grains); i++)
+		{
+			if (!strcmp(grain_name, rollup_grains[i]))
+				grain = i;
+		}
+
+		if (grain < 0)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("invalid rollup granularity \"%s\"", grain_name),
+					 errhint("Valid granularities are second, minute, hour, day, month and year.")));
+
+		if (grain <= prev_grain)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("rollup granularity \"%s\" must be coarser than \"%s\"", grain_name, rollup_grains[prev_grain])));
+
+		name = palloc0(NAMEDATALEN);
+		strcpy(name, view->relname);
+		append_suffix(name, psprintf("_%s", grain_name), NAMEDATALEN);
+
+		initStringInfo(&sql);
+		initStringInfo(&groups);
+		appendStringInfo(&sql, "CREATE VIEW %s AS SELECT ", quote_qualified_identifier(view->schemaname, name));
+
+		foreach(tlc, query->targetList)
+		{
+			TargetEntry *te = (TargetEntry *) lfirst(tlc);
+			const char *col;
+			char *expr;
+
+			if (te->resjunk)
+				continue;
+
+			col = quote_identifier(te->resname);
+
+			if (te == bucket)
+				expr = psprintf("date_trunc('%s', (new).%s)", grain_name, col);
+			else if (IsA(te->expr, Aggref))
+				expr = psprintf("combine((delta).%s)", col);
+			else
+				expr = psprintf("(new).%s", col);
+
+			if (!first)
+				appendStringInfoString(&sql, ", ");
+			appendStringInfo(&sql, "%s AS %s", expr, col);
+			first = false;
 
-	options = DatumGetArrayTypeP(d);
-	deconstruct_array(options, TEXTOID, -1, false, 'i', &values, &nulls, &noptions);
+			if (IsA(te->expr, Aggref))
+				continue;
 
-	for (i = 0; i < noptions; i++)
-	{
-		char *raw = TextDatumGetCString(values[i]);
-		char *key;
-		char *value;
-		List *split = NIL;
-		RangeVar *rv;
+			if (groups.len)
+				appendStringInfoString(&groups, ", ");
+			appendStringInfoString(&groups, expr);
+		}
 
-		if (!SplitIdentifierString(raw, '=', &split))
-			elog(ERROR, "failed to parse option \"%s\"", raw);
+		appendStringInfo(&sql, " FROM output_of(%s) GROUP BY %s",
+				quote_literal_cstr(quote_qualified_identifier(view->schemaname, prev_name)), groups.data);
 
-		if (list_length(split) != 2)
-			elog(ERROR, "failed to parse option \"%s\"", raw);
+		stmt = (ViewStmt *) ((RawStmt *) linitial(pg_parse_query(sql.data)))->stmt;
+		Assert(IsA(stmt, ViewStmt));
 
-		key = (char *) linitial(split);
-		value = (char *) lsecond(split);
-		rv = makeRangeVar(name->schemaname, value, -1);
+		ExecCreateContViewStmt(stmt->view, stmt->query, stmt->options, sql.data);
+		CommandCounterIncrement();
 
-		if (!pg_strcasecmp(key, OPTION_LOOKUPINDEX))
-			lookupindexid = RangeVarGetRelid(rv, NoLock, false);
-		else if (!pg_strcasecmp(key, OPTION_PKINDEX))
-			pkindexid = RangeVarGetRelid(rv, NoLock, false);
-		else if (!pg_strcasecmp(key, OPTION_SEQREL))
-			seqrelid = RangeVarGetRelid(rv, NoLock, false);
-		else if (!pg_strcasecmp(key, OPTION_MATREL))
-			matrelid = RangeVarGetRelid(rv, NoLock, false);
-		else if (!pg_strcasecmp(key, OPTION_OSREL))
-			osrelid = RangeVarGetRelid(rv, NoLock, false);
-		else if (!pg_strcasecmp(key, OPTION_OVERLAY))
-			overlayid = RangeVarGetRelid(rv, NoLock, false);
+		prev_name = name;
+		prev_grain = grain;
 	}
+}
 
-	pq = OpenPipelineQuery(NoLock);
-	ReleaseSysCache(tup);
-	UpdateContViewIndexIds(pq, cq->id, pkindexid, lookupindexid, seqrelid);
+/*
+ * get_interval_ms_option
+ *
+ * Returns the given interval option in milliseconds, or 0 if it wasn't specified
+ */
+static int
+get_interval_ms_option(List *options, char *option, char *example)
+{
+	Interval *interval;
+	char *value;
+	double ms;
 
-	raw = (RawStmt *) linitial(pg_parse_query(cq->sql));
-	Assert(IsA(raw->stmt, SelectStmt));
+	if (!GetOptionAsString(options, option, &value))
+		return 0;
 
-	record_cv_dependencies(matrelid, osrelid, overlayid,
-			lookupindexid, pkindexid, defrelid, seqrelid, (SelectStmt *) raw->stmt, cq->cvdef);
+	interval = (Interval *) DirectFunctionCall3(interval_in,
+			CStringGetDatum(value), ObjectIdGetDatum(InvalidOid), Int32GetDatum(-1));
+	ms = 1000 * DatumGetFloat8(DirectFunctionCall2(interval_part,
+				CStringGetTextDatum("epoch"), PointerGetDatum(interval)));
 
-	ClosePipelineQuery(pq, NoLock);
+	if (ms < 1 || ms > INT_MAX)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("\"%s\" must be an interval of at least 1 millisecond", option),
+				 errhint("For example, ... WITH (%s = '%s') ...", option, example)));
 
-	/*
-	 * This CV is ready to start reading events now
-	 */
-	SyncPipelineStreamReaders();
+	return (int) ms;
 }
 
 /*
@@ -1650,6 +2779,23 @@ ExecCreateContViewStmt(RangeVar *view, Node *sel, List *options, const char *que
 	RawStmt *def;
 	SelectStmt *defstmt;
 	char *given_ttl_column = NULL;
+	int shards = 0;
+	DefElem *unlogged_def;
+	bool unlogged = false;
+	char *rollups = NULL;
+	char *freeze_after_str = NULL;
+	int freeze_after = 0;
+	char *ttl_partition_str = NULL;
+	int ttl_partition = 0;
+	TargetEntry *freeze_bucket = NULL;
+	SelectStmt *overlayselect = NULL;
+	int topn = 0;
+	char *topn_column = NULL;
+	DefElem *cache_def;
+	bool cache = false;
+	int commit_interval = 0;
+	int freshness = 0;
+	int priority = 0;
 
 	check_relation_already_exists(view);
 
@@ -1672,6 +2818,82 @@ ExecCreateContViewStmt(RangeVar *view, Node *sel, List *options, const char *que
 	/* Apply any CQ storage options like sw, step_factor */
 	options = ApplyStorageOptions((SelectStmt *) sel, options, &has_sw, &ttl, &ttl_column);
 
+	if (GetContQueryOption(options, OPTION_SHARDS) &&
+			(!GetOptionAsInteger(options, OPTION_SHARDS, &shards) || shards < 1 || shards > CQ_MATREL_MAX_SHARDS))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("\"%s\" must be a valid integer in the range 1..%d", OPTION_SHARDS, CQ_MATREL_MAX_SHARDS),
+				 errhint("For example, ... WITH (shards = 4) ...")));
+
+	if (GetOptionAsString(options, OPTION_TTL_PARTITION, &ttl_partition_str))
+	{
+		Interval *interval = (Interval *) DirectFunctionCall3(interval_in,
+				CStringGetDatum(ttl_partition_str), ObjectIdGetDatum(InvalidOid), Int32GetDatum(-1));
+
+		ttl_partition = IntervalToEpoch(interval);
+		if (ttl_partition < 1)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("\"%s\" must be an interval of at least 1 second", OPTION_TTL_PARTITION),
+					 errhint("For example, ... WITH (ttl = '1 day', ttl_column = 'hour', ttl_partition = '1 hour') ...")));
+	}
+
+	/* If the matrel is sharded or partitioned, the overlay view must read from all of its children */
+	matrel_name->inh = shards > 0 || ttl_partition > 0;
+
+	unlogged_def = GetContQueryOption(options, OPTION_UNLOGGED);
+	if (unlogged_def)
+		unlogged = defGetBoolean(unlogged_def);
+
+	if (unlogged && shards)
+		elog(ERROR, "\"%s\" cannot be specified for sharded continuous views", OPTION_UNLOGGED);
+
+	GetOptionAsString(options, OPTION_ROLLUPS, &rollups);
+
+	if (GetOptionAsString(options, OPTION_FREEZE_AFTER, &freeze_after_str))
+	{
+		Interval *interval = (Interval *) DirectFunctionCall3(interval_in,
+				CStringGetDatum(freeze_after_str), ObjectIdGetDatum(InvalidOid), Int32GetDatum(-1));
+
+		freeze_after = IntervalToEpoch(interval);
+		if (freeze_after < 1)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("\"%s\" must be an interval of at least 1 second", OPTION_FREEZE_AFTER),
+					 errhint("For example, ... WITH (freeze_after = '1 day') ...")));
+	}
+
+	commit_interval = get_interval_ms_option(options, OPTION_COMMIT_INTERVAL, "500ms");
+	freshness = get_interval_ms_option(options, OPTION_FRESHNESS, "1 second");
+
+	if (GetContQueryOption(options, OPTION_PRIORITY) &&
+			(!GetOptionAsInteger(options, OPTION_PRIORITY, &priority) || priority < 0 || priority > CQ_PRIORITY_MAX))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("\"%s\" must be a valid integer in the range 0..%d", OPTION_PRIORITY, CQ_PRIORITY_MAX),
+				 errhint("For example, ... WITH (priority = 10) ...")));
+
+	cache_def = GetContQueryOption(options, OPTION_CACHE);
+	if (cache_def)
+	{
+		cache = defGetBoolean(cache_def);
+		options = list_delete(options, cache_def);
+	}
+
+	if (GetContQueryOption(options, OPTION_TOPN))
+	{
+		if (!GetOptionAsInteger(options, OPTION_TOPN, &topn) || topn < 1 || topn > CQ_TOPN_MAX)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("\"%s\" must be a valid integer in the range 1..%d", OPTION_TOPN, CQ_TOPN_MAX),
+					 errhint("For example, ... WITH (topn = 10, topn_column = 'count') ...")));
+
+		if (!GetOptionAsString(options, OPTION_TOPN_COLUMN, &topn_column))
+			elog(ERROR, "\"%s\" must be specified in conjunction with \"%s\"", OPTION_TOPN_COLUMN, OPTION_TOPN);
+	}
+	else if (GetContQueryOption(options, OPTION_TOPN_COLUMN))
+		elog(ERROR, "\"%s\" must be specified in conjunction with \"%s\"", OPTION_TOPN, OPTION_TOPN_COLUMN);
+
 	ValidateParsedContQuery(view, sel, querystring);
 
 	raw = makeNode(RawStmt);
@@ -1680,6 +2902,24 @@ ExecCreateContViewStmt(RangeVar *view, Node *sel, List *options, const char *que
 	/* Deparse query so that analyzer always see the same canonicalized SelectStmt */
 	cont_query = parse_analyze(raw, querystring, NULL, 0, NULL);
 
+	/* Buckets are frozen by the CV's time bucket column, which is what the watermark is compared against */
+	if (freeze_after)
+	{
+		Oid type;
+
+		freeze_bucket = get_time_bucket(cont_query, OPTION_FREEZE_AFTER, NULL);
+		type = exprType((Node *) freeze_bucket->expr);
+
+		if (type != TIMESTAMPOID && type != TIMESTAMPTZOID)
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("\"%s\" requires a timestamp or timestamptz time bucket column", OPTION_FREEZE_AFTER),
+					 errdetail("Column \"%s\" is of type %s.", freeze_bucket->resname, format_type_be(type))));
+	}
+
+	if (topn)
+		get_topn_column(cont_query, topn_column);
+
 	/*
 	 * Detect if we're restoring a dumped CV, which requires its own definition path
 	 */
@@ -1786,6 +3026,16 @@ ExecCreateContViewStmt(RangeVar *view, Node *sel, List *options, const char *que
 	create_stmt = makeNode(CreateStmt);
 	create_stmt->relation = matrel_name;
 	create_stmt->tableElts = tableElts;
+
+	/*
+	 * Unlogged matrels don't generate any WAL and are emptied by crash recovery, after which they are
+	 * restored from their last snapshot
+	 */
+	if (unlogged)
+	{
+		create_stmt->relation = copyObject(matrel_name);
+		create_stmt->relation->relpersistence = RELPERSISTENCE_UNLOGGED;
+	}
 	create_stmt->options = matrel_options;
 
 	if (GetOptionAsString(options, OPTION_TABLESPACE, &tsname))
@@ -1796,6 +3046,8 @@ ExecCreateContViewStmt(RangeVar *view, Node *sel, List *options, const char *que
 	matrelid = address.objectId;
 	CommandCounterIncrement();
 
+	set_sketch_storage(matrelid);
+
 	toast_options = transformRelOptions((Datum) 0, create_stmt->options, "toast",
 			validnsps, true, false);
 
@@ -1862,6 +3114,58 @@ ExecCreateContViewStmt(RangeVar *view, Node *sel, List *options, const char *que
 		ttl_attno = FindTTLColumnAttrNo(given_ttl_column, matrelid);
 	}
 
+	if (shards && has_sw)
+		elog(ERROR, "\"%s\" cannot be specified for sliding-window continuous views", OPTION_SHARDS);
+	if (freeze_after && has_sw)
+		elog(ERROR, "\"%s\" cannot be specified for sliding-window continuous views", OPTION_FREEZE_AFTER);
+	if (rollups && has_sw)
+		elog(ERROR, "\"%s\" cannot be specified for sliding-window continuous views", OPTION_ROLLUPS);
+	if (topn && has_sw)
+		elog(ERROR, "\"%s\" cannot be specified for sliding-window continuous views", OPTION_TOPN);
+	if (cache && has_sw)
+		elog(ERROR, "\"%s\" cannot be specified for sliding-window continuous views", OPTION_CACHE);
+	if (shards && query->groupClause == NIL)
+		elog(ERROR, "\"%s\" can only be specified for continuous views with a GROUP BY clause", OPTION_SHARDS);
+
+	if (ttl_partition)
+	{
+		bool grouped = false;
+
+		if (has_sw)
+			elog(ERROR, "\"%s\" cannot be specified for sliding-window continuous views", OPTION_TTL_PARTITION);
+		if (!given_ttl_column)
+			elog(ERROR, "\"%s\" must be specified in conjunction with \"%s\"", OPTION_TTL_PARTITION, OPTION_TTL_COLUMN);
+		if (shards)
+			elog(ERROR, "\"%s\" cannot be specified for sharded continuous views", OPTION_TTL_PARTITION);
+		if (unlogged)
+			elog(ERROR, "\"%s\" cannot be specified for unlogged continuous views", OPTION_TTL_PARTITION);
+		if (freeze_after)
+			elog(ERROR, "\"%s\" cannot be specified in conjunction with \"%s\"", OPTION_TTL_PARTITION, OPTION_FREEZE_AFTER);
+		if (cache)
+			elog(ERROR, "\"%s\" cannot be specified in conjunction with \"%s\"", OPTION_TTL_PARTITION, OPTION_CACHE);
+
+		if (ttl_partition > ttl || ttl / ttl_partition > CQ_MATREL_MAX_TTL_PARTITIONS)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("\"%s\" must be at most \"%s\", and at least 1/%d of it",
+						 OPTION_TTL_PARTITION, OPTION_TTL, CQ_MATREL_MAX_TTL_PARTITIONS)));
+
+		/* A group must never move to another partition when it's updated */
+		foreach(lc, query->groupClause)
+		{
+			TargetEntry *te = get_sortgroupclause_tle((SortGroupClause *) lfirst(lc), query->targetList);
+
+			if (te->resname && !strcmp(te->resname, CompatGetAttName(matrelid, ttl_attno)))
+				grouped = true;
+		}
+
+		if (!grouped)
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("the TTL column of a continuous view with \"%s\" must be one of its grouping columns",
+						 OPTION_TTL_PARTITION)));
+	}
+
 	MemSet(&cxt, 0, sizeof(ContAnalyzeContext));
 	collect_rels_and_streams((Node *) workerselect->fromClause, &cxt);
 
@@ -1886,6 +3190,10 @@ ExecCreateContViewStmt(RangeVar *view, Node *sel, List *options, const char *que
 	view_stmt->view = view;
 	view_stmt->query = (Node *) viewselect;
 
+	/* A frozen or cached CV's view is later redefined as a union, so keep the matrel side as it is now */
+	if (freeze_after || cache)
+		overlayselect = copyObject(viewselect);
+
 	address = DefineView(view_stmt, cont_select_sql, -1, 0);
 	CommandCounterIncrement();
 
@@ -1968,9 +3276,73 @@ ExecCreateContViewStmt(RangeVar *view, Node *sel, List *options, const char *que
 	lookup_idx_oid = create_lookup_index(view, matrelid, matrel_name, select, has_sw);
 	CommandCounterIncrement();
 
+	if (AttributeNumberIsValid(ttl_attno))
+	{
+		create_ttl_index(matrelid, matrel_name, select, has_sw, ttl_attno);
+		CommandCounterIncrement();
+	}
+
 	pkey_idx_oid = create_pkey_index(view, matrelid, matrel_name, pk ? strVal(pk->arg) : CQ_MATREL_PKEY);
 	CommandCounterIncrement();
 
+	if (shards)
+		create_matrel_shards(view, matrelid, matrel_name, create_stmt, select, has_sw, ttl_attno,
+				pk ? strVal(pk->arg) : CQ_MATREL_PKEY, shards);
+
+	if (unlogged)
+		create_matrel_snapshot(matrelid, matrel_name, create_stmt);
+
+	if (freeze_after)
+	{
+		AttrNumber bucket_attno = get_attnum(matrelid, freeze_bucket->resname);
+
+		/* Archived groups can only be expired a whole row group at a time, by their bucket */
+		if (AttributeNumberIsValid(ttl_attno) && ttl_attno != bucket_attno)
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("the TTL column of a continuous view with \"%s\" must be its time bucket column", OPTION_FREEZE_AFTER)));
+
+		create_matrel_archive(view, matrelid, matrel_name, create_stmt, overlayid, overlayselect,
+				get_attnum(matrelid, pk ? strVal(pk->arg) : CQ_MATREL_PKEY), bucket_attno);
+
+		/* Store the watermark in seconds, which is still a valid interval */
+		options = set_option(options, OPTION_FREEZE_AFTER, (Node *) makeString(psprintf("%d", freeze_after)));
+		options = set_option(options, OPTION_FREEZE_ATTNO, (Node *) makeInteger(bucket_attno));
+	}
+
+	if (topn)
+	{
+		AttrNumber topn_attno = get_attnum(overlayid, topn_column);
+
+		create_topn(view, matrelid, matrel_name, create_stmt, overlayid,
+				get_attnum(matrelid, pk ? strVal(pk->arg) : CQ_MATREL_PKEY), topn_attno, topn);
+
+		/* Combiners find the ranked column by its position in the overlay row */
+		options = list_delete(options, GetContQueryOption(options, OPTION_TOPN_COLUMN));
+		options = set_option(options, OPTION_TOPN_ATTNO, (Node *) makeInteger(topn_attno));
+	}
+
+	/* Store the partition width in seconds, which is still a valid interval */
+	if (ttl_partition)
+		options = set_option(options, OPTION_TTL_PARTITION, (Node *) makeString(psprintf("%d", ttl_partition)));
+
+	if (cache)
+	{
+		create_cache(view, matrelid, matrel_name, create_stmt, overlayid, overlayselect,
+				get_attnum(matrelid, pk ? strVal(pk->arg) : CQ_MATREL_PKEY));
+
+		/* Only CVs with a cache ever have this option stored */
+		options = set_option(options, OPTION_CACHE, (Node *) makeString("true"));
+	}
+
+	/* Store intervals in milliseconds, which is still a valid interval */
+	if (commit_interval)
+		options = set_option(options, OPTION_COMMIT_INTERVAL, (Node *) makeString(psprintf("%dms", commit_interval)));
+	if (freshness)
+		options = set_option(options, OPTION_FRESHNESS, (Node *) makeString(psprintf("%dms", freshness)));
+	if (priority)
+		options = set_option(options, OPTION_PRIORITY, (Node *) makeInteger(priority));
+
 	UpdateContViewIndexIds(pipeline_query, cvid, pkey_idx_oid, lookup_idx_oid, seqrelid);
 	CommandCounterIncrement();
 
@@ -1991,7 +3363,17 @@ ExecCreateContViewStmt(RangeVar *view, Node *sel, List *options, const char *que
 	GetContPlan(cv, Worker);
 	GetCombinerLookupPlan(cv);
 
+	if (cv->ttl_partition)
+		CreateMatRelTTLPartitions(cv);
+
 	ClosePipelineQuery(pipeline_query, NoLock);
+
+	/* Rollups read this CV's output stream, so they can only be created once it's complete */
+	if (rollups)
+	{
+		CommandCounterIncrement();
+		create_rollups(view, cont_query, rollups);
+	}
 }
 
 /*
@@ -2342,6 +3724,64 @@ GetTriggerFnOid(Oid defrelid)
 	return result;
 }
 
+/*
+ * get_defrel_option
+ *
+ * Returns the value of the given option stored in a defrel's reloptions, or NULL if it isn't set
+ */
+static char *
+get_defrel_option(Oid defrelid, char *option)
+{
+	HeapTuple tup;
+	Datum d;
+	bool isnull;
+	int i;
+	ArrayType *options;
+	Datum *values;
+	bool *nulls;
+	int noptions;
+	char *result = NULL;
+
+	tup = SearchSysCache1(RELOID, ObjectIdGetDatum(defrelid));
+	if (!HeapTupleIsValid(tup))
+		return NULL;
+
+	d = SysCacheGetAttr(RELOID, tup, Anum_pg_class_reloptions, &isnull);
+
+	if (isnull)
+	{
+		ReleaseSysCache(tup);
+		return NULL;
+	}
+
+	options = DatumGetArrayTypeP(d);
+	deconstruct_array(options, TEXTOID, -1, false, 'i', &values, &nulls, &noptions);
+
+	for (i = 0; i < noptions; i++)
+	{
+		char *raw = TextDatumGetCString(values[i]);
+		char *key;
+		List *split = NIL;
+
+		if (!SplitIdentifierString(raw, '=', &split))
+			elog(ERROR, "failed to parse option \"%s\"", raw);
+
+		if (list_length(split) != 2)
+			elog(ERROR, "failed to parse option \"%s\"", raw);
+
+		key = (char *) linitial(split);
+		if (pg_strcasecmp(key, option))
+			continue;
+
+		result = (char *) lsecond(split);
+		break;
+	}
+
+	ReleaseSysCache(tup);
+
+	return result;
+}
+
 /*
  * GetContQueryForId
  */
@@ -2355,6 +3795,15 @@ GetContQueryForId(Oid id)
 	Query *query;
 	Oid tgfnid = InvalidOid;
 	char *relname;
+	char *shards;
+	char *ttl_partition;
+	char *freeze_after;
+	char *freeze_attno;
+	char *topn;
+	char *topn_attno;
+	char *commit_interval;
+	char *freshness;
+	char *priority;
 
 	if (!HeapTupleIsValid(tup))
 		return NULL;
@@ -2389,6 +3838,46 @@ GetContQueryForId(Oid id)
 		cq->matrel = makeRangeVar(get_namespace_name(get_rel_namespace(row->matrelid)), get_rel_name(row->matrelid), -1);
 		/* Ignore inherited tables when working with the matrel */
 		cq->matrel->inh = false;
+
+		shards = get_defrel_option(row->defrelid, OPTION_SHARDS);
+		if (shards)
+			cq->matrel_shards = atoi(shards);
+
+		ttl_partition = get_defrel_option(row->defrelid, OPTION_TTL_PARTITION);
+		if (ttl_partition)
+			cq->ttl_partition = atoi(ttl_partition);
+
+		cq->unlogged = get_rel_persistence(row->matrelid) == RELPERSISTENCE_UNLOGGED;
+
+		freeze_after = get_defrel_option(row->defrelid, OPTION_FREEZE_AFTER);
+		freeze_attno = get_defrel_option(row->defrelid, OPTION_FREEZE_ATTNO);
+		if (freeze_after && freeze_attno)
+		{
+			cq->freeze_after = atoi(freeze_after);
+			cq->freeze_attno = atoi(freeze_attno);
+		}
+
+		cq->cached = get_defrel_option(row->defrelid, OPTION_CACHE) != NULL;
+
+		topn = get_defrel_option(row->defrelid, OPTION_TOPN);
+		topn_attno = get_defrel_option(row->defrelid, OPTION_TOPN_ATTNO);
+		if (topn && topn_attno)
+		{
+			cq->topn = atoi(topn);
+			cq->topn_attno = atoi(topn_attno);
+		}
+
+		commit_interval = get_defrel_option(row->defrelid, OPTION_COMMIT_INTERVAL);
+		if (commit_interval)
+			cq->commit_interval = atoi(commit_interval);
+
+		freshness = get_defrel_option(row->defrelid, OPTION_FRESHNESS);
+		if (freshness)
+			cq->freshness = atoi(freshness);
+
+		priority = get_defrel_option(row->defrelid, OPTION_PRIORITY);
+		if (priority)
+			cq->priority = atoi(priority);
 	}
 	else
 		cq->matrel = NULL;
@@ -2451,6 +3940,30 @@ GetContQueryForId(Oid id)
 	return cq;
 }
 
+/*
+ * GetContQueryPriority
+ *
+ * Look up a CQ's priority without building the rest of its ContQuery
+ */
+int
+GetContQueryPriority(Oid id)
+{
+	HeapTuple tup = PipelineCatalogLookup(PIPELINEQUERYID, 1, ObjectIdGetDatum(id));
+	Form_pipeline_query row;
+	char *priority;
+
+	if (!HeapTupleIsValid(tup))
+		return 0;
+
+	row = (Form_pipeline_query) GETSTRUCT(tup);
+	if (row->type != PIPELINE_QUERY_VIEW)
+		return 0;
+
+	priority = get_defrel_option(row->defrelid, OPTION_PRIORITY);
+
+	return priority ? atoi(priority) : 0;
+}
+
 /*
  * GetContViewForId
  */
@@ -2613,6 +4126,7 @@ SyncPipelineQuery(void)
 		{
 			PipelineCatalogTupleDelete(pipeline_query, &tup->t_self);
 			PurgeDeadProcStats(row->id);
+			PurgeDeadLatencyStats(row->id);
 		}
 	}
 
@@ -3147,10 +4661,99 @@ SyncContQuerySchema(Oid cqrelid, char *schema)
 
 	if (cq->type == CONT_VIEW)
 	{
+		Oid snaprelid = InvalidOid;
+		Oid markerrelid = InvalidOid;
+		Oid archiverelid = InvalidOid;
+		Oid topnrelid = InvalidOid;
+		Oid topnviewid = InvalidOid;
+		Oid cacherelid = InvalidOid;
+		int i;
+
+		/* Snapshot, archive and top-N relations are found through the matrel's schema, so look them up before it moves */
+		if (cq->unlogged)
+		{
+			snaprelid = GetMatRelSnapshotRelid(cq->matrelid);
+			markerrelid = GetMatRelSnapshotMarkerRelid(cq->matrelid);
+		}
+
+		if (cq->freeze_after)
+			archiverelid = GetMatRelArchiveRelid(cq->matrelid);
+
+		if (cq->topn)
+		{
+			topnrelid = GetMatRelTopNRelid(cq->matrelid);
+			topnviewid = get_relname_relid(CVNameToTopNName(get_rel_name(cq->relid)),
+					get_rel_namespace(cq->matrelid));
+		}
+
+		if (cq->cached)
+			cacherelid = GetMatRelCacheRelid(cq->matrelid);
+
 		/* matrel */
 		stmt->relation = RelidGetRangeVar(cq->matrelid);
 		stmt->objectType = OBJECT_TABLE;
 		ExecAlterObjectSchemaStmt(stmt, NULL);
+
+		/* matrel shards */
+		for (i = 0; i < cq->matrel_shards; i++)
+		{
+			stmt->relation = RelidGetRangeVar(GetMatRelShardRelid(cq->matrelid, i));
+			ExecAlterObjectSchemaStmt(stmt, NULL);
+		}
+
+		/* matrel TTL partitions, which are the matrel's only children */
+		if (cq->ttl_partition)
+		{
+			List *children = find_inheritance_children(cq->matrelid, NoLock);
+			ListCell *lc;
+
+			foreach(lc, children)
+			{
+				stmt->relation = RelidGetRangeVar(lfirst_oid(lc));
+				ExecAlterObjectSchemaStmt(stmt, NULL);
+			}
+
+			list_free(children);
+		}
+
+		/* matrel snapshot relations */
+		if (cq->unlogged)
+		{
+			stmt->relation = RelidGetRangeVar(snaprelid);
+			ExecAlterObjectSchemaStmt(stmt, NULL);
+
+			stmt->relation = RelidGetRangeVar(markerrelid);
+			ExecAlterObjectSchemaStmt(stmt, NULL);
+		}
+
+		/* matrel archive */
+		if (OidIsValid(archiverelid))
+		{
+			stmt->relation = RelidGetRangeVar(archiverelid);
+			ExecAlterObjectSchemaStmt(stmt, NULL);
+		}
+
+		/* top-N relation and the view over it */
+		if (OidIsValid(topnrelid))
+		{
+			stmt->relation = RelidGetRangeVar(topnrelid);
+			ExecAlterObjectSchemaStmt(stmt, NULL);
+		}
+
+		if (OidIsValid(topnviewid))
+		{
+			stmt->relation = RelidGetRangeVar(topnviewid);
+			stmt->objectType = OBJECT_VIEW;
+			ExecAlterObjectSchemaStmt(stmt, NULL);
+		}
+
+		/* finalized cache relation */
+		if (OidIsValid(cacherelid))
+		{
+			stmt->relation = RelidGetRangeVar(cacherelid);
+			stmt->objectType = OBJECT_TABLE;
+			ExecAlterObjectSchemaStmt(stmt, NULL);
+		}
 	}
 
 	CommandCounterIncrement();
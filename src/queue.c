@@ -13,6 +13,7 @@
 #include "microbatch.h"
 #include "pzmq.h"
 #include "miscutils.h"
+#include "pipeline_trace.h"
 #include "scheduler.h"
 #include "utils/hsearch.h"
 #include "utils/memutils.h"
@@ -99,6 +100,8 @@ retry_pending(Size *memory_freed)
 		count--;
 	}
 
+	TRACE_PIPELINEDB_QUEUE_RETRY(count + list_length(to_delete), list_length(to_delete), freed);
+
 	list_free(to_delete);
 	*memory_freed -= freed;
 
@@ -184,6 +187,8 @@ ContinuousQueryQueueMain(void)
 			entry->recv_id = recv_id;
 			entry->len = len;
 			memory_consumed += PENDING_MICROBATCH_SIZE(entry);
+
+			TRACE_PIPELINEDB_QUEUE_SPILL(recv_id, len, hash_get_num_entries(pending));
 		}
 	}
 }
@@ -13,8 +13,11 @@
 #include "executor.h"
 #include "microbatch.h"
 #include "miscutils.h"
+#include "pipeline_trace.h"
 #include "pzmq.h"
 #include "reader.h"
+#include "scheduler.h"
+#include "stats.h"
 #include "utils/memutils.h"
 #include "utils/timestamp.h"
 
@@ -35,8 +38,28 @@ typedef struct ipc_tuple_reader
 	MemoryContext cxt;
 	List *batches;
 	List *flush_acks;
+
+	/*
+	 * Microbatches with tuples for each query, indexed by query id. This is built once per pull
+	 * so that each query only iterates over the microbatches it actually reads.
+	 */
+	List **batches_per_query;
+
+	/*
+	 * Acks of logged asynchronous inserts that combiners may only count once the tuples they
+	 * read have been committed, which can be several batches later
+	 */
+	MemoryContext deferred_cxt;
+	List *deferred_acks;
 } ipc_tuple_reader;
 
+typedef struct deferred_ack
+{
+	tagged_ref_t ref;
+	int ntups;
+	Bitmapset *queries; /* queries whose tuples from this microbatch haven't been committed yet */
+} deferred_ack;
+
 static ipc_tuple_reader *my_reader = NULL;
 
 /*
@@ -58,6 +81,11 @@ ipc_tuple_reader_init(void)
 
 	reader = palloc0(sizeof(ipc_tuple_reader));
 	reader->cxt = cxt;
+	reader->batches_per_query = palloc0(sizeof(List *) * MAX_CQS);
+	reader->deferred_cxt = AllocSetContextCreate(TopMemoryContext, "ipc_tuple_reader deferred acks MemoryContext",
+			ALLOCSET_DEFAULT_MINSIZE,
+			ALLOCSET_DEFAULT_INITSIZE,
+			ALLOCSET_DEFAULT_MAXSIZE);
 
 	MemoryContextSwitchTo(old);
 
@@ -75,6 +103,74 @@ ipc_tuple_reader_destroy(void)
 
 	MemoryContextDelete(my_reader->cxt);
 	my_reader->cxt = NULL;
+
+	MemoryContextDelete(my_reader->deferred_cxt);
+	my_reader->deferred_cxt = NULL;
+	my_reader->deferred_acks = NIL;
+}
+
+/*
+ * is_async_ack
+ */
+static bool
+is_async_ack(tagged_ref_t *ref)
+{
+	microbatch_ack_t *ack = (microbatch_ack_t *) ref->ptr;
+
+	return microbatch_ack_ref_is_valid(ref) && microbatch_ack_get_level(ack) == STREAM_INSERT_ASYNCHRONOUS;
+}
+
+/*
+ * has_sync_acks
+ *
+ * Asynchronous acks only track logged inserts, so they shouldn't force combiners to commit early
+ */
+static bool
+has_sync_acks(List *acks)
+{
+	ListCell *lc;
+
+	foreach(lc, acks)
+	{
+		tagged_ref_t *ref = lfirst(lc);
+
+		if (microbatch_ack_ref_is_valid(ref) && !is_async_ack(ref))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * defer_async_acks
+ */
+static void
+defer_async_acks(microbatch_t *mb)
+{
+	MemoryContext old = MemoryContextSwitchTo(my_reader->deferred_cxt);
+	List *acks = NIL;
+	ListCell *lc;
+
+	foreach(lc, mb->acks)
+	{
+		tagged_ref_t *ref = lfirst(lc);
+
+		if (is_async_ack(ref))
+		{
+			deferred_ack *d = palloc(sizeof(deferred_ack));
+
+			d->ref = *ref;
+			d->ntups = mb->ntups;
+			d->queries = bms_copy(mb->queries);
+			my_reader->deferred_acks = lappend(my_reader->deferred_acks, d);
+		}
+		else
+			acks = lappend(acks, ref);
+	}
+
+	MemoryContextSwitchTo(old);
+
+	mb->acks = acks;
 }
 
 /*
@@ -118,6 +214,8 @@ ipc_tuple_reader_pull(void)
 			continue;
 
 		mb = microbatch_unpack(buf, len);
+		mb->recv_at = GetCurrentTimestamp();
+		TRACE_PIPELINEDB_MICROBATCH_RECV(mb->type, mb->ntups, len, mb->sent_at ? mb->recv_at - mb->sent_at : -1);
 		ntups += mb->ntups;
 		nbytes += len;
 
@@ -152,6 +250,17 @@ ipc_tuple_reader_pull(void)
 
 		queries = bms_union(queries, mb->queries);
 
+		if (mb->ntups)
+		{
+			int id = -1;
+
+			while ((id = bms_next_member(mb->queries, id)) >= 0)
+			{
+				Assert(id < MAX_CQS);
+				my_reader->batches_per_query[id] = lappend(my_reader->batches_per_query[id], mb);
+			}
+		}
+
 		/*
 		 * Hot path for STREAM_INSERT_SYNCHRONOUS_RECEIVE inserts. If we're receiving a microbatch from the insert process
 		 * (we are a worker and microbatch has a single ack of level STREAM_INSERT_SYNCHRONOUS_RECEIVE), mark it as read
@@ -174,7 +283,7 @@ ipc_tuple_reader_pull(void)
 			}
 		}
 
-		my_rbatch.has_acks |= list_length(mb->acks) > 0;
+		my_rbatch.has_acks |= has_sync_acks(mb->acks);
 	}
 
 	MemoryContextSwitchTo(old);
@@ -196,6 +305,14 @@ ipc_tuple_reader_pull(void)
 void
 ipc_tuple_reader_reset(void)
 {
+	int id = -1;
+
+	/* The per-query lists live in the reader's context, so we only need to forget about them */
+	while ((id = bms_next_member(my_rbatch.queries, id)) >= 0)
+		my_reader->batches_per_query[id] = NIL;
+
+	my_rbatch.queries = NULL;
+
 	MemoryContextReset(my_reader->cxt);
 	my_reader->batches = NIL;
 	my_reader->flush_acks = NIL;
@@ -213,12 +330,57 @@ ipc_tuple_reader_ack(void)
 	foreach(lc, my_reader->batches)
 	{
 		microbatch_t *mb = lfirst(lc);
+
+		if (IsContQueryCombinerProcess())
+			defer_async_acks(mb);
+
 		microbatch_acks_check_and_exec(mb->acks, microbatch_ack_increment_acks, mb->ntups);
 	}
 
 	microbatch_acks_check_and_exec(my_reader->flush_acks, microbatch_ack_increment_acks, 1);
 }
 
+/*
+ * ipc_tuple_reader_ack_committed
+ *
+ * Called after each commit with the queries that still have tuples pending for a later one. Any other
+ * query has committed everything it has read so far, so it no longer holds back the deferred acks of
+ * microbatches it read. An ack is counted once none of its microbatch's queries hold it back.
+ */
+void
+ipc_tuple_reader_ack_committed(Bitmapset *pending)
+{
+	MemoryContext old = MemoryContextSwitchTo(my_reader->deferred_cxt);
+	List *remaining = NIL;
+	ListCell *lc;
+
+	foreach(lc, my_reader->deferred_acks)
+	{
+		deferred_ack *d = lfirst(lc);
+
+		d->queries = bms_int_members(d->queries, pending);
+		if (!bms_is_empty(d->queries))
+		{
+			remaining = lappend(remaining, d);
+			continue;
+		}
+
+		if (microbatch_ack_ref_is_valid(&d->ref))
+			microbatch_ack_increment_acks((microbatch_ack_t *) d->ref.ptr, d->ntups);
+
+		bms_free(d->queries);
+		pfree(d);
+	}
+
+	list_free(my_reader->deferred_acks);
+	my_reader->deferred_acks = remaining;
+
+	MemoryContextSwitchTo(old);
+
+	if (remaining == NIL)
+		MemoryContextReset(my_reader->deferred_cxt);
+}
+
 /*
  * read_from_next_batch
  */
@@ -246,7 +408,7 @@ ipc_tuple_reader_next(Oid query_id)
 	if (!my_rscan.scan_started)
 	{
 		my_rscan.scan_started = true;
-		my_rscan.batch = list_head(my_reader->batches);
+		my_rscan.batch = query_id < MAX_CQS ? list_head(my_reader->batches_per_query[query_id]) : NULL;
 	}
 
 	/* Have we read all microbatches? */
@@ -260,9 +422,9 @@ ipc_tuple_reader_next(Oid query_id)
 	Assert(mb->allow_iter);
 	Assert(mb->ntups >= my_rscan.tup_idx);
 
-	/* If this microbatch isn't for the desired query, skip it */
-	if (!bms_is_member(query_id, mb->queries) || !mb->ntups)
-		return read_from_next_batch(query_id);
+	/* We only ever iterate over this query's microbatches */
+	Assert(bms_is_member(query_id, mb->queries));
+	Assert(mb->ntups);
 
 	/* Have we started reading this microbatch? */
 	if (my_rscan.tup_idx == -1)
@@ -270,6 +432,11 @@ ipc_tuple_reader_next(Oid query_id)
 		my_rscan.tup_idx = 0;
 		my_rscan_tup.desc = mb->desc;
 
+		if (mb->sent_at)
+			StatsRecordCQLatency(MyLatencyStatCQEntry,
+					IsContQueryWorkerProcess() ? LATENCY_WORKER_QUEUE : LATENCY_COMBINER_QUEUE,
+					mb->sent_at, mb->recv_at, mb->ntups);
+
 		if (mb->acks)
 		{
 			ListCell *lc;
@@ -9,11 +9,24 @@
 #include "postgres.h"
 
 #include "postgres.h"
+#include "access/genam.h"
+#include "access/heapam.h"
 #include "access/htup_details.h"
+#include "access/stratnum.h"
 #include "access/xact.h"
 #include "catalog.h"
+#include "catalog/dependency.h"
+#include "catalog/pg_am.h"
+#if (PG_VERSION_NUM < 110000)
+#include "catalog/pg_inherits_fn.h"
+#else
+#include "catalog/pg_inherits.h"
+#endif
+#include "catalog/pg_type.h"
+#include "compat.h"
 #include "executor/spi.h"
 #include "executor/tstoreReceiver.h"
+#include "ingestlog.h"
 #include "matrel.h"
 #include "miscadmin.h"
 #include "miscutils.h"
@@ -24,27 +37,46 @@
 #include "optimizer/planner.h"
 #include "parser/parse_expr.h"
 #include "pipeline_query.h"
+#include "pipeline_trace.h"
 #include "reaper.h"
 #include "scheduler.h"
+#include "stats.h"
 #include "storage/lmgr.h"
 #include "tcop/pquery.h"
 #include "tcop/tcopprot.h"
 #include "utils/hsearch.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
 #include "utils/int8.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/rel.h"
 #include "utils/ruleutils.h"
 #include "utils/snapmgr.h"
+#include "utils/timestamp.h"
 
 #define DEFAULT_SLEEP_S 2 /* Sleep for 2s unless there are CVs with TTLs */
 
 #define DELETE_TEMPLATE "DELETE FROM \"%s\".\"%s\" WHERE \"$pk\" IN (%s);"
+#define DELETE_RETURNING_TEMPLATE "DELETE FROM \"%s\".\"%s\" WHERE \"$pk\" IN (%s) RETURNING %s;"
 #define SELECT_PK_WITH_LIMIT "SELECT \"$pk\" FROM \"%s\".\"%s\" WHERE %s < now() - interval '%d seconds' LIMIT %d FOR UPDATE SKIP LOCKED"
 #define SELECT_PK_NO_LIMIT "SELECT \"$pk\" FROM \"%s\".\"%s\" WHERE %s < now() - interval '%d seconds' FOR UPDATE SKIP LOCKED"
+#define FREEZE_TEMPLATE "WITH frozen AS (DELETE FROM ONLY %s m WHERE ctid = ANY (ARRAY(SELECT ctid FROM ONLY %s WHERE %s < now() - interval '%d seconds'%s FOR UPDATE SKIP LOCKED)) " \
+	"RETURNING m.%s AS \"$bucket\", m.%s AS \"$pk\", %s AS \"$keep\"%s), " \
+	"archived AS (INSERT INTO %s SELECT max(\"$bucket\"), count(*), array_agg(\"$pk\")%s FROM frozen WHERE \"$keep\" HAVING count(*) > 0) " \
+	"SELECT count(*) FROM frozen"
+#define SNAPSHOT_TEMPLATE "WITH deleted AS (DELETE FROM %s s WHERE NOT EXISTS (SELECT 1 FROM ONLY %s m WHERE m.%s = s.%s)), " \
+	"updated AS (UPDATE %s s SET (%s) = ROW(%s) FROM ONLY %s m WHERE m.%s = s.%s AND m::text IS DISTINCT FROM s::text) " \
+	"INSERT INTO %s SELECT m.* FROM ONLY %s m WHERE NOT EXISTS (SELECT 1 FROM %s s WHERE s.%s = m.%s)"
+#define ARCHIVE_EXPIRE_TEMPLATE "WITH expired AS (DELETE FROM %s WHERE \"$bucket\" < now() - interval '%d seconds' RETURNING \"$groups\", \"$pks\")%s " \
+	"SELECT coalesce(sum(\"$groups\"), 0)::int8 FROM expired"
+#define ARCHIVE_CACHE_EXPIRE_TEMPLATE ", uncached AS (DELETE FROM %s WHERE group_pk IN (SELECT unnest(\"$pks\") FROM expired))"
+#define CACHE_EXPIRE_TEMPLATE "DELETE FROM %s WHERE group_pk = ANY ($1)"
 
 int ttl_expiration_batch_size;
 int ttl_expiration_threshold;
+int matrel_snapshot_interval;
 
 typedef struct ReaperEntry
 {
@@ -52,15 +84,24 @@ typedef struct ReaperEntry
 	TimestampTz last_expired;
 	int last_deleted;
 	int ttl;
+	ProcStatsEntry *stats;
 } ReaperEntry;
 
+typedef struct MaintenanceEntry
+{
+	Oid relid;
+	TimestampTz last_snapshot;
+	TimestampTz last_frozen;
+} MaintenanceEntry;
+
 static HTAB *last_expired = NULL;
+static HTAB *last_maintained = NULL;
 
 /*
  * get_delete_sql
  */
 static char *
-get_delete_sql(RangeVar *cvname, RangeVar *matrelname)
+get_delete_sql(RangeVar *cvname, RangeVar *matrelname, char *returning)
 {
 	StringInfoData delete_sql;
 	StringInfoData select_sql;
@@ -78,12 +119,380 @@ get_delete_sql(RangeVar *cvname, RangeVar *matrelname)
 		appendStringInfo(&select_sql, SELECT_PK_NO_LIMIT, matrelname->schemaname, matrelname->relname, ttl_col, ttl);
 
 	initStringInfo(&delete_sql);
-	appendStringInfo(&delete_sql, DELETE_TEMPLATE,
-			matrelname->schemaname, matrelname->relname, select_sql.data);
+	if (returning)
+		appendStringInfo(&delete_sql, DELETE_RETURNING_TEMPLATE,
+				matrelname->schemaname, matrelname->relname, select_sql.data, returning);
+	else
+		appendStringInfo(&delete_sql, DELETE_TEMPLATE,
+				matrelname->schemaname, matrelname->relname, select_sql.data);
 
 	return delete_sql.data;
 }
 
+/*
+ * get_ttl_index
+ *
+ * Find a plain btree index on the given matrel's TTL column, if there is one
+ */
+static Oid
+get_ttl_index(Relation rel, AttrNumber ttl_attno)
+{
+	List *indexes = RelationGetIndexList(rel);
+	ListCell *lc;
+	Oid result = InvalidOid;
+
+	foreach(lc, indexes)
+	{
+		Relation index = index_open(lfirst_oid(lc), AccessShareLock);
+		Form_pg_index form = index->rd_index;
+
+		if (index->rd_rel->relam == BTREE_AM_OID && form->indnatts == 1 &&
+				form->indkey.values[0] == ttl_attno && RelationGetIndexPredicate(index) == NIL)
+			result = RelationGetRelid(index);
+
+		index_close(index, AccessShareLock);
+
+		if (OidIsValid(result))
+			break;
+	}
+
+	list_free(indexes);
+
+	return result;
+}
+
+/*
+ * get_ttl_threshold
+ *
+ * Get the TTL column value that rows must be older than in order to be expired
+ */
+static Datum
+get_ttl_threshold(Relation rel, AttrNumber ttl_attno, int ttl)
+{
+	TimestampTz threshold = GetCurrentTimestamp() - ((int64) ttl * USECS_PER_SEC);
+
+	if (TupleDescAttr(RelationGetDescr(rel), ttl_attno - 1)->atttypid == TIMESTAMPOID)
+		return DirectFunctionCall1(timestamptz_timestamp, TimestampTzGetDatum(threshold));
+
+	return TimestampTzGetDatum(threshold);
+}
+
+/*
+ * accum_pk
+ *
+ * Remember the primary key of a group we're removing, so that its finalized cache row can be removed too
+ */
+static void
+accum_pk(Relation rel, HeapTuple tup, AttrNumber pk, ArrayBuildState *pks)
+{
+	bool isnull;
+	Datum value = heap_getattr(tup, pk, RelationGetDescr(rel), &isnull);
+
+	Assert(!isnull);
+	accumArrayResult(pks, value, false, TupleDescAttr(RelationGetDescr(rel), pk - 1)->atttypid, pks->mcontext);
+}
+
+/*
+ * count_rows
+ */
+static int
+count_rows(Relation rel, Snapshot snapshot)
+{
+	HeapScanDesc scan = heap_beginscan(rel, snapshot, 0, NULL);
+	int result = 0;
+
+	while (heap_getnext(scan, ForwardScanDirection) != NULL)
+	{
+		CHECK_FOR_INTERRUPTS();
+		result++;
+	}
+
+	heap_endscan(scan);
+
+	return result;
+}
+
+/*
+ * drop_ttl_partition
+ *
+ * Drop a TTL partition whose whole range has expired, which is far cheaper than deleting its rows one by one
+ * and leaves nothing behind for vacuum. Combiners keep each partition they've read existing groups from locked
+ * until they commit, so we only drop it if we can get an exclusive lock right away, and otherwise try again on
+ * the next run.
+ *
+ * Rows are counted before the partition is locked so that we never scan a heap while blocking combiners. A
+ * combiner that inserts into the partition in between isn't counted, so the count is approximate. Returns the
+ * number of rows removed, or -1 if the partition wasn't dropped.
+ */
+static int
+drop_ttl_partition(Oid relid)
+{
+	Relation rel = heap_open(relid, NoLock);
+	ObjectAddress object;
+	int num_deleted;
+
+	PushActiveSnapshot(GetTransactionSnapshot());
+	num_deleted = count_rows(rel, GetActiveSnapshot());
+	PopActiveSnapshot();
+
+	/* A relation can't be dropped while we have it open */
+	heap_close(rel, NoLock);
+
+	if (!ConditionalLockRelationOid(relid, AccessExclusiveLock))
+		return -1;
+
+	object.classId = RelationRelationId;
+	object.objectId = relid;
+	object.objectSubId = 0;
+
+	performDeletion(&object, DROP_RESTRICT, PERFORM_DELETION_INTERNAL);
+
+	return num_deleted;
+}
+
+/*
+ * lock_expired_tuple
+ *
+ * Lock an expired tuple the same way combiners lock the existing groups they're about to update, except
+ * that we never wait. A combiner that has already looked up this group holds the lock until it commits its
+ * update, so we just skip the tuple and pick it up on a later run if it's still expired. Conversely, a
+ * combiner that looks up the group after we've locked it waits for us, and since the group is deleted by the
+ * time it gets the lock, it treats the group as new rather than updating a tuple that no longer exists.
+ */
+static bool
+lock_expired_tuple(Relation rel, HeapTuple tup, CommandId cid)
+{
+	HeapTupleData locktup;
+	HeapUpdateFailureData hufd;
+	Buffer buffer;
+	HTSU_Result res;
+
+	locktup.t_self = tup->t_self;
+	res = heap_lock_tuple(rel, &locktup, cid, LockTupleExclusive, LockWaitSkip, false, &buffer, &hufd);
+	ReleaseBuffer(buffer);
+
+	return res == HeapTupleMayBeUpdated;
+}
+
+/*
+ * delete_expired_rows
+ *
+ * Delete expired rows by walking the TTL index up to the expiration threshold and deleting the heap tuples
+ * it points to directly, which saves us from planning and executing a DELETE on every run. Each tuple is
+ * locked first with the same tuple lock that combiners take on the groups they update, so this has the
+ * same effect as FOR UPDATE SKIP LOCKED and a combiner never has a group deleted underneath it.
+ *
+ * As with any heap deletion, dead index entries are left for vacuum to clean up.
+ */
+static int
+delete_expired_rows(Relation rel, Oid indexid, AttrNumber ttl_attno, int ttl, AttrNumber pk, ArrayBuildState *pks)
+{
+	Relation index = index_open(indexid, AccessShareLock);
+	IndexScanDesc scan;
+	ScanKeyData skey;
+	HeapTuple tup;
+	CommandId cid = GetCurrentCommandId(true);
+	int num_deleted = 0;
+
+	ScanKeyInit(&skey, 1, BTLessStrategyNumber, F_TIMESTAMP_LT, get_ttl_threshold(rel, ttl_attno, ttl));
+
+	scan = index_beginscan(rel, index, GetActiveSnapshot(), 1, 0);
+	index_rescan(scan, &skey, 1, NULL, 0);
+
+	while ((tup = index_getnext(scan, ForwardScanDirection)) != NULL)
+	{
+		HeapUpdateFailureData hufd;
+
+		CHECK_FOR_INTERRUPTS();
+
+		/*
+		 * If the tuple is locked, or has been updated or deleted since our snapshot was taken,
+		 * a combiner owns it right now
+		 */
+		if (!lock_expired_tuple(rel, tup, cid))
+			continue;
+
+		if (CompatHeapDelete(rel, &tup->t_self, cid, true, &hufd) != HeapTupleMayBeUpdated)
+			continue;
+
+		num_deleted++;
+
+		if (pks)
+			accum_pk(rel, tup, pk, pks);
+
+		if (ttl_expiration_batch_size && num_deleted >= ttl_expiration_batch_size)
+			break;
+	}
+
+	index_endscan(scan);
+	index_close(index, AccessShareLock);
+
+	return num_deleted;
+}
+
+/*
+ * expire_rel
+ *
+ * Remove expired rows from a matrel or one of its shards. If pks is given, the primary keys of the
+ * removed rows are added to it.
+ */
+static int
+expire_rel(RangeVar *cvname, RangeVar *relname, Relation rel, AttrNumber ttl_attno, int ttl,
+		AttrNumber pk, ArrayBuildState *pks)
+{
+	char *delete_cmd;
+	int num_deleted = 0;
+	Oid indexid = InvalidOid;
+
+	if (AttributeNumberIsValid(ttl_attno))
+		indexid = get_ttl_index(rel, ttl_attno);
+
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	if (OidIsValid(indexid))
+	{
+		LockRelation(rel, RowExclusiveLock);
+		num_deleted = delete_expired_rows(rel, indexid, ttl_attno, ttl, pk, pks);
+	}
+	else
+	{
+		/* Now we're certain relid is for a TTL continuous view's matrel */
+		delete_cmd = get_delete_sql(cvname, relname,
+				pks ? quote_identifier(CompatGetAttName(RelationGetRelid(rel), pk)) : NULL);
+
+		if (SPI_connect() != SPI_OK_CONNECT)
+			elog(ERROR, "could not connect to SPI manager");
+
+		if (SPI_execute(delete_cmd, false, 0) != (pks ? SPI_OK_DELETE_RETURNING : SPI_OK_DELETE))
+			elog(ERROR, "SPI_execute failed: %s", delete_cmd);
+
+		num_deleted = SPI_processed;
+
+		if (pks)
+		{
+			uint64 i;
+
+			for (i = 0; i < SPI_processed; i++)
+			{
+				bool isnull;
+				Datum value = SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1, &isnull);
+
+				Assert(!isnull);
+				accumArrayResult(pks, value, false, SPI_gettypeid(SPI_tuptable->tupdesc, 1), pks->mcontext);
+			}
+		}
+
+		if (SPI_finish() != SPI_OK_FINISH)
+			elog(ERROR, "SPI_finish failed");
+	}
+
+	PopActiveSnapshot();
+
+	return num_deleted;
+}
+
+/*
+ * get_pkey_attno
+ */
+static AttrNumber
+get_pkey_attno(Relation rel)
+{
+	List *indexes = RelationGetIndexList(rel);
+	ListCell *lc;
+	AttrNumber result = InvalidAttrNumber;
+
+	foreach(lc, indexes)
+	{
+		Relation index = index_open(lfirst_oid(lc), AccessShareLock);
+
+		if (index->rd_index->indisprimary)
+			result = index->rd_index->indkey.values[0];
+
+		index_close(index, AccessShareLock);
+
+		if (AttributeNumberIsValid(result))
+			break;
+	}
+
+	list_free(indexes);
+
+	return result;
+}
+
+/*
+ * expire_cache
+ *
+ * Remove the finalized cache rows of the groups we just removed from a matrel
+ */
+static void
+expire_cache(Oid cacherelid, ArrayBuildState *pks)
+{
+	Oid argtype = get_array_type(pks->element_type);
+	Datum arg = makeArrayResult(pks, CurrentMemoryContext);
+	StringInfoData sql;
+
+	initStringInfo(&sql);
+	appendStringInfo(&sql, CACHE_EXPIRE_TEMPLATE,
+			quote_qualified_identifier(get_namespace_name(get_rel_namespace(cacherelid)), get_rel_name(cacherelid)));
+
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "could not connect to SPI manager");
+
+	if (SPI_execute_with_args(sql.data, 1, &argtype, &arg, NULL, false, 0) != SPI_OK_DELETE)
+		elog(ERROR, "SPI_execute failed: %s", sql.data);
+
+	if (SPI_finish() != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish failed");
+
+	PopActiveSnapshot();
+}
+
+/*
+ * expire_archive
+ *
+ * Remove the archived row groups of a frozen CV whose latest time bucket has expired. A CV can only
+ * freeze buckets if its TTL column is its time bucket column, so every group in these row groups has
+ * expired too. Their cache rows are removed by the same statement, using the keys each row group kept.
+ */
+static int
+expire_archive(ContQuery *cq, int ttl, Oid cacherelid)
+{
+	Oid archiveid = GetMatRelArchiveRelid(cq->matrelid);
+	StringInfoData uncache;
+	StringInfoData sql;
+	bool isnull;
+	int num_deleted;
+
+	initStringInfo(&uncache);
+	if (OidIsValid(cacherelid))
+		appendStringInfo(&uncache, ARCHIVE_CACHE_EXPIRE_TEMPLATE,
+				quote_qualified_identifier(get_namespace_name(get_rel_namespace(cacherelid)), get_rel_name(cacherelid)));
+
+	initStringInfo(&sql);
+	appendStringInfo(&sql, ARCHIVE_EXPIRE_TEMPLATE,
+			quote_qualified_identifier(get_namespace_name(get_rel_namespace(archiveid)), get_rel_name(archiveid)), ttl,
+			uncache.data);
+
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "could not connect to SPI manager");
+
+	if (SPI_execute(sql.data, false, 0) != SPI_OK_SELECT || SPI_processed != 1)
+		elog(ERROR, "SPI_execute failed: %s", sql.data);
+
+	num_deleted = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull));
+
+	if (SPI_finish() != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish failed");
+
+	PopActiveSnapshot();
+
+	return num_deleted;
+}
+
 /*
  * DeleteTTLExpiredRows
  */
@@ -91,8 +500,14 @@ int
 DeleteTTLExpiredRows(RangeVar *cvname, RangeVar *matrel)
 {
 	bool save_matrels_writable = matrels_writable;
-	char *delete_cmd;
 	int num_deleted = 0;
+	char *ttl_col;
+	int ttl;
+	AttrNumber ttl_attno;
+	AttrNumber pk = InvalidAttrNumber;
+	Oid cacherelid;
+	ArrayBuildState *pks = NULL;
+	ContQuery *cq;
 
 	/* We need to lock the relation to prevent it from being dropped before we run the DELETE */
 	Relation rel = heap_openrv_extended(matrel, AccessShareLock, true);
@@ -103,26 +518,74 @@ DeleteTTLExpiredRows(RangeVar *cvname, RangeVar *matrel)
 	matrels_writable = true;
 	Assert(RangeVarIsTTLContView(cvname));
 
-	/* Now we're certain relid is for a TTL continuous view's matrel */
-	delete_cmd = get_delete_sql(cvname, matrel);
+	RangeVarGetTTLInfo(cvname, &ttl_col, &ttl);
+	ttl_attno = get_attnum(RelationGetRelid(rel), ttl_col);
 
-	PushActiveSnapshot(GetTransactionSnapshot());
+	/* If the CV has a finalized cache, we remember which groups we remove so that we can remove their cache rows too */
+	cacherelid = get_relname_relid(MatRelNameToCacheName(RelationGetRelationName(rel)), RelationGetNamespace(rel));
+	if (OidIsValid(cacherelid))
+	{
+		pk = get_pkey_attno(rel);
+		Assert(AttributeNumberIsValid(pk));
+		pks = initArrayResult(TupleDescAttr(RelationGetDescr(rel), pk - 1)->atttypid, CurrentMemoryContext, true);
+	}
 
-	if (SPI_connect() != SPI_OK_CONNECT)
-		elog(ERROR, "could not connect to SPI manager");
+	cq = RangeVarGetContView(cvname);
+
+	/*
+	 * A TTL-partitioned matrel only has rows of its own when they were inserted before their
+	 * partition was created, so deleting expired rows from it is just a fallback
+	 */
+	num_deleted = expire_rel(cvname, matrel, rel, ttl_attno, ttl, pk, pks);
+
+	/*
+	 * A sharded matrel's rows live in its shards, which share the matrel's attribute numbers,
+	 * so we expire each of them independently
+	 */
+	if (rel->rd_rel->relhassubclass)
+	{
+		List *children = find_inheritance_children(RelationGetRelid(rel), AccessShareLock);
+		ListCell *lc;
 
-	if (SPI_execute(delete_cmd, false, 0) != SPI_OK_DELETE)
-		elog(ERROR, "SPI_execute failed: %s", delete_cmd);
+		foreach(lc, children)
+		{
+			Oid relid = lfirst_oid(lc);
+			RangeVar *childname = makeRangeVar(get_namespace_name(get_rel_namespace(relid)), get_rel_name(relid), -1);
+			Relation child;
+			int64 start;
 
-	num_deleted = SPI_processed;
+			/*
+			 * A TTL partition is dropped once its whole range has expired, so its rows may outlive
+			 * the TTL by up to the partition width
+			 */
+			if (cq && cq->ttl_partition &&
+					TTLPartitionNameGetStart(RelationGetRelationName(rel), childname->relname, &start))
+			{
+				if (TTLPartitionStartGetTimestamp(start + cq->ttl_partition) <=
+						DatumGetTimestamp(get_ttl_threshold(rel, ttl_attno, ttl)))
+					num_deleted += Max(drop_ttl_partition(relid), 0);
+				continue;
+			}
 
-	if (SPI_finish() != SPI_OK_FINISH)
-		elog(ERROR, "SPI_finish failed");
+			child = heap_open(relid, NoLock);
+			childname->inh = false;
+			num_deleted += expire_rel(cvname, childname, child, ttl_attno, ttl, pk, pks);
+
+			heap_close(child, NoLock);
+		}
+	}
+
+	/* A frozen CV's closed buckets live in its archive */
+	if (cq && cq->freeze_after && ttl_attno == cq->freeze_attno)
+		num_deleted += expire_archive(cq, ttl, cacherelid);
+
+	if (pks && pks->nelems > 0)
+		expire_cache(cacherelid, pks);
 
-	PopActiveSnapshot();
 	matrels_writable = save_matrels_writable;
 
-	heap_close(rel, AccessShareLock);
+	heap_close(rel, NoLock);
+	StatsIncrementCQDelete(num_deleted);
 
 	return num_deleted;
 }
@@ -166,6 +629,18 @@ set_last_expiration(Oid relid, int deleted)
 	entry->last_deleted = deleted;
 }
 
+/*
+ * get_stats_entry
+ */
+static ProcStatsEntry *
+get_stats_entry(Oid relid)
+{
+	ReaperEntry *entry = (ReaperEntry *) hash_search(last_expired, &relid, HASH_FIND, NULL);
+	Assert(entry);
+
+	return entry->stats;
+}
+
 /*
  * reset_entries
  */
@@ -218,12 +693,343 @@ get_ttl_rels(int *min_ttl)
 		{
 			entry->last_expired = 0;
 			entry->ttl = cq->ttl;
+			entry->stats = ProcStatsInit(cq->id, MyProcPid);
 		}
 	}
 
 	return result;
 }
 
+/*
+ * get_maintained_cvs
+ *
+ * Get the CVs whose matrels need periodic maintenance other than TTL expiration
+ */
+static List *
+get_maintained_cvs(void)
+{
+	List *result = NIL;
+	int id = -1;
+	Bitmapset *ids = GetContViewIds();
+
+	while ((id = bms_next_member(ids, id)) >= 0)
+	{
+		ContQuery *cq = GetContQueryForId(id);
+
+		if (!cq || (!cq->unlogged && !cq->freeze_after && !cq->ttl_partition))
+			continue;
+
+		result = lappend(result, cq);
+	}
+
+	return result;
+}
+
+/*
+ * snapshot_matrel
+ *
+ * Bring an unlogged matrel's snapshot relation up to date with the matrel's current rows. Only groups that
+ * were added, changed or removed since the last snapshot are written, so an idle or mostly idle matrel
+ * generates little or no WAL no matter how large it is. The whole diff is a single statement, so the
+ * snapshot always reflects exactly what some set of combiner commits left behind.
+ *
+ * Rows are compared by their text representation because not every aggregate transition state type has
+ * an equality operator.
+ */
+static void
+snapshot_matrel(Oid matrelid)
+{
+	Relation rel = heap_open(matrelid, AccessShareLock);
+	TupleDesc desc = RelationGetDescr(rel);
+	Oid snaprelid = GetMatRelSnapshotRelid(matrelid);
+	char *matrel = quote_qualified_identifier(get_namespace_name(RelationGetNamespace(rel)), RelationGetRelationName(rel));
+	char *snapshot = quote_qualified_identifier(get_namespace_name(get_rel_namespace(snaprelid)), get_rel_name(snaprelid));
+	AttrNumber pk = get_pkey_attno(rel);
+	const char *pkname;
+	StringInfoData cols;
+	StringInfoData vals;
+	StringInfoData sql;
+	int i;
+
+	if (!AttributeNumberIsValid(pk))
+		elog(ERROR, "relation \"%s\" has no primary key", RelationGetRelationName(rel));
+
+	pkname = quote_identifier(NameStr(TupleDescAttr(desc, pk - 1)->attname));
+
+	initStringInfo(&cols);
+	initStringInfo(&vals);
+
+	for (i = 0; i < desc->natts; i++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(desc, i);
+		const char *name;
+
+		if (attr->attisdropped)
+			continue;
+
+		name = quote_identifier(NameStr(attr->attname));
+		appendStringInfo(&cols, "%s%s", cols.len ? ", " : "", name);
+		appendStringInfo(&vals, "%sm.%s", vals.len ? ", " : "", name);
+	}
+
+	heap_close(rel, AccessShareLock);
+
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "could not connect to SPI manager");
+
+	initStringInfo(&sql);
+	appendStringInfo(&sql, SNAPSHOT_TEMPLATE,
+			snapshot, matrel, pkname, pkname,
+			snapshot, cols.data, vals.data, matrel, pkname, pkname,
+			snapshot, matrel, snapshot, pkname, pkname);
+
+	if (SPI_execute(sql.data, false, 0) != SPI_OK_INSERT)
+		elog(ERROR, "SPI_execute failed: %s", sql.data);
+
+	if (SPI_finish() != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish failed");
+
+	PopActiveSnapshot();
+}
+
+/*
+ * freeze_matrel
+ *
+ * Move every group whose time bucket is older than the CV's freeze watermark out of the matrel (or each
+ * of its shards) and into its archive, in a single statement per relation. Each statement finalizes the
+ * groups it removes exactly as the CV's view does and appends them to the archive as a single row group.
+ * As with TTL expiration, rows that a combiner has locked are skipped and picked up on a later run.
+ */
+static int
+freeze_matrel(ContQuery *cq)
+{
+	Oid archiveid = GetMatRelArchiveRelid(cq->matrelid);
+	char *archive = quote_qualified_identifier(get_namespace_name(get_rel_namespace(archiveid)), get_rel_name(archiveid));
+	const char *column = quote_identifier(CompatGetAttName(cq->matrelid, cq->freeze_attno));
+	bool save_matrels_writable = matrels_writable;
+	List *rels = list_make1_oid(cq->matrelid);
+	List *context = deparse_context_for("m", cq->matrelid);
+	Relation overlayrel;
+	Relation matrel;
+	Query *overlay;
+	char *limit = "";
+	char *keep = "true";
+	const char *pk;
+	StringInfoData targets;
+	StringInfoData aggs;
+	StringInfoData sql;
+	ListCell *lc;
+	int num_frozen = 0;
+	int i = 0;
+
+	/* Shards share the matrel's attribute numbers */
+	rels = list_concat(rels, find_inheritance_children(cq->matrelid, AccessShareLock));
+
+	matrel = heap_open(cq->matrelid, AccessShareLock);
+	pk = quote_identifier(CompatGetAttName(cq->matrelid, get_pkey_attno(matrel)));
+	heap_close(matrel, AccessShareLock);
+
+	/*
+	 * Finalize groups with the matrel side of the CV's view. Its only range table entry is the matrel,
+	 * which we alias as the rows being frozen.
+	 */
+	overlayrel = heap_open(cq->relid, AccessShareLock);
+	overlay = GetContViewMatRelQuery(overlayrel);
+
+	initStringInfo(&targets);
+	initStringInfo(&aggs);
+
+	foreach(lc, overlay->targetList)
+	{
+		TargetEntry *te = (TargetEntry *) lfirst(lc);
+
+		if (te->resjunk)
+			continue;
+
+		i++;
+		appendStringInfo(&targets, ", %s AS c%d", deparse_expression((Node *) te->expr, context, true, false), i);
+		appendStringInfo(&aggs, ", array_agg(c%d)", i);
+	}
+
+	/* Groups the view filters out, e.g. by a HAVING clause, are frozen but not archived */
+	if (overlay->jointree && overlay->jointree->quals)
+		keep = deparse_expression(overlay->jointree->quals, context, true, false);
+
+	heap_close(overlayrel, AccessShareLock);
+
+	if (ttl_expiration_batch_size)
+		limit = psprintf(" LIMIT %d", ttl_expiration_batch_size);
+
+	matrels_writable = true;
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "could not connect to SPI manager");
+
+	initStringInfo(&sql);
+
+	foreach(lc, rels)
+	{
+		Oid relid = lfirst_oid(lc);
+		char *rel = quote_qualified_identifier(get_namespace_name(get_rel_namespace(relid)), get_rel_name(relid));
+		bool isnull;
+
+		resetStringInfo(&sql);
+		appendStringInfo(&sql, FREEZE_TEMPLATE, rel, rel, column, cq->freeze_after, limit,
+				column, pk, keep, targets.data, archive, aggs.data);
+
+		if (SPI_execute(sql.data, false, 0) != SPI_OK_SELECT || SPI_processed != 1)
+			elog(ERROR, "SPI_execute failed: %s", sql.data);
+
+		num_frozen += DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull));
+	}
+
+	if (SPI_finish() != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish failed");
+
+	PopActiveSnapshot();
+	matrels_writable = save_matrels_writable;
+
+	return num_frozen;
+}
+
+/*
+ * maintain_matrels
+ *
+ * Restore any unlogged matrels that crash recovery has emptied and snapshot each one whose last snapshot
+ * is older than matrel_snapshot_interval, freeze closed time buckets into their CV's archive, and create
+ * the TTL partitions that combiners will soon be inserting into
+ */
+static void
+maintain_matrels(MemoryContext cxt)
+{
+	List *cvs = NIL;
+	ListCell *lc;
+	MemoryContext old;
+	Relation rel;
+
+	PG_TRY();
+	{
+		StartTransactionCommand();
+
+		MemoryContextReset(cxt);
+		old = MemoryContextSwitchTo(cxt);
+		rel = OpenPipelineQuery(RowExclusiveLock);
+		cvs = get_maintained_cvs();
+		ClosePipelineQuery(rel, NoLock);
+		MemoryContextSwitchTo(old);
+
+		CommitTransactionCommand();
+
+		foreach(lc, cvs)
+		{
+			ContQuery *cq = (ContQuery *) lfirst(lc);
+			MaintenanceEntry *entry;
+			bool found;
+
+			CHECK_FOR_INTERRUPTS();
+
+			if (get_sigterm_flag())
+				break;
+
+			/*
+			 * We don't know when a matrel we haven't seen yet was last snapshotted, but its snapshot is
+			 * at most one interval old unless we crashed, in which case restoring it comes first anyway
+			 */
+			entry = (MaintenanceEntry *) hash_search(last_maintained, &cq->matrelid, HASH_ENTER, &found);
+			if (!found)
+			{
+				entry->last_snapshot = GetCurrentTimestamp();
+				entry->last_frozen = 0;
+			}
+
+			StartTransactionCommand();
+			SetCurrentStatementStartTimestamp();
+
+			rel = OpenPipelineQuery(RowExclusiveLock);
+
+			/* The CV may have been dropped since we looked it up */
+			if (get_rel_name(cq->matrelid) && cq->unlogged)
+			{
+				/*
+				 * Always check for a restore first, so that we never overwrite the last good snapshot
+				 * with a matrel that crash recovery has emptied
+				 */
+				RestoreMatRelSnapshot(cq->matrelid);
+
+				if (TimestampDifferenceExceeds(entry->last_snapshot, GetCurrentTimestamp(),
+							matrel_snapshot_interval * 1000))
+				{
+					snapshot_matrel(cq->matrelid);
+					entry->last_snapshot = GetCurrentTimestamp();
+				}
+			}
+
+			/* Buckets close at the rate the watermark moves, so check at the same rate as TTLs */
+			if (get_rel_name(cq->matrelid) && cq->freeze_after &&
+					TimestampDifferenceExceeds(entry->last_frozen, GetCurrentTimestamp(),
+						cq->freeze_after * (1000 * ttl_expiration_threshold / 100.0)))
+			{
+				int frozen = freeze_matrel(cq);
+
+				/* If we hit the batch limit there is more to freeze, so don't wait */
+				if (!ttl_expiration_batch_size || frozen < ttl_expiration_batch_size)
+					entry->last_frozen = GetCurrentTimestamp();
+			}
+
+			if (get_rel_name(cq->matrelid) && cq->ttl_partition)
+			{
+				PushActiveSnapshot(GetTransactionSnapshot());
+				CreateMatRelTTLPartitions(cq);
+				PopActiveSnapshot();
+			}
+
+			ClosePipelineQuery(rel, NoLock);
+
+			CommitTransactionCommand();
+		}
+	}
+	PG_CATCH();
+	{
+		EmitErrorReport();
+		FlushErrorState();
+
+		if (ActiveSnapshotSet())
+			PopActiveSnapshot();
+
+		AbortCurrentTransaction();
+	}
+	PG_END_TRY();
+}
+
+/*
+ * replay_ingest_log
+ *
+ * Resend any logged asynchronous inserts that were lost before combiners committed them
+ */
+static void
+replay_ingest_log(void)
+{
+	PG_TRY();
+	{
+		IngestLogReplay();
+	}
+	PG_CATCH();
+	{
+		EmitErrorReport();
+		FlushErrorState();
+
+		if (ActiveSnapshotSet())
+			PopActiveSnapshot();
+
+		LWLockReleaseAll();
+		AbortCurrentTransaction();
+	}
+	PG_END_TRY();
+}
+
 void
 ContinuousQueryReaperMain(void)
 {
@@ -239,6 +1045,9 @@ ContinuousQueryReaperMain(void)
 	hctl.entrysize = sizeof(ReaperEntry);
 	last_expired = hash_create("ReaperHash", 32, &hctl, HASH_CONTEXT | HASH_ELEM | HASH_BLOBS);
 
+	hctl.entrysize = sizeof(MaintenanceEntry);
+	last_maintained = hash_create("ReaperMaintenanceHash", 32, &hctl, HASH_CONTEXT | HASH_ELEM | HASH_BLOBS);
+
 	StartTransactionCommand();
 	InitPipelineCatalog();
 	CommitTransactionCommand();
@@ -290,6 +1099,7 @@ ContinuousQueryReaperMain(void)
 					RangeVar *cv;
 					RangeVar *matrel;
 					Oid relid;
+					TimestampTz start;
 
 					CHECK_FOR_INTERRUPTS();
 
@@ -316,8 +1126,14 @@ ContinuousQueryReaperMain(void)
 						 */
 						rel = OpenPipelineQuery(RowExclusiveLock);
 
+						MyProcStatCQEntry = get_stats_entry(relid);
+						start = TRACE_PIPELINEDB_REAPER_DELETE_ENABLED() ? GetCurrentTimestamp() : 0;
 						deleted = DeleteTTLExpiredRows(cv, matrel);
+						TRACE_PIPELINEDB_REAPER_DELETE(MyProcStatCQEntry ? MyProcStatCQEntry->key.cqid : InvalidOid,
+								deleted, start ? GetCurrentTimestamp() - start : -1);
 						set_last_expiration(relid, deleted);
+						StatsIncrementCQExec(1);
+						MyProcStatCQEntry = NULL;
 
 						ClosePipelineQuery(rel, NoLock);
 
@@ -332,6 +1148,9 @@ ContinuousQueryReaperMain(void)
 
 				error = true;
 
+				StatsIncrementCQError(1);
+				MyProcStatCQEntry = NULL;
+
 				if (ActiveSnapshotSet())
 					PopActiveSnapshot();
 
@@ -346,6 +1165,13 @@ ContinuousQueryReaperMain(void)
 				break;
 		}
 
+		/* Snapshots, freezing and ingest log replay only need to happen once per database */
+		if (MyContQueryProc->group_id == 0 && !get_sigterm_flag())
+		{
+			maintain_matrels(cxt);
+			replay_ingest_log();
+		}
+
 		reset_entries();
 		pg_usleep(min_sleep * 1000 * 1000);
 	}
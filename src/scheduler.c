@@ -86,6 +86,10 @@ int  continuous_query_max_wait;
 int  continuous_query_combiner_work_mem;
 int  continuous_query_combiner_synchronous_commit;
 int continuous_query_commit_interval;
+bool continuous_query_combiner_group_commit;
+bool continuous_query_adaptive_commit_interval;
+int continuous_query_min_commit_interval;
+int continuous_query_max_commit_interval;
 double continuous_query_proc_priority;
 
 /* flags set by signal handlers */
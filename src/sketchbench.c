@@ -0,0 +1,538 @@
+/*-------------------------------------------------------------------------
+ *
+ * sketchbench.c
+ *		Microbenchmarks for the sketch data structures
+ *
+ * These run each sketch's C API directly, so they measure the data structures
+ * themselves rather than the aggregate and executor machinery around them.
+ *
+ * Copyright (c) 2018, PipelineDB, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "bloom.h"
+#include "catalog/pg_type.h"
+#include "cmsketch.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "fss.h"
+#include "hll.h"
+#include "miscadmin.h"
+#include "portability/instr_time.h"
+#include "tdigest.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+#include "utils/tuplestore.h"
+#include "utils/typcache.h"
+
+#define SKETCH_BENCH_SEED 0x5bd1e9955bd1e995L
+#define ESTIMATES_PER_REP 1000
+#define FSS_BENCH_K 10
+
+typedef struct SketchBenchType
+{
+	const char *name;
+	void *(*create) (int size);
+	void *(*add) (void *sketch, uint64 value);
+	void *(*copy) (void *sketch);
+	void *(*merge) (void *result, void *incoming);
+	void (*estimate) (void *sketch, uint64 value);
+	void *(*prepare_serialize) (void *sketch);
+	void *(*serialize) (void *sketch);
+	void *(*finish) (void *sketch);
+	Size (*size) (void *sketch);
+} SketchBenchType;
+
+/* Keeps the compiler from optimizing away estimates whose results we don't otherwise use */
+static volatile float8 estimate_sink;
+
+static TypeCacheEntry *fss_typ = NULL;
+
+/*
+ * next_value
+ *
+ * xorshift64*, which is plenty for spreading values across a sketch's buckets
+ */
+static inline uint64
+next_value(uint64 *state, int64 cardinality)
+{
+	uint64 x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	x *= 0x2545f4914f6cdd1dL;
+
+	return cardinality > 0 ? x % (uint64) cardinality : x;
+}
+
+/*
+ * HyperLogLog
+ */
+static void *
+hll_create(int size)
+{
+	if (size <= 0)
+		return HLLCreate();
+	if (size > 14)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("p must be in [1, 14]")));
+	return HLLCreateWithP(size);
+}
+
+static void *
+hll_add(void *sketch, uint64 value)
+{
+	int result;
+	HyperLogLog *hll = HLLAdd((HyperLogLog *) sketch, &value, sizeof(uint64), &result);
+
+	SET_VARSIZE(hll, HLLSize(hll));
+	return hll;
+}
+
+static void *
+hll_copy(void *sketch)
+{
+	return HLLCopy((HyperLogLog *) sketch);
+}
+
+static void *
+hll_merge(void *result, void *incoming)
+{
+	return HLLUnion((HyperLogLog *) result, (HyperLogLog *) incoming);
+}
+
+static void
+hll_estimate(void *sketch, uint64 value)
+{
+	HyperLogLog *hll = (HyperLogLog *) sketch;
+
+	/* Cardinalities are cached until the HLL changes, so force them to be recomputed */
+	if (HLL_IS_DENSE(hll))
+		hll->encoding = HLL_DENSE_DIRTY;
+	else if (HLL_IS_SPARSE(hll))
+		hll->encoding = HLL_SPARSE_DIRTY;
+	else if (HLL_IS_EXPLICIT(hll))
+		hll->encoding = HLL_EXPLICIT_DIRTY;
+
+	estimate_sink = HLLCardinality(hll);
+}
+
+static void *
+hll_prepare_serialize(void *sketch)
+{
+	/* Combiners keep HLLs unpacked and pack them when they're serialized */
+	return HLLUnpack((HyperLogLog *) sketch);
+}
+
+static void *
+hll_serialize(void *sketch)
+{
+	return HLLPack((HyperLogLog *) sketch);
+}
+
+static Size
+hll_size(void *sketch)
+{
+	return HLLSize((HyperLogLog *) sketch);
+}
+
+/*
+ * t-digest
+ */
+static void *
+tdigest_create(int size)
+{
+	return size > 0 ? TDigestCreateWithCompression(size) : TDigestCreate();
+}
+
+static void *
+tdigest_add(void *sketch, uint64 value)
+{
+	return TDigestAdd((TDigest *) sketch, (float8) value, 1);
+}
+
+static void *
+tdigest_copy(void *sketch)
+{
+	return TDigestCopy((TDigest *) sketch);
+}
+
+static void *
+tdigest_merge(void *result, void *incoming)
+{
+	return TDigestMerge((TDigest *) result, (TDigest *) incoming);
+}
+
+static void
+tdigest_estimate(void *sketch, uint64 value)
+{
+	estimate_sink = TDigestQuantile((TDigest *) sketch, (float8) (value % 1000) / 1000.0);
+}
+
+static void *
+tdigest_serialize(void *sketch)
+{
+	return TDigestCompress((TDigest *) sketch);
+}
+
+static Size
+tdigest_size(void *sketch)
+{
+	return TDigestSize((TDigest *) sketch);
+}
+
+/*
+ * Count-Min Sketch
+ */
+static void *
+cmsketch_create(int size)
+{
+	CountMinSketch *cms = CountMinSketchCreate();
+
+	/* size is the width, and we keep the default depth */
+	if (size > 0)
+		cms = CountMinSketchCreateWithDAndW(cms->d, size);
+
+	return cms;
+}
+
+static void *
+cmsketch_add(void *sketch, uint64 value)
+{
+	CountMinSketchAdd((CountMinSketch *) sketch, &value, sizeof(uint64), 1);
+	return sketch;
+}
+
+static void *
+cmsketch_copy(void *sketch)
+{
+	return CountMinSketchCopy((CountMinSketch *) sketch);
+}
+
+static void *
+cmsketch_merge(void *result, void *incoming)
+{
+	return CountMinSketchMerge((CountMinSketch *) result, (CountMinSketch *) incoming);
+}
+
+static void
+cmsketch_estimate(void *sketch, uint64 value)
+{
+	estimate_sink = CountMinSketchEstimateFrequency((CountMinSketch *) sketch, &value, sizeof(uint64));
+}
+
+static Size
+cmsketch_size(void *sketch)
+{
+	return CountMinSketchSize((CountMinSketch *) sketch);
+}
+
+/*
+ * Bloom filter
+ */
+static void *
+bloom_create(int size)
+{
+	/* size is the expected number of elements, at the default false positive rate */
+	return size > 0 ? BloomFilterCreateWithPAndN(0.02, size) : BloomFilterCreate();
+}
+
+static void *
+bloom_add(void *sketch, uint64 value)
+{
+	BloomFilterAdd((BloomFilter *) sketch, &value, sizeof(uint64));
+	return sketch;
+}
+
+static void *
+bloom_copy(void *sketch)
+{
+	return BloomFilterCopy((BloomFilter *) sketch);
+}
+
+static void *
+bloom_merge(void *result, void *incoming)
+{
+	return BloomFilterUnion((BloomFilter *) result, (BloomFilter *) incoming);
+}
+
+static void
+bloom_estimate(void *sketch, uint64 value)
+{
+	estimate_sink = BloomFilterContains((BloomFilter *) sketch, &value, sizeof(uint64));
+}
+
+static Size
+bloom_size(void *sketch)
+{
+	return BloomFilterSize((BloomFilter *) sketch);
+}
+
+/*
+ * Filtered Space-Saving
+ */
+static void *
+fss_create(int size)
+{
+	if (!fss_typ)
+		fss_typ = lookup_type_cache(INT8OID, 0);
+
+	return FSSCreate(size > 0 ? size : FSS_BENCH_K, fss_typ);
+}
+
+static void *
+fss_add(void *sketch, uint64 value)
+{
+	return FSSIncrement((FSS *) sketch, Int64GetDatum((int64) value), false);
+}
+
+static void *
+fss_copy(void *sketch)
+{
+	return FSSCopy((FSS *) sketch);
+}
+
+static void *
+fss_merge(void *result, void *incoming)
+{
+	return FSSMerge((FSS *) result, (FSS *) incoming);
+}
+
+static void
+fss_estimate(void *sketch, uint64 value)
+{
+	FSS *fss = (FSS *) sketch;
+	bool *nulls;
+	uint16_t found;
+	Datum *values = FSSTopK(fss, fss->k, &nulls, &found);
+
+	estimate_sink = found;
+	pfree(values);
+	pfree(nulls);
+}
+
+static Size
+fss_size(void *sketch)
+{
+	return FSSSize((FSS *) sketch);
+}
+
+/*
+ * Sketches with a flat representation are serialized by copying them as they are. finish brings a
+ * sketch into the state that lets it be read without modifying it.
+ */
+static const SketchBenchType sketch_bench_types[] = {
+	{"hll", hll_create, hll_add, hll_copy, hll_merge, hll_estimate, hll_prepare_serialize, hll_serialize, NULL, hll_size},
+	{"tdigest", tdigest_create, tdigest_add, tdigest_copy, tdigest_merge, tdigest_estimate, tdigest_copy, tdigest_serialize, tdigest_serialize, tdigest_size},
+	{"cmsketch", cmsketch_create, cmsketch_add, cmsketch_copy, cmsketch_merge, cmsketch_estimate, NULL, cmsketch_copy, NULL, cmsketch_size},
+	{"bloom", bloom_create, bloom_add, bloom_copy, bloom_merge, bloom_estimate, NULL, bloom_copy, NULL, bloom_size},
+	{"fss", fss_create, fss_add, fss_copy, fss_merge, fss_estimate, NULL, fss_copy, NULL, fss_size}
+};
+
+/*
+ * build_sketch
+ */
+static void *
+build_sketch(const SketchBenchType *type, int size, int64 n, int64 cardinality, uint64 *seed)
+{
+	void *sketch = type->create(size);
+	int64 i;
+
+	for (i = 0; i < n; i++)
+		sketch = type->add(sketch, next_value(seed, cardinality));
+
+	return sketch;
+}
+
+/*
+ * put_result
+ */
+static void
+put_result(Tuplestorestate *store, TupleDesc desc, const char *op, int64 ops, instr_time elapsed, Size bytes)
+{
+	Datum values[6];
+	bool nulls[6];
+	float8 secs = INSTR_TIME_GET_DOUBLE(elapsed);
+
+	MemSet(nulls, 0, sizeof(nulls));
+
+	values[0] = CStringGetTextDatum(op);
+	values[1] = Int64GetDatum(ops);
+	values[2] = Float8GetDatum(secs * 1000.0);
+	values[3] = Float8GetDatum(ops ? secs * 1000000000.0 / ops : 0);
+	values[4] = Float8GetDatum(secs > 0 ? ops / secs : 0);
+	values[5] = Int64GetDatum(bytes);
+
+	tuplestore_putvalues(store, desc, values, nulls);
+}
+
+/*
+ * pipeline_sketch_benchmark
+ *
+ * Times add, merge, estimate and serialize operations on the given sketch, filled with n values
+ * drawn from the given number of distinct values (0 for unbounded). size is the sketch's main size
+ * parameter: p for hll, compression for tdigest, width for cmsketch, expected elements for bloom
+ * and k for fss, or NULL for the defaults.
+ */
+PG_FUNCTION_INFO_V1(pipeline_sketch_benchmark);
+Datum
+pipeline_sketch_benchmark(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsi = (ReturnSetInfo *) fcinfo->resultinfo;
+	char *name;
+	int64 n;
+	int64 cardinality;
+	int size;
+	int reps;
+	const SketchBenchType *type = NULL;
+	Tuplestorestate *store;
+	TupleDesc desc;
+	MemoryContext old;
+	MemoryContext bench_cxt;
+	MemoryContext rep_cxt;
+	instr_time start;
+	instr_time end;
+	instr_time elapsed;
+	uint64 seed;
+	void *sketch = NULL;
+	void *incoming;
+	int i;
+	int j;
+
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) || PG_ARGISNULL(4))
+		elog(ERROR, "sketch, n, cardinality and reps must not be NULL");
+
+	name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	n = PG_GETARG_INT64(1);
+	cardinality = PG_GETARG_INT64(2);
+	size = PG_ARGISNULL(3) ? 0 : PG_GETARG_INT32(3);
+	reps = PG_GETARG_INT32(4);
+
+	for (i = 0; i < lengthof(sketch_bench_types); i++)
+	{
+		if (pg_strcasecmp(name, sketch_bench_types[i].name) == 0)
+			type = &sketch_bench_types[i];
+	}
+
+	if (!type)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("unknown sketch \"%s\"", name),
+				 errhint("Valid sketches are hll, tdigest, cmsketch, bloom and fss.")));
+
+	if (n <= 0 || reps <= 0 || cardinality < 0 || size < 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("n and reps must be positive, and cardinality and size must not be negative")));
+
+	desc = CreateTemplateTupleDesc(6, false);
+	TupleDescInitEntry(desc, (AttrNumber) 1, "op", TEXTOID, -1, 0);
+	TupleDescInitEntry(desc, (AttrNumber) 2, "ops", INT8OID, -1, 0);
+	TupleDescInitEntry(desc, (AttrNumber) 3, "total_ms", FLOAT8OID, -1, 0);
+	TupleDescInitEntry(desc, (AttrNumber) 4, "ns_per_op", FLOAT8OID, -1, 0);
+	TupleDescInitEntry(desc, (AttrNumber) 5, "ops_per_sec", FLOAT8OID, -1, 0);
+	TupleDescInitEntry(desc, (AttrNumber) 6, "bytes", INT8OID, -1, 0);
+
+	rsi->returnMode = SFRM_Materialize;
+	rsi->setDesc = BlessTupleDesc(desc);
+
+	old = MemoryContextSwitchTo(rsi->econtext->ecxt_per_query_memory);
+	store = tuplestore_begin_heap(false, false, work_mem);
+	MemoryContextSwitchTo(old);
+
+	rsi->setResult = store;
+
+	bench_cxt = AllocSetContextCreate(CurrentMemoryContext, "SketchBenchContext", ALLOCSET_DEFAULT_SIZES);
+	rep_cxt = AllocSetContextCreate(bench_cxt, "SketchBenchRepContext", ALLOCSET_DEFAULT_SIZES);
+	old = MemoryContextSwitchTo(bench_cxt);
+
+	/* add: build a sketch from scratch each rep and keep the last one for the other operations */
+	INSTR_TIME_SET_ZERO(elapsed);
+	for (i = 0; i < reps; i++)
+	{
+		seed = SKETCH_BENCH_SEED;
+		if (sketch)
+			pfree(sketch);
+
+		INSTR_TIME_SET_CURRENT(start);
+		sketch = build_sketch(type, size, n, cardinality, &seed);
+		INSTR_TIME_SET_CURRENT(end);
+		INSTR_TIME_ACCUM_DIFF(elapsed, end, start);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+	put_result(store, rsi->setDesc, "add", n * reps, elapsed, type->size(sketch));
+
+	/* serialize: each rep serializes a fresh copy, since some sketches serialize in place */
+	INSTR_TIME_SET_ZERO(elapsed);
+	MemoryContextSwitchTo(rep_cxt);
+	for (i = 0; i < reps; i++)
+	{
+		void *result = type->prepare_serialize ? type->prepare_serialize(sketch) : sketch;
+
+		INSTR_TIME_SET_CURRENT(start);
+		result = type->serialize(result);
+		INSTR_TIME_SET_CURRENT(end);
+		INSTR_TIME_ACCUM_DIFF(elapsed, end, start);
+
+		if (i == reps - 1)
+			put_result(store, rsi->setDesc, "serialize", reps, elapsed, VARSIZE(result));
+
+		MemoryContextReset(rep_cxt);
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	MemoryContextSwitchTo(bench_cxt);
+	if (type->finish)
+		sketch = type->finish(sketch);
+
+	/* merge: merge a sketch built from a different sequence of values into a copy of the first */
+	seed = ~SKETCH_BENCH_SEED;
+	incoming = build_sketch(type, size, n, cardinality, &seed);
+	if (type->finish)
+		incoming = type->finish(incoming);
+
+	INSTR_TIME_SET_ZERO(elapsed);
+	MemoryContextSwitchTo(rep_cxt);
+	for (i = 0; i < reps; i++)
+	{
+		void *result = type->copy(sketch);
+
+		INSTR_TIME_SET_CURRENT(start);
+		result = type->merge(result, incoming);
+		INSTR_TIME_SET_CURRENT(end);
+		INSTR_TIME_ACCUM_DIFF(elapsed, end, start);
+
+		if (i == reps - 1)
+			put_result(store, rsi->setDesc, "merge", reps, elapsed, type->size(result));
+
+		MemoryContextReset(rep_cxt);
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	/* estimate */
+	INSTR_TIME_SET_ZERO(elapsed);
+	seed = SKETCH_BENCH_SEED;
+	for (i = 0; i < reps; i++)
+	{
+		INSTR_TIME_SET_CURRENT(start);
+		for (j = 0; j < ESTIMATES_PER_REP; j++)
+			type->estimate(sketch, next_value(&seed, cardinality));
+		INSTR_TIME_SET_CURRENT(end);
+		INSTR_TIME_ACCUM_DIFF(elapsed, end, start);
+
+		MemoryContextReset(rep_cxt);
+		CHECK_FOR_INTERRUPTS();
+	}
+	put_result(store, rsi->setDesc, "estimate", (int64) reps * ESTIMATES_PER_REP, elapsed, type->size(sketch));
+
+	MemoryContextSwitchTo(old);
+	MemoryContextDelete(bench_cxt);
+
+	return (Datum) 0;
+}
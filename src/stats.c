@@ -8,6 +8,8 @@
  */
 #include "postgres.h"
 
+#include <math.h>
+
 #include "access/htup_details.h"
 #include "catalog/pg_type.h"
 #include "funcapi.h"
@@ -16,13 +18,29 @@
 #include "stats.h"
 #include "storage/lwlock.h"
 #include "storage/shmem.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/hsearch.h"
+#include "utils/tuplestore.h"
 
 static HTAB *proc_stats = NULL;
 static HTAB *stream_stats = NULL;
+static HTAB *latency_stats = NULL;
 
 ProcStatsEntry *MyProcStatCQEntry = NULL;
+LatencyStatsEntry *MyLatencyStatCQEntry = NULL;
+
+/* guc */
+int latency_stats_max_queries;
+
+static const char *latency_stage_names[NUM_LATENCY_STAGES] = {
+	"worker_queue",
+	"worker_exec",
+	"combiner_queue",
+	"combine",
+	"sync",
+	"commit"
+};
 
 /*
  * StatsRequestLWLocks
@@ -32,6 +50,7 @@ StatsRequestLWLocks(void)
 {
 	RequestNamedLWLockTranche("pipelinedb_proc_stats", 1);
 	RequestNamedLWLockTranche("pipelinedb_stream_stats", 1);
+	RequestNamedLWLockTranche("pipelinedb_latency_stats", 1);
 }
 
 /*
@@ -65,6 +84,12 @@ StatsShmemSize(void)
 	 */
 	size = add_size(size, hash_estimate_size(4, sizeof(ProcStatsEntry)));
 
+	/*
+	 * latency_stats, which is fixed-size since its entries are much larger
+	 */
+	if (latency_stats_max_queries)
+		size = add_size(size, hash_estimate_size(latency_stats_max_queries, sizeof(LatencyStatsEntry)));
+
 	return size;
 }
 
@@ -92,6 +117,17 @@ StatsShmemInit(void)
 
 	stream_stats = ShmemInitHash("stream_stats", 32, 1024, &ctl, HASH_ELEM | HASH_BLOBS);
 
+	if (latency_stats_max_queries)
+	{
+		MemSet(&ctl, 0, sizeof(HASHCTL));
+
+		ctl.keysize = sizeof(LatencyStatsKey);
+		ctl.entrysize = sizeof(LatencyStatsEntry);
+
+		latency_stats = ShmemInitHash("latency_stats", latency_stats_max_queries, latency_stats_max_queries,
+				&ctl, HASH_ELEM | HASH_BLOBS);
+	}
+
 	LWLockRelease(AddinShmemInitLock);
 }
 
@@ -140,6 +176,28 @@ PurgeDeadStreamStats(Oid relid)
 	hash_search(stream_stats, &key, HASH_REMOVE, NULL);
 }
 
+/*
+ * PurgeDeadLatencyStats
+ */
+void
+PurgeDeadLatencyStats(Oid cqid)
+{
+	LatencyStatsKey key;
+	LWLock *lock;
+
+	if (!latency_stats)
+		return;
+
+	key.dbid = MyDatabaseId;
+	key.cqid = cqid;
+
+	lock = &(GetNamedLWLockTranche("pipelinedb_latency_stats")->lock);
+
+	LWLockAcquire(lock, LW_EXCLUSIVE);
+	hash_search(latency_stats, &key, HASH_REMOVE, NULL);
+	LWLockRelease(lock);
+}
+
 /*
  * GetInstallationStats
  */
@@ -253,6 +311,9 @@ get_proc_stats_entry(Oid cqid, pid_t pid, bool *found)
 			pg_atomic_write_u64(&entry->executions, 0);
 			pg_atomic_write_u64(&entry->errors, 0);
 			pg_atomic_write_u64(&entry->exec_ms, 0);
+			pg_atomic_write_u64(&entry->deleted_rows, 0);
+			pg_atomic_write_u64(&entry->toast_bytes, 0);
+			pg_atomic_write_u64(&entry->commit_interval, 0);
 		}
 	}
 
@@ -361,6 +422,114 @@ StreamStatsInit(Oid relid)
 	return entry;
 }
 
+/*
+ * LatencyStatsInit
+ *
+ * Returns the given query's latency histograms, or NULL if latency stats are disabled or there is no
+ * room left for another query
+ */
+LatencyStatsEntry *
+LatencyStatsInit(Oid cqid)
+{
+	LatencyStatsEntry *entry;
+	LatencyStatsKey key;
+	static LWLock *lock = NULL;
+	bool found;
+
+	if (!latency_stats || !MyContQueryProc)
+		return NULL;
+
+	if (!lock)
+		lock = &(GetNamedLWLockTranche("pipelinedb_latency_stats")->lock);
+
+	key.dbid = MyDatabaseId;
+	key.cqid = cqid;
+
+	LWLockAcquire(lock, LW_SHARED);
+	entry = (LatencyStatsEntry *) hash_search(latency_stats, &key, HASH_FIND, NULL);
+
+	if (!entry)
+	{
+		LWLockRelease(lock);
+		LWLockAcquire(lock, LW_EXCLUSIVE);
+		entry = (LatencyStatsEntry *) hash_search(latency_stats, &key, HASH_ENTER_NULL, &found);
+
+		if (entry && !found)
+		{
+			int i;
+			int j;
+
+			for (i = 0; i < NUM_LATENCY_STAGES; i++)
+				for (j = 0; j < LATENCY_BUCKETS; j++)
+					pg_atomic_init_u64(&entry->counts[i][j], 0);
+		}
+	}
+
+	LWLockRelease(lock);
+
+	return entry;
+}
+
+/*
+ * latency_bucket
+ */
+static int
+latency_bucket(uint64 us)
+{
+	int msb = 0;
+	int shift;
+	int bucket;
+
+	if (us < LATENCY_SUB_BUCKETS)
+		return (int) us;
+
+	while ((us >> (msb + 1)) != 0)
+		msb++;
+
+	/* us >> shift is in [LATENCY_SUB_BUCKETS, 2 * LATENCY_SUB_BUCKETS) */
+	shift = msb - LATENCY_SUB_BUCKET_BITS;
+	bucket = (shift + 1) * LATENCY_SUB_BUCKETS + (int) ((us >> shift) & (LATENCY_SUB_BUCKETS - 1));
+
+	return Min(bucket, LATENCY_BUCKETS - 1);
+}
+
+/*
+ * latency_bucket_value
+ *
+ * Returns the highest value that falls into the given bucket
+ */
+static uint64
+latency_bucket_value(int bucket)
+{
+	int shift;
+	uint64 sub;
+
+	if (bucket < LATENCY_SUB_BUCKETS)
+		return (uint64) bucket;
+
+	shift = bucket / LATENCY_SUB_BUCKETS - 1;
+	sub = LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS;
+
+	return ((sub + 1) << shift) - 1;
+}
+
+/*
+ * RecordLatency
+ *
+ * Records n occurrences of the given latency for a stage
+ */
+void
+RecordLatency(LatencyStatsEntry *entry, LatencyStage stage, int64 us, uint64 n)
+{
+	Assert(stage < NUM_LATENCY_STAGES);
+
+	/* Clocks on different procs can disagree slightly */
+	if (us < 0)
+		us = 0;
+
+	pg_atomic_fetch_add_u64(&entry->counts[stage][latency_bucket((uint64) us)], n);
+}
+
 /*
  * get_proc_type_str
  */
@@ -413,7 +582,7 @@ pipeline_get_proc_query_stats(PG_FUNCTION_ARGS)
 		old = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
 
 		/* build tupdesc for result tuples */
-		desc = CreateTemplateTupleDesc(13, false);
+		desc = CreateTemplateTupleDesc(16, false);
 		TupleDescInitEntry(desc, (AttrNumber) 1, "type", TEXTOID, -1, 0);
 		TupleDescInitEntry(desc, (AttrNumber) 2, "pid", INT4OID, -1, 0);
 		TupleDescInitEntry(desc, (AttrNumber) 3, "start_time", TIMESTAMPTZOID, -1, 0);
@@ -427,6 +596,9 @@ pipeline_get_proc_query_stats(PG_FUNCTION_ARGS)
 		TupleDescInitEntry(desc, (AttrNumber) 11, "executions", INT8OID, -1, 0);
 		TupleDescInitEntry(desc, (AttrNumber) 12, "errors", INT8OID, -1, 0);
 		TupleDescInitEntry(desc, (AttrNumber) 13, "exec_ms", INT8OID, -1, 0);
+		TupleDescInitEntry(desc, (AttrNumber) 14, "deleted_rows", INT8OID, -1, 0);
+		TupleDescInitEntry(desc, (AttrNumber) 15, "toast_bytes", INT8OID, -1, 0);
+		TupleDescInitEntry(desc, (AttrNumber) 16, "commit_interval", INT8OID, -1, 0);
 
 		funcctx->tuple_desc = BlessTupleDesc(desc);
 
@@ -444,8 +616,8 @@ pipeline_get_proc_query_stats(PG_FUNCTION_ARGS)
 
 	while ((entry = (ProcStatsEntry *) hash_seq_search(iter)) != NULL)
 	{
-		Datum values[13];
-		bool nulls[13];
+		Datum values[16];
+		bool nulls[16];
 		HeapTuple tup;
 		pid_t pid = entry->key.pid;
 
@@ -476,6 +648,9 @@ pipeline_get_proc_query_stats(PG_FUNCTION_ARGS)
 		values[10] = Int64GetDatum(pg_atomic_read_u64(&entry->executions));
 		values[11] = Int64GetDatum(pg_atomic_read_u64(&entry->errors));
 		values[12] = Int64GetDatum(pg_atomic_read_u64(&entry->exec_ms));
+		values[13] = Int64GetDatum(pg_atomic_read_u64(&entry->deleted_rows));
+		values[14] = Int64GetDatum(pg_atomic_read_u64(&entry->toast_bytes));
+		values[15] = Int64GetDatum(pg_atomic_read_u64(&entry->commit_interval));
 
 		tup = heap_form_tuple(funcctx->tuple_desc, values, nulls);
 		result = HeapTupleGetDatum(tup);
@@ -554,3 +729,170 @@ pipeline_get_stream_stats(PG_FUNCTION_ARGS)
 
 	SRF_RETURN_DONE(funcctx);
 }
+
+/*
+ * latency_percentile
+ *
+ * Returns the highest value of the bucket that contains the given percentile of all counts
+ */
+static uint64
+latency_percentile(uint64 *counts, uint64 total, double percentile)
+{
+	uint64 target = (uint64) ceil(total * percentile);
+	uint64 seen = 0;
+	int i;
+
+	target = Max(target, 1);
+
+	for (i = 0; i < LATENCY_BUCKETS; i++)
+	{
+		seen += counts[i];
+		if (seen >= target)
+			return latency_bucket_value(i);
+	}
+
+	return latency_bucket_value(LATENCY_BUCKETS - 1);
+}
+
+/*
+ * pipeline_get_latency_stats
+ *
+ * Returns the given percentiles, in microseconds, of each stage's latency for each continuous query
+ * in the current database
+ */
+PG_FUNCTION_INFO_V1(pipeline_get_latency_stats);
+Datum
+pipeline_get_latency_stats(PG_FUNCTION_ARGS)
+{
+	ArrayType *arr = PG_GETARG_ARRAYTYPE_P(0);
+	ReturnSetInfo *rsi = (ReturnSetInfo *) fcinfo->resultinfo;
+	Tuplestorestate *store;
+	TupleDesc desc;
+	MemoryContext old;
+	HASH_SEQ_STATUS iter;
+	LatencyStatsEntry *entry;
+	LWLock *lock;
+	Datum *percentiles;
+	bool *pnulls;
+	int npercentiles;
+	int i;
+
+	if (ARR_NDIM(arr) > 1)
+		elog(ERROR, "percentiles must be a one-dimensional array");
+
+	deconstruct_array(arr, FLOAT8OID, sizeof(float8), FLOAT8PASSBYVAL, 'd', &percentiles, &pnulls, &npercentiles);
+
+	for (i = 0; i < npercentiles; i++)
+	{
+		if (pnulls[i] || DatumGetFloat8(percentiles[i]) < 0 || DatumGetFloat8(percentiles[i]) > 1)
+			elog(ERROR, "percentiles must be between 0 and 1");
+	}
+
+	desc = CreateTemplateTupleDesc(5, false);
+	TupleDescInitEntry(desc, (AttrNumber) 1, "query_id", INT4OID, -1, 0);
+	TupleDescInitEntry(desc, (AttrNumber) 2, "stage", TEXTOID, -1, 0);
+	TupleDescInitEntry(desc, (AttrNumber) 3, "count", INT8OID, -1, 0);
+	TupleDescInitEntry(desc, (AttrNumber) 4, "percentiles", FLOAT8ARRAYOID, -1, 0);
+	TupleDescInitEntry(desc, (AttrNumber) 5, "max", FLOAT8OID, -1, 0);
+
+	rsi->returnMode = SFRM_Materialize;
+	rsi->setDesc = BlessTupleDesc(desc);
+
+	old = MemoryContextSwitchTo(rsi->econtext->ecxt_per_query_memory);
+	store = tuplestore_begin_heap(false, false, work_mem);
+	MemoryContextSwitchTo(old);
+
+	rsi->setResult = store;
+
+	if (!latency_stats)
+		return (Datum) 0;
+
+	lock = &(GetNamedLWLockTranche("pipelinedb_latency_stats")->lock);
+	LWLockAcquire(lock, LW_SHARED);
+
+	hash_seq_init(&iter, latency_stats);
+	while ((entry = (LatencyStatsEntry *) hash_seq_search(&iter)) != NULL)
+	{
+		LatencyStage stage;
+
+		if (entry->key.dbid != MyDatabaseId)
+			continue;
+
+		for (stage = 0; stage < NUM_LATENCY_STAGES; stage++)
+		{
+			uint64 counts[LATENCY_BUCKETS];
+			uint64 total = 0;
+			int max_bucket = 0;
+			Datum *values_p = palloc(sizeof(Datum) * Max(npercentiles, 1));
+			Datum values[5];
+			bool nulls[5];
+			HeapTuple tup;
+
+			/* Take a snapshot of the counts so that all percentiles are computed over the same ones */
+			for (i = 0; i < LATENCY_BUCKETS; i++)
+			{
+				counts[i] = pg_atomic_read_u64(&entry->counts[stage][i]);
+				total += counts[i];
+				if (counts[i])
+					max_bucket = i;
+			}
+
+			if (!total)
+				continue;
+
+			for (i = 0; i < npercentiles; i++)
+				values_p[i] = Float8GetDatum((float8) latency_percentile(counts, total, DatumGetFloat8(percentiles[i])));
+
+			MemSet(nulls, 0, sizeof(nulls));
+
+			values[0] = Int32GetDatum(entry->key.cqid);
+			values[1] = CStringGetTextDatum(latency_stage_names[stage]);
+			values[2] = Int64GetDatum(total);
+			values[3] = PointerGetDatum(construct_array(values_p, npercentiles, FLOAT8OID, sizeof(float8), FLOAT8PASSBYVAL, 'd'));
+			values[4] = Float8GetDatum((float8) latency_bucket_value(max_bucket));
+
+			tup = heap_form_tuple(rsi->setDesc, values, nulls);
+			tuplestore_puttuple(store, tup);
+		}
+	}
+
+	LWLockRelease(lock);
+
+	return (Datum) 0;
+}
+
+/*
+ * pipeline_reset_latency_stats
+ */
+PG_FUNCTION_INFO_V1(pipeline_reset_latency_stats);
+Datum
+pipeline_reset_latency_stats(PG_FUNCTION_ARGS)
+{
+	HASH_SEQ_STATUS iter;
+	LatencyStatsEntry *entry;
+	LWLock *lock;
+
+	if (!latency_stats)
+		PG_RETURN_VOID();
+
+	lock = &(GetNamedLWLockTranche("pipelinedb_latency_stats")->lock);
+	LWLockAcquire(lock, LW_SHARED);
+
+	hash_seq_init(&iter, latency_stats);
+	while ((entry = (LatencyStatsEntry *) hash_seq_search(&iter)) != NULL)
+	{
+		int i;
+		int j;
+
+		if (entry->key.dbid != MyDatabaseId)
+			continue;
+
+		for (i = 0; i < NUM_LATENCY_STAGES; i++)
+			for (j = 0; j < LATENCY_BUCKETS; j++)
+				pg_atomic_write_u64(&entry->counts[i][j], 0);
+	}
+
+	LWLockRelease(lock);
+
+	PG_RETURN_VOID();
+}
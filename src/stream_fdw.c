@@ -509,10 +509,21 @@ BeginStreamModify(ModifyTableState *mtstate, ResultRelInfo *result_info,
 			sis->ack = NULL;
 		else
 			sis->ack = microbatch_ack_new(stream_insert_level);
+
+		/* Asynchronous inserts can be made durable by logging them locally before they're sent */
+		if (stream_insert_level == STREAM_INSERT_ASYNCHRONOUS && ingest_log_enabled)
+			sis->log_slot = IngestLogBegin();
 	}
 
 	sis->batch = microbatch_new(WorkerTuple, queries, sis->desc);
 
+	if (sis->log_slot)
+	{
+		microbatch_add_ack(sis->batch, &sis->log_slot->ack);
+		sis->batch->log_slot = sis->log_slot;
+		sis->batch->log_relid = RelationGetRelid(rel);
+	}
+
 	if (sis->ack)
 	{
 		Assert(!acks);
@@ -571,6 +582,9 @@ EndStreamModify(EState *estate, ResultRelInfo *result_info)
 	StatsIncrementStreamInsert(RelationGetRelid(result_info->ri_RelationDesc), sis->ntups, sis->nbatches, sis->nbytes);
 	microbatch_acks_check_and_exec(sis->batch->acks, microbatch_ack_increment_wtups, sis->ntups);
 
+	if (sis->log_slot)
+		IngestLogEnd(sis->log_slot);
+
 	if (sis->ack)
 	{
 		bool success = microbatch_ack_wait(sis->ack, sis->db_meta, sis->start_generation);
@@ -293,6 +293,18 @@ TDigestMerge(TDigest *t1, TDigest *t2)
 	return t1;
 }
 
+/*
+ * TDigestStateChanged
+ *
+ * Compression folds all added weight into total_weight, and weights are never removed,
+ * so compressed states with the same total weight have seen the same centroids
+ */
+bool
+TDigestStateChanged(TDigest *prev, TDigest *t)
+{
+	return prev->total_weight != t->total_weight || prev->compression != t->compression;
+}
+
 /*
  * TDigestCDF
  */
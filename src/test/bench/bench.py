@@ -0,0 +1,418 @@
+#! /usr/bin/python
+"""
+Throughput and latency benchmarks for PipelineDB.
+
+Each workload runs against its own throwaway instance (see src/test/py/base.py),
+drives its streams at a fixed rate for a fixed duration and then waits for the
+continuous views to catch up. Results are written as JSON so that they can be
+tracked over time.
+"""
+
+import argparse
+import cStringIO
+import getpass
+import json
+import os
+import platform
+import psycopg2
+import random
+import re
+import subprocess
+import sys
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'py'))
+
+from base import PipelineDB
+
+
+SEED = 42
+
+# Number of rows in each generated batch, and batches generated per workload. Batches are reused
+# in a cycle so that generating input doesn't limit the ingest rate.
+BATCH_SIZE = 1000
+NUM_BATCHES = 100
+
+PERCENTILES = (('p50', 0.5), ('p90', 0.9), ('p99', 0.99), ('p999', 0.999))
+
+BGWORKER_RE = re.compile(r'(worker|combiner)[0-9]+ \[')
+
+# Seconds to wait for CVs to reflect all input once we're done sending
+CATCHUP_TIMEOUT = 120
+
+
+class Workload(object):
+  """
+  A workload is a set of streams, tables and CVs, a row generator and a default rate. progress
+  is a query that returns how many input rows are reflected in the workload's CVs so far.
+  """
+  name = None
+  rate = 50000
+  columns = ('k', 'x')
+  params = {}
+
+  def setup(self, pdb):
+    raise NotImplementedError
+
+  def row(self, rand):
+    raise NotImplementedError
+
+  def progress(self, pdb):
+    raise NotImplementedError
+
+  def run(self, pdb, rate, duration):
+    return drive(pdb, 'stream0', self.columns, batches(self), rate, duration)
+
+
+class SingleKeyGroupBy(Workload):
+  name = 'groupby_single_key'
+  rate = 100000
+
+  def setup(self, pdb):
+    pdb.create_stream('stream0', k='int', x='int')
+    pdb.create_cv('cv0', 'SELECT k, count(*), sum(x), avg(x) FROM stream0 GROUP BY k')
+
+  def row(self, rand):
+    return (1, rand.randint(0, 1000))
+
+  def progress(self, pdb):
+    return pdb.execute('SELECT coalesce(sum(count), 0) AS n FROM cv0')[0]['n']
+
+
+class HighCardinalityGroupBy(Workload):
+  name = 'groupby_high_cardinality'
+  rate = 50000
+
+  def setup(self, pdb):
+    pdb.create_stream('stream0', k='int', x='int')
+    pdb.create_cv('cv0', 'SELECT k, count(*), sum(x), avg(x) FROM stream0 GROUP BY k')
+
+  def row(self, rand):
+    return (rand.randint(0, 1000000), rand.randint(0, 1000))
+
+  def progress(self, pdb):
+    return pdb.execute('SELECT coalesce(sum(count), 0) AS n FROM cv0')[0]['n']
+
+
+class SlidingWindow(Workload):
+  name = 'sliding_window'
+  rate = 50000
+
+  def setup(self, pdb):
+    pdb.create_stream('stream0', k='int', x='int')
+    pdb.create_cv('cv0', "SELECT k, count(*), sum(x) FROM stream0 "
+                  "WHERE arrival_timestamp > clock_timestamp() - interval '1 hour' GROUP BY k")
+
+  def row(self, rand):
+    return (rand.randint(0, 1000), rand.randint(0, 1000))
+
+  def progress(self, pdb):
+    # The view only exposes the combined window, so count every step in the matrel instead
+    return pdb.execute('SELECT coalesce(sum(count), 0) AS n FROM cv0_mrel')[0]['n']
+
+
+class Sketches(Workload):
+  name = 'sketches'
+  rate = 20000
+  columns = ('k', 'x', 'y')
+
+  def setup(self, pdb):
+    pdb.create_stream('stream0', k='int', x='int', y='float8')
+    pdb.create_cv('cv0', 'SELECT k, count(*), count(DISTINCT x), '
+                  'percentile_cont(0.99) WITHIN GROUP (ORDER BY y), '
+                  'topk_agg(x, 10), bloom_agg(x), freq_agg(x) FROM stream0 GROUP BY k')
+
+  def row(self, rand):
+    return (rand.randint(0, 100), rand.randint(0, 100000), rand.random())
+
+  def progress(self, pdb):
+    return pdb.execute('SELECT coalesce(sum(count), 0) AS n FROM cv0')[0]['n']
+
+
+class StreamTableJoin(Workload):
+  name = 'stream_table_join'
+  rate = 50000
+
+  def setup(self, pdb):
+    pdb.create_stream('stream0', k='int', x='int')
+    pdb.create_table('dim', k='int', v='text')
+    pdb.execute("INSERT INTO dim (k, v) SELECT n, 'v' || (n % 100) FROM generate_series(0, 9999) n")
+    pdb.execute('CREATE INDEX dim_k_idx ON dim (k)')
+    pdb.create_cv('cv0', 'SELECT d.v, count(*), sum(s.x) FROM stream0 s JOIN dim d ON s.k = d.k GROUP BY d.v')
+
+  def row(self, rand):
+    return (rand.randint(0, 9999), rand.randint(0, 1000))
+
+  def progress(self, pdb):
+    return pdb.execute('SELECT coalesce(sum(count), 0) AS n FROM cv0')[0]['n']
+
+
+class SyncInsertLatency(Workload):
+  """
+  Measures the client-side latency of single-row inserts that wait for combiners to commit
+  """
+  name = 'sync_insert_latency'
+  rate = 200
+
+  def setup(self, pdb):
+    pdb.create_stream('stream0', k='int', x='int')
+    pdb.create_cv('cv0', 'SELECT k, count(*), sum(x) FROM stream0 GROUP BY k')
+
+  def row(self, rand):
+    return (rand.randint(0, 1000), rand.randint(0, 1000))
+
+  def progress(self, pdb):
+    return pdb.execute('SELECT coalesce(sum(count), 0) AS n FROM cv0')[0]['n']
+
+  def run(self, pdb, rate, duration):
+    conn = connect(pdb)
+    cur = conn.cursor()
+    cur.execute('SET pipelinedb.stream_insert_level = sync_commit')
+
+    rand = random.Random(SEED)
+    latencies = []
+    start = time.time()
+    sent = 0
+
+    while time.time() - start < duration:
+      k, x = self.row(rand)
+      t = time.time()
+      cur.execute('INSERT INTO stream0 (k, x) VALUES (%s, %s)', (k, x))
+      latencies.append((time.time() - t) * 1000000)
+      sent += 1
+      throttle(start, sent, rate)
+
+    conn.close()
+    elapsed = time.time() - start
+
+    return {
+      'rows': sent,
+      'send_seconds': elapsed,
+      'send_rate': sent / elapsed,
+      'client_latency_us': summarize(latencies)
+    }
+
+
+WORKLOADS = [
+  SingleKeyGroupBy,
+  HighCardinalityGroupBy,
+  SlidingWindow,
+  Sketches,
+  StreamTableJoin,
+  SyncInsertLatency
+]
+
+
+def connect(pdb):
+  conn = psycopg2.connect('host=localhost dbname=postgres user=%s port=%d' % (getpass.getuser(), pdb.port))
+  conn.autocommit = True
+  return conn
+
+
+def batches(workload):
+  """
+  Pre-generates the workload's input as COPY buffers
+  """
+  rand = random.Random(SEED)
+  result = []
+  for i in xrange(NUM_BATCHES):
+    rows = [workload.row(rand) for _ in xrange(BATCH_SIZE)]
+    result.append(''.join('\t'.join(str(v) for v in r) + '\n' for r in rows))
+  return result
+
+
+def throttle(start, sent, rate):
+  """
+  Sleeps until sent rows are due at the given rate, if we're ahead of it
+  """
+  if not rate:
+    return
+  delay = start + float(sent) / rate - time.time()
+  if delay > 0:
+    time.sleep(delay)
+
+
+def drive(pdb, stream, columns, bufs, rate, duration):
+  """
+  COPYs the given buffers into a stream in a cycle at a fixed rate (rows/s, 0 for unthrottled)
+  """
+  conn = connect(pdb)
+  cur = conn.cursor()
+  start = time.time()
+  sent = 0
+  i = 0
+
+  while time.time() - start < duration:
+    cur.copy_from(cStringIO.StringIO(bufs[i % len(bufs)]), stream, columns=columns)
+    sent += BATCH_SIZE
+    i += 1
+    throttle(start, sent, rate)
+
+  conn.close()
+  elapsed = time.time() - start
+
+  return {
+    'rows': sent,
+    'send_seconds': elapsed,
+    'send_rate': sent / elapsed
+  }
+
+
+def summarize(values):
+  """
+  Returns the percentiles and max of a list of values
+  """
+  if not values:
+    return None
+  values = sorted(values)
+  result = {}
+  for name, p in PERCENTILES:
+    result[name] = values[min(int(p * len(values)), len(values) - 1)]
+  result['max'] = values[-1]
+  return result
+
+
+def bgworker_pids(pdb):
+  """
+  Returns the pids of the instance's workers and combiners, by type
+  """
+  out = subprocess.check_output(['ps', 'x', '-o', 'pid=,ppid=,args='])
+  pids = {}
+  for line in out.split('\n'):
+    parts = line.split(None, 2)
+    if len(parts) < 3 or int(parts[1]) != pdb.proc.pid:
+      continue
+    m = BGWORKER_RE.search(parts[2])
+    if m:
+      pids.setdefault(m.group(1), []).append(int(parts[0]))
+  return pids
+
+
+def memory(pdb):
+  """
+  Returns peak and current RSS in kB summed across each process type. Only supported on Linux.
+  """
+  result = {}
+  for t, pids in bgworker_pids(pdb).iteritems():
+    peak = rss = 0
+    for pid in pids:
+      try:
+        with open('/proc/%d/status' % pid) as f:
+          for line in f:
+            if line.startswith('VmHWM:'):
+              peak += int(line.split()[1])
+            elif line.startswith('VmRSS:'):
+              rss += int(line.split()[1])
+      except IOError:
+        pass
+    result[t] = {'processes': len(pids), 'peak_rss_kb': peak, 'rss_kb': rss}
+  return result
+
+
+def stage_latencies(pdb):
+  """
+  Returns the per-stage latency percentiles recorded by the server, in microseconds
+  """
+  rows = pdb.execute('SELECT * FROM pipelinedb.latency_stats')
+  result = {}
+  for r in rows:
+    result.setdefault(r['query'], {})[r['stage']] = {
+      'count': r['count'],
+      'p50': r['p50'],
+      'p90': r['p90'],
+      'p99': r['p99'],
+      'p999': r['p999'],
+      'max': r['max']
+    }
+  return result
+
+
+def run_workload(workload, args):
+  rate = int(workload.rate * args.rate_scale)
+  params = {
+    'pipelinedb.stream_insert_level': 'sync_receive',
+    'pipelinedb.num_workers': args.workers,
+    'pipelinedb.num_combiners': args.combiners
+  }
+  params.update(workload.params)
+
+  pdb = PipelineDB()
+  try:
+    pdb.run(params)
+    workload.setup(pdb)
+    pdb.execute('SELECT pipelinedb.reset_latency_stats()')
+
+    result = workload.run(pdb, rate, args.duration)
+    sent = result['rows']
+    start = time.time() - result['send_seconds']
+
+    # Wait for everything we sent to be reflected in the CVs
+    processed = 0
+    while time.time() - start < result['send_seconds'] + CATCHUP_TIMEOUT:
+      processed = int(workload.progress(pdb))
+      if processed >= sent:
+        break
+      time.sleep(0.1)
+    done = time.time()
+
+    result.update({
+      'target_rate': rate,
+      'processed_rows': processed,
+      'catchup_seconds': max(done - start - result['send_seconds'], 0),
+      'events_per_second': processed / (done - start),
+      'complete': processed >= sent,
+      'stage_latency_us': stage_latencies(pdb),
+      'memory': memory(pdb)
+    })
+
+    return result
+  finally:
+    pdb.destroy()
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__.strip().split('\n')[0])
+  parser.add_argument('-d', '--duration', type=float, default=30, help='seconds to drive each workload for')
+  parser.add_argument('-r', '--rate-scale', type=float, default=1.0,
+                      help='multiplier for each workload\'s input rate, 0 for unthrottled')
+  parser.add_argument('-w', '--workloads', nargs='*', default=None, help='workloads to run, all by default')
+  parser.add_argument('--workers', type=int, default=2)
+  parser.add_argument('--combiners', type=int, default=2)
+  parser.add_argument('-o', '--output', default=None, help='file to write JSON results to, stdout by default')
+  args = parser.parse_args()
+
+  workloads = [w() for w in WORKLOADS if not args.workloads or w.name in args.workloads]
+  if not workloads:
+    parser.error('valid workloads are: %s' % ', '.join(w.name for w in WORKLOADS))
+
+  version = subprocess.check_output(['pg_config', '--version']).strip()
+  revision = None
+  try:
+    revision = subprocess.check_output(['git', 'rev-parse', 'HEAD'], stderr=open(os.devnull, 'w')).strip()
+  except (OSError, subprocess.CalledProcessError):
+    pass
+
+  results = {
+    'timestamp': int(time.time()),
+    'revision': revision,
+    'postgres': version,
+    'host': {'machine': platform.machine(), 'system': platform.system(), 'cpus': os.sysconf('SC_NPROCESSORS_ONLN')},
+    'config': {'duration': args.duration, 'rate_scale': args.rate_scale, 'workers': args.workers,
+               'combiners': args.combiners, 'seed': SEED, 'batch_size': BATCH_SIZE},
+    'workloads': {}
+  }
+
+  for w in workloads:
+    sys.stderr.write('running %s...\n' % w.name)
+    results['workloads'][w.name] = run_workload(w, args)
+
+  out = json.dumps(results, indent=2, sort_keys=True)
+  if args.output:
+    with open(args.output, 'w') as f:
+      f.write(out + '\n')
+  else:
+    print out
+
+
+if __name__ == '__main__':
+  main()
@@ -0,0 +1,101 @@
+#! /usr/bin/python
+"""
+Microbenchmarks for PipelineDB's sketch data structures.
+
+Runs pipelinedb.sketch_benchmark, which times add, merge, estimate and
+serialize directly against each sketch's C implementation, across a grid of
+input sizes, cardinalities and sketch sizes. Results are written as JSON so
+that they can be compared across revisions.
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'py'))
+
+from base import PipelineDB
+
+
+# Sketch sizes to run in addition to the defaults (None): p for hll, compression for tdigest,
+# width for cmsketch, expected elements for bloom and k for fss
+SIZES = {
+  'hll': [None, 10, 14],
+  'tdigest': [None, 100, 500],
+  'cmsketch': [None, 100, 10000],
+  'bloom': [None, 1000, 1000000],
+  'fss': [None, 10, 100]
+}
+
+NS = [1000, 100000, 1000000]
+CARDINALITIES = [100, 10000, 0]
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__.strip().split('\n')[0])
+  parser.add_argument('-s', '--sketches', nargs='*', default=None, help='sketches to run, all by default')
+  parser.add_argument('-n', nargs='*', type=int, default=NS, help='numbers of values to add')
+  parser.add_argument('-c', '--cardinalities', nargs='*', type=int, default=CARDINALITIES,
+                      help='numbers of distinct values, 0 for unbounded')
+  parser.add_argument('-r', '--reps', type=int, default=5, help='repetitions of each operation')
+  parser.add_argument('-o', '--output', default=None, help='file to write JSON results to, stdout by default')
+  args = parser.parse_args()
+
+  sketches = args.sketches or sorted(SIZES.keys())
+  for s in sketches:
+    if s not in SIZES:
+      parser.error('valid sketches are: %s' % ', '.join(sorted(SIZES.keys())))
+
+  revision = None
+  try:
+    revision = subprocess.check_output(['git', 'rev-parse', 'HEAD'], stderr=open(os.devnull, 'w')).strip()
+  except (OSError, subprocess.CalledProcessError):
+    pass
+
+  results = {
+    'timestamp': int(time.time()),
+    'revision': revision,
+    'postgres': subprocess.check_output(['pg_config', '--version']).strip(),
+    'reps': args.reps,
+    'results': []
+  }
+
+  pdb = PipelineDB()
+  try:
+    pdb.run()
+    for sketch in sketches:
+      for size in SIZES[sketch]:
+        for n in args.n:
+          for cardinality in args.cardinalities:
+            sys.stderr.write('%s size=%s n=%d cardinality=%d\n' % (sketch, size, n, cardinality))
+            rows = pdb.execute('SELECT * FROM pipelinedb.sketch_benchmark(%r, %d, %d, %s, %d)' %
+                               (sketch, n, cardinality, 'NULL' if size is None else size, args.reps))
+            for r in rows:
+              results['results'].append({
+                'sketch': sketch,
+                'size': size,
+                'n': n,
+                'cardinality': cardinality,
+                'op': r['op'],
+                'ops': r['ops'],
+                'total_ms': r['total_ms'],
+                'ns_per_op': r['ns_per_op'],
+                'ops_per_sec': r['ops_per_sec'],
+                'bytes': r['bytes']
+              })
+  finally:
+    pdb.destroy()
+
+  out = json.dumps(results, indent=2, sort_keys=True)
+  if args.output:
+    with open(args.output, 'w') as f:
+      f.write(out + '\n')
+  else:
+    print out
+
+
+if __name__ == '__main__':
+  main()
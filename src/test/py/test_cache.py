@@ -0,0 +1,78 @@
+from base import pipeline, clean_db
+import psycopg2
+import pytest
+import time
+
+
+def _cached(pipeline, cv):
+  return sorted(r['x'] for r in pipeline.execute('SELECT (group_row).x AS x FROM %s_mrel_cache' % cv))
+
+
+def test_cache_reads(pipeline, clean_db):
+  """
+  Verify that reading a cached CV scans its finalized rows rather than finalizing the matrel's
+  """
+  pipeline.create_stream('s', x='int', y='int')
+  pipeline.create_cv('cv', 'SELECT x, count(*), avg(y), count(DISTINCT y) AS d FROM s GROUP BY x', cache=True)
+  pipeline.create_cv('uncached', 'SELECT x, count(*), avg(y), count(DISTINCT y) AS d FROM s GROUP BY x')
+
+  for i in xrange(3):
+    pipeline.execute('INSERT INTO s (x, y) SELECT x %% 10, x FROM generate_series(1, %d) x' % (100 * (i + 1)))
+    assert pipeline.execute('SELECT * FROM cv ORDER BY x') == pipeline.execute('SELECT * FROM uncached ORDER BY x')
+
+  # The view's matrel side is only there for combiners to finalize groups with
+  plan = [r['QUERY PLAN'] for r in pipeline.execute('EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF) SELECT * FROM cv')]
+  cache = [l for l in plan if 'on cv_mrel_cache' in l]
+  matrel = [l for l in plan if 'on cv_mrel ' in l or l.endswith('on cv_mrel')]
+  assert len(cache) == 1 and 'rows=10 ' in cache[0]
+  assert len(matrel) == 1 and 'never executed' in matrel[0]
+
+  # Cached values are already finalized
+  with pytest.raises(psycopg2.Error):
+    pipeline.execute('SELECT combine(count) FROM cv')
+
+
+def test_cache_ttl_expiry(pipeline, clean_db):
+  """
+  Verify that TTL expiration removes the cache rows of exactly the groups it removes
+  """
+  pipeline.create_stream('s', x='int', ts='timestamptz')
+  pipeline.create_cv('cv', 'SELECT x, max(ts) AS ts, count(*) FROM s GROUP BY x',
+                     cache=True, ttl='3 seconds', ttl_column='ts')
+
+  pipeline.execute('INSERT INTO s (x, ts) SELECT x, now() FROM generate_series(0, 9) x')
+  pipeline.execute("INSERT INTO s (x, ts) SELECT x, now() + interval '1 hour' FROM generate_series(10, 19) x")
+  assert _cached(pipeline, 'cv') == range(20)
+
+  time.sleep(4)
+
+  # The reaper may have expired them already
+  pipeline.execute("SELECT pipelinedb.ttl_expire('cv')")
+  assert sorted(r['x'] for r in pipeline.execute('SELECT x FROM cv')) == range(10, 19 + 1)
+  assert _cached(pipeline, 'cv') == range(10, 19 + 1)
+
+  # Cache rows follow their groups' primary keys
+  rows = pipeline.execute('SELECT count(*) FROM cv_mrel m JOIN cv_mrel_cache c ON m."$pk" = c.group_pk')
+  assert rows[0]['count'] == 10
+
+
+def test_cache_ttl_truncate(pipeline, clean_db):
+  """
+  Verify that the cache is emptied when every group of a CV expires at once
+  """
+  pipeline.create_stream('s', x='int', ts='timestamptz')
+  pipeline.create_cv('cv', 'SELECT x, max(ts) AS ts, count(*) FROM s GROUP BY x',
+                     cache=True, ttl='3 seconds', ttl_column='ts')
+
+  pipeline.execute('INSERT INTO s (x, ts) SELECT x, now() FROM generate_series(0, 9) x')
+  assert _cached(pipeline, 'cv') == range(10)
+
+  time.sleep(4)
+
+  pipeline.execute("SELECT pipelinedb.ttl_expire('cv')")
+  assert pipeline.execute('SELECT count(*) FROM cv')[0]['count'] == 0
+  assert _cached(pipeline, 'cv') == []
+
+  # New groups are cached again
+  pipeline.execute('INSERT INTO s (x, ts) SELECT x, now() FROM generate_series(0, 2) x')
+  assert _cached(pipeline, 'cv') == range(3)
@@ -0,0 +1,59 @@
+from base import pipeline, clean_db
+import time
+
+
+def _temp_files(pipeline):
+  return pipeline.execute('SELECT temp_files FROM pg_stat_database WHERE datname = current_database()')[0]['temp_files']
+
+
+def test_spill_cold_groups(pipeline, clean_db):
+  """
+  Verify that cold groups spilled to disk between syncs are merged back in correctly at sync time
+  """
+  pipeline.stop()
+  pipeline.run({'pipelinedb.combiner_work_mem': 16384,
+                'pipelinedb.commit_interval': 30000,
+                'pipelinedb.stream_insert_level': 'async'})
+  try:
+    pipeline.create_stream('s', x='int', v='text')
+    pipeline.create_cv('cv', 'SELECT x, count(*), max(v) AS v FROM s GROUP BY x')
+
+    temp_files = _temp_files(pipeline)
+
+    # About 1kB of partial results per group, for several times combiner_work_mem in total
+    batches = 10
+    groups = 5000
+    for i in xrange(batches):
+      pipeline.execute("INSERT INTO s (x, v) SELECT x, repeat('v', 1000) || x FROM generate_series(%d, %d) x" %
+                       (i * groups, (i + 1) * groups - 1))
+
+      # Groups 0-99 are hot, and groups 100-199 are spilled and then touched again every other batch
+      pipeline.execute("INSERT INTO s (x, v) SELECT x, repeat('v', 1000) || x FROM generate_series(0, 99) x")
+      if i % 2:
+        pipeline.execute("INSERT INTO s (x, v) SELECT x, repeat('v', 1000) || x FROM generate_series(100, 199) x")
+
+    expected = batches * groups + 100 * batches + 100 * (batches / 2)
+    for i in xrange(240):
+      total = pipeline.execute('SELECT sum(count) FROM cv')[0]['sum']
+      if total == expected:
+        break
+      time.sleep(0.25)
+
+    assert total == expected
+    assert pipeline.execute('SELECT count(*) FROM cv')[0]['count'] == batches * groups
+
+    rows = pipeline.execute('SELECT x, count FROM cv WHERE x < 200 ORDER BY x')
+    assert [r['count'] for r in rows] == [batches + 1] * 100 + [batches / 2 + 1] * 100
+
+    # Every group was written exactly once, with its full partial result
+    assert pipeline.execute("SELECT count(*) FROM cv WHERE v <> repeat('v', 1000) || x")[0]['count'] == 0
+    assert pipeline.execute('SELECT count(*) FROM cv_mrel')[0]['count'] == batches * groups
+
+    for i in xrange(40):
+      if _temp_files(pipeline) > temp_files:
+        break
+      time.sleep(0.25)
+    assert _temp_files(pipeline) > temp_files
+  finally:
+    pipeline.stop()
+    pipeline.run()
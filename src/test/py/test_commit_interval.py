@@ -0,0 +1,151 @@
+from base import pipeline, clean_db
+import psycopg2
+import pytest
+import time
+
+
+def _commit_interval(pipeline, cv):
+  rows = pipeline.execute("SELECT commit_interval FROM pipelinedb.query_stats "
+                          "WHERE continuous_query = '%s' AND type = 'combiner'" % cv)
+  return rows[0]['commit_interval'] if rows else None
+
+
+def _wait_for_commit_interval(pipeline, cv, expected, timeout=10):
+  value = None
+  for i in xrange(timeout * 4):
+    value = _commit_interval(pipeline, cv)
+    if value == expected:
+      break
+    time.sleep(0.25)
+  return value
+
+
+def _is_adaptive_interval(value, min_interval):
+  while value > min_interval and value % 2 == 0:
+    value /= 2
+  return value == min_interval
+
+
+def test_adaptive_commit_interval(pipeline, clean_db):
+  """
+  Verify that adaptive commit intervals stay power-of-two multiples of the minimum within the maximum,
+  and shrink back to the minimum once combiners go idle
+  """
+  pipeline.stop()
+  pipeline.run({
+    'pipelinedb.adaptive_commit_interval': 'on',
+    'pipelinedb.min_commit_interval': 10,
+    'pipelinedb.max_commit_interval': 1000,
+    'pipelinedb.combiner_group_commit': 'on'
+  })
+  try:
+    pipeline.create_stream('s', x='int')
+    pipeline.create_cv('cv', 'SELECT x % 1000 AS g, count(*) FROM s GROUP BY g')
+
+    # Intervals start at the minimum and are published as soon as a combiner picks up the CV
+    pipeline.insert('s', ['x'], [(1,)])
+    assert _wait_for_commit_interval(pipeline, 'cv', 10) == 10
+
+    seen = set()
+    end = time.time() + 5
+    while time.time() < end:
+      pipeline.execute('INSERT INTO s (x) SELECT x FROM generate_series(1, 50000) x')
+      seen.add(_commit_interval(pipeline, 'cv'))
+
+    # 1000ms isn't a power-of-two multiple of 10ms, so the longest interval is 640ms
+    for value in seen:
+      assert 10 <= value <= 640
+      assert _is_adaptive_interval(value, 10)
+
+    assert _wait_for_commit_interval(pipeline, 'cv', 10) == 10
+  finally:
+    pipeline.stop()
+    pipeline.run()
+
+
+def _count(pipeline, cv):
+  rows = pipeline.execute('SELECT count FROM %s' % cv)
+  return rows[0]['count'] if rows else None
+
+
+def _wait_for_count(pipeline, cv, expected, timeout=10):
+  count = None
+  for i in xrange(timeout * 20):
+    count = _count(pipeline, cv)
+    if count == expected:
+      break
+    time.sleep(0.05)
+  return count
+
+
+def test_cv_commit_interval_and_freshness(pipeline, clean_db):
+  """
+  Verify that a CV's own commit interval overrides the combiner's, and that its freshness target caps it
+  """
+  pipeline.create_stream('s', x='int')
+  pipeline.create_cv('fast', 'SELECT count(*) FROM s')
+  pipeline.create_cv('slow', 'SELECT count(*) FROM s', commit_interval='3 seconds')
+  pipeline.create_cv('fresh', 'SELECT count(*) FROM s', commit_interval='1 minute', freshness='1 second')
+
+  # Synchronous acks force every CV to sync, so only asynchronous inserts can show the difference
+  pipeline.execute('SET pipelinedb.stream_insert_level TO async')
+  try:
+    start = time.time()
+    pipeline.execute('INSERT INTO s (x) SELECT x FROM generate_series(1, 100) x')
+
+    assert _wait_for_count(pipeline, 'fast', 100) == 100
+    assert _count(pipeline, 'slow') is None
+
+    assert _wait_for_count(pipeline, 'fresh', 100) == 100
+    assert _wait_for_count(pipeline, 'slow', 100) == 100
+    assert time.time() - start >= 2.5
+  finally:
+    pipeline.execute('RESET pipelinedb.stream_insert_level')
+
+  assert _wait_for_commit_interval(pipeline, 'slow', 3000) == 3000
+  assert _wait_for_commit_interval(pipeline, 'fresh', 1000) == 1000
+
+
+def test_cv_priority(pipeline, clean_db):
+  """
+  Verify that priorities are validated, and that prioritized CVs get all of their input from the first batch on
+  """
+  pipeline.create_stream('s', x='int')
+
+  for priority in (-1, 101, 'high'):
+    with pytest.raises(psycopg2.Error):
+      pipeline.create_cv('bad', 'SELECT count(*) FROM s', priority=priority)
+
+  pipeline.create_cv('low', 'SELECT count(*) FROM s')
+  pipeline.create_cv('high', 'SELECT count(*) FROM s', priority=100)
+  pipeline.create_cv('mid', 'SELECT count(*) FROM s', priority=50)
+
+  pipeline.insert('s', ['x'], [(x,) for x in range(1000)])
+  for cv in ('low', 'high', 'mid'):
+    assert _count(pipeline, cv) == 1000
+
+
+def test_logged_acks_with_cv_commit_interval(pipeline, clean_db):
+  """
+  Verify that logged inserts are acked while a CV with a longer commit interval always has something pending
+  """
+  pipeline.stop()
+  pipeline.run({'pipelinedb.stream_insert_level': 'async',
+                'pipelinedb.ingest_log': 'on',
+                'pipelinedb.ingest_log_max_pending': 16})
+  try:
+    pipeline.create_stream('s', x='int')
+    pipeline.create_cv('fast', 'SELECT count(*) FROM s')
+    pipeline.create_cv('slow', 'SELECT count(*) FROM s', commit_interval='1 second')
+
+    # Many more logged inserts than there are slots for, so each needs earlier ones to be acked
+    pipeline.execute("SET statement_timeout TO '10s'")
+    for i in xrange(200):
+      pipeline.execute('INSERT INTO s (x) VALUES (%d)' % i)
+    pipeline.execute('RESET statement_timeout')
+
+    assert _wait_for_count(pipeline, 'fast', 200) == 200
+    assert _wait_for_count(pipeline, 'slow', 200) == 200
+  finally:
+    pipeline.stop()
+    pipeline.run()
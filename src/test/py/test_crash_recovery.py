@@ -1,5 +1,7 @@
 from base import pipeline, clean_db
+import getpass
 import os
+import psycopg2
 import random
 import signal
 from subprocess import check_output, CalledProcessError
@@ -219,3 +221,94 @@ def test_postmaster_worker_recovery(pipeline, clean_db):
   # Now verify that we have the correct number of CQ worker procs
   assert expected_workers == len(get_worker_pids())
   assert expected_combiners == len(get_combiner_pids())
+
+
+def test_ingest_log_recovery(pipeline, clean_db):
+  """
+  Verify that logged asynchronous inserts survive worker and combiner crashes
+  """
+  pipeline.stop()
+  pipeline.run({'pipelinedb.stream_insert_level': 'async',
+                'pipelinedb.ingest_log': 'on'})
+  try:
+    pipeline.create_stream('stream0', x='int')
+    q = 'SELECT COUNT(*) FROM stream0'
+    pipeline.create_cv('test_ingest_log_recovery', q)
+    batch_size = 1000
+    num_inserted = 0
+
+    for i in xrange(10):
+      pipeline.insert('stream0', ['x'], [(1,)] * batch_size)
+      num_inserted += batch_size
+      if i % 3 == 0:
+        assert kill_worker()
+      elif i % 3 == 1:
+        assert kill_combiner()
+
+    # Give the reaper enough time to notice the lost batches and replay them
+    time.sleep(15)
+
+    # Delivery is at-least-once, so some tuples may have been combined twice
+    result = pipeline.execute('SELECT count FROM test_ingest_log_recovery')[0]
+    assert result['count'] >= num_inserted
+  finally:
+    pipeline.stop()
+    pipeline.run()
+
+
+def test_ingest_log_mid_insert_crash(pipeline, clean_db):
+  """
+  Verify that logged inserts that a worker crashed in the middle of are replayed, and don't keep
+  their slots forever
+  """
+  pipeline.stop()
+  pipeline.run({'pipelinedb.stream_insert_level': 'async',
+                'pipelinedb.ingest_log': 'on',
+                'pipelinedb.ingest_log_max_pending': 16})
+  try:
+    pipeline.create_stream('stream0', x='int', v='text')
+    pipeline.create_cv('test_ingest_log_mid_insert', 'SELECT COUNT(*) FROM stream0')
+
+    stop = threading.Event()
+    inserted = []
+
+    def insert():
+      conn = psycopg2.connect('dbname=postgres user=%s host=localhost port=%s'
+                              % (getpass.getuser(), pipeline.port))
+      conn.autocommit = True
+      cur = conn.cursor()
+      while not stop.is_set():
+        # Large enough to be sent as many batches, so that workers die while it's still sending
+        cur.execute("INSERT INTO stream0 (x, v) SELECT x, repeat('v', 100) FROM generate_series(1, 50000) x")
+        inserted.append(50000)
+      conn.close()
+
+    t = threading.Thread(target=insert)
+    t.start()
+    try:
+      # More crashes than there are slots, so leaked slots would eventually block new inserts
+      for i in xrange(24):
+        time.sleep(0.25)
+        kill_worker()
+    finally:
+      stop.set()
+      t.join()
+
+    # New logged inserts must still get slots once the reaper has replayed the lost ones
+    pipeline.execute("SET statement_timeout TO '30s'")
+    for i in xrange(64):
+      pipeline.execute("INSERT INTO stream0 (x, v) VALUES (%d, 'v')" % i)
+    pipeline.execute('RESET statement_timeout')
+
+    # Delivery is at-least-once, so some tuples may have been combined twice
+    expected = sum(inserted) + 64
+    count = 0
+    for i in xrange(120):
+      count = pipeline.execute('SELECT count FROM test_ingest_log_mid_insert')[0]['count']
+      if count >= expected:
+        break
+      time.sleep(0.25)
+    assert count >= expected
+  finally:
+    pipeline.stop()
+    pipeline.run()
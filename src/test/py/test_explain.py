@@ -0,0 +1,73 @@
+from base import pipeline, clean_db
+import getpass
+import psycopg2
+import pytest
+import threading
+import time
+
+
+def test_explain_continuous(pipeline, clean_db):
+  """
+  Verify that EXPLAIN (CONTINUOUS, ANALYZE) reports sampled worker and combiner plans
+  """
+  pipeline.create_stream('s', x='int')
+  pipeline.create_cv('cv', 'SELECT x % 10 AS g, count(*) FROM s GROUP BY g')
+
+  done = threading.Event()
+
+  def insert():
+    conn = psycopg2.connect('dbname=postgres user=%s host=localhost port=%s'
+                % (getpass.getuser(), pipeline.port))
+    conn.autocommit = True
+    cur = conn.cursor()
+    while not done.is_set():
+      cur.execute('INSERT INTO s (x) SELECT generate_series(1, 100)')
+      time.sleep(0.05)
+    conn.close()
+
+  t = threading.Thread(target=insert)
+  t.start()
+
+  try:
+    rows = pipeline.execute('EXPLAIN (CONTINUOUS, ANALYZE, DURATION 2) SELECT * FROM cv')
+  finally:
+    done.set()
+    t.join()
+
+  plan = '\n'.join(r[0] for r in rows)
+  assert 'Continuous View: public.cv' in plan
+  assert 'Worker 0' in plan
+  assert 'Combiner 0' in plan
+  assert 'actual rows=' in plan
+  assert 'Sent to Combiners:' in plan
+  assert 'Group Lookups:' in plan
+  assert 'Sync Writes:' in plan
+
+  # Nothing is inserted, so there's nothing to sample
+  rows = pipeline.execute('EXPLAIN (CONTINUOUS, ANALYZE, DURATION 0.5) SELECT * FROM cv')
+  plan = '\n'.join(r[0] for r in rows)
+  assert 'No executions were sampled' in plan
+
+
+def test_explain_continuous_errors(pipeline, clean_db):
+  """
+  Verify that unsupported EXPLAIN (CONTINUOUS) forms are rejected
+  """
+  pipeline.create_stream('s', x='int')
+  pipeline.create_cv('cv', 'SELECT count(*) FROM s')
+  pipeline.create_table('t', x='int')
+
+  with pytest.raises(psycopg2.Error):
+    pipeline.execute('EXPLAIN (CONTINUOUS) SELECT * FROM cv')
+
+  with pytest.raises(psycopg2.Error):
+    pipeline.execute('EXPLAIN (CONTINUOUS, ANALYZE, FORMAT JSON) SELECT * FROM cv')
+
+  with pytest.raises(psycopg2.Error):
+    pipeline.execute('EXPLAIN (CONTINUOUS, ANALYZE, DURATION 0) SELECT * FROM cv')
+
+  with pytest.raises(psycopg2.Error):
+    pipeline.execute('EXPLAIN (CONTINUOUS, ANALYZE) SELECT * FROM t')
+
+  # Regular EXPLAIN still works
+  assert pipeline.execute('EXPLAIN SELECT * FROM cv')
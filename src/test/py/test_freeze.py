@@ -0,0 +1,105 @@
+from base import pipeline, clean_db
+import psycopg2
+import pytest
+import time
+
+
+def _wait_for_freeze(pipeline, cv, timeout=15):
+  for i in xrange(timeout * 4):
+    mrel = pipeline.execute('SELECT count(*) FROM %s_mrel' % cv)[0]['count']
+    archived = pipeline.execute('SELECT count(*) FROM %s_mrel_archive' % cv)[0]['count']
+    if mrel == 0 and archived > 0:
+      return
+    time.sleep(0.25)
+  assert False, 'buckets of %s were never frozen' % cv
+
+
+def test_freeze_closed_buckets(pipeline, clean_db):
+  """
+  Verify that closed buckets are archived with finalized values and late events don't duplicate them
+  """
+  pipeline.create_stream('s', ts='timestamptz', x='int')
+  pipeline.create_cv('cv', 'SELECT second(ts) AS sec, count(*), sum(x), avg(x) FROM s GROUP BY sec',
+                     freeze_after='1 second')
+
+  pipeline.execute('INSERT INTO s (ts, x) SELECT now(), x FROM generate_series(1, 10) x')
+  _wait_for_freeze(pipeline, 'cv')
+
+  rows = pipeline.execute('SELECT * FROM cv')
+  assert len(rows) == 1
+  assert rows[0]['count'] == 10
+  assert rows[0]['sum'] == 55
+  assert float(rows[0]['avg']) == 5.5
+  sec = rows[0]['sec']
+
+  # The archive holds finalized values, one array element per group
+  row = pipeline.execute('SELECT "$groups", pg_typeof(avg)::text AS type, avg FROM cv_mrel_archive')[0]
+  assert row['$groups'] == 1
+  assert row['type'] == 'numeric[]'
+  assert [float(v) for v in row['avg']] == [5.5]
+
+  # A late event for the frozen bucket is dropped rather than starting a second row for it
+  pipeline.execute("INSERT INTO s (ts, x) VALUES ('%s', 100)" % sec)
+  rows = pipeline.execute('SELECT * FROM cv')
+  assert len(rows) == 1
+  assert rows[0]['count'] == 10
+  assert pipeline.execute('SELECT count(*) FROM cv_mrel')[0]['count'] == 0
+
+  # Open buckets still go to the matrel
+  pipeline.execute('INSERT INTO s (ts, x) SELECT now() + interval \'1 hour\', 1')
+  rows = pipeline.execute('SELECT * FROM cv ORDER BY sec')
+  assert len(rows) == 2
+  assert [r['count'] for r in rows] == [10, 1]
+  assert pipeline.execute('SELECT count(*) FROM cv_mrel')[0]['count'] == 1
+
+  # Finalized values can't be combined
+  with pytest.raises(psycopg2.Error):
+    pipeline.execute('SELECT combine(count) FROM cv')
+
+
+def test_freeze_ttl(pipeline, clean_db):
+  """
+  Verify that archived row groups expire by their time bucket
+  """
+  pipeline.create_stream('s', ts='timestamptz', x='int')
+
+  with pytest.raises(psycopg2.Error):
+    pipeline.create_cv('bad', 'SELECT second(ts) AS sec, max(ts), count(*) FROM s GROUP BY sec',
+                       freeze_after='1 second', ttl='3 seconds', ttl_column='max')
+
+  pipeline.create_cv('cv', 'SELECT second(ts) AS sec, count(*) FROM s GROUP BY sec',
+                     freeze_after='1 second', ttl='3 seconds', ttl_column='sec')
+
+  pipeline.execute('INSERT INTO s (ts, x) SELECT now(), x FROM generate_series(1, 10) x')
+  _wait_for_freeze(pipeline, 'cv')
+  assert pipeline.execute('SELECT count FROM cv')[0]['count'] == 10
+
+  time.sleep(3)
+
+  # The reaper may have expired it already
+  pipeline.execute('SELECT pipelinedb.ttl_expire(\'cv\')')
+  assert pipeline.execute('SELECT count(*) FROM cv')[0]['count'] == 0
+  assert pipeline.execute('SELECT count(*) FROM cv_mrel_archive')[0]['count'] == 0
+
+
+def test_freeze_truncate(pipeline, clean_db):
+  """
+  Verify that truncating a CV removes its archived row groups along with its cached groups
+  """
+  pipeline.create_stream('s', ts='timestamptz', x='int')
+  pipeline.create_cv('cv', 'SELECT second(ts) AS sec, count(*) FROM s GROUP BY sec',
+                     freeze_after='1 second', cache=True)
+
+  pipeline.execute('INSERT INTO s (ts, x) SELECT now(), x FROM generate_series(1, 10) x')
+  _wait_for_freeze(pipeline, 'cv')
+  pipeline.execute('INSERT INTO s (ts, x) SELECT now() + interval \'1 hour\', 1')
+  assert pipeline.execute('SELECT count(*) FROM cv')[0]['count'] == 2
+
+  pipeline.execute("SELECT pipelinedb.truncate_continuous_view('cv')")
+  assert pipeline.execute('SELECT count(*) FROM cv')[0]['count'] == 0
+  assert pipeline.execute('SELECT count(*) FROM cv_mrel')[0]['count'] == 0
+  assert pipeline.execute('SELECT count(*) FROM cv_mrel_archive')[0]['count'] == 0
+  assert pipeline.execute('SELECT count(*) FROM cv_mrel_cache')[0]['count'] == 0
+
+  pipeline.execute('INSERT INTO s (ts, x) SELECT now() + interval \'1 hour\', 1')
+  assert pipeline.execute('SELECT count FROM cv')[0]['count'] == 1
@@ -0,0 +1,87 @@
+from base import pipeline, clean_db
+import getpass
+import psycopg2
+import signal
+import threading
+import time
+
+
+def _crash(pipeline):
+  """
+  Stop the server without a shutdown checkpoint, so that it has to recover from WAL on restart
+  """
+  pipeline.conn.close()
+  pipeline.proc.send_signal(signal.SIGQUIT)
+  pipeline.proc.wait()
+  pipeline.proc = None
+
+
+def _insert(port, stop, inserted, errors):
+  conn = psycopg2.connect('host=localhost dbname=postgres user=%s port=%d' % (getpass.getuser(), port))
+  conn.autocommit = True
+  cur = conn.cursor()
+  try:
+    while not stop.is_set():
+      cur.execute('INSERT INTO s (x) SELECT x FROM generate_series(1, 100) x')
+      inserted.append(100)
+  except Exception as e:
+    errors.append(e)
+  finally:
+    conn.close()
+
+
+def _check_durable_commits(pipeline, params):
+  pipeline.stop()
+  pipeline.run(params)
+  try:
+    pipeline.create_stream('s', x='int')
+    for i in xrange(4):
+      pipeline.create_cv('cv%d' % i, 'SELECT x %% %d AS g, count(*) FROM s GROUP BY g' % (i + 1))
+
+    stop = threading.Event()
+    inserted = []
+    errors = []
+    threads = [threading.Thread(target=_insert, args=(pipeline.port, stop, inserted, errors)) for i in xrange(4)]
+    for t in threads:
+      t.start()
+
+    time.sleep(3)
+    stop.set()
+    for t in threads:
+      t.join()
+
+    assert not errors
+    total = sum(inserted)
+    assert total > 0
+
+    # Synchronous stream inserts only return once combiners have committed, so nothing may be lost
+    _crash(pipeline)
+    pipeline.run(params)
+
+    for i in xrange(4):
+      assert pipeline.execute('SELECT sum(count) FROM cv%d' % i)[0]['sum'] == total
+  finally:
+    pipeline.stop()
+    pipeline.run()
+
+
+def test_group_commit_durability(pipeline, clean_db):
+  """
+  Verify that group commits of concurrent combiners are durable once inserts return
+  """
+  _check_durable_commits(pipeline, {
+    'pipelinedb.num_combiners': 4,
+    'pipelinedb.combiner_group_commit': 'on',
+    'pipelinedb.combiner_synchronous_commit': 'on'
+  })
+
+
+def test_no_group_commit_durability(pipeline, clean_db):
+  """
+  Verify that combiners committing on their own are durable once inserts return
+  """
+  _check_durable_commits(pipeline, {
+    'pipelinedb.num_combiners': 4,
+    'pipelinedb.combiner_group_commit': 'off',
+    'pipelinedb.combiner_synchronous_commit': 'on'
+  })
@@ -0,0 +1,90 @@
+from base import pipeline, clean_db
+import psycopg2
+import pytest
+import time
+
+
+STAGES = ['combine', 'combiner_queue', 'commit', 'sync', 'worker_exec', 'worker_queue']
+
+
+def _stats(pipeline, cv):
+  rows = pipeline.execute("SELECT * FROM pipelinedb.latency_stats WHERE query = '%s' ORDER BY stage" % cv)
+  return dict((r['stage'], r) for r in rows)
+
+
+def _wait_for_stages(pipeline, cv, timeout=10):
+  stats = {}
+  for i in xrange(timeout * 4):
+    stats = _stats(pipeline, cv)
+    if sorted(stats.keys()) == STAGES:
+      break
+    time.sleep(0.25)
+  return stats
+
+
+def test_latency_stats(pipeline, clean_db):
+  """
+  Verify that every stage of a CV's pipeline reports ordered percentiles, and that they can be reset
+  """
+  pipeline.create_stream('s', x='int')
+  pipeline.create_cv('cv0', 'SELECT x % 10 AS g, count(*) FROM s GROUP BY g')
+  pipeline.create_cv('cv1', 'SELECT count(*) FROM s')
+
+  for i in xrange(20):
+    pipeline.insert('s', ['x'], [(x,) for x in range(100)])
+
+  for cv in ('cv0', 'cv1'):
+    stats = _wait_for_stages(pipeline, cv)
+    assert sorted(stats.keys()) == STAGES
+
+    for stage, r in stats.items():
+      assert r['namespace'] == 'public'
+      assert r['count'] > 0
+      assert 0 <= r['p50'] <= r['p90'] <= r['p99'] <= r['p999'] <= r['max']
+
+    # Queue latencies are counted once per tuple
+    assert stats['worker_queue']['count'] == 2000
+
+  # Any percentiles may be asked for, in the order given
+  rows = pipeline.execute("SELECT s.* FROM pipelinedb.get_latency_stats('{1.0,0.0,0.5}') s "
+                          "JOIN pipelinedb.cont_query q ON s.query_id = q.id "
+                          "JOIN pg_class c ON q.relid = c.oid WHERE c.relname = 'cv0'")
+  assert len(rows) == len(STAGES)
+  for r in rows:
+    p100, p0, p50 = r['percentiles']
+    assert p0 <= p50 <= p100 <= r['max']
+
+  for percentiles in ("'{1.5}'", "'{-0.1}'", "'{0.5,NULL}'", "'{{0.5},{0.9}}'"):
+    with pytest.raises(psycopg2.Error):
+      pipeline.execute('SELECT * FROM pipelinedb.get_latency_stats(%s)' % percentiles)
+
+  # Stages without any samples since the reset aren't shown
+  pipeline.execute('SELECT pipelinedb.reset_latency_stats()')
+  assert _stats(pipeline, 'cv0') == {}
+  assert _stats(pipeline, 'cv1') == {}
+
+  pipeline.insert('s', ['x'], [(1,)])
+  stats = _wait_for_stages(pipeline, 'cv1')
+  assert sorted(stats.keys()) == STAGES
+  assert stats['worker_queue']['count'] == 1
+
+
+def test_latency_stats_disabled(pipeline, clean_db):
+  """
+  Verify that nothing is tracked when latency_stats_max_queries is 0
+  """
+  pipeline.stop()
+  pipeline.run({'pipelinedb.latency_stats_max_queries': 0})
+  try:
+    pipeline.create_stream('s', x='int')
+    pipeline.create_cv('cv', 'SELECT count(*) FROM s')
+    pipeline.insert('s', ['x'], [(x,) for x in range(100)])
+
+    assert pipeline.execute('SELECT count FROM cv')[0]['count'] == 100
+    assert pipeline.execute('SELECT count(*) FROM pipelinedb.latency_stats')[0]['count'] == 0
+
+    # Resetting is a noop
+    pipeline.execute('SELECT pipelinedb.reset_latency_stats()')
+  finally:
+    pipeline.stop()
+    pipeline.run()
@@ -0,0 +1,62 @@
+from base import pipeline, clean_db
+import time
+
+
+def _wait_for_snapshot(pipeline, cv, expected, timeout=15):
+  for i in xrange(timeout * 4):
+    rows = pipeline.execute('SELECT x, count FROM %s_mrel_snap ORDER BY x' % cv)
+    if [(r['x'], r['count']) for r in rows] == expected:
+      return
+    time.sleep(0.25)
+  assert False, 'snapshot of %s never reached %s' % (cv, expected)
+
+
+def test_unlogged_matrel_snapshot_restore(pipeline, clean_db):
+  """
+  Verify that unlogged matrels are snapshotted incrementally and restored from their snapshot
+  """
+  pipeline.stop()
+  pipeline.run({'pipelinedb.matrel_snapshot_interval': 1})
+  try:
+    pipeline.create_stream('s', x='int')
+    pipeline.create_cv('cv', 'SELECT x, count(*) FROM s GROUP BY x', unlogged=True)
+
+    rows = pipeline.execute("SELECT relpersistence FROM pg_class WHERE relname = 'cv_mrel'")
+    assert rows[0]['relpersistence'] == 'u'
+
+    pipeline.insert('s', ['x'], [(x % 10,) for x in range(100)])
+    _wait_for_snapshot(pipeline, 'cv', [(x, 10) for x in range(10)])
+
+    # Nothing changed, so later snapshots must leave every snapshot row alone
+    before = pipeline.execute('SELECT x, xmin::text AS xmin FROM cv_mrel_snap ORDER BY x')
+    time.sleep(3)
+    after = pipeline.execute('SELECT x, xmin::text AS xmin FROM cv_mrel_snap ORDER BY x')
+    assert [(r['x'], r['xmin']) for r in before] == [(r['x'], r['xmin']) for r in after]
+
+    # Only the changed group is rewritten
+    pipeline.insert('s', ['x'], [(0,)])
+    _wait_for_snapshot(pipeline, 'cv', [(0, 11)] + [(x, 10) for x in range(1, 10)])
+    after = pipeline.execute('SELECT x, xmin::text AS xmin FROM cv_mrel_snap ORDER BY x')
+    assert before[0]['xmin'] != after[0]['xmin']
+    assert [(r['x'], r['xmin']) for r in before[1:]] == [(r['x'], r['xmin']) for r in after[1:]]
+
+    # Emulate what crash recovery does to an unlogged matrel and its marker
+    pipeline.execute('SET pipelinedb.matrels_writable TO on')
+    pipeline.execute('DELETE FROM cv_mrel')
+    pipeline.execute('DELETE FROM cv_mrel_snapmark')
+    pipeline.execute('SET pipelinedb.matrels_writable TO off')
+
+    for i in xrange(60):
+      if pipeline.execute('SELECT count(*) FROM cv_mrel_snapmark')[0]['count']:
+        break
+      time.sleep(0.25)
+
+    rows = pipeline.execute('SELECT x, count FROM cv ORDER BY x')
+    assert [(r['x'], r['count']) for r in rows] == [(0, 11)] + [(x, 10) for x in range(1, 10)]
+
+    pipeline.insert('s', ['x'], [(x,) for x in range(10)])
+    rows = pipeline.execute('SELECT x, count FROM cv ORDER BY x')
+    assert [(r['x'], r['count']) for r in rows] == [(0, 12)] + [(x, 11) for x in range(1, 10)]
+  finally:
+    pipeline.stop()
+    pipeline.run()
@@ -94,6 +94,51 @@ def test_concurrent_sw_ticking(pipeline, clean_db):
     pipeline.drop_cv(name)
 
 
+def test_sw_output_over_ticks(pipeline, clean_db):
+  """
+  Verify that a sliding-window query's output stream values are correct over several
+  ticks as steps are added to and expire from each window one at a time
+  """
+  pipeline.create_stream('s', x='int')
+  pipeline.create_cv('sw', 'SELECT x::integer, count(*), sum(x), max(x) FROM s GROUP BY x',
+                     sw='20 seconds', step_factor=5)
+  pipeline.create_cv('sw_output', """
+  SELECT arrival_timestamp,
+  CASE WHEN (old).x IS NULL THEN (new).x ELSE (old).x END AS x,
+  (new).count, (new).sum, (new).max, new IS NULL AS expired FROM sw_osrel
+  """)
+
+  # Each insert lands in its own 1s step
+  for n in range(5):
+    pipeline.insert('s', ('x',), [(x % 4,) for x in range(100)])
+    time.sleep(1.5)
+
+  # Wait for every step to fall out of the window
+  time.sleep(24)
+
+  for x in range(4):
+    rows = pipeline.execute(
+      'SELECT count, sum, max, expired FROM sw_output WHERE x = %d ORDER BY arrival_timestamp' % x)
+    assert rows[-1]['expired']
+
+    counts = []
+    for row in rows[:-1]:
+      assert not row['expired']
+      assert row['sum'] == row['count'] * x
+      assert row['max'] == x
+      counts.append(row['count'])
+
+    # Values only change when a step is added or expires
+    assert all(a != b for a, b in zip(counts, counts[1:]))
+
+    peak = counts.index(125)
+    assert counts[:peak + 1] == sorted(counts[:peak + 1])
+    assert counts[peak:] == [125, 100, 75, 50, 25]
+
+  pipeline.drop_cv('sw_output')
+  pipeline.drop_cv('sw')
+
+
 def test_transforms(pipeline, clean_db):
   """
   Verify that continuous transforms work properly on output streams
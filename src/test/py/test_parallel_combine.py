@@ -0,0 +1,56 @@
+from base import pipeline, clean_db
+
+
+def _plan(pipeline, q):
+  return [r['QUERY PLAN'] for r in pipeline.execute('EXPLAIN (COSTS OFF) %s' % q)]
+
+
+def _rows(pipeline, q):
+  return sorted((r['a'], r['count'], r['uniques'], r['p50']) for r in pipeline.execute(q))
+
+
+def test_parallel_combine(pipeline, clean_db):
+  """
+  Verify that combining a CV's internal-state sketches over a subset of its groups is planned as a
+  parallel partial aggregate, and gives the same results as a serial one
+  """
+  pipeline.create_stream('s', a='int', b='int', x='int')
+  pipeline.create_cv('cv', 'SELECT a, b, count(*), count(DISTINCT x) AS d, '
+                     'percentile_cont(0.5) WITHIN GROUP (ORDER BY x) AS p FROM s GROUP BY a, b')
+
+  pipeline.execute('INSERT INTO s (a, b, x) SELECT x % 10, x % 1000, x FROM generate_series(1, 100000) x')
+  assert pipeline.execute('SELECT count(*) FROM cv')[0]['count'] == 1000
+
+  q = ('SELECT a, combine(count) AS count, combine(d) AS uniques, combine(p) AS p50 '
+       'FROM cv GROUP BY a')
+
+  pipeline.execute('SET max_parallel_workers_per_gather TO 2')
+  pipeline.execute('SET parallel_setup_cost TO 0')
+  pipeline.execute('SET parallel_tuple_cost TO 0')
+  pipeline.execute('SET min_parallel_table_scan_size TO 0')
+  try:
+    plan = _plan(pipeline, q)
+    gather = [i for i, l in enumerate(plan) if 'Gather' in l]
+    partial = [i for i, l in enumerate(plan) if 'Partial' in l and 'Aggregate' in l]
+    assert gather and partial, '\n'.join(plan)
+    assert gather[0] < partial[0], '\n'.join(plan)
+    assert any('Finalize' in l for l in plan[:gather[0]]), '\n'.join(plan)
+
+    parallel = _rows(pipeline, q)
+  finally:
+    pipeline.execute('RESET max_parallel_workers_per_gather')
+    pipeline.execute('RESET parallel_setup_cost')
+    pipeline.execute('RESET parallel_tuple_cost')
+    pipeline.execute('RESET min_parallel_table_scan_size')
+
+  pipeline.execute('SET max_parallel_workers_per_gather TO 0')
+  try:
+    assert not any('Gather' in l for l in _plan(pipeline, q))
+    serial = _rows(pipeline, q)
+  finally:
+    pipeline.execute('RESET max_parallel_workers_per_gather')
+
+  # HLL unions don't depend on the order states are combined in, but t-digest merges may differ slightly
+  assert [r[:3] for r in parallel] == [r[:3] for r in serial]
+  for p, s in zip(parallel, serial):
+    assert abs(p[3] - s[3]) <= 0.01 * s[3]
@@ -0,0 +1,70 @@
+from base import pipeline, clean_db
+from datetime import datetime, timedelta
+import psycopg2
+import pytest
+import random
+import time
+
+
+def _rows(pipeline, q):
+  return sorted((r['m'], r['k'], r['count'], r['sum'], float(round(r['avg'], 6)), r['max'])
+                for r in pipeline.execute(q))
+
+
+def _expected(pipeline, grain):
+  return _rows(pipeline, "SELECT date_trunc('%s', ts) AS m, k, count(*), sum(x), avg(x), max(x) "
+                         "FROM t GROUP BY 1, k" % grain)
+
+
+def _wait_for_rollup(pipeline, cv, grain, timeout=10):
+  expected = _expected(pipeline, grain)
+  rows = None
+  for i in xrange(timeout * 4):
+    rows = _rows(pipeline, 'SELECT * FROM %s' % cv)
+    if rows == expected:
+      break
+    time.sleep(0.25)
+  return rows, expected
+
+
+def test_rollup_cascade(pipeline, clean_db):
+  """
+  Verify that each level of a rollup cascade has the same values as aggregating raw events at its granularity
+  """
+  pipeline.create_stream('s', ts='timestamptz', k='int', x='int')
+  pipeline.create_table('t', ts='timestamptz', k='int', x='int')
+  pipeline.create_cv('cv', 'SELECT minute(ts) AS m, k, count(*), sum(x), avg(x), max(x) FROM s GROUP BY m, k',
+                     rollups='hour, day')
+
+  # Later batches update existing finer-grained groups, so rollups must combine their deltas
+  for i in xrange(3):
+    start = datetime(2026, 1, 1)
+    rows = [((start + timedelta(minutes=random.randint(0, 3 * 24 * 60))).strftime('%Y-%m-%d %H:%M:%S+00'),
+             random.randint(0, 4), random.randint(-100, 100)) for n in xrange(2000)]
+    values = ', '.join("('%s', %d, %d)" % r for r in rows)
+    pipeline.execute('INSERT INTO s (ts, k, x) VALUES %s' % values)
+    pipeline.execute('INSERT INTO t (ts, k, x) VALUES %s' % values)
+
+  assert _rows(pipeline, 'SELECT * FROM cv') == _expected(pipeline, 'minute')
+
+  rows, expected = _wait_for_rollup(pipeline, 'cv_hour', 'hour')
+  assert rows == expected
+
+  rows, expected = _wait_for_rollup(pipeline, 'cv_day', 'day')
+  assert rows == expected
+
+
+def test_rollup_validation(pipeline, clean_db):
+  """
+  Verify that rollups are only created for CVs they can be computed for
+  """
+  pipeline.create_stream('s', ts='timestamptz', x='int')
+
+  with pytest.raises(psycopg2.Error):
+    pipeline.create_cv('bad', 'SELECT hour(ts) AS h, count(*) FROM s GROUP BY h', rollups='minute')
+
+  with pytest.raises(psycopg2.Error):
+    pipeline.create_cv('bad', 'SELECT minute(ts) AS m, count(*) FROM s GROUP BY m', rollups='week')
+
+  with pytest.raises(psycopg2.Error):
+    pipeline.create_cv('bad', 'SELECT minute(ts) AS m, count(*) + 1 AS c FROM s GROUP BY m', rollups='hour')
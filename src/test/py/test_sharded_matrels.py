@@ -0,0 +1,31 @@
+from base import pipeline, clean_db
+
+
+def test_shard_ownership(pipeline, clean_db):
+  """
+  Verify that each group of a sharded matrel lives in exactly the shard its group hash
+  maps to, and that reads through the CV see all shards
+  """
+  pipeline.create_stream('s', x='int')
+  pipeline.create_cv('sharded', 'SELECT x, count(*) FROM s GROUP BY x', shards=4)
+
+  for n in range(3):
+    pipeline.insert('s', ('x',), [(x % 100,) for x in range(1000)])
+
+  rows = pipeline.execute('SELECT x, count FROM sharded ORDER BY x')
+  assert [(r[0], r[1]) for r in rows] == [(x, 30) for x in range(100)]
+
+  # The parent matrel itself never has any rows
+  assert pipeline.execute('SELECT count(*) FROM ONLY sharded_mrel')[0][0] == 0
+
+  total = 0
+  for shard in range(4):
+    rows = pipeline.execute('SELECT x FROM ONLY sharded_mrel_%d' % shard)
+    assert rows
+    for row in rows:
+      assert pipeline.execute(
+        'SELECT (pipelinedb.hash_group(%d)::bigint & 4294967295) %% 4' % row[0])[0][0] == shard
+    total += len(rows)
+
+  # Every group is in exactly one shard
+  assert total == 100
@@ -0,0 +1,75 @@
+from base import pipeline, clean_db
+import hashlib
+import time
+
+
+def _toast_bytes(pipeline, cv, expected, timeout=10):
+  """
+  Wait for the combiner's toast_bytes stat to reach the expected value
+  """
+  q = ("SELECT toast_bytes FROM pipelinedb.query_stats "
+       "WHERE continuous_query = '%s' AND type = 'combiner'" % cv)
+  value = None
+  for i in xrange(timeout * 4):
+    rows = pipeline.execute(q)
+    value = rows[0]['toast_bytes'] if rows else None
+    if value == expected:
+      break
+    time.sleep(0.25)
+  return value
+
+
+def _incompressible(prefix, n):
+  return prefix + ''.join(hashlib.md5('%s%d' % (prefix, i)).hexdigest() for i in range(n))
+
+
+def test_sketch_column_storage(pipeline, clean_db):
+  """
+  Verify that sketch columns get the configured storage strategy and other columns keep their default
+  """
+  pipeline.create_stream('s', x='int')
+  pipeline.create_cv('cv_e', 'SELECT count(*), hll_agg(x), bloom_agg(x) FROM s')
+
+  rows = pipeline.execute("SELECT attname, attstorage FROM pg_attribute "
+                          "WHERE attrelid = 'cv_e_mrel'::regclass AND attname IN ('count', 'hll_agg', 'bloom_agg')")
+  storage = dict((r['attname'], r['attstorage']) for r in rows)
+  assert storage == {'count': 'p', 'hll_agg': 'e', 'bloom_agg': 'e'}
+
+  pipeline.execute('SET pipelinedb.sketch_storage TO extended')
+  pipeline.create_cv('cv_x', 'SELECT hll_agg(x) FROM s')
+  pipeline.execute('RESET pipelinedb.sketch_storage')
+
+  rows = pipeline.execute("SELECT attstorage FROM pg_attribute "
+                          "WHERE attrelid = 'cv_x_mrel'::regclass AND attname = 'hll_agg'")
+  assert rows[0]['attstorage'] == 'x'
+
+
+def test_toast_bytes(pipeline, clean_db):
+  """
+  Verify that toast_bytes counts values written out of line by each write, and not unchanged values
+  an update carries over from the old row
+  """
+  pipeline.create_stream('s', k='text', v='text')
+  pipeline.create_cv('cv', 'SELECT k, max(v) AS v FROM s GROUP BY k')
+
+  key = _incompressible('k', 300)
+
+  pipeline.insert('s', ['k', 'v'], [(key, _incompressible('a', 300))])
+  sizes = pipeline.execute('SELECT pg_column_size(k) AS k, pg_column_size(v) AS v FROM cv_mrel')[0]
+
+  # Both values are too big to keep inline and don't compress, so the insert writes both out of line
+  total = sizes['k'] + sizes['v']
+  assert sizes['k'] > 8000
+  assert _toast_bytes(pipeline, 'cv', total) == total
+
+  # The update writes a new v but reuses the key's TOAST pointer
+  pipeline.insert('s', ['k', 'v'], [(key, _incompressible('b', 300))])
+  sizes = pipeline.execute('SELECT pg_column_size(v) AS v FROM cv_mrel')[0]
+
+  total += sizes['v']
+  assert _toast_bytes(pipeline, 'cv', total) == total
+
+  # Small values stay inline and aren't counted
+  pipeline.insert('s', ['k', 'v'], [('small', 'small')])
+  time.sleep(1)
+  assert _toast_bytes(pipeline, 'cv', total) == total
@@ -0,0 +1,62 @@
+from base import pipeline, clean_db
+
+
+def _toasted(pipeline, relname):
+  rows = pipeline.execute("SELECT pg_relation_size(reltoastrelid) AS size FROM pg_class WHERE relname = '%s'" % relname)
+  return rows[0]['size'] > 0
+
+
+def _insert(pipeline, start, n):
+  """
+  Insert n new values, and repeat the first one more often than any earlier batch's first value.
+  Returns how many events were inserted.
+  """
+  reps = n + start / n
+  pipeline.execute('INSERT INTO s (k, x) SELECT 0, x FROM generate_series(%d, %d) x' % (start, start + n - 1))
+  pipeline.execute('INSERT INTO s (k, x) SELECT 0, %d FROM generate_series(1, %d)' % (start, reps))
+  return n + reps
+
+
+def test_toasted_sketch_updates(pipeline, clean_db):
+  """
+  Verify that every sync of a group with TOASTed sketch states writes each changed state and its output stream row
+  """
+  pipeline.create_stream('s', k='int', x='int')
+
+  # No plain aggregate, so the row is only written if a sketch is seen to change
+  pipeline.create_cv('cv', 'SELECT k, freq_agg(x) AS cms, dist_agg(x) AS td, topk_agg(x, 5) AS topk, '
+                     'hll_agg(x) AS hll FROM s GROUP BY k')
+  pipeline.create_cv('deltas', 'SELECT count(*), sum(freq_total((delta).cms)) AS total FROM cv_osrel')
+
+  start = 0
+  batch = 100
+  expected = 0
+  while not _toasted(pipeline, 'cv_mrel'):
+    expected += _insert(pipeline, start, batch)
+    start += batch
+    assert start < 100000
+
+  syncs = pipeline.execute('SELECT count FROM deltas')[0]['count']
+  prev = None
+
+  for i in xrange(20):
+    expected += _insert(pipeline, start, batch)
+    total = pipeline.execute('SELECT freq_total(cms) FROM cv_mrel')[0]['freq_total']
+    assert total == expected
+
+    row = pipeline.execute('SELECT freq(cms, %d) AS freq, dist_quantile(td, 1.0) AS max, '
+                           'topk_values(topk) AS topk, hll_cardinality(hll) AS card FROM cv' % start)[0]
+    assert row['freq'] >= batch + 1 + start / batch
+    assert row['max'] >= start + batch - 1
+    assert row['topk'][0] == start
+    if prev:
+      assert row['card'] > prev['card']
+
+    # Each sync of a changed group is written to the output stream with its delta
+    deltas = pipeline.execute('SELECT count, total FROM deltas')[0]
+    assert deltas['count'] > syncs
+    assert deltas['total'] == total
+    syncs = deltas['count']
+
+    prev = row
+    start += batch
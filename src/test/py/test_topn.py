@@ -0,0 +1,61 @@
+from base import pipeline, clean_db
+import psycopg2
+import pytest
+import random
+
+
+def _expected(pipeline, cv, column, n):
+  rows = pipeline.execute('SELECT k, %s FROM %s ORDER BY %s DESC NULLS LAST, k LIMIT %d' % (column, cv, column, n))
+  return set((r['k'], r[column]) for r in rows)
+
+
+def _topn(pipeline, cv, column):
+  return set((r['k'], r[column]) for r in pipeline.execute('SELECT k, %s FROM %s_topn' % (column, cv)))
+
+
+def test_topn_count(pipeline, clean_db):
+  """
+  Verify that the top-N relation always holds the CV's groups with the highest counts
+  """
+  pipeline.create_stream('s', k='int')
+  pipeline.create_cv('cv', 'SELECT k, count(*) FROM s GROUP BY k', topn=5, topn_column='count')
+
+  # Counts are distinct so that the top 5 is unambiguous
+  rows = [(k,) for k in range(50) for i in range(k + 1)]
+  random.shuffle(rows)
+  pipeline.insert('s', ['k'], rows)
+  assert _topn(pipeline, 'cv', 'count') == _expected(pipeline, 'cv', 'count', 5)
+
+  # Groups outside the top-N overtake the ones in it
+  pipeline.insert('s', ['k'], [(k,) for k in (0, 1) for i in range(100)])
+  assert _topn(pipeline, 'cv', 'count') == _expected(pipeline, 'cv', 'count', 5)
+  assert set(r['k'] for r in pipeline.execute('SELECT k FROM cv_topn')) == set([0, 1, 49, 48, 47])
+
+
+def test_topn_sum(pipeline, clean_db):
+  """
+  Verify that sums can only rank top-N groups when their input is known to be non-negative
+  """
+  pipeline.create_stream('s', k='int', x='int')
+
+  with pytest.raises(psycopg2.Error):
+    pipeline.create_cv('bad', 'SELECT k, sum(x) FROM s GROUP BY k', topn=3, topn_column='sum')
+
+  with pytest.raises(psycopg2.Error):
+    pipeline.create_cv('bad', 'SELECT k, min(x) FROM s GROUP BY k', topn=3, topn_column='min')
+
+  with pytest.raises(psycopg2.Error):
+    pipeline.create_cv('bad', 'SELECT k, avg(x) FROM s GROUP BY k', topn=3, topn_column='avg')
+
+  pipeline.create_cv('cv', 'SELECT k, sum(x) FROM s WHERE x >= 0 GROUP BY k', topn=3, topn_column='sum')
+  pipeline.create_cv('cv_filter', 'SELECT k, sum(x) FILTER (WHERE x > 0) FROM s GROUP BY k',
+                     topn=3, topn_column='sum')
+
+  rows = [(random.randint(0, 20), random.randint(-100, 100)) for i in range(2000)]
+  pipeline.insert('s', ['k', 'x'], rows)
+  pipeline.insert('s', ['k', 'x'], [(k, random.randint(-100, 100)) for k in range(20) for i in range(50)])
+
+  for cv in ('cv', 'cv_filter'):
+    topn = _topn(pipeline, cv, 'sum')
+    assert len(topn) == 3
+    assert sorted(v for k, v in topn) == sorted(v for k, v in _expected(pipeline, cv, 'sum', 3))
@@ -0,0 +1,175 @@
+from base import pipeline, clean_db
+import getpass
+import psycopg2
+import pytest
+import threading
+import time
+
+
+def test_ttl_expire_counts(pipeline, clean_db):
+  """
+  Verify that TTL expiration reports exactly how many rows it removed, both when only some
+  rows have expired and when all of them have
+  """
+  pipeline.create_stream('s', x='int')
+  pipeline.create_cv('ttl', 'SELECT second(arrival_timestamp), x, count(*) FROM s GROUP BY second, x',
+                     ttl='3 seconds', ttl_column='second')
+
+  pipeline.insert('s', ('x',), [(x,) for x in range(10)])
+  expired = pipeline.execute('SELECT count(*) FROM ttl_mrel')[0][0]
+  assert expired >= 10
+
+  time.sleep(4)
+
+  pipeline.insert('s', ('x',), [(x,) for x in range(5)])
+  live = pipeline.execute('SELECT count(*) FROM ttl_mrel')[0][0] - expired
+  assert live >= 5
+
+  # Some rows are still live, so only the expired ones are deleted
+  assert pipeline.execute("SELECT pipelinedb.ttl_expire('ttl')")[0][0] == expired
+  assert pipeline.execute('SELECT count(*) FROM ttl_mrel')[0][0] == live
+
+  time.sleep(4)
+
+  # Now everything has expired
+  assert pipeline.execute("SELECT pipelinedb.ttl_expire('ttl')")[0][0] == live
+  assert pipeline.execute('SELECT count(*) FROM ttl_mrel')[0][0] == 0
+  assert pipeline.execute("SELECT pipelinedb.ttl_expire('ttl')")[0][0] == 0
+
+  # The CV keeps working after being emptied
+  pipeline.insert('s', ('x',), [(x,) for x in range(3)])
+  assert pipeline.execute('SELECT sum(count) FROM ttl')[0][0] == 3
+
+
+def test_ttl_expire_concurrent_ingest(pipeline, clean_db):
+  """
+  Verify that expiring rows while combiners are concurrently updating the same groups
+  never causes combiner errors or lost updates
+  """
+  pipeline.create_stream('s', x='int')
+  pipeline.create_cv('ttl', 'SELECT second(arrival_timestamp), x, count(*) FROM s GROUP BY second, x',
+                     ttl='1 second', ttl_column='second')
+
+  done = threading.Event()
+
+  def insert():
+    conn = psycopg2.connect('dbname=postgres user=%s host=localhost port=%s'
+                % (getpass.getuser(), pipeline.port))
+    conn.autocommit = True
+    cur = conn.cursor()
+    while not done.is_set():
+      cur.execute('INSERT INTO s (x) SELECT x % 10 FROM generate_series(1, 1000) AS x')
+    conn.close()
+
+  threads = [threading.Thread(target=insert) for n in range(4)]
+  for t in threads:
+    t.start()
+
+  try:
+    deleted = 0
+    end = time.time() + 8
+    while time.time() < end:
+      deleted += pipeline.execute("SELECT pipelinedb.ttl_expire('ttl')")[0][0]
+      time.sleep(0.1)
+  finally:
+    done.set()
+    for t in threads:
+      t.join()
+
+  assert deleted > 0
+
+  errors = pipeline.execute("""
+  SELECT sum(errors) FROM pipelinedb.proc_query_stats s
+  JOIN pipelinedb.cont_query cq ON cq.id = s.query_id
+  JOIN pg_class c ON c.oid = cq.relid WHERE c.relname = 'ttl'
+  """)[0][0]
+  assert errors == 0
+
+  # Once ingestion stops, everything expires and new rows are still combined correctly
+  time.sleep(3)
+  pipeline.execute("SELECT pipelinedb.ttl_expire('ttl')")
+  assert pipeline.execute('SELECT count(*) FROM ttl_mrel')[0][0] == 0
+
+  pipeline.insert('s', ('x',), [(x % 10,) for x in range(100)])
+  rows = pipeline.execute('SELECT x, sum(count) FROM ttl GROUP BY x ORDER BY x')
+  assert [(r[0], r[1]) for r in rows] == [(x, 10) for x in range(10)]
+
+
+def _partitions(pipeline, matrel):
+  rows = pipeline.execute("SELECT c.relname FROM pg_inherits i JOIN pg_class c ON c.oid = i.inhrelid "
+                          "WHERE i.inhparent = '%s'::regclass" % matrel)
+  return set(r[0] for r in rows)
+
+
+def test_ttl_partition(pipeline, clean_db):
+  """
+  Verify that a matrel partitioned by its TTL column stores its groups in the partitions, and
+  that whole partitions are dropped once their range has expired
+  """
+  pipeline.create_stream('s', x='int')
+  pipeline.create_cv('ttl', 'SELECT second(arrival_timestamp), x, count(*) FROM s GROUP BY second, x',
+                     ttl='3 seconds', ttl_column='second', ttl_partition='1 second')
+
+  # Partitions are created ahead of time, so nothing goes in the matrel itself
+  assert _partitions(pipeline, 'ttl_mrel')
+
+  pipeline.insert('s', ('x',), [(x,) for x in range(10)])
+  expired = pipeline.execute('SELECT count(*) FROM ttl_mrel')[0][0]
+  assert expired >= 10
+  assert pipeline.execute('SELECT count(*) FROM ONLY ttl_mrel')[0][0] == 0
+
+  rows = pipeline.execute('SELECT DISTINCT c.relname FROM ttl_mrel m JOIN pg_class c ON c.oid = m.tableoid')
+  old = set(r[0] for r in rows)
+  assert old <= _partitions(pipeline, 'ttl_mrel')
+
+  # Partitions expire once their whole range is older than the TTL
+  time.sleep(5)
+
+  pipeline.insert('s', ('x',), [(x,) for x in range(5)])
+  live = pipeline.execute('SELECT count(*) FROM ttl_mrel')[0][0] - expired
+  assert live >= 5
+
+  assert pipeline.execute("SELECT pipelinedb.ttl_expire('ttl')")[0][0] == expired
+  assert pipeline.execute('SELECT count(*) FROM ttl_mrel')[0][0] == live
+  assert not old & _partitions(pipeline, 'ttl_mrel')
+
+  rows = pipeline.execute('SELECT x, sum(count) FROM ttl GROUP BY x ORDER BY x')
+  assert [(r[0], r[1]) for r in rows] == [(x, 1) for x in range(5)]
+
+  # A partitioned CV's TTL column can't change
+  with pytest.raises(psycopg2.Error):
+    pipeline.execute("SELECT pipelinedb.set_ttl('ttl', '1 day', 'x')")
+  with pytest.raises(psycopg2.Error):
+    pipeline.execute("SELECT pipelinedb.set_ttl('ttl', NULL, NULL)")
+
+
+def test_ttl_partition_options(pipeline, clean_db):
+  """
+  Verify that ttl_partition is only accepted for CVs that it can be used with
+  """
+  pipeline.create_stream('s', x='int')
+  q = 'SELECT second(arrival_timestamp), x, count(*) FROM s GROUP BY second, x'
+
+  invalid = [
+    dict(ttl_partition='1 second'),
+    dict(ttl='1 minute', ttl_column='second', ttl_partition='0 seconds'),
+    dict(ttl='1 minute', ttl_column='second', ttl_partition='1 hour'),
+    dict(ttl='1 day', ttl_column='second', ttl_partition='1 second'),
+    dict(ttl='1 minute', ttl_column='second', ttl_partition='1 second', shards=2),
+    dict(ttl='1 minute', ttl_column='second', ttl_partition='1 second', unlogged=True),
+    dict(ttl='1 minute', ttl_column='second', ttl_partition='1 second', cache=True),
+  ]
+
+  for opts in invalid:
+    with pytest.raises(psycopg2.Error):
+      pipeline.create_cv('ttl', q, **opts)
+
+  # The TTL column must be a grouping column, so that groups never move between partitions
+  with pytest.raises(psycopg2.Error):
+    pipeline.create_cv('ttl', 'SELECT x, max(arrival_timestamp) AS t, count(*) FROM s GROUP BY x',
+                       ttl='1 minute', ttl_column='t', ttl_partition='1 second')
+
+  with pytest.raises(psycopg2.Error):
+    pipeline.create_cv('ttl', 'SELECT second(arrival_timestamp), count(*) FROM s WHERE '
+                       "arrival_timestamp > clock_timestamp() - interval '1 minute' GROUP BY second",
+                       ttl_partition='1 second')
@@ -17,7 +17,9 @@
 #include "miscadmin.h"
 #include "nodes/makefuncs.h"
 #include "pgstat.h"
+#include "pipeline_trace.h"
 #include "combiner_receiver.h"
+#include "cont_explain.h"
 #include "executor.h"
 #include "planner.h"
 #include "scheduler.h"
@@ -95,18 +97,24 @@ init_query_state(ContExecutor *exec, ContQueryState *base)
 	pfree(base);
 	base = (ContQueryState *) state;
 
-	/* Each plan execution's output on a microbatch is buffered in a tuplestore */
-	state->dest = CreateDestReceiver(DestTuplestore);
-	state->plan_output = tuplestore_begin_heap(false, false, continuous_query_batch_mem);
-	SetTuplestoreDestReceiverParams(state->dest, state->plan_output, CurrentMemoryContext, false);
-
 	/*
-	 * Now create the receivers, which send the buffered plan output down the processing pipeline
+	 * Now create the receivers, which send plan output down the processing pipeline.
+	 *
+	 * CV plans write their partial results directly into microbatches bound for combiners,
+	 * while each transform plan execution's output on a microbatch is buffered in a tuplestore.
 	 */
 	if (base->query->type == CONT_VIEW)
-		state->receiver = CreateCombinerReceiver(exec, base->query, state->plan_output);
+	{
+		state->receiver = CreateCombinerReceiver(exec, base->query);
+		state->dest = GetCombinerDestReceiver(state->receiver);
+	}
 	else
+	{
+		state->dest = CreateDestReceiver(DestTuplestore);
+		state->plan_output = tuplestore_begin_heap(false, false, continuous_query_batch_mem);
+		SetTuplestoreDestReceiverParams(state->dest, state->plan_output, CurrentMemoryContext, false);
 		state->receiver = CreateTransformReceiver(exec, base->query, state->plan_output);
+	}
 
 	pstmt = GetContPlan(base->query, Worker);
 
@@ -125,6 +133,7 @@ init_query_state(ContExecutor *exec, ContQueryState *base)
 
 	/* process/query level statistics */
 	state->base.stats = ProcStatsInit(state->base.query->id, MyProcPid);
+	state->base.latency = LatencyStatsInit(state->base.query->id);
 	MyProcStatCQEntry = state->base.stats;
 
 	if (IsA(state->query_desc->plannedstmt->planTree, Agg))
@@ -193,7 +202,8 @@ flush_tuples(ContQueryWorkerState *state)
 	 * at end-of-transaction. But if it did spill to disk we must explicitly clear it here in order
 	 * to clean up its associated temporary files.
 	 */
-	tuplestore_clear(state->plan_output);
+	if (state->plan_output)
+		tuplestore_clear(state->plan_output);
 }
 
 /*
@@ -221,7 +231,8 @@ init_plan(ContQueryWorkerState *state)
 	query_desc->tupDesc = ExecGetResultType(query_desc->planstate);
 
 	state->result_slot = MakeSingleTupleTableSlot(query_desc->tupDesc);
-	tuplestore_clear(state->plan_output);
+	if (state->plan_output)
+		tuplestore_clear(state->plan_output);
 }
 
 /*
@@ -364,11 +375,17 @@ ContinuousQueryWorkerMain(void)
 
 			PG_TRY();
 			{
+				ContExplainSample *sample;
+
 				if (state == NULL)
 					goto next;
 
 				MemoryContextSwitchTo(state->base.tmp_cxt);
 
+				/* only instrument the plan while it's being sampled by EXPLAIN (CONTINUOUS, ANALYZE) */
+				sample = ContExplainStartQuery(&state->base);
+				state->query_desc->instrument_options = ContExplainIsSampling(sample) ? sample->instrument_options : 0;
+
 				estate = CreateEState(state->query_desc);
 				state->query_desc->estate = (EState *) estate;
 				SetEStateSnapshot((EState *) estate);
@@ -376,8 +393,19 @@ ContinuousQueryWorkerMain(void)
 				if (should_exec_query(state->base.query))
 				{
 					TimestampTz start_time = GetCurrentTimestamp();
+					TimestampTz end_time;
 					long secs;
 					int usecs;
+					uint64 input_rows = 0;
+					uint64 output_rows = 0;
+
+					TRACE_PIPELINEDB_WORKER_BATCH_START(query_id, cont_exec->batch ? cont_exec->batch->ntups : 0,
+							cont_exec->batch ? cont_exec->batch->nbytes : 0);
+					if (TRACE_PIPELINEDB_WORKER_BATCH_DONE_ENABLED() && state->base.stats)
+					{
+						input_rows = pg_atomic_read_u64(&state->base.stats->input_rows);
+						output_rows = pg_atomic_read_u64(&state->base.stats->output_rows);
+					}
 
 					/* initialize the plan for execution within this xact */
 					init_plan(state);
@@ -386,15 +414,28 @@ ContinuousQueryWorkerMain(void)
 					ExecuteContPlan((EState *) estate, state->query_desc->planstate, true, state->query_desc->operation,
 							true, 0, ForwardScanDirection, state->dest, true);
 
+					ContExplainAccumulate(sample, state->query_desc);
+
 					/* free up any resources used by this plan before committing */
 					end_plan(state->query_desc);
 
 					/* flush tuples to combiners or transform out functions */
 					flush_tuples(state);
 
+					if (ContExplainIsSampling(sample))
+						ContExplainPublish(sample);
+
 					/* record execution time */
-					TimestampDifference(start_time, GetCurrentTimestamp(), &secs, &usecs);
+					end_time = GetCurrentTimestamp();
+					TimestampDifference(start_time, end_time, &secs, &usecs);
 					StatsIncrementCQExecMs(secs * 1000 + (usecs / 1000));
+					StatsRecordCQLatency(state->base.latency, LATENCY_WORKER_EXEC, start_time, end_time, 1);
+					if (TRACE_PIPELINEDB_WORKER_BATCH_DONE_ENABLED() && state->base.stats)
+					{
+						input_rows = pg_atomic_read_u64(&state->base.stats->input_rows) - input_rows;
+						output_rows = pg_atomic_read_u64(&state->base.stats->output_rows) - output_rows;
+					}
+					TRACE_PIPELINEDB_WORKER_BATCH_DONE(query_id, input_rows, output_rows, end_time - start_time);
 				}
 
 				UnsetEStateSnapshot((EState *) estate);